@@ -0,0 +1,583 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "fake_drm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_mode.h>
+#include <drm_fourcc.h>
+
+#define FAKE_DRM_FD 1000
+#define FAKE_DRM_FRAMEBUFFERS_PER_MONITOR 3
+#define FAKE_DRM_MAX_MONITORS 16
+#define FAKE_DRM_MAX_OVERLAY_PLANES 8
+#define FAKE_DRM_MAX_PLANES (FAKE_DRM_MAX_MONITORS * (2 + FAKE_DRM_MAX_OVERLAY_PLANES))
+#define FAKE_DRM_MAX_CONNECTORS 32
+
+#define FAKE_DRM_PLANE_PROPERTY_ID_START 1
+#define FAKE_DRM_CONNECTOR_PROPERTY_ID_START 100
+#define FAKE_DRM_PLANE_ID_START 200
+#define FAKE_DRM_CRTC_ID_START 300
+#define FAKE_DRM_CONNECTOR_ID_START 400
+#define FAKE_DRM_PRIMARY_FB_ID_START 500
+#define FAKE_DRM_CURSOR_FB_ID_START 600
+#define FAKE_DRM_HDR_METADATA_BLOB_ID 700
+
+#define FAKE_DRM_MONITOR_WIDTH 1920
+#define FAKE_DRM_MONITOR_HEIGHT 1080
+#define FAKE_DRM_CURSOR_SIZE 256
+
+typedef enum {
+    FAKE_PLANE_TYPE_OVERLAY = 0,
+    FAKE_PLANE_TYPE_PRIMARY = 1,
+    FAKE_PLANE_TYPE_CURSOR  = 2
+} fake_plane_type;
+
+typedef struct {
+    const char *name;
+    uint32_t flags;
+} fake_property;
+
+/* The properties of a plane and a connector on amdgpu */
+static const fake_property plane_properties[] = {
+    { "type",             DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE },
+    { "FB_ID",            DRM_MODE_PROP_OBJECT },
+    { "IN_FENCE_FD",      DRM_MODE_PROP_SIGNED_RANGE },
+    { "CRTC_ID",          DRM_MODE_PROP_OBJECT },
+    { "SRC_X",            DRM_MODE_PROP_RANGE },
+    { "SRC_Y",            DRM_MODE_PROP_RANGE },
+    { "SRC_W",            DRM_MODE_PROP_RANGE },
+    { "SRC_H",            DRM_MODE_PROP_RANGE },
+    { "CRTC_X",           DRM_MODE_PROP_SIGNED_RANGE },
+    { "CRTC_Y",           DRM_MODE_PROP_SIGNED_RANGE },
+    { "CRTC_W",           DRM_MODE_PROP_RANGE },
+    { "CRTC_H",           DRM_MODE_PROP_RANGE },
+    { "IN_FORMATS",       DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE },
+    { "rotation",         DRM_MODE_PROP_BITMASK },
+    { "zpos",             DRM_MODE_PROP_RANGE },
+    { "alpha",            DRM_MODE_PROP_RANGE },
+    { "pixel blend mode", DRM_MODE_PROP_ENUM },
+    { "COLOR_ENCODING",   DRM_MODE_PROP_ENUM },
+    { "COLOR_RANGE",      DRM_MODE_PROP_ENUM },
+    { "FB_DAMAGE_CLIPS",  DRM_MODE_PROP_BLOB },
+};
+
+static const fake_property connector_properties[] = {
+    { "EDID",                DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE },
+    { "DPMS",                DRM_MODE_PROP_ENUM },
+    { "link-status",         DRM_MODE_PROP_ENUM },
+    { "non-desktop",         DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE },
+    { "TILE",                DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE },
+    { "CRTC_ID",             DRM_MODE_PROP_OBJECT },
+    { "scaling mode",        DRM_MODE_PROP_ENUM },
+    { "underscan",           DRM_MODE_PROP_ENUM },
+    { "max bpc",             DRM_MODE_PROP_RANGE },
+    { "abm level",           DRM_MODE_PROP_RANGE },
+    { "Colorspace",          DRM_MODE_PROP_ENUM },
+    { "HDR_OUTPUT_METADATA", DRM_MODE_PROP_BLOB },
+    { "vrr_capable",         DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE },
+    { "content type",        DRM_MODE_PROP_ENUM },
+};
+
+#define NUM_PLANE_PROPERTIES (int)(sizeof(plane_properties) / sizeof(plane_properties[0]))
+#define NUM_CONNECTOR_PROPERTIES (int)(sizeof(connector_properties) / sizeof(connector_properties[0]))
+
+static struct drm_mode_property_enum plane_type_enums[] = {
+    { FAKE_PLANE_TYPE_OVERLAY, "Overlay" },
+    { FAKE_PLANE_TYPE_PRIMARY, "Primary" },
+    { FAKE_PLANE_TYPE_CURSOR,  "Cursor" },
+};
+
+typedef struct {
+    uint32_t plane_id;
+    fake_plane_type type;
+    uint32_t crtc_id;
+    uint32_t fb_id;
+    int crtc_x;
+    int crtc_y;
+    uint32_t width;
+    uint32_t height;
+} fake_plane;
+
+typedef struct {
+    fake_drm_params params;
+    fake_plane planes[FAKE_DRM_MAX_PLANES];
+    int num_planes;
+    int num_connectors;
+    int frame;
+    uint64_t num_ioctls;
+    uint32_t hdr_metadata_blob_id; /* Of the first monitor, 0 if it has no hdr metadata */
+    uint16_t hdr_metadata_max_cll;
+    int framebuffer_memfds[FAKE_DRM_MAX_MONITORS * FAKE_DRM_FRAMEBUFFERS_PER_MONITOR + FAKE_DRM_MAX_MONITORS];
+} fake_drm;
+
+static fake_drm fake;
+
+static void fake_ioctl(void) {
+    ++fake.num_ioctls;
+    if(fake.params.ioctl_cost_us <= 0.0)
+        return;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(;;) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const double elapsed_us = (double)(now.tv_sec - start.tv_sec) * 1000000.0 + (double)(now.tv_nsec - start.tv_nsec) * 0.001;
+        if(elapsed_us >= fake.params.ioctl_cost_us)
+            break;
+    }
+}
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+void fake_drm_init(const fake_drm_params *params) {
+    memset(&fake, 0, sizeof(fake));
+    fake.params = *params;
+    fake.params.num_monitors = min_int(fake.params.num_monitors, FAKE_DRM_MAX_MONITORS);
+    fake.params.num_overlay_planes = min_int(fake.params.num_overlay_planes, FAKE_DRM_MAX_OVERLAY_PLANES);
+    fake.num_connectors = min_int(fake.params.num_monitors + fake.params.num_disconnected_connectors, FAKE_DRM_MAX_CONNECTORS);
+
+    for(int i = 0; i < (int)(sizeof(fake.framebuffer_memfds) / sizeof(fake.framebuffer_memfds[0])); ++i) {
+        fake.framebuffer_memfds[i] = -1;
+    }
+
+    for(int monitor = 0; monitor < fake.params.num_monitors; ++monitor) {
+        const uint32_t crtc_id = FAKE_DRM_CRTC_ID_START + monitor;
+
+        fake_plane *primary_plane = &fake.planes[fake.num_planes++];
+        primary_plane->type = FAKE_PLANE_TYPE_PRIMARY;
+        primary_plane->crtc_id = crtc_id;
+        primary_plane->fb_id = FAKE_DRM_PRIMARY_FB_ID_START + monitor * FAKE_DRM_FRAMEBUFFERS_PER_MONITOR;
+        primary_plane->width = FAKE_DRM_MONITOR_WIDTH;
+        primary_plane->height = FAKE_DRM_MONITOR_HEIGHT;
+
+        /* The cursor is only on the first monitor */
+        fake_plane *cursor_plane = &fake.planes[fake.num_planes++];
+        cursor_plane->type = FAKE_PLANE_TYPE_CURSOR;
+        cursor_plane->crtc_id = monitor == 0 ? crtc_id : 0;
+        cursor_plane->fb_id = monitor == 0 ? FAKE_DRM_CURSOR_FB_ID_START + monitor : 0;
+        cursor_plane->width = FAKE_DRM_CURSOR_SIZE;
+        cursor_plane->height = FAKE_DRM_CURSOR_SIZE;
+
+        for(int i = 0; i < fake.params.num_overlay_planes; ++i) {
+            fake_plane *overlay_plane = &fake.planes[fake.num_planes++];
+            overlay_plane->type = FAKE_PLANE_TYPE_OVERLAY;
+        }
+    }
+
+    for(int i = 0; i < fake.num_planes; ++i) {
+        fake.planes[i].plane_id = FAKE_DRM_PLANE_ID_START + i;
+    }
+
+    fake.hdr_metadata_blob_id = FAKE_DRM_HDR_METADATA_BLOB_ID;
+    fake.hdr_metadata_max_cll = 1000;
+}
+
+void fake_drm_deinit(void) {
+    for(int i = 0; i < (int)(sizeof(fake.framebuffer_memfds) / sizeof(fake.framebuffer_memfds[0])); ++i) {
+        if(fake.framebuffer_memfds[i] > 0)
+            close(fake.framebuffer_memfds[i]);
+    }
+    memset(&fake, 0, sizeof(fake));
+}
+
+int fake_drm_get_fd(void) {
+    return FAKE_DRM_FD;
+}
+
+void fake_drm_flip(void) {
+    ++fake.frame;
+    for(int i = 0; i < fake.num_planes; ++i) {
+        fake_plane *plane = &fake.planes[i];
+        if(plane->type == FAKE_PLANE_TYPE_PRIMARY) {
+            const int monitor = (plane->crtc_id - FAKE_DRM_CRTC_ID_START);
+            plane->fb_id = FAKE_DRM_PRIMARY_FB_ID_START + monitor * FAKE_DRM_FRAMEBUFFERS_PER_MONITOR + (fake.frame % FAKE_DRM_FRAMEBUFFERS_PER_MONITOR);
+        } else if(plane->type == FAKE_PLANE_TYPE_CURSOR && plane->fb_id) {
+            plane->crtc_x = fake.frame % FAKE_DRM_MONITOR_WIDTH;
+            plane->crtc_y = (fake.frame / 2) % FAKE_DRM_MONITOR_HEIGHT;
+        }
+    }
+}
+
+void fake_drm_set_hdr_metadata(uint16_t max_cll) {
+    if(max_cll == 0) {
+        fake.hdr_metadata_blob_id = 0;
+    } else {
+        /* Property blobs can't be modified, so new metadata is a new blob */
+        fake.hdr_metadata_blob_id = fake.hdr_metadata_blob_id == 0 ? FAKE_DRM_HDR_METADATA_BLOB_ID : fake.hdr_metadata_blob_id + 1;
+        fake.hdr_metadata_max_cll = max_cll;
+    }
+}
+
+uint64_t fake_drm_get_num_ioctls(void) {
+    return fake.num_ioctls;
+}
+
+static fake_plane* get_plane_by_id(uint32_t plane_id) {
+    for(int i = 0; i < fake.num_planes; ++i) {
+        if(fake.planes[i].plane_id == plane_id)
+            return &fake.planes[i];
+    }
+    return NULL;
+}
+
+static bool connector_is_connected(uint32_t connector_id) {
+    return connector_id - FAKE_DRM_CONNECTOR_ID_START < (uint32_t)fake.params.num_monitors;
+}
+
+static uint64_t get_plane_property_value(const fake_plane *plane, const char *name) {
+    if(strcmp(name, "type") == 0)
+        return plane->type;
+    else if(strcmp(name, "FB_ID") == 0)
+        return plane->fb_id;
+    else if(strcmp(name, "CRTC_ID") == 0)
+        return plane->crtc_id;
+    else if(strcmp(name, "SRC_W") == 0 || strcmp(name, "CRTC_W") == 0)
+        return strcmp(name, "SRC_W") == 0 ? (uint64_t)plane->width << 16 : plane->width;
+    else if(strcmp(name, "SRC_H") == 0 || strcmp(name, "CRTC_H") == 0)
+        return strcmp(name, "SRC_H") == 0 ? (uint64_t)plane->height << 16 : plane->height;
+    else if(strcmp(name, "CRTC_X") == 0)
+        return (uint64_t)(int64_t)plane->crtc_x;
+    else if(strcmp(name, "CRTC_Y") == 0)
+        return (uint64_t)(int64_t)plane->crtc_y;
+    return 0;
+}
+
+static uint64_t get_connector_property_value(uint32_t connector_id, const char *name) {
+    const uint32_t index = connector_id - FAKE_DRM_CONNECTOR_ID_START;
+    if(strcmp(name, "CRTC_ID") == 0)
+        return connector_is_connected(connector_id) ? FAKE_DRM_CRTC_ID_START + index : 0;
+    else if(strcmp(name, "HDR_OUTPUT_METADATA") == 0)
+        return index == 0 ? fake.hdr_metadata_blob_id : 0;
+    return 0;
+}
+
+int drmSetClientCap(int fd, uint64_t capability, uint64_t value) {
+    (void)fd;
+    (void)capability;
+    (void)value;
+    fake_ioctl();
+    return 0;
+}
+
+int drmCloseBufferHandle(int fd, uint32_t handle) {
+    (void)fd;
+    (void)handle;
+    fake_ioctl();
+    return 0;
+}
+
+/* The handle is the framebuffer id. The same framebuffer always gives the same dma buf, like the kernel does */
+int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd) {
+    (void)fd;
+    (void)flags;
+    fake_ioctl();
+
+    int index = -1;
+    if(handle >= FAKE_DRM_CURSOR_FB_ID_START && handle < FAKE_DRM_CURSOR_FB_ID_START + FAKE_DRM_MAX_MONITORS)
+        index = FAKE_DRM_MAX_MONITORS * FAKE_DRM_FRAMEBUFFERS_PER_MONITOR + (handle - FAKE_DRM_CURSOR_FB_ID_START);
+    else if(handle >= FAKE_DRM_PRIMARY_FB_ID_START && handle < FAKE_DRM_PRIMARY_FB_ID_START + FAKE_DRM_MAX_MONITORS * FAKE_DRM_FRAMEBUFFERS_PER_MONITOR)
+        index = handle - FAKE_DRM_PRIMARY_FB_ID_START;
+
+    if(index == -1) {
+        errno = ENOENT;
+        *prime_fd = -1;
+        return -1;
+    }
+
+    if(fake.framebuffer_memfds[index] == -1)
+        fake.framebuffer_memfds[index] = memfd_create("gsr-fake-drm-framebuffer", MFD_CLOEXEC);
+
+    *prime_fd = fake.framebuffer_memfds[index] == -1 ? -1 : dup(fake.framebuffer_memfds[index]);
+    return *prime_fd == -1 ? -1 : 0;
+}
+
+drmModePlaneResPtr drmModeGetPlaneResources(int fd) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    drmModePlaneResPtr plane_res = calloc(1, sizeof(drmModePlaneRes));
+    if(!plane_res)
+        return NULL;
+
+    plane_res->count_planes = fake.num_planes;
+    plane_res->planes = calloc(fake.num_planes + 1, sizeof(uint32_t));
+    for(int i = 0; i < fake.num_planes; ++i) {
+        plane_res->planes[i] = fake.planes[i].plane_id;
+    }
+    return plane_res;
+}
+
+void drmModeFreePlaneResources(drmModePlaneResPtr plane_res) {
+    if(!plane_res)
+        return;
+    free(plane_res->planes);
+    free(plane_res);
+}
+
+drmModePlanePtr drmModeGetPlane(int fd, uint32_t plane_id) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    const fake_plane *plane_state = get_plane_by_id(plane_id);
+    if(!plane_state) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModePlanePtr plane = calloc(1, sizeof(drmModePlane));
+    if(!plane)
+        return NULL;
+
+    plane->plane_id = plane_state->plane_id;
+    plane->crtc_id = plane_state->crtc_id;
+    plane->fb_id = plane_state->fb_id;
+    return plane;
+}
+
+void drmModeFreePlane(drmModePlanePtr plane) {
+    free(plane);
+}
+
+drmModeFB2Ptr drmModeGetFB2(int fd, uint32_t fb_id) {
+    (void)fd;
+    fake_ioctl();
+
+    const bool is_cursor = fb_id >= FAKE_DRM_CURSOR_FB_ID_START && fb_id < FAKE_DRM_CURSOR_FB_ID_START + FAKE_DRM_MAX_MONITORS;
+    const bool is_primary = fb_id >= FAKE_DRM_PRIMARY_FB_ID_START && fb_id < FAKE_DRM_PRIMARY_FB_ID_START + FAKE_DRM_MAX_MONITORS * FAKE_DRM_FRAMEBUFFERS_PER_MONITOR;
+    if(!is_cursor && !is_primary) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeFB2Ptr fb = calloc(1, sizeof(drmModeFB2));
+    if(!fb)
+        return NULL;
+
+    fb->fb_id = fb_id;
+    fb->width = is_cursor ? FAKE_DRM_CURSOR_SIZE : FAKE_DRM_MONITOR_WIDTH;
+    fb->height = is_cursor ? FAKE_DRM_CURSOR_SIZE : FAKE_DRM_MONITOR_HEIGHT;
+    fb->pixel_format = is_cursor ? DRM_FORMAT_ARGB8888 : DRM_FORMAT_XRGB8888;
+    fb->flags = DRM_MODE_FB_MODIFIERS;
+    fb->modifier = DRM_FORMAT_MOD_LINEAR;
+    fb->handles[0] = fb_id;
+    fb->pitches[0] = fb->width * 4;
+    fb->offsets[0] = 0;
+    return fb;
+}
+
+void drmModeFreeFB2(drmModeFB2Ptr fb) {
+    free(fb);
+}
+
+drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    const fake_property *fake_prop = NULL;
+    if(property_id >= FAKE_DRM_PLANE_PROPERTY_ID_START && property_id < FAKE_DRM_PLANE_PROPERTY_ID_START + NUM_PLANE_PROPERTIES)
+        fake_prop = &plane_properties[property_id - FAKE_DRM_PLANE_PROPERTY_ID_START];
+    else if(property_id >= FAKE_DRM_CONNECTOR_PROPERTY_ID_START && property_id < FAKE_DRM_CONNECTOR_PROPERTY_ID_START + NUM_CONNECTOR_PROPERTIES)
+        fake_prop = &connector_properties[property_id - FAKE_DRM_CONNECTOR_PROPERTY_ID_START];
+
+    if(!fake_prop) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModePropertyPtr prop = calloc(1, sizeof(drmModePropertyRes));
+    if(!prop)
+        return NULL;
+
+    prop->prop_id = property_id;
+    prop->flags = fake_prop->flags;
+    snprintf(prop->name, sizeof(prop->name), "%s", fake_prop->name);
+    if(strcmp(fake_prop->name, "type") == 0) {
+        prop->count_enums = sizeof(plane_type_enums) / sizeof(plane_type_enums[0]);
+        prop->enums = malloc(sizeof(plane_type_enums));
+        if(prop->enums)
+            memcpy(prop->enums, plane_type_enums, sizeof(plane_type_enums));
+        else
+            prop->count_enums = 0;
+    }
+    return prop;
+}
+
+void drmModeFreeProperty(drmModePropertyPtr prop) {
+    if(!prop)
+        return;
+    free(prop->enums);
+    free(prop);
+}
+
+drmModeObjectPropertiesPtr drmModeObjectGetProperties(int fd, uint32_t object_id, uint32_t object_type) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    const fake_plane *plane = object_type == DRM_MODE_OBJECT_PLANE ? get_plane_by_id(object_id) : NULL;
+    const bool is_connector = object_type == DRM_MODE_OBJECT_CONNECTOR && object_id >= FAKE_DRM_CONNECTOR_ID_START && object_id < FAKE_DRM_CONNECTOR_ID_START + (uint32_t)fake.num_connectors;
+    if(!plane && !is_connector) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeObjectPropertiesPtr props = calloc(1, sizeof(drmModeObjectProperties));
+    if(!props)
+        return NULL;
+
+    const int num_properties = plane ? NUM_PLANE_PROPERTIES : NUM_CONNECTOR_PROPERTIES;
+    props->count_props = num_properties;
+    props->props = calloc(num_properties, sizeof(uint32_t));
+    props->prop_values = calloc(num_properties, sizeof(uint64_t));
+    if(!props->props || !props->prop_values) {
+        drmModeFreeObjectProperties(props);
+        return NULL;
+    }
+
+    for(int i = 0; i < num_properties; ++i) {
+        if(plane) {
+            props->props[i] = FAKE_DRM_PLANE_PROPERTY_ID_START + i;
+            props->prop_values[i] = get_plane_property_value(plane, plane_properties[i].name);
+        } else {
+            props->props[i] = FAKE_DRM_CONNECTOR_PROPERTY_ID_START + i;
+            props->prop_values[i] = get_connector_property_value(object_id, connector_properties[i].name);
+        }
+    }
+    return props;
+}
+
+void drmModeFreeObjectProperties(drmModeObjectPropertiesPtr props) {
+    if(!props)
+        return;
+    free(props->props);
+    free(props->prop_values);
+    free(props);
+}
+
+drmModeResPtr drmModeGetResources(int fd) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    drmModeResPtr resources = calloc(1, sizeof(drmModeRes));
+    if(!resources)
+        return NULL;
+
+    resources->count_connectors = fake.num_connectors;
+    resources->connectors = calloc(fake.num_connectors + 1, sizeof(uint32_t));
+    resources->count_crtcs = fake.params.num_monitors;
+    resources->crtcs = calloc(fake.params.num_monitors + 1, sizeof(uint32_t));
+    if(!resources->connectors || !resources->crtcs) {
+        drmModeFreeResources(resources);
+        return NULL;
+    }
+
+    for(int i = 0; i < fake.num_connectors; ++i) {
+        resources->connectors[i] = FAKE_DRM_CONNECTOR_ID_START + i;
+    }
+    for(int i = 0; i < fake.params.num_monitors; ++i) {
+        resources->crtcs[i] = FAKE_DRM_CRTC_ID_START + i;
+    }
+    return resources;
+}
+
+void drmModeFreeResources(drmModeResPtr resources) {
+    if(!resources)
+        return;
+    free(resources->connectors);
+    free(resources->crtcs);
+    free(resources);
+}
+
+drmModeConnectorPtr drmModeGetConnectorCurrent(int fd, uint32_t connector_id) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    if(connector_id < FAKE_DRM_CONNECTOR_ID_START || connector_id >= FAKE_DRM_CONNECTOR_ID_START + (uint32_t)fake.num_connectors) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeConnectorPtr connector = calloc(1, sizeof(drmModeConnector));
+    if(!connector)
+        return NULL;
+
+    connector->connector_id = connector_id;
+    connector->count_props = NUM_CONNECTOR_PROPERTIES;
+    connector->props = calloc(NUM_CONNECTOR_PROPERTIES, sizeof(uint32_t));
+    connector->prop_values = calloc(NUM_CONNECTOR_PROPERTIES, sizeof(uint64_t));
+    if(!connector->props || !connector->prop_values) {
+        drmModeFreeConnector(connector);
+        return NULL;
+    }
+
+    for(int i = 0; i < NUM_CONNECTOR_PROPERTIES; ++i) {
+        connector->props[i] = FAKE_DRM_CONNECTOR_PROPERTY_ID_START + i;
+        connector->prop_values[i] = get_connector_property_value(connector_id, connector_properties[i].name);
+    }
+    return connector;
+}
+
+void drmModeFreeConnector(drmModeConnectorPtr connector) {
+    if(!connector)
+        return;
+    free(connector->props);
+    free(connector->prop_values);
+    free(connector);
+}
+
+drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd, uint32_t blob_id) {
+    (void)fd;
+    fake_ioctl();
+    fake_ioctl();
+
+    if(blob_id == 0 || blob_id != fake.hdr_metadata_blob_id) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModePropertyBlobPtr blob = calloc(1, sizeof(drmModePropertyBlobRes));
+    struct hdr_output_metadata *hdr_metadata = calloc(1, sizeof(struct hdr_output_metadata));
+    if(!blob || !hdr_metadata) {
+        free(blob);
+        free(hdr_metadata);
+        return NULL;
+    }
+
+    hdr_metadata->metadata_type = 0; /* HDMI_STATIC_METADATA_TYPE1 */
+    hdr_metadata->hdmi_metadata_type1.eotf = 2; /* HDMI_EOTF_SMPTE_ST2084 */
+    hdr_metadata->hdmi_metadata_type1.max_display_mastering_luminance = 1000;
+    hdr_metadata->hdmi_metadata_type1.max_cll = fake.hdr_metadata_max_cll;
+    hdr_metadata->hdmi_metadata_type1.max_fall = 400;
+
+    blob->id = blob_id;
+    blob->length = sizeof(struct hdr_output_metadata);
+    blob->data = hdr_metadata;
+    return blob;
+}
+
+void drmModeFreePropertyBlob(drmModePropertyBlobPtr blob) {
+    if(!blob)
+        return;
+    free(blob->data);
+    free(blob);
+}
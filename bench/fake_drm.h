@@ -0,0 +1,28 @@
+#ifndef GSR_FAKE_DRM_H
+#define GSR_FAKE_DRM_H
+
+#include <stdint.h>
+
+/*
+    A fake drm device that implements the libdrm functions that gsr-kms-server uses, so that the kms server can be benchmarked without a gpu.
+    Every monitor has a primary plane that flips between three framebuffers, a cursor plane and overlay planes without framebuffers, with properties like amdgpu.
+    The cost of the ioctls that the libdrm functions do is simulated with a busy wait and the ioctls are counted.
+*/
+typedef struct {
+    int num_monitors;
+    int num_overlay_planes;       /* Per monitor */
+    int num_disconnected_connectors;
+    double ioctl_cost_us;
+} fake_drm_params;
+
+void fake_drm_init(const fake_drm_params *params);
+void fake_drm_deinit(void);
+int fake_drm_get_fd(void);
+
+/* Flips the primary planes to their next framebuffer and moves the cursor, like a compositor does every frame */
+void fake_drm_flip(void);
+/* Replaces the hdr metadata of the first monitor with a new property blob, like a compositor does when it changes. 0 removes the hdr metadata */
+void fake_drm_set_hdr_metadata(uint16_t max_cll);
+uint64_t fake_drm_get_num_ioctls(void);
+
+#endif /* GSR_FAKE_DRM_H */
@@ -0,0 +1,966 @@
+extern "C" {
+#include "../include/capture/synthetic.h"
+#include "../include/encoder/video/software.h"
+#include "../include/window/window_x11.h"
+#include "../include/window/window_wayland.h"
+#include "../include/egl.h"
+#include "../include/utils.h"
+#include "../include/color_conversion.h"
+#include "../include/replay_buffer.h"
+#include "../include/audio_mixer.h"
+#include "../include/frame_scheduler.h"
+}
+#include "../include/sound.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+// Runs the stages of the gpu-screen-recorder main loop on a synthetic capture and reports the latency of each stage as json.
+// The cpu encoder is used (the synthetic capture requires it), so this also works on a headless machine with a software opengl renderer.
+
+#define VIDEO_STREAM_INDEX 0
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_FRAME_SIZE 1024
+#define AUDIO_NUM_CHANNELS 2
+#define REPLAY_BUFFER_SECONDS 30
+
+struct BenchStage {
+    const char *name;
+    std::vector<double> samples_us;
+};
+
+struct BenchOptions {
+    std::string synthetic_options = "1920x1080:bars";
+    int fps = 60;
+    int num_frames = 600;
+    int num_warmup_frames = 30;
+    int cpu_threads = 0;
+    bool cpu_slice_threads = false;
+    int cpu_readback_buffers = 2;
+    int static_sequence_changing_frames = 0; // The static frames sequence is not run when this is 0
+    int static_sequence_static_frames = 0;
+    int composite_sources = 0; // The composite test is not run when this is 0
+    std::vector<std::string> pulse_devices; // The pulseaudio read test is not run when this is empty
+    int pulse_seconds = 10;
+    const char *output_filepath = nullptr;
+};
+
+static void usage() {
+    fprintf(stderr, "usage: gsr-bench [-w synthetic:WxH:pattern[:damage_fps]] [-f <fps>] [-n <frames>] [-warmup <frames>] [-cpu-threads auto|<n>] [-cpu-thread-mode frame|slice] [-cpu-readback-buffers 1|2|3] [-static-sequence <changing>:<static>] [-composite <sources>] [-pulse-devices <device>[|<device>...]] [-pulse-seconds <seconds>] [-o <output.json>]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Runs the capture, color conversion, readback, encode, mux, replay buffer and audio stages of gpu-screen-recorder on a synthetic capture and prints the p50, p99 and max latency of each stage in microseconds as json.\n");
+    fprintf(stderr, "The stages are first measured one at a time (with glFinish after the opengl stages) and then together without synchronization, which gives the end-to-end frame time and the encoded fps.\n");
+    fprintf(stderr, "-static-sequence also encodes a scripted sequence of <changing> frames that are all different followed by <static> frames that are the same, repeated for -n frames.\n");
+    fprintf(stderr, "The sequence is encoded once with every frame and once without the static frames like -skip-static-frames does in gpu-screen-recorder, and the cpu time, opengl time and encoded size of both are reported.\n");
+    fprintf(stderr, "-composite also color converts <sources> textures side by side and a cursor on top of them every frame, like kms capture does when all monitors are captured.\n");
+    fprintf(stderr, "The frame is drawn once with one gsr_color_conversion_draw per texture and once batched with gsr_color_conversion_draw_batched, and the opengl calls per frame and the cpu time of both are reported.\n");
+    fprintf(stderr, "-pulse-devices also records the pulseaudio devices for -pulse-seconds seconds (10 by default) like the audio thread of gpu-screen-recorder does, and the wakeups per second and the cpu usage per device are reported.\n");
+    fprintf(stderr, "A null sink makes the result independent of what is playing: pactl load-module module-null-sink sink_name=gsr-bench and then -pulse-devices gsr-bench.monitor.\n");
+    fprintf(stderr, "By default 600 frames are measured after 30 warmup frames, the capture is 1920x1080 color bars at 60 fps and the json is written to stdout.\n");
+    _exit(1);
+}
+
+static int parse_int_arg(const char *name, const char *value, int min_value, int max_value) {
+    char *end = nullptr;
+    const long result = strtol(value, &end, 10);
+    if(end == value || *end != '\0' || result < min_value || result > max_value) {
+        fprintf(stderr, "gsr error: gsr-bench: expected %s to be a number between %d and %d, got: %s\n", name, min_value, max_value, value);
+        usage();
+    }
+    return (int)result;
+}
+
+static BenchOptions parse_options(int argc, char **argv) {
+    BenchOptions options;
+    for(int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if(i + 1 >= argc)
+            usage();
+
+        const char *value = argv[++i];
+        if(strcmp(arg, "-w") == 0) {
+            if(strncmp(value, "synthetic:", 10) != 0) {
+                fprintf(stderr, "gsr error: gsr-bench: only synthetic capture is supported, expected -w synthetic:WxH:pattern, got: %s\n", value);
+                usage();
+            }
+            options.synthetic_options = value + 10;
+        } else if(strcmp(arg, "-f") == 0) {
+            options.fps = parse_int_arg(arg, value, 1, 500);
+        } else if(strcmp(arg, "-n") == 0) {
+            options.num_frames = parse_int_arg(arg, value, 1, 1000000);
+        } else if(strcmp(arg, "-warmup") == 0) {
+            options.num_warmup_frames = parse_int_arg(arg, value, 0, 1000000);
+        } else if(strcmp(arg, "-cpu-threads") == 0) {
+            options.cpu_threads = strcmp(value, "auto") == 0 ? 0 : parse_int_arg(arg, value, 1, 64);
+        } else if(strcmp(arg, "-cpu-thread-mode") == 0) {
+            if(strcmp(value, "frame") == 0) {
+                options.cpu_slice_threads = false;
+            } else if(strcmp(value, "slice") == 0) {
+                options.cpu_slice_threads = true;
+            } else {
+                fprintf(stderr, "gsr error: gsr-bench: expected -cpu-thread-mode to be frame or slice, got: %s\n", value);
+                usage();
+            }
+        } else if(strcmp(arg, "-cpu-readback-buffers") == 0) {
+            options.cpu_readback_buffers = parse_int_arg(arg, value, 1, GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS);
+        } else if(strcmp(arg, "-static-sequence") == 0) {
+            char trailing = 0;
+            if(sscanf(value, "%d:%d%c", &options.static_sequence_changing_frames, &options.static_sequence_static_frames, &trailing) != 2
+                || options.static_sequence_changing_frames <= 0 || options.static_sequence_static_frames < 0)
+            {
+                fprintf(stderr, "gsr error: gsr-bench: expected -static-sequence to be <changing>:<static> where <changing> is at least 1, got: %s\n", value);
+                usage();
+            }
+        } else if(strcmp(arg, "-composite") == 0) {
+            options.composite_sources = parse_int_arg(arg, value, 1, GSR_COLOR_CONVERSION_MAX_QUADS - 1);
+        } else if(strcmp(arg, "-pulse-devices") == 0) {
+            options.pulse_devices.clear();
+            const char *start = value;
+            for(;;) {
+                const char *end = strchr(start, '|');
+                const size_t length = end ? (size_t)(end - start) : strlen(start);
+                if(length == 0) {
+                    fprintf(stderr, "gsr error: gsr-bench: expected -pulse-devices to be device names separated by |, got: %s\n", value);
+                    usage();
+                }
+                options.pulse_devices.emplace_back(start, length);
+                if(!end)
+                    break;
+                start = end + 1;
+            }
+        } else if(strcmp(arg, "-pulse-seconds") == 0) {
+            options.pulse_seconds = parse_int_arg(arg, value, 1, 3600);
+        } else if(strcmp(arg, "-o") == 0) {
+            options.output_filepath = value;
+        } else {
+            fprintf(stderr, "gsr error: gsr-bench: invalid option: %s\n", arg);
+            usage();
+        }
+    }
+    return options;
+}
+
+static double get_time_us() {
+    return clock_get_monotonic_seconds() * 1000000.0;
+}
+
+// Nearest-rank percentile. |samples| has to be sorted
+static double get_percentile(const std::vector<double> &samples, double percentile) {
+    if(samples.empty())
+        return 0.0;
+    const size_t rank = (size_t)ceil(percentile * (double)samples.size());
+    return samples[std::min(samples.size(), std::max((size_t)1, rank)) - 1];
+}
+
+static void write_stage_json(FILE *file, BenchStage &stage, bool last) {
+    std::sort(stage.samples_us.begin(), stage.samples_us.end());
+    double sum = 0.0;
+    for(double sample : stage.samples_us) {
+        sum += sample;
+    }
+    const double mean = stage.samples_us.empty() ? 0.0 : sum / (double)stage.samples_us.size();
+    const double max = stage.samples_us.empty() ? 0.0 : stage.samples_us.back();
+    fprintf(file, "    \"%s\": {\"count\": %zu, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}%s\n",
+        stage.name, stage.samples_us.size(), mean, get_percentile(stage.samples_us, 0.50), get_percentile(stage.samples_us, 0.99), max, last ? "" : ",");
+}
+
+static void write_json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for(const char *c = str; *c; ++c) {
+        if(*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if((unsigned char)*c >= 0x20)
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static AVCodecContext* create_video_codec_context(const BenchOptions &options) {
+    const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+    if(!codec) {
+        fprintf(stderr, "gsr error: gsr-bench: libx264 is not available\n");
+        _exit(1);
+    }
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    codec_context->codec_id = codec->id;
+    codec_context->time_base.num = 1;
+    codec_context->time_base.den = options.fps;
+    codec_context->framerate.num = options.fps;
+    codec_context->framerate.den = 1;
+    codec_context->gop_size = options.fps * 2;
+    codec_context->max_b_frames = 0;
+    codec_context->pix_fmt = AV_PIX_FMT_NV12;
+    codec_context->color_range = AVCOL_RANGE_MPEG;
+    codec_context->color_primaries = AVCOL_PRI_BT709;
+    codec_context->color_trc = AVCOL_TRC_BT709;
+    codec_context->colorspace = AVCOL_SPC_BT709;
+    codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    return codec_context;
+}
+
+// Same options as the cpu encoder in gpu-screen-recorder, the qp is fixed instead of depending on the quality option
+static void open_video_codec(AVCodecContext *codec_context, const BenchOptions &options) {
+    AVDictionary *codec_options = nullptr;
+    gsr_video_encoder_software_set_codec_options(codec_context, options.cpu_threads, options.cpu_slice_threads, &codec_options);
+    av_dict_set_int(&codec_options, "qp", 24, 0);
+
+    const int ret = avcodec_open2(codec_context, codec_context->codec, &codec_options);
+    av_dict_free(&codec_options);
+    if(ret < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to open video codec, error: %d\n", ret);
+        _exit(1);
+    }
+}
+
+static AVFormatContext* create_muxer(AVCodecContext *video_codec_context, AVStream **video_stream) {
+    AVFormatContext *av_format_context = nullptr;
+    if(avformat_alloc_output_context2(&av_format_context, nullptr, "matroska", "/dev/null") < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to create matroska muxer\n");
+        _exit(1);
+    }
+
+    *video_stream = avformat_new_stream(av_format_context, nullptr);
+    (*video_stream)->id = VIDEO_STREAM_INDEX;
+    (*video_stream)->time_base = video_codec_context->time_base;
+    avcodec_parameters_from_context((*video_stream)->codecpar, video_codec_context);
+
+    if(avio_open(&av_format_context->pb, "/dev/null", AVIO_FLAG_WRITE) < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to open /dev/null\n");
+        _exit(1);
+    }
+
+    if(avformat_write_header(av_format_context, nullptr) < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to write the muxer header\n");
+        _exit(1);
+    }
+    return av_format_context;
+}
+
+static unsigned int create_source_texture(gsr_egl *egl, vec2i size) {
+    std::vector<uint8_t> pixels((size_t)size.x * (size_t)size.y * 4);
+    for(size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = (uint8_t)(i * 31);
+    }
+
+    unsigned int texture_id = 0;
+    egl->glGenTextures(1, &texture_id);
+    egl->glBindTexture(GL_TEXTURE_2D, texture_id);
+    egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    return texture_id;
+}
+
+struct VideoPipeline {
+    gsr_egl *egl;
+    gsr_capture *capture;
+    gsr_video_encoder *video_encoder;
+    gsr_color_conversion *color_conversion;
+    AVCodecContext *video_codec_context;
+    AVFrame *video_frame;
+    AVPacket *packet;
+    AVFormatContext *av_format_context;
+    AVStream *video_stream;
+    gsr_replay_buffer *replay_buffer;
+    int64_t pts;
+    int64_t num_packets;
+};
+
+// The packets are added to the replay buffer and written to the muxer, like gpu-screen-recorder does when recording and when the replay buffer is used.
+// |encode_stage|, |mux_stage| and |replay_insert_stage| can be null
+static void encode_frame(VideoPipeline &pipeline, BenchStage *encode_stage, BenchStage *mux_stage, BenchStage *replay_insert_stage, bool warmup) {
+    pipeline.video_frame->pts = pipeline.pts++;
+    double start_time = get_time_us();
+    if(avcodec_send_frame(pipeline.video_codec_context, pipeline.video_frame) < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: avcodec_send_frame failed\n");
+        _exit(1);
+    }
+
+    for(;;) {
+        const int ret = avcodec_receive_packet(pipeline.video_codec_context, pipeline.packet);
+        if(encode_stage && !warmup)
+            encode_stage->samples_us.push_back(get_time_us() - start_time);
+        if(ret != 0)
+            break;
+
+        pipeline.packet->stream_index = VIDEO_STREAM_INDEX;
+        ++pipeline.num_packets;
+
+        start_time = get_time_us();
+        gsr_replay_buffer_append(pipeline.replay_buffer, pipeline.packet, (double)pipeline.packet->pts / (double)pipeline.video_codec_context->time_base.den);
+        if(replay_insert_stage && !warmup)
+            replay_insert_stage->samples_us.push_back(get_time_us() - start_time);
+
+        start_time = get_time_us();
+        av_packet_rescale_ts(pipeline.packet, pipeline.video_codec_context->time_base, pipeline.video_stream->time_base);
+        pipeline.packet->stream_index = pipeline.video_stream->index;
+        if(av_write_frame(pipeline.av_format_context, pipeline.packet) < 0)
+            fprintf(stderr, "gsr error: gsr-bench: av_write_frame failed\n");
+        av_packet_unref(pipeline.packet);
+        if(mux_stage && !warmup)
+            mux_stage->samples_us.push_back(get_time_us() - start_time);
+
+        // Only the time of the first receive counts as encode time, the other packets are already done
+        encode_stage = nullptr;
+        start_time = get_time_us();
+    }
+}
+
+struct StaticFramesResult {
+    double cpu_seconds;
+    double gl_seconds;
+    int64_t encoded_frames;
+    int64_t encoded_bytes;
+};
+
+static double get_process_cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+static void encode_static_sequence_frame(AVCodecContext *codec_context, AVFrame *frame, AVPacket *packet, StaticFramesResult &result) {
+    if(avcodec_send_frame(codec_context, frame) < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: avcodec_send_frame failed\n");
+        _exit(1);
+    }
+
+    while(avcodec_receive_packet(codec_context, packet) == 0) {
+        result.encoded_bytes += packet->size;
+        av_packet_unref(packet);
+    }
+}
+
+// Encodes the -static-sequence script with a new codec context, so that the encoder state of the two runs is the same at the start.
+// The changing frames move the source texture so that each one of them is different from the previous one.
+// When |skip_static_frames| is true the static frames are not captured, converted or encoded and the previous frame is only encoded again
+// with the same policy as gpu-screen-recorder with -skip-static-frames (gsr_frame_scheduler_should_repeat_static_frame). The video then has frames that are longer than the frame time.
+// The cpu time is the time of the whole process (the encoder threads and the mesa software renderer threads are included).
+static StaticFramesResult run_static_frames_sequence(VideoPipeline &pipeline, const BenchOptions &options, unsigned int source_texture, vec2i frame_size, bool skip_static_frames) {
+    AVCodecContext *codec_context = create_video_codec_context(options);
+    codec_context->width = frame_size.x;
+    codec_context->height = frame_size.y;
+    open_video_codec(codec_context, options);
+    AVPacket *packet = av_packet_alloc();
+
+    const int max_texture_offset = std::min(64, frame_size.x / 2);
+    const vec2i texture_size = { frame_size.x - max_texture_offset, frame_size.y };
+    const int sequence_length = options.static_sequence_changing_frames + options.static_sequence_static_frames;
+    const double frame_time_seconds = 1.0 / (double)options.fps;
+
+    StaticFramesResult result = { 0.0, 0.0, 0, 0 };
+    int texture_offset = 0;
+    int64_t last_encoded_frame = -1;
+    const double cpu_start_seconds = get_process_cpu_seconds();
+    for(int i = 0; i < options.num_frames; ++i) {
+        const bool changing = i % sequence_length < options.static_sequence_changing_frames;
+        if(changing)
+            texture_offset = (texture_offset + 1) % max_texture_offset;
+
+        const double seconds_since_last_frame = (double)(i - last_encoded_frame) / (double)options.fps;
+        const bool repeat_frame = skip_static_frames && gsr_frame_scheduler_should_repeat_static_frame(changing, last_encoded_frame >= 0, seconds_since_last_frame, frame_time_seconds);
+        if(skip_static_frames && !changing && !repeat_frame)
+            continue;
+
+        // A repeated frame is already in the destination textures
+        if(!repeat_frame) {
+            const double gl_start_time = get_time_us();
+            gsr_color_conversion_draw(pipeline.color_conversion, source_texture, {0, 0}, frame_size, {texture_offset, 0}, texture_size, 0.0f, false, GSR_SOURCE_COLOR_RGB);
+            pipeline.egl->glFinish();
+            result.gl_seconds += (get_time_us() - gl_start_time) / 1000000.0;
+        }
+
+        pipeline.video_frame->pts = i;
+        if(gsr_video_encoder_copy_textures_to_frame(pipeline.video_encoder, pipeline.video_frame, pipeline.color_conversion)) {
+            encode_static_sequence_frame(codec_context, pipeline.video_frame, packet, result);
+            ++result.encoded_frames;
+        }
+        last_encoded_frame = i;
+    }
+
+    while(gsr_video_encoder_get_delayed_frame(pipeline.video_encoder, pipeline.video_frame)) {
+        encode_static_sequence_frame(codec_context, pipeline.video_frame, packet, result);
+        ++result.encoded_frames;
+    }
+    encode_static_sequence_frame(codec_context, nullptr, packet, result);
+    result.cpu_seconds = get_process_cpu_seconds() - cpu_start_seconds;
+
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_context);
+    return result;
+}
+
+static void write_static_frames_result_json(FILE *file, const char *name, const StaticFramesResult &result, bool last) {
+    fprintf(file, "    \"%s\": {\"cpu_seconds\": %.3f, \"gl_seconds\": %.3f, \"encoded_frames\": %" PRId64 ", \"encoded_bytes\": %" PRId64 "}%s\n",
+        name, result.cpu_seconds, result.gl_seconds, result.encoded_frames, result.encoded_bytes, last ? "" : ",");
+}
+
+static double get_saved_percent(double every_frame_value, double skip_static_frames_value) {
+    return every_frame_value > 0.0 ? (1.0 - skip_static_frames_value / every_frame_value) * 100.0 : 0.0;
+}
+
+static gsr_egl original_egl;
+static uint64_t num_gl_calls = 0;
+
+// Replaces a gl function in gsr_egl with one that counts the call and then calls the gl function from |original_egl|
+template<typename T> struct CountedGlFunction;
+template<typename R, typename... Args>
+struct CountedGlFunction<R (*)(Args...)> {
+    template<R (*gsr_egl::*function)(Args...)>
+    static R call(Args... args) {
+        ++num_gl_calls;
+        return (original_egl.*function)(args...);
+    }
+};
+
+#define COUNT_GL_CALLS(egl, name) (egl)->name = CountedGlFunction<decltype(gsr_egl::name)>::call<&gsr_egl::name>
+
+// The gl functions that the color conversion calls every frame
+static void count_gl_calls_start(gsr_egl *egl) {
+    original_egl = *egl;
+    num_gl_calls = 0;
+    COUNT_GL_CALLS(egl, glBindTexture);
+    COUNT_GL_CALLS(egl, glTexParameteriv);
+    COUNT_GL_CALLS(egl, glGetTexLevelParameteriv);
+    COUNT_GL_CALLS(egl, glBindFramebuffer);
+    COUNT_GL_CALLS(egl, glViewport);
+    COUNT_GL_CALLS(egl, glBindBuffer);
+    COUNT_GL_CALLS(egl, glBufferSubData);
+    COUNT_GL_CALLS(egl, glBindVertexArray);
+    COUNT_GL_CALLS(egl, glUseProgram);
+    COUNT_GL_CALLS(egl, glUniform1f);
+    COUNT_GL_CALLS(egl, glUniform2f);
+    COUNT_GL_CALLS(egl, glDrawArrays);
+    COUNT_GL_CALLS(egl, glEnable);
+    COUNT_GL_CALLS(egl, glDisable);
+    COUNT_GL_CALLS(egl, glScissor);
+}
+
+static void count_gl_calls_stop(gsr_egl *egl) {
+    *egl = original_egl;
+}
+
+struct CompositeResult {
+    BenchStage stage;
+    double gl_calls_per_frame;
+};
+
+// The sources are placed next to each other and the cursor is drawn at the edge of the first source, limited to it, like kms capture draws the monitors and the cursor.
+// The cpu time of the draws is measured without glFinish, since the number of opengl calls is what changes.
+static CompositeResult run_composite(gsr_egl *egl, gsr_color_conversion *color_conversion, const std::vector<unsigned int> &source_textures, vec2i source_size, unsigned int cursor_texture, vec2i cursor_size, int num_frames, bool batched) {
+    CompositeResult result = { { batched ? "batched" : "draw", {} }, 0.0 };
+    gsr_color_conversion_clear(color_conversion);
+    egl->glFinish();
+
+    count_gl_calls_start(egl);
+    for(int i = 0; i < num_frames; ++i) {
+        const double start_time = get_time_us();
+        for(size_t j = 0; j < source_textures.size(); ++j) {
+            const vec2i pos = { (int)j * source_size.x, 0 };
+            if(batched)
+                gsr_color_conversion_draw_batched(color_conversion, source_textures[j], pos, source_size, {0, 0}, source_size, 0.0f, false, GSR_SOURCE_COLOR_RGB);
+            else
+                gsr_color_conversion_draw(color_conversion, source_textures[j], pos, source_size, {0, 0}, source_size, 0.0f, false, GSR_SOURCE_COLOR_RGB);
+        }
+
+        const vec2i cursor_pos = { source_size.x - cursor_size.x / 2, (i * 7) % std::max(1, source_size.y - cursor_size.y) };
+        if(batched) {
+            const gsr_rectangle clip = { {0, 0}, source_size };
+            gsr_color_conversion_set_clip(color_conversion, &clip);
+            gsr_color_conversion_draw_batched(color_conversion, cursor_texture, cursor_pos, cursor_size, {0, 0}, cursor_size, 0.0f, false, GSR_SOURCE_COLOR_RGB);
+            gsr_color_conversion_set_clip(color_conversion, nullptr);
+            gsr_color_conversion_flush(color_conversion);
+        } else {
+            egl->glEnable(GL_SCISSOR_TEST);
+            egl->glScissor(0, 0, source_size.x, source_size.y);
+            gsr_color_conversion_draw(color_conversion, cursor_texture, cursor_pos, cursor_size, {0, 0}, cursor_size, 0.0f, false, GSR_SOURCE_COLOR_RGB);
+            egl->glDisable(GL_SCISSOR_TEST);
+        }
+        result.stage.samples_us.push_back(get_time_us() - start_time);
+    }
+    result.gl_calls_per_frame = (double)num_gl_calls / (double)num_frames;
+    count_gl_calls_stop(egl);
+
+    egl->glFinish();
+    return result;
+}
+
+static void write_composite_result_json(FILE *file, CompositeResult &result, bool last) {
+    std::sort(result.stage.samples_us.begin(), result.stage.samples_us.end());
+    fprintf(file, "    \"%s\": {\"gl_calls_per_frame\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f}%s\n",
+        result.stage.name, result.gl_calls_per_frame, get_percentile(result.stage.samples_us, 0.50), get_percentile(result.stage.samples_us, 0.99), last ? "" : ",");
+}
+
+// Takes a snapshot of the whole replay buffer and reads every packet in it, which is what saving a replay does except for the muxing
+static void save_replay(gsr_replay_buffer *replay_buffer) {
+    gsr_replay_snapshot snapshot;
+    if(!gsr_replay_buffer_snapshot(replay_buffer, 0.0, &snapshot))
+        return;
+
+    uint64_t checksum = 0;
+    for(size_t slab_index = 0; slab_index < snapshot.num_slabs; ++slab_index) {
+        const gsr_replay_slab *slab = snapshot.slabs[slab_index];
+        const size_t first_packet_index = slab_index == 0 ? snapshot.first_packet_index : 0;
+        for(size_t i = first_packet_index; i < slab->num_packets; ++i) {
+            const uint8_t *data = slab->data + slab->packets[i].offset;
+            for(uint32_t j = 0; j < slab->packets[i].size; j += 4096) {
+                checksum += data[j];
+            }
+        }
+    }
+
+    gsr_replay_buffer_snapshot_release(replay_buffer, &snapshot);
+    // Makes sure that the reads are not optimized away
+    if(checksum == 1)
+        fprintf(stderr, " ");
+}
+
+static SwrContext* create_swr(enum AVSampleFormat in_sample_format, enum AVSampleFormat out_sample_format) {
+    SwrContext *swr = swr_alloc();
+    if(!swr) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to create SwrContext\n");
+        _exit(1);
+    }
+    #if LIBAVUTIL_VERSION_MAJOR <= 56
+    av_opt_set_channel_layout(swr, "in_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+    av_opt_set_channel_layout(swr, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+    #else
+    AVChannelLayout ch_layout;
+    av_channel_layout_default(&ch_layout, AUDIO_NUM_CHANNELS);
+    #if LIBAVUTIL_VERSION_MAJOR >= 59
+    av_opt_set_chlayout(swr, "in_chlayout", &ch_layout, 0);
+    av_opt_set_chlayout(swr, "out_chlayout", &ch_layout, 0);
+    #else
+    av_opt_set_chlayout(swr, "in_channel_layout", &ch_layout, 0);
+    av_opt_set_chlayout(swr, "out_channel_layout", &ch_layout, 0);
+    #endif
+    #endif
+    av_opt_set_int(swr, "in_sample_rate", AUDIO_SAMPLE_RATE, 0);
+    av_opt_set_int(swr, "out_sample_rate", AUDIO_SAMPLE_RATE, 0);
+    av_opt_set_sample_fmt(swr, "in_sample_fmt", in_sample_format, 0);
+    av_opt_set_sample_fmt(swr, "out_sample_fmt", out_sample_format, 0);
+    if(swr_init(swr) < 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to initialize SwrContext\n");
+        _exit(1);
+    }
+    return swr;
+}
+
+// The audio stages don't depend on the video stages. The sound device data is 16-bit interleaved stereo (what pulseaudio gives by default)
+// and it's converted to planar float (what the opus and aac encoders take), copied as is (when the device format matches the codec format)
+// and mixed with another device
+static void bench_audio(int num_iterations, BenchStage &convert_stage, BenchStage &copy_stage, BenchStage &mix_stage) {
+    std::vector<int16_t> device_samples(AUDIO_FRAME_SIZE * AUDIO_NUM_CHANNELS);
+    for(size_t i = 0; i < device_samples.size(); ++i) {
+        device_samples[i] = (int16_t)(sin((double)i * 0.01) * 16000.0);
+    }
+
+    std::vector<float> planar_samples[AUDIO_NUM_CHANNELS];
+    uint8_t *planar_data[AUDIO_NUM_CHANNELS];
+    for(int i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
+        planar_samples[i].resize(AUDIO_FRAME_SIZE);
+        planar_data[i] = (uint8_t*)planar_samples[i].data();
+    }
+
+    std::vector<float> mixed_samples[AUDIO_NUM_CHANNELS];
+    uint8_t *mixed_data[AUDIO_NUM_CHANNELS];
+    for(int i = 0; i < AUDIO_NUM_CHANNELS; ++i) {
+        mixed_samples[i].resize(AUDIO_FRAME_SIZE);
+        mixed_data[i] = (uint8_t*)mixed_samples[i].data();
+    }
+
+    std::vector<int16_t> copied_samples(device_samples.size());
+
+    SwrContext *swr = create_swr(AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP);
+    gsr_audio_mixer mixer;
+    if(!gsr_audio_mixer_init(&mixer, 2, AUDIO_FRAME_SIZE, AUDIO_NUM_CHANNELS, AV_SAMPLE_FMT_FLTP))
+        _exit(1);
+
+    for(int i = 0; i < num_iterations; ++i) {
+        const uint8_t *sound_buffer = (const uint8_t*)device_samples.data();
+        double start_time = get_time_us();
+        swr_convert(swr, planar_data, AUDIO_FRAME_SIZE, &sound_buffer, AUDIO_FRAME_SIZE);
+        convert_stage.samples_us.push_back(get_time_us() - start_time);
+
+        start_time = get_time_us();
+        memcpy(copied_samples.data(), device_samples.data(), device_samples.size() * sizeof(int16_t));
+        copy_stage.samples_us.push_back(get_time_us() - start_time);
+
+        start_time = get_time_us();
+        gsr_audio_mixer_add_frame(&mixer, 0, planar_data);
+        gsr_audio_mixer_add_frame(&mixer, 1, planar_data);
+        while(gsr_audio_mixer_get_frame(&mixer, mixed_data)) {}
+        mix_stage.samples_us.push_back(get_time_us() - start_time);
+    }
+
+    gsr_audio_mixer_deinit(&mixer);
+    swr_free(&swr);
+}
+
+struct PulseReadResult {
+    BenchStage stage; // Reading all available chunks after a wakeup
+    double seconds;
+    double cpu_seconds;
+    int64_t wakeups;
+    int64_t chunks;
+};
+
+static double get_thread_cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+// Records the devices like the audio thread of gpu-screen-recorder, which sleeps in sound_mainloop_wait until a device has data or until an audio frame is expected.
+// The stream read callbacks run in sound_mainloop_wait on this thread, so the thread cpu time includes all of the pulseaudio work
+static PulseReadResult run_pulse_read(const BenchOptions &options) {
+    PulseReadResult result = { { "pulse_read", {} }, 0.0, 0.0, 0, 0 };
+
+    SoundMainloop mainloop;
+    if(sound_mainloop_create(&mainloop) != 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to connect to pulseaudio\n");
+        _exit(1);
+    }
+
+    std::vector<SoundDevice> devices(options.pulse_devices.size());
+    for(size_t i = 0; i < devices.size(); ++i) {
+        if(sound_device_get_by_name(&devices[i], &mainloop, options.pulse_devices[i].c_str(), "gsr-bench", AUDIO_NUM_CHANNELS, AUDIO_FRAME_SIZE, S16) != 0) {
+            fprintf(stderr, "gsr error: gsr-bench: failed to record pulseaudio device %s\n", options.pulse_devices[i].c_str());
+            _exit(1);
+        }
+    }
+
+    const double timeout_sec = (double)AUDIO_FRAME_SIZE / (double)AUDIO_SAMPLE_RATE;
+    const double start_time = get_time_us();
+    const double start_cpu_seconds = get_thread_cpu_seconds();
+    const double end_time = start_time + options.pulse_seconds * 1000000.0;
+    while(get_time_us() < end_time) {
+        if(sound_mainloop_wait(&mainloop, timeout_sec) != 0) {
+            fprintf(stderr, "gsr error: gsr-bench: failed to wait for audio data\n");
+            _exit(1);
+        }
+        ++result.wakeups;
+
+        const double read_start_time = get_time_us();
+        for(SoundDevice &device : devices) {
+            void *buffer = nullptr;
+            double latency_seconds = 0.0;
+            int num_frames = 0;
+            while((num_frames = sound_device_read_next_chunk(&device, &buffer, &latency_seconds)) > 0) {
+                ++result.chunks;
+            }
+
+            if(num_frames < 0) {
+                fprintf(stderr, "gsr error: gsr-bench: failed to read audio data\n");
+                _exit(1);
+            }
+        }
+        result.stage.samples_us.push_back(get_time_us() - read_start_time);
+    }
+    result.cpu_seconds = get_thread_cpu_seconds() - start_cpu_seconds;
+    result.seconds = (get_time_us() - start_time) / 1000000.0;
+
+    for(SoundDevice &device : devices) {
+        sound_device_close(&device);
+    }
+    sound_mainloop_destroy(&mainloop);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    const BenchOptions options = parse_options(argc, argv);
+
+    gsr_capture_synthetic_params synthetic_params;
+    memset(&synthetic_params, 0, sizeof(synthetic_params));
+    synthetic_params.fps = options.fps;
+    if(!gsr_capture_synthetic_parse_options(options.synthetic_options.c_str(), &synthetic_params))
+        usage();
+
+    Display *dpy = XOpenDisplay(nullptr);
+    gsr_window *window = dpy ? gsr_window_x11_create(dpy) : gsr_window_wayland_create();
+    if(!window) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to create window. An X11 server or a wayland compositor is needed, for example xvfb-run\n");
+        _exit(1);
+    }
+
+    gsr_egl egl;
+    if(!gsr_egl_load(&egl, window, false, false, true)) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to load opengl\n");
+        _exit(1);
+    }
+
+    synthetic_params.egl = &egl;
+    gsr_capture *capture = gsr_capture_synthetic_create(&synthetic_params);
+    if(!capture)
+        _exit(1);
+
+    AVCodecContext *video_codec_context = create_video_codec_context(options);
+    AVFrame *video_frame = av_frame_alloc();
+    video_frame->format = video_codec_context->pix_fmt;
+    video_frame->color_range = video_codec_context->color_range;
+    video_frame->color_primaries = video_codec_context->color_primaries;
+    video_frame->color_trc = video_codec_context->color_trc;
+    video_frame->colorspace = video_codec_context->colorspace;
+
+    if(gsr_capture_start(capture, video_codec_context, video_frame) != 0) {
+        fprintf(stderr, "gsr error: gsr-bench: gsr_capture_start failed\n");
+        _exit(1);
+    }
+    video_frame->width = video_codec_context->width;
+    video_frame->height = video_codec_context->height;
+
+    gsr_video_encoder_software_params encoder_params;
+    encoder_params.egl = &egl;
+    encoder_params.color_depth = GSR_COLOR_DEPTH_8_BITS;
+    encoder_params.num_readback_buffers = options.cpu_readback_buffers;
+    gsr_video_encoder *video_encoder = gsr_video_encoder_software_create(&encoder_params);
+    if(!video_encoder || !gsr_video_encoder_start(video_encoder, video_codec_context, video_frame)) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to start the cpu video encoder\n");
+        _exit(1);
+    }
+
+    gsr_color_conversion_params color_conversion_params;
+    memset(&color_conversion_params, 0, sizeof(color_conversion_params));
+    color_conversion_params.color_range = GSR_COLOR_RANGE_LIMITED;
+    color_conversion_params.egl = &egl;
+    color_conversion_params.load_external_image_shader = false;
+    gsr_video_encoder_get_textures(video_encoder, color_conversion_params.destination_textures, &color_conversion_params.num_destination_textures, &color_conversion_params.destination_color);
+
+    gsr_color_conversion color_conversion;
+    if(gsr_color_conversion_init(&color_conversion, &color_conversion_params) != 0) {
+        fprintf(stderr, "gsr error: gsr-bench: failed to create color conversion\n");
+        _exit(1);
+    }
+    gsr_color_conversion_clear(&color_conversion);
+
+    open_video_codec(video_codec_context, options);
+
+    gsr_replay_buffer replay_buffer;
+    if(!gsr_replay_buffer_init(&replay_buffer, GSR_REPLAY_STORAGE_RAM, nullptr, 0, REPLAY_BUFFER_SECONDS, VIDEO_STREAM_INDEX))
+        _exit(1);
+
+    VideoPipeline pipeline;
+    pipeline.egl = &egl;
+    pipeline.capture = capture;
+    pipeline.video_encoder = video_encoder;
+    pipeline.color_conversion = &color_conversion;
+    pipeline.video_codec_context = video_codec_context;
+    pipeline.video_frame = video_frame;
+    pipeline.packet = av_packet_alloc();
+    pipeline.av_format_context = create_muxer(video_codec_context, &pipeline.video_stream);
+    pipeline.replay_buffer = &replay_buffer;
+    pipeline.pts = 0;
+    pipeline.num_packets = 0;
+
+    const vec2i frame_size = { video_codec_context->width, video_codec_context->height };
+    const unsigned int source_texture = create_source_texture(&egl, frame_size);
+
+    BenchStage capture_stage = { "capture", {} };
+    BenchStage color_conversion_stage = { "color_conversion", {} };
+    BenchStage copy_textures_stage = { "copy_textures_to_frame", {} };
+    BenchStage encode_stage = { "encode", {} };
+    BenchStage mux_stage = { "mux", {} };
+    BenchStage replay_insert_stage = { "replay_insert", {} };
+    BenchStage replay_save_stage = { "replay_save", {} };
+    BenchStage frame_stage = { "frame", {} };
+    BenchStage audio_convert_stage = { "audio_convert", {} };
+    BenchStage audio_copy_stage = { "audio_copy", {} };
+    BenchStage audio_mix_stage = { "audio_mix", {} };
+
+    // Each stage on its own. The opengl stages are followed by glFinish so that the gpu time is included in the stage that caused it
+    for(int i = 0; i < options.num_warmup_frames + options.num_frames; ++i) {
+        const bool warmup = i < options.num_warmup_frames;
+
+        double start_time = get_time_us();
+        gsr_color_conversion_draw(&color_conversion, source_texture, {0, 0}, frame_size, {0, 0}, frame_size, 0.0f, false, GSR_SOURCE_COLOR_RGB);
+        egl.glFinish();
+        if(!warmup)
+            color_conversion_stage.samples_us.push_back(get_time_us() - start_time);
+
+        // The synthetic capture draws the pattern and color converts it to the encoder textures
+        start_time = get_time_us();
+        gsr_capture_tick(capture);
+        gsr_capture_capture(capture, video_frame, &color_conversion);
+        egl.glFinish();
+        if(!warmup)
+            capture_stage.samples_us.push_back(get_time_us() - start_time);
+
+        start_time = get_time_us();
+        gsr_video_encoder_copy_textures_to_frame(video_encoder, video_frame, &color_conversion);
+        if(!warmup)
+            copy_textures_stage.samples_us.push_back(get_time_us() - start_time);
+
+        encode_frame(pipeline, &encode_stage, &mux_stage, &replay_insert_stage, warmup);
+
+        if(!warmup && (i - options.num_warmup_frames) % options.fps == options.fps - 1) {
+            start_time = get_time_us();
+            save_replay(&replay_buffer);
+            replay_save_stage.samples_us.push_back(get_time_us() - start_time);
+        }
+    }
+
+    // The whole main loop iteration without synchronization, as fast as possible
+    const double pipeline_start_time = get_time_us();
+    for(int i = 0; i < options.num_frames; ++i) {
+        const double start_time = get_time_us();
+        gsr_capture_tick(capture);
+        gsr_capture_capture(capture, video_frame, &color_conversion);
+        gsr_video_encoder_copy_textures_to_frame(video_encoder, video_frame, &color_conversion);
+        encode_frame(pipeline, nullptr, nullptr, nullptr, false);
+        frame_stage.samples_us.push_back(get_time_us() - start_time);
+    }
+    const double pipeline_seconds = (get_time_us() - pipeline_start_time) / 1000000.0;
+
+    bench_audio(std::max(options.num_frames, 1000), audio_convert_stage, audio_copy_stage, audio_mix_stage);
+
+    const bool run_static_sequence = options.static_sequence_changing_frames > 0;
+    StaticFramesResult every_frame_result = { 0.0, 0.0, 0, 0 };
+    StaticFramesResult skip_static_frames_result = { 0.0, 0.0, 0, 0 };
+    if(run_static_sequence) {
+        every_frame_result = run_static_frames_sequence(pipeline, options, source_texture, frame_size, false);
+        skip_static_frames_result = run_static_frames_sequence(pipeline, options, source_texture, frame_size, true);
+    }
+
+    const bool run_composite_test = options.composite_sources > 0;
+    CompositeResult composite_draw_result = { { "draw", {} }, 0.0 };
+    CompositeResult composite_batched_result = { { "batched", {} }, 0.0 };
+    const vec2i composite_source_size = { std::max(1, frame_size.x / std::max(1, options.composite_sources)), frame_size.y };
+    const vec2i composite_cursor_size = { 64, 64 };
+    if(run_composite_test) {
+        std::vector<unsigned int> composite_source_textures;
+        for(int i = 0; i < options.composite_sources; ++i) {
+            composite_source_textures.push_back(create_source_texture(&egl, composite_source_size));
+        }
+        const unsigned int cursor_texture = create_source_texture(&egl, composite_cursor_size);
+
+        composite_draw_result = run_composite(&egl, &color_conversion, composite_source_textures, composite_source_size, cursor_texture, composite_cursor_size, options.num_frames, false);
+        composite_batched_result = run_composite(&egl, &color_conversion, composite_source_textures, composite_source_size, cursor_texture, composite_cursor_size, options.num_frames, true);
+
+        egl.glDeleteTextures(composite_source_textures.size(), composite_source_textures.data());
+        egl.glDeleteTextures(1, &cursor_texture);
+    }
+
+    const bool run_pulse_read_test = !options.pulse_devices.empty();
+    PulseReadResult pulse_read_result = { { "pulse_read", {} }, 0.0, 0.0, 0, 0 };
+    if(run_pulse_read_test)
+        pulse_read_result = run_pulse_read(options);
+
+    const int num_cores = (int)std::thread::hardware_concurrency();
+    const int num_encoder_threads = std::max(1, video_codec_context->thread_count);
+    const double encoded_fps = pipeline_seconds > 0.0 ? (double)options.num_frames / pipeline_seconds : 0.0;
+
+    FILE *output_file = stdout;
+    if(options.output_filepath) {
+        output_file = fopen(options.output_filepath, "wb");
+        if(!output_file) {
+            fprintf(stderr, "gsr error: gsr-bench: failed to open %s for writing\n", options.output_filepath);
+            _exit(1);
+        }
+    }
+
+    fprintf(output_file, "{\n");
+    fprintf(output_file, "  \"config\": {\n");
+    fprintf(output_file, "    \"capture\": ");
+    write_json_string(output_file, ("synthetic:" + options.synthetic_options).c_str());
+    fprintf(output_file, ",\n");
+    fprintf(output_file, "    \"width\": %d,\n", video_codec_context->width);
+    fprintf(output_file, "    \"height\": %d,\n", video_codec_context->height);
+    fprintf(output_file, "    \"fps\": %d,\n", options.fps);
+    fprintf(output_file, "    \"frames\": %d,\n", options.num_frames);
+    fprintf(output_file, "    \"cpu_threads\": %d,\n", num_encoder_threads);
+    fprintf(output_file, "    \"cpu_thread_mode\": \"%s\",\n", options.cpu_slice_threads ? "slice" : "frame");
+    fprintf(output_file, "    \"cpu_readback_buffers\": %d,\n", options.cpu_readback_buffers);
+    fprintf(output_file, "    \"cpu_cores\": %d,\n", num_cores);
+    fprintf(output_file, "    \"gl_renderer\": ");
+    write_json_string(output_file, (const char*)egl.glGetString(GL_RENDERER));
+    fprintf(output_file, "\n");
+    fprintf(output_file, "  },\n");
+    fprintf(output_file, "  \"stages\": {\n");
+    BenchStage *stages[] = {
+        &capture_stage, &color_conversion_stage, &copy_textures_stage, &encode_stage, &mux_stage, &replay_insert_stage, &replay_save_stage,
+        &frame_stage, &audio_convert_stage, &audio_copy_stage, &audio_mix_stage
+    };
+    const int num_stages = sizeof(stages) / sizeof(stages[0]);
+    for(int i = 0; i < num_stages; ++i) {
+        write_stage_json(output_file, *stages[i], i == num_stages - 1);
+    }
+    fprintf(output_file, "  },\n");
+    fprintf(output_file, "  \"pipeline\": {\n");
+    fprintf(output_file, "    \"seconds\": %.3f,\n", pipeline_seconds);
+    fprintf(output_file, "    \"encoded_fps\": %.2f,\n", encoded_fps);
+    fprintf(output_file, "    \"encoded_fps_per_thread\": %.2f,\n", encoded_fps / (double)num_encoder_threads);
+    fprintf(output_file, "    \"packets\": %" PRId64 ",\n", pipeline.num_packets);
+    fprintf(output_file, "    \"replay_buffer_bytes\": %zu\n", gsr_replay_buffer_get_num_bytes(&replay_buffer));
+    fprintf(output_file, "  }%s\n", run_static_sequence || run_composite_test || run_pulse_read_test ? "," : "");
+    if(run_static_sequence) {
+        fprintf(output_file, "  \"static_frames\": {\n");
+        fprintf(output_file, "    \"changing_frames\": %d,\n", options.static_sequence_changing_frames);
+        fprintf(output_file, "    \"static_frames\": %d,\n", options.static_sequence_static_frames);
+        write_static_frames_result_json(output_file, "every_frame", every_frame_result, false);
+        write_static_frames_result_json(output_file, "skip_static_frames", skip_static_frames_result, false);
+        fprintf(output_file, "    \"cpu_saved_percent\": %.1f,\n", get_saved_percent(every_frame_result.cpu_seconds, skip_static_frames_result.cpu_seconds));
+        fprintf(output_file, "    \"gl_saved_percent\": %.1f,\n", get_saved_percent(every_frame_result.gl_seconds, skip_static_frames_result.gl_seconds));
+        fprintf(output_file, "    \"size_saved_percent\": %.1f\n", get_saved_percent((double)every_frame_result.encoded_bytes, (double)skip_static_frames_result.encoded_bytes));
+        fprintf(output_file, "  }%s\n", run_composite_test || run_pulse_read_test ? "," : "");
+    }
+    if(run_composite_test) {
+        fprintf(output_file, "  \"composite\": {\n");
+        fprintf(output_file, "    \"sources\": %d,\n", options.composite_sources);
+        fprintf(output_file, "    \"source_width\": %d,\n", composite_source_size.x);
+        write_composite_result_json(output_file, composite_draw_result, false);
+        write_composite_result_json(output_file, composite_batched_result, false);
+        fprintf(output_file, "    \"gl_calls_saved_percent\": %.1f\n", get_saved_percent(composite_draw_result.gl_calls_per_frame, composite_batched_result.gl_calls_per_frame));
+        fprintf(output_file, "  }%s\n", run_pulse_read_test ? "," : "");
+    }
+    if(run_pulse_read_test) {
+        const double num_devices = (double)options.pulse_devices.size();
+        fprintf(output_file, "  \"pulse\": {\n");
+        fprintf(output_file, "    \"devices\": %zu,\n", options.pulse_devices.size());
+        fprintf(output_file, "    \"seconds\": %.3f,\n", pulse_read_result.seconds);
+        fprintf(output_file, "    \"wakeups_per_second\": %.1f,\n", (double)pulse_read_result.wakeups / pulse_read_result.seconds);
+        fprintf(output_file, "    \"chunks_per_second_per_device\": %.1f,\n", (double)pulse_read_result.chunks / pulse_read_result.seconds / num_devices);
+        fprintf(output_file, "    \"cpu_percent_per_device\": %.3f,\n", pulse_read_result.cpu_seconds / pulse_read_result.seconds / num_devices * 100.0);
+        write_stage_json(output_file, pulse_read_result.stage, true);
+        fprintf(output_file, "  }\n");
+    }
+    fprintf(output_file, "}\n");
+    if(output_file != stdout)
+        fclose(output_file);
+
+    av_write_trailer(pipeline.av_format_context);
+    avio_close(pipeline.av_format_context->pb);
+    avformat_free_context(pipeline.av_format_context);
+    av_packet_free(&pipeline.packet);
+    egl.glDeleteTextures(1, &source_texture);
+    gsr_replay_buffer_deinit(&replay_buffer);
+    gsr_color_conversion_deinit(&color_conversion);
+    gsr_video_encoder_destroy(video_encoder, video_codec_context);
+    gsr_capture_destroy(capture, video_codec_context);
+    avcodec_free_context(&video_codec_context);
+    av_frame_free(&video_frame);
+    gsr_egl_unload(&egl);
+    gsr_window_destroy(window);
+    if(dpy)
+        XCloseDisplay(dpy);
+    return 0;
+}
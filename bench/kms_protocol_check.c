@@ -0,0 +1,327 @@
+/* The kms server is a single source file with static functions, it's included here so that its subscription code can be called directly */
+#define main gsr_kms_server_main
+#include "../kms/server/kms_server.c"
+#undef main
+
+#include "fake_drm.h"
+#include "../kms/client/kms_client.h"
+
+#include <sys/wait.h>
+
+// Checks the subscription protocol between gsr-kms-server and the kms client against the fake drm device in fake_drm.c.
+// The server side runs in a child process, like gsr-kms-server, and the client side uses the functions in kms_client.c.
+// The subscribe request, the state in the shared memory, the framebuffer updates on the socket and framebuffer_cache_cleared are checked.
+
+#define NUM_MONITORS 2
+/* A primary plane on every monitor and the cursor on the first monitor, see fake_drm.c */
+#define NUM_ITEMS (NUM_MONITORS + 1)
+#define FRAMEBUFFERS_PER_MONITOR 3
+
+typedef enum {
+    SERVER_COMMAND_REQUEST, /* Handle a request from the client and update, like the server does after a request */
+    SERVER_COMMAND_UPDATE,  /* Update without a change in the planes */
+    SERVER_COMMAND_FLIP,    /* Flip the primary planes and move the cursor, then update */
+    SERVER_COMMAND_CHANGE_HDR_METADATA, /* Replace the hdr metadata blob of the first monitor (max_cll 500), then update */
+    SERVER_COMMAND_REMOVE_HDR_METADATA, /* Remove the hdr metadata of the first monitor, then update */
+    SERVER_COMMAND_QUIT
+} server_command;
+
+static int num_failed_checks = 0;
+
+#define CHECK(condition) do { \
+        if(!(condition)) { \
+            fprintf(stderr, "gsr error: gsr-kms-protocol-check: line %d: check failed: %s\n", __LINE__, #condition); \
+            ++num_failed_checks; \
+        } \
+    } while(0)
+
+/* gsr_kms_client_init is not used, the server is started by the check. This avoids linking utils.c and egl */
+bool generate_random_characters_standard_alphabet(char *buffer, int buffer_size) {
+    (void)buffer;
+    (void)buffer_size;
+    return false;
+}
+
+static int run_server(int socket_fd, int command_fd) {
+    const fake_drm_params drm_params = { NUM_MONITORS, 1, 1, 0.0 };
+    fake_drm_init(&drm_params);
+
+    gsr_drm drm;
+    drm.drmfd = fake_drm_get_fd();
+    drm.planes = drmModeGetPlaneResources(drm.drmfd);
+    if(!drm.planes) {
+        fprintf(stderr, "gsr error: gsr-kms-protocol-check: failed to get plane resources\n");
+        return 1;
+    }
+
+    drm_topology topology;
+    memset(&topology, 0, sizeof(topology));
+    topology.uevent_fd = -1;
+    if(!drm_topology_rebuild(&drm, &topology))
+        return 1;
+
+    client_framebuffer_cache fb_cache;
+    memset(&fb_cache, 0, sizeof(fb_cache));
+
+    kms_subscription subscription;
+    memset(&subscription, 0, sizeof(subscription));
+
+    for(;;) {
+        int command = SERVER_COMMAND_QUIT;
+        if(recv(command_fd, &command, sizeof(command), 0) != sizeof(command) || command == SERVER_COMMAND_QUIT)
+            break;
+
+        switch(command) {
+            case SERVER_COMMAND_REQUEST: {
+                gsr_kms_request request;
+                memset(&request, 0, sizeof(request));
+                if(recv_msg_from_client(socket_fd, &request) <= 0 || request.type != KMS_REQUEST_TYPE_SUBSCRIBE) {
+                    fprintf(stderr, "gsr error: gsr-kms-protocol-check: expected a KMS_REQUEST_TYPE_SUBSCRIBE request\n");
+                    break;
+                }
+                kms_subscription_handle_request(&subscription, &request, socket_fd);
+                break;
+            }
+            case SERVER_COMMAND_UPDATE:
+                break;
+            case SERVER_COMMAND_FLIP:
+                fake_drm_flip();
+                break;
+            case SERVER_COMMAND_CHANGE_HDR_METADATA:
+                fake_drm_set_hdr_metadata(500);
+                break;
+            case SERVER_COMMAND_REMOVE_HDR_METADATA:
+                fake_drm_set_hdr_metadata(0);
+                break;
+        }
+
+        if(subscription.active)
+            kms_subscription_update(&subscription, &drm, &topology, &fb_cache, socket_fd);
+
+        const char done = 1;
+        if(send(command_fd, &done, sizeof(done), 0) != sizeof(done))
+            break;
+    }
+
+    kms_subscription_deinit(&subscription);
+    drm_topology_deinit(&topology);
+    drmModeFreePlaneResources(drm.planes);
+    fake_drm_deinit();
+    return 0;
+}
+
+static void run_server_command(int command_fd, server_command command) {
+    const int value = command;
+    char done = 0;
+    if(send(command_fd, &value, sizeof(value), 0) != sizeof(value) || recv(command_fd, &done, sizeof(done), 0) != sizeof(done)) {
+        fprintf(stderr, "gsr error: gsr-kms-protocol-check: the server process didn't respond\n");
+        exit(1);
+    }
+}
+
+static void close_response_item_fds(gsr_kms_response *response) {
+    for(int i = 0; i < response->num_items; ++i) {
+        for(int j = 0; j < response->items[i].num_dma_bufs; ++j) {
+            if(response->items[i].dma_buf[j].fd > 0)
+                close(response->items[i].dma_buf[j].fd);
+            response->items[i].dma_buf[j].fd = -1;
+        }
+    }
+}
+
+static int get_num_new_framebuffers(const gsr_kms_response *response) {
+    int num_new_framebuffers = 0;
+    for(int i = 0; i < response->num_items; ++i) {
+        if(!response->items[i].dma_buf_cached && response->items[i].num_dma_bufs > 0 && response->items[i].dma_buf[0].fd > 0)
+            ++num_new_framebuffers;
+    }
+    return num_new_framebuffers;
+}
+
+/* Receives all framebuffer updates up to |num_framebuffer_updates|. Returns the number of received updates, |last_update| is set to the last one */
+static int receive_framebuffer_updates(gsr_kms_client *client, uint32_t num_framebuffer_updates, gsr_kms_response *last_update) {
+    int num_received = 0;
+    for(;;) {
+        gsr_kms_response update;
+        const int res = gsr_kms_client_get_framebuffer_update(client, num_framebuffer_updates, &update);
+        if(res != 1) {
+            CHECK(res == 0);
+            break;
+        }
+
+        *last_update = update;
+        close_response_item_fds(&update);
+        ++num_received;
+    }
+    return num_received;
+}
+
+/* Returns the max_cll of the monitor that has hdr metadata in the state, 0 if no monitor has hdr metadata and -1 on error */
+static int get_hdr_metadata_max_cll(gsr_kms_client *client) {
+    gsr_kms_response state;
+    uint32_t num_framebuffer_updates = 0;
+    if(!gsr_kms_client_get_state(client, &state, &num_framebuffer_updates))
+        return -1;
+
+    int max_cll = 0;
+    for(int i = 0; i < state.num_items; ++i) {
+        if(!state.items[i].is_cursor && state.items[i].has_hdr_metadata)
+            max_cll = state.items[i].hdr_metadata.hdmi_metadata_type1.max_cll;
+    }
+    return max_cll;
+}
+
+static void check_state(gsr_kms_client *client, uint32_t expected_num_framebuffer_updates) {
+    gsr_kms_response state;
+    uint32_t num_framebuffer_updates = 0;
+    CHECK(gsr_kms_client_get_state(client, &state, &num_framebuffer_updates));
+    CHECK(num_framebuffer_updates == expected_num_framebuffer_updates);
+    CHECK(state.result == KMS_RESULT_OK);
+    CHECK(state.num_items == NUM_ITEMS);
+    CHECK(state.num_removed_fb_ids == 0);
+    CHECK(!state.framebuffer_cache_cleared);
+    for(int i = 0; i < state.num_items; ++i) {
+        CHECK(state.items[i].dma_buf_cached);
+        CHECK(state.items[i].num_dma_bufs == 0 || state.items[i].dma_buf[0].fd == -1);
+    }
+    CHECK(!gsr_kms_client_has_new_state(client));
+}
+
+int main(void) {
+    int sockets[2];
+    int command_sockets[2];
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1 || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, command_sockets) == -1) {
+        fprintf(stderr, "gsr error: gsr-kms-protocol-check: socketpair failed, error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    const pid_t server_pid = fork();
+    if(server_pid == -1) {
+        fprintf(stderr, "gsr error: gsr-kms-protocol-check: fork failed, error: %s\n", strerror(errno));
+        return 1;
+    } else if(server_pid == 0) {
+        close(sockets[0]);
+        close(command_sockets[0]);
+        _exit(run_server(sockets[1], command_sockets[1]));
+    }
+    close(sockets[1]);
+    close(command_sockets[1]);
+    const int command_fd = command_sockets[0];
+
+    gsr_kms_client client;
+    memset(&client, 0, sizeof(client));
+    client.kms_server_pid = server_pid;
+    client.initial_socket_fd = -1;
+    client.initial_client_fd = -1;
+    client.socket_pair[0] = sockets[0];
+    client.socket_pair[1] = -1;
+    client.update_event_fd = -1;
+
+    gsr_kms_response update;
+    uint32_t num_framebuffer_updates = 0;
+
+    /* The first state comes with all framebuffers */
+    {
+        const int value = SERVER_COMMAND_REQUEST;
+        CHECK(send(command_fd, &value, sizeof(value), 0) == sizeof(value));
+        CHECK(gsr_kms_client_subscribe(&client, 60) == 0);
+        char done = 0;
+        CHECK(recv(command_fd, &done, sizeof(done), 0) == sizeof(done));
+    }
+    CHECK(gsr_kms_client_get_update_fd(&client) != -1);
+    CHECK(gsr_kms_client_has_new_state(&client));
+    num_framebuffer_updates = gsr_kms_client_get_num_framebuffer_updates(&client);
+    CHECK(num_framebuffer_updates == 1);
+    CHECK(receive_framebuffer_updates(&client, num_framebuffer_updates, &update) == 1);
+    CHECK(update.framebuffer_cache_cleared);
+    CHECK(get_num_new_framebuffers(&update) == NUM_ITEMS);
+    check_state(&client, num_framebuffer_updates);
+    gsr_kms_client_clear_update_event(&client);
+
+    /* Nothing changed, nothing is pushed */
+    run_server_command(command_fd, SERVER_COMMAND_UPDATE);
+    CHECK(!gsr_kms_client_has_new_state(&client));
+    CHECK(gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates);
+
+    /* The primary planes flip to framebuffers that the client doesn't have, the cursor framebuffer is cached */
+    for(int i = 1; i < FRAMEBUFFERS_PER_MONITOR; ++i) {
+        run_server_command(command_fd, SERVER_COMMAND_FLIP);
+        CHECK(gsr_kms_client_has_new_state(&client));
+        CHECK(gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates + 1);
+        num_framebuffer_updates = gsr_kms_client_get_num_framebuffer_updates(&client);
+        CHECK(receive_framebuffer_updates(&client, num_framebuffer_updates, &update) == 1);
+        CHECK(!update.framebuffer_cache_cleared);
+        CHECK(get_num_new_framebuffers(&update) == NUM_MONITORS);
+        check_state(&client, num_framebuffer_updates);
+    }
+
+    /* All framebuffers are cached now, only the state changes (the cursor moved) */
+    run_server_command(command_fd, SERVER_COMMAND_FLIP);
+    CHECK(gsr_kms_client_has_new_state(&client));
+    CHECK(gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates);
+    CHECK(receive_framebuffer_updates(&client, num_framebuffer_updates, &update) == 0);
+    check_state(&client, num_framebuffer_updates);
+
+    /* The compositor changes the hdr metadata, which is a new property blob and not a hotplug event */
+    CHECK(get_hdr_metadata_max_cll(&client) == 1000);
+    run_server_command(command_fd, SERVER_COMMAND_CHANGE_HDR_METADATA);
+    CHECK(gsr_kms_client_has_new_state(&client));
+    CHECK(get_hdr_metadata_max_cll(&client) == 500);
+    run_server_command(command_fd, SERVER_COMMAND_REMOVE_HDR_METADATA);
+    CHECK(gsr_kms_client_has_new_state(&client));
+    CHECK(get_hdr_metadata_max_cll(&client) == 0);
+    CHECK(gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates);
+
+    /* The client lost its framebuffers */
+    gsr_kms_client_reset_framebuffer_cache(&client);
+    run_server_command(command_fd, SERVER_COMMAND_REQUEST);
+    CHECK(gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates + 1);
+    num_framebuffer_updates = gsr_kms_client_get_num_framebuffer_updates(&client);
+    CHECK(receive_framebuffer_updates(&client, num_framebuffer_updates, &update) == 1);
+    CHECK(update.framebuffer_cache_cleared);
+    CHECK(get_num_new_framebuffers(&update) == NUM_ITEMS);
+    check_state(&client, num_framebuffer_updates);
+
+    /*
+        The client doesn't read the socket until it's full. The framebuffer update that doesn't fit is not sent and the state is not updated,
+        and the next framebuffer update after that clears the framebuffer cache.
+    */
+    bool socket_full = false;
+    for(int i = 0; i < 10000 && !socket_full; ++i) {
+        const uint32_t num_framebuffer_updates_before = gsr_kms_client_get_num_framebuffer_updates(&client);
+        gsr_kms_client_reset_framebuffer_cache(&client);
+        run_server_command(command_fd, SERVER_COMMAND_REQUEST);
+        socket_full = gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates_before;
+    }
+    CHECK(socket_full);
+
+    num_framebuffer_updates = gsr_kms_client_get_num_framebuffer_updates(&client);
+    CHECK(receive_framebuffer_updates(&client, num_framebuffer_updates, &update) > 0);
+    check_state(&client, num_framebuffer_updates);
+
+    run_server_command(command_fd, SERVER_COMMAND_UPDATE);
+    CHECK(gsr_kms_client_get_num_framebuffer_updates(&client) == num_framebuffer_updates + 1);
+    num_framebuffer_updates = gsr_kms_client_get_num_framebuffer_updates(&client);
+    CHECK(receive_framebuffer_updates(&client, num_framebuffer_updates, &update) == 1);
+    CHECK(update.framebuffer_cache_cleared);
+    CHECK(get_num_new_framebuffers(&update) == NUM_ITEMS);
+    check_state(&client, num_framebuffer_updates);
+
+    const int quit = SERVER_COMMAND_QUIT;
+    CHECK(send(command_fd, &quit, sizeof(quit), 0) == sizeof(quit));
+    int status = 0;
+    CHECK(waitpid(server_pid, &status, 0) == server_pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    client.kms_server_pid = -1;
+    gsr_kms_client_deinit(&client);
+    close(command_fd);
+
+    if(num_failed_checks > 0) {
+        fprintf(stderr, "gsr error: gsr-kms-protocol-check: %d check(s) failed\n", num_failed_checks);
+        return 1;
+    }
+
+    fprintf(stderr, "gsr info: gsr-kms-protocol-check: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,227 @@
+/* The kms server is a single source file with static functions, it's included here so that its request path can be called directly */
+#define main gsr_kms_server_main
+#include "../kms/server/kms_server.c"
+#undef main
+
+#include "fake_drm.h"
+
+#include <math.h>
+
+// Measures the time that gsr-kms-server spends on a KMS_REQUEST_TYPE_GET_KMS request (without sending the response) against the fake drm device in fake_drm.c, as json.
+// Requests are measured while the drm topology is cached and right after a hotplug event, where the topology has to be queried again.
+
+typedef struct {
+    const char *name;
+    double *samples_us;
+    int num_samples;
+    uint64_t num_ioctls;
+} bench_stage;
+
+typedef struct {
+    fake_drm_params drm_params;
+    int num_requests;
+    int num_warmup_requests;
+    const char *output_filepath;
+} bench_options;
+
+static void usage(void) {
+    fprintf(stderr, "usage: gsr-kms-server-bench [-monitors <n>] [-overlay-planes <n>] [-disconnected-connectors <n>] [-ioctl-cost-us <us>] [-n <requests>] [-warmup <requests>] [-o <output.json>]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Runs the KMS_REQUEST_TYPE_GET_KMS request path of gsr-kms-server against a fake drm device and prints the p50, p99 and max time per request in microseconds, and the number of drm ioctls per request, as json.\n");
+    fprintf(stderr, "The primary planes flip to a new framebuffer and the cursor moves before every request. The time of an ioctl is simulated with a busy wait of -ioctl-cost-us.\n");
+    fprintf(stderr, "\"cached\" is a request with the cached drm topology and \"after_hotplug\" is a request right after a drm hotplug event, where the plane and connector properties are queried again.\n");
+    fprintf(stderr, "By default there are 2 monitors with 3 overlay planes each, 2 disconnected connectors, ioctls take 1 microsecond, 2000 requests are measured after 100 warmup requests and the json is written to stdout.\n");
+    exit(1);
+}
+
+static int parse_int_arg(const char *name, const char *value, int min_value, int max_value) {
+    char *end = NULL;
+    const long result = strtol(value, &end, 10);
+    if(end == value || *end != '\0' || result < min_value || result > max_value) {
+        fprintf(stderr, "gsr error: gsr-kms-server-bench: expected %s to be a number between %d and %d, got: %s\n", name, min_value, max_value, value);
+        usage();
+    }
+    return (int)result;
+}
+
+static bench_options parse_options(int argc, char **argv) {
+    bench_options options;
+    options.drm_params.num_monitors = 2;
+    options.drm_params.num_overlay_planes = 3;
+    options.drm_params.num_disconnected_connectors = 2;
+    options.drm_params.ioctl_cost_us = 1.0;
+    options.num_requests = 2000;
+    options.num_warmup_requests = 100;
+    options.output_filepath = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if(i + 1 >= argc)
+            usage();
+
+        const char *value = argv[++i];
+        if(strcmp(arg, "-monitors") == 0) {
+            options.drm_params.num_monitors = parse_int_arg(arg, value, 1, 16);
+        } else if(strcmp(arg, "-overlay-planes") == 0) {
+            options.drm_params.num_overlay_planes = parse_int_arg(arg, value, 0, 8);
+        } else if(strcmp(arg, "-disconnected-connectors") == 0) {
+            options.drm_params.num_disconnected_connectors = parse_int_arg(arg, value, 0, 16);
+        } else if(strcmp(arg, "-ioctl-cost-us") == 0) {
+            char *end = NULL;
+            options.drm_params.ioctl_cost_us = strtod(value, &end);
+            if(end == value || *end != '\0' || options.drm_params.ioctl_cost_us < 0.0) {
+                fprintf(stderr, "gsr error: gsr-kms-server-bench: expected -ioctl-cost-us to be a positive number, got: %s\n", value);
+                usage();
+            }
+        } else if(strcmp(arg, "-n") == 0) {
+            options.num_requests = parse_int_arg(arg, value, 1, 1000000);
+        } else if(strcmp(arg, "-warmup") == 0) {
+            options.num_warmup_requests = parse_int_arg(arg, value, 0, 1000000);
+        } else if(strcmp(arg, "-o") == 0) {
+            options.output_filepath = value;
+        } else {
+            fprintf(stderr, "gsr error: gsr-kms-server-bench: invalid option: %s\n", arg);
+            usage();
+        }
+    }
+    return options;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double da = *(const double*)a;
+    const double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+/* Nearest-rank percentile. |samples| has to be sorted */
+static double get_percentile(const double *samples, int num_samples, double percentile) {
+    if(num_samples == 0)
+        return 0.0;
+
+    int rank = (int)ceil(percentile * num_samples);
+    if(rank < 1)
+        rank = 1;
+    if(rank > num_samples)
+        rank = num_samples;
+    return samples[rank - 1];
+}
+
+static void write_stage_json(FILE *file, bench_stage *stage, bool last) {
+    qsort(stage->samples_us, stage->num_samples, sizeof(double), compare_doubles);
+    double sum = 0.0;
+    for(int i = 0; i < stage->num_samples; ++i) {
+        sum += stage->samples_us[i];
+    }
+    const double mean = stage->num_samples == 0 ? 0.0 : sum / stage->num_samples;
+    const double max = stage->num_samples == 0 ? 0.0 : stage->samples_us[stage->num_samples - 1];
+    const double ioctls_per_request = stage->num_samples == 0 ? 0.0 : (double)stage->num_ioctls / stage->num_samples;
+    fprintf(file, "    \"%s\": {\"count\": %d, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"ioctls_per_request\": %.1f}%s\n",
+        stage->name, stage->num_samples, mean, get_percentile(stage->samples_us, stage->num_samples, 0.50), get_percentile(stage->samples_us, stage->num_samples, 0.99), max, ioctls_per_request, last ? "" : ",");
+}
+
+/* What the kernel sends on the uevent socket when a monitor is connected or disconnected */
+static void send_hotplug_uevent(int uevent_fd) {
+    const char uevent[] = "change@/devices/pci0000:00/0000:00:01.0/drm/card0\0ACTION=change\0DEVNAME=dri/card0\0SUBSYSTEM=drm\0HOTPLUG=1\0";
+    if(send(uevent_fd, uevent, sizeof(uevent), 0) != (ssize_t)sizeof(uevent))
+        fprintf(stderr, "gsr error: gsr-kms-server-bench: failed to send the hotplug event, error: %s\n", strerror(errno));
+}
+
+static void run_request(gsr_drm *drm, drm_topology *topology, client_framebuffer_cache *fb_cache, bench_stage *stage) {
+    fake_drm_flip();
+
+    gsr_kms_response response;
+    memset(&response, 0, sizeof(response));
+    response.version = GSR_KMS_PROTOCOL_VERSION;
+
+    const uint64_t num_ioctls_start = fake_drm_get_num_ioctls();
+    const double start = clock_get_monotonic_seconds();
+    if(kms_get_fb(drm, &response, topology, fb_cache, false) != 0)
+        fprintf(stderr, "gsr error: gsr-kms-server-bench: request failed, error: %s\n", response.err_msg);
+    const double end = clock_get_monotonic_seconds();
+
+    if(stage) {
+        stage->samples_us[stage->num_samples++] = (end - start) * 1000000.0;
+        stage->num_ioctls += fake_drm_get_num_ioctls() - num_ioctls_start;
+    }
+
+    close_response_fds(&response);
+}
+
+int main(int argc, char **argv) {
+    const bench_options options = parse_options(argc, argv);
+    fake_drm_init(&options.drm_params);
+
+    gsr_drm drm;
+    drm.drmfd = fake_drm_get_fd();
+    drm.planes = drmModeGetPlaneResources(drm.drmfd);
+    if(!drm.planes) {
+        fprintf(stderr, "gsr error: gsr-kms-server-bench: failed to get plane resources\n");
+        return 1;
+    }
+
+    /* The kernel uevent socket is replaced with a socket pair, so that the hotplug events come from the benchmark */
+    int uevent_sockets[2];
+    if(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, uevent_sockets) == -1) {
+        fprintf(stderr, "gsr error: gsr-kms-server-bench: socketpair failed, error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    drm_topology topology;
+    memset(&topology, 0, sizeof(topology));
+    topology.uevent_fd = uevent_sockets[0];
+    if(!drm_topology_rebuild(&drm, &topology))
+        return 1;
+
+    client_framebuffer_cache fb_cache;
+    memset(&fb_cache, 0, sizeof(fb_cache));
+
+    bench_stage cached_stage = { "cached", calloc(options.num_requests, sizeof(double)), 0, 0 };
+    bench_stage after_hotplug_stage = { "after_hotplug", calloc(options.num_requests, sizeof(double)), 0, 0 };
+    if(!cached_stage.samples_us || !after_hotplug_stage.samples_us) {
+        fprintf(stderr, "gsr error: gsr-kms-server-bench: failed to allocate memory\n");
+        return 1;
+    }
+
+    for(int i = 0; i < options.num_warmup_requests; ++i) {
+        run_request(&drm, &topology, &fb_cache, NULL);
+    }
+
+    for(int i = 0; i < options.num_requests; ++i) {
+        run_request(&drm, &topology, &fb_cache, &cached_stage);
+    }
+
+    for(int i = 0; i < options.num_requests; ++i) {
+        send_hotplug_uevent(uevent_sockets[1]);
+        run_request(&drm, &topology, &fb_cache, &after_hotplug_stage);
+    }
+
+    FILE *file = stdout;
+    if(options.output_filepath) {
+        file = fopen(options.output_filepath, "wb");
+        if(!file) {
+            fprintf(stderr, "gsr error: gsr-kms-server-bench: failed to open %s, error: %s\n", options.output_filepath, strerror(errno));
+            return 1;
+        }
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"monitors\": %d,\n", options.drm_params.num_monitors);
+    fprintf(file, "  \"planes\": %u,\n", drm.planes->count_planes);
+    fprintf(file, "  \"ioctl_cost_us\": %.2f,\n", options.drm_params.ioctl_cost_us);
+    fprintf(file, "  \"requests\": {\n");
+    write_stage_json(file, &cached_stage, false);
+    write_stage_json(file, &after_hotplug_stage, true);
+    fprintf(file, "  }\n");
+    fprintf(file, "}\n");
+
+    if(file != stdout)
+        fclose(file);
+
+    free(cached_stage.samples_us);
+    free(after_hotplug_stage.samples_us);
+    drm_topology_deinit(&topology);
+    close(uevent_sockets[1]);
+    drmModeFreePlaneResources(drm.planes);
+    fake_drm_deinit();
+    return 0;
+}
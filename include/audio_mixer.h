@@ -0,0 +1,38 @@
+#ifndef GSR_AUDIO_MIXER_H
+#define GSR_AUDIO_MIXER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+
+/* The number of frames a source can be ahead of the slowest source before the slowest source is treated as silent */
+#define GSR_AUDIO_MIXER_MAX_PENDING_FRAMES 32
+
+/*
+    Mixes audio frames from multiple sources into one, the same way as the amix filter with default options
+    (each source is scaled by 1/number of sources). The n:th frame of every source is mixed together.
+*/
+typedef struct {
+    int num_sources;
+    int num_samples; /* Per channel, per frame */
+    int num_channels;
+    enum AVSampleFormat sample_format; /* AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP or AV_SAMPLE_FMT_S16 */
+
+    float *pending_frames; /* GSR_AUDIO_MIXER_MAX_PENDING_FRAMES frames of interleaved samples */
+    int num_pending_frame_sources[GSR_AUDIO_MIXER_MAX_PENDING_FRAMES];
+    int64_t first_pending_frame_index;
+    int64_t *source_next_frame_index;
+} gsr_audio_mixer;
+
+bool gsr_audio_mixer_init(gsr_audio_mixer *self, int num_sources, int num_samples, int num_channels, enum AVSampleFormat sample_format);
+void gsr_audio_mixer_deinit(gsr_audio_mixer *self);
+
+/* |data| is the data planes of a frame in the mixer sample format (AVFrame->data) */
+void gsr_audio_mixer_add_frame(gsr_audio_mixer *self, int source_index, uint8_t *const *data);
+/*
+    Writes the next mixed frame into |data| (AVFrame->data) and returns true if every source has added the frame,
+    or if a source is too far behind. Call this until it returns false after adding a frame.
+*/
+bool gsr_audio_mixer_get_frame(gsr_audio_mixer *self, uint8_t *const *data);
+
+#endif /* GSR_AUDIO_MIXER_H */
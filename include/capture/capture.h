@@ -25,6 +25,9 @@ struct gsr_capture {
     uint64_t (*get_window_id)(gsr_capture *cap); /* can be NULL. Returns 0 if unknown */
     bool (*is_damaged)(gsr_capture *cap); /* can be NULL */
     void (*clear_damage)(gsr_capture *cap); /* can be NULL */
+    int (*get_damage_fd)(gsr_capture *cap); /* can be NULL. Returns an fd that becomes readable when |is_damaged| becomes true, or -1 */
+    void (*set_damage_regions)(gsr_capture *cap, const gsr_rectangle *regions, int num_regions); /* can be NULL. Damage tracked outside of the capture (x11 damage), see |gsr_capture_set_damage_regions| */
+    bool (*get_frame_damage_regions)(gsr_capture *cap, const gsr_rectangle **regions, int *num_regions); /* can be NULL. If NULL, return false */
     void (*destroy)(gsr_capture *cap, AVCodecContext *video_codec_context);
 
     void *priv; /* can be NULL */
@@ -37,6 +40,18 @@ void gsr_capture_tick(gsr_capture *cap);
 bool gsr_capture_should_stop(gsr_capture *cap, bool *err);
 int gsr_capture_capture(gsr_capture *cap, AVFrame *frame, gsr_color_conversion *color_conversion);
 bool gsr_capture_uses_external_image(gsr_capture *cap);
+/* Returns -1 if the capture doesn't have a damage fd, in which case |is_damaged| has to be polled */
+int gsr_capture_get_damage_fd(gsr_capture *cap);
+/*
+    Sets the regions of the captured window that changed since the previous capture, for the next |gsr_capture_capture|.
+    |regions| is NULL if the damage is not known, in which case everything is drawn again.
+*/
+void gsr_capture_set_damage_regions(gsr_capture *cap, const gsr_rectangle *regions, int num_regions);
+/*
+    Returns the regions of the frame (in frame pixels) that changed in the last |gsr_capture_capture|, including the cursor.
+    Returns false if it's not known which regions changed, in which case the whole frame should be considered changed.
+*/
+bool gsr_capture_get_frame_damage_regions(gsr_capture *cap, const gsr_rectangle **regions, int *num_regions);
 bool gsr_capture_set_hdr_metadata(gsr_capture *cap, AVMasteringDisplayMetadata *mastering_display_metadata, AVContentLightMetadata *light_metadata);
 void gsr_capture_destroy(gsr_capture *cap, AVCodecContext *video_codec_context);
 
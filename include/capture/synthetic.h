@@ -0,0 +1,29 @@
+#ifndef GSR_CAPTURE_SYNTHETIC_H
+#define GSR_CAPTURE_SYNTHETIC_H
+
+#include "capture.h"
+
+typedef enum {
+    GSR_SYNTHETIC_PATTERN_BARS,    /* Color bars with a moving box */
+    GSR_SYNTHETIC_PATTERN_CHECKER, /* Scrolling checkerboard */
+    GSR_SYNTHETIC_PATTERN_SOLID    /* The whole frame changes color */
+} gsr_synthetic_pattern;
+
+/*
+    Generates a test pattern on the gpu instead of capturing a display. The pattern changes |damage_fps| times per second and each step of the
+    pattern always looks the same, so it can be used to benchmark the encoding pipeline without a monitor or a window to capture.
+*/
+typedef struct {
+    gsr_egl *egl;
+    vec2i size;
+    gsr_synthetic_pattern pattern;
+    int fps;
+    int damage_fps; /* How many times per second the pattern changes, at most |fps| */
+} gsr_capture_synthetic_params;
+
+gsr_capture* gsr_capture_synthetic_create(const gsr_capture_synthetic_params *params);
+
+/* Parses "WxH:pattern" or "WxH:pattern:damage_fps" (the part after "synthetic:"). Returns false on error */
+bool gsr_capture_synthetic_parse_options(const char *str, gsr_capture_synthetic_params *params);
+
+#endif /* GSR_CAPTURE_SYNTHETIC_H */
@@ -5,6 +5,9 @@
 #include "vec2.h"
 #include <stdbool.h>
 
+#define GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS 16
+#define GSR_COLOR_CONVERSION_MAX_QUADS 16
+
 typedef enum {
     GSR_COLOR_RANGE_LIMITED,
     GSR_COLOR_RANGE_FULL
@@ -26,9 +29,17 @@ typedef enum {
 } gsr_destination_color;
 
 typedef struct {
-    int offset;
-    int rotation;
-} gsr_color_uniforms;
+    unsigned int texture_id;
+    vec2i source_pos;
+    vec2i source_size;
+    vec2i texture_pos;
+    vec2i texture_size;
+    float rotation;
+    bool external_texture;
+    gsr_source_color source_color;
+    bool has_clip;
+    gsr_rectangle clip;
+} gsr_color_conversion_quad;
 
 typedef struct {
     gsr_egl *egl;
@@ -44,19 +55,47 @@ typedef struct {
 
 typedef struct {
     gsr_color_conversion_params params;
-    gsr_color_uniforms uniforms[4];
     gsr_shader shaders[4];
 
     unsigned int framebuffers[2];
 
     unsigned int vertex_array_object_id;
     unsigned int vertex_buffer_object_id;
+    vec2i destination_texture_size;
+
+    gsr_color_conversion_quad quads[GSR_COLOR_CONVERSION_MAX_QUADS];
+    int num_quads;
+    bool has_clip;
+    gsr_rectangle clip;
+
+    gsr_rectangle damage_regions[GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS];
+    int num_damage_regions;
+
+    double draw_time_seconds; /* Total cpu time spent in |gsr_color_conversion_draw| and |gsr_color_conversion_flush|, for statistics */
 } gsr_color_conversion;
 
 int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conversion_params *params);
 void gsr_color_conversion_deinit(gsr_color_conversion *self);
 
 void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture, gsr_source_color source_color);
+/*
+    Same as |gsr_color_conversion_draw| except that the quad is only queued. The queued quads are drawn in order by |gsr_color_conversion_flush|,
+    with one vertex upload and one draw call per destination texture for quads after each other that use the same texture.
+    |gsr_color_conversion_flush| has to be called before the destination textures are used. It's called automatically when the queue is full.
+*/
+void gsr_color_conversion_draw_batched(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture, gsr_source_color source_color);
+void gsr_color_conversion_flush(gsr_color_conversion *self);
 void gsr_color_conversion_clear(gsr_color_conversion *self);
+/*
+    Limits the following draws to |regions| (in destination texture pixels), so that only the parts of the previous frame that changed are converted again.
+    Everything outside of the regions keeps the content of the previous frame. The regions replace the scissor box set by the caller, so they have to be inside of it.
+    Set |num_regions| to 0 to draw everything again. The regions are also removed by |gsr_color_conversion_clear|.
+*/
+void gsr_color_conversion_set_damage_regions(gsr_color_conversion *self, const gsr_rectangle *regions, int num_regions);
+/*
+    Only the part of the following draws that is inside of |clip| (in destination texture pixels) is drawn, for example to keep the cursor inside of the captured area.
+    Use this instead of a scissor box around batched draws since they are drawn later. Set |clip| to NULL to draw everywhere again.
+*/
+void gsr_color_conversion_set_clip(gsr_color_conversion *self, const gsr_rectangle *clip);
 
 #endif /* GSR_COLOR_CONVERSION_H */
@@ -6,6 +6,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define GSR_DAMAGE_MAX_REGIONS 16
+
 typedef struct _XDisplay Display;
 typedef union _XEvent XEvent;
 
@@ -19,6 +21,7 @@ typedef struct {
     gsr_egl *egl;
     Display *display;
     bool track_cursor;
+    bool track_regions;
     gsr_damage_track_type track_type;
 
     int damage_event;
@@ -26,6 +29,11 @@ typedef struct {
     uint64_t damage;
     bool damaged;
 
+    /* Damaged regions since the last |gsr_damage_clear|, relative to |window| */
+    gsr_rectangle regions[GSR_DAMAGE_MAX_REGIONS];
+    int num_regions;
+    bool regions_unknown;
+
     int randr_event;
     int randr_error;
 
@@ -38,7 +46,11 @@ typedef struct {
     char monitor_name[32];
 } gsr_damage;
 
-bool gsr_damage_init(gsr_damage *self, gsr_egl *egl, bool track_cursor);
+/*
+    If |track_regions| is false then the damaged regions are only fetched from the X server when they are needed to know if the monitor was damaged,
+    which saves a round trip per damage event. |gsr_damage_get_regions| then returns false when tracking a window.
+*/
+bool gsr_damage_init(gsr_damage *self, gsr_egl *egl, bool track_cursor, bool track_regions);
 void gsr_damage_deinit(gsr_damage *self);
 
 bool gsr_damage_set_target_window(gsr_damage *self, uint64_t window);
@@ -48,5 +60,15 @@ void gsr_damage_tick(gsr_damage *self);
 /* Also returns true if damage tracking is not available */
 bool gsr_damage_is_damaged(gsr_damage *self);
 void gsr_damage_clear(gsr_damage *self);
+/*
+    Returns false if the damaged regions are not known, in which case everything should be drawn again.
+    The regions are relative to the target window (the root window when tracking a monitor) and don't include cursor movement.
+*/
+bool gsr_damage_get_regions(gsr_damage *self, const gsr_rectangle **regions, int *num_regions);
+/*
+    Damage events arrive on the X11 connection so waiting on the connection fd is enough to wake up on damage,
+    but cursor movement is only detected in |gsr_damage_tick|. Returns true if |gsr_damage_tick| has to be called regularly for that.
+*/
+bool gsr_damage_needs_polling(gsr_damage *self);
 
 #endif /* GSR_DAMAGE_H */
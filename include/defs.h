@@ -6,7 +6,8 @@
 typedef enum {
     GSR_GPU_VENDOR_AMD,
     GSR_GPU_VENDOR_INTEL,
-    GSR_GPU_VENDOR_NVIDIA
+    GSR_GPU_VENDOR_NVIDIA,
+    GSR_GPU_VENDOR_SOFTWARE /* Software rendering (llvmpipe for example), only allowed when requested in |gsr_egl_load|. There is no gpu video encoding or gpu capture */
 } gsr_gpu_vendor;
 
 typedef struct {
@@ -125,6 +125,12 @@ typedef void(*__GLXextFuncPtr)(void);
 #define GL_FRAMEBUFFER_COMPLETE                 0x8CD5
 #define GL_DYNAMIC_DRAW                         0x88E8
 #define GL_ARRAY_BUFFER                         0x8892
+#define GL_PIXEL_PACK_BUFFER                    0x88EB
+#define GL_STREAM_READ                          0x88E1
+#define GL_READ_ONLY                            0x88B8
+#define GL_SYNC_GPU_COMMANDS_COMPLETE           0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT              0x00000001
+#define GL_WAIT_FAILED                          0x911D
 #define GL_BLEND                                0x0BE2
 #define GL_SRC_ALPHA                            0x0302
 #define GL_ONE_MINUS_SRC_ALPHA                  0x0303
@@ -149,6 +155,7 @@ typedef GLXContext (*FUNC_glXCreateContextAttribsARB)(Display *dpy, GLXFBConfig
 typedef void (*FUNC_glXSwapIntervalEXT)(Display * dpy, GLXDrawable drawable, int interval);
 typedef int (*FUNC_glXSwapIntervalMESA)(unsigned int interval);
 typedef int (*FUNC_glXSwapIntervalSGI)(int interval);
+typedef struct __GLsync *GLsync;
 typedef void (*GLDEBUGPROC)(unsigned int source, unsigned int type, unsigned int id, unsigned int severity, int length, const char *message, const void *userParam);
 typedef int (*FUNC_eglQueryDisplayAttribEXT)(EGLDisplay dpy, int32_t attribute, intptr_t *value);
 typedef const char* (*FUNC_eglQueryDeviceStringEXT)(void *device, int32_t name);
@@ -179,6 +186,7 @@ struct gsr_egl {
     gsr_gpu_info gpu_info;
 
     char card_path[128];
+    bool allow_software_renderer;
 
     int32_t (*eglGetError)(void);
     EGLDisplay (*eglGetDisplay)(EGLNativeDisplayType display_id);
@@ -275,9 +283,13 @@ struct gsr_egl {
     void (*glReadPixels)(int x, int y, int width, int height, unsigned int format, unsigned int type, void *pixels);
     void* (*glMapBuffer)(unsigned int target, unsigned int access);
     unsigned char (*glUnmapBuffer)(unsigned int target);
+    GLsync (*glFenceSync)(unsigned int condition, unsigned int flags);
+    unsigned int (*glClientWaitSync)(GLsync sync, unsigned int flags, uint64_t timeout);
+    void (*glDeleteSync)(GLsync sync);
 };
 
-bool gsr_egl_load(gsr_egl *self, gsr_window *window, bool is_monitor_capture, bool enable_debug);
+/* |allow_software_renderer| allows opengl without a gpu (llvmpipe for example), which only works with synthetic capture and the cpu encoder */
+bool gsr_egl_load(gsr_egl *self, gsr_window *window, bool is_monitor_capture, bool enable_debug, bool allow_software_renderer);
 void gsr_egl_unload(gsr_egl *self);
 
 /* Does opengl swap with egl or glx, depending on which one is active */
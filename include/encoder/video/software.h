@@ -3,13 +3,29 @@
 
 #include "video.h"
 
+#define GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS 3
+
 typedef struct gsr_egl gsr_egl;
+typedef struct AVDictionary AVDictionary;
 
 typedef struct {
     gsr_egl *egl;
     gsr_color_depth color_depth;
+    /*
+        Number of frames that are read back from the gpu at the same time, 1-GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS.
+        With 1 every frame waits for the gpu. With more the frames are delayed by num_readback_buffers-1 frames but the gpu isn't waited on.
+    */
+    int num_readback_buffers;
 } gsr_video_encoder_software_params;
 
 gsr_video_encoder* gsr_video_encoder_software_create(const gsr_video_encoder_software_params *params);
 
+/*
+    Sets the threads of |codec_context| and the codec options (preset, tune) that are used to encode on the cpu. The quality (qp or bitrate) and the profile are not set.
+    If |num_threads| is 0 then the number of threads is picked from the resolution and framerate of |codec_context|, which have to be set.
+    With |slice_threads| every frame is split between the threads (lower latency), otherwise the threads encode different frames.
+    Returns the number of threads.
+*/
+int gsr_video_encoder_software_set_codec_options(AVCodecContext *codec_context, int num_threads, bool slice_threads, AVDictionary **options);
+
 #endif /* GSR_ENCODER_VIDEO_SOFTWARE_H */
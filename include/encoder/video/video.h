@@ -10,7 +10,8 @@ typedef struct AVFrame AVFrame;
 
 struct gsr_video_encoder {
     bool (*start)(gsr_video_encoder *encoder, AVCodecContext *video_codec_context, AVFrame *frame);
-    void (*copy_textures_to_frame)(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion); /* Can be NULL */
+    bool (*copy_textures_to_frame)(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion); /* Can be NULL */
+    bool (*get_delayed_frame)(gsr_video_encoder *encoder, AVFrame *frame); /* Can be NULL */
     /* |textures| should be able to fit 2 elements */
     void (*get_textures)(gsr_video_encoder *encoder, unsigned int *textures, int *num_textures, gsr_destination_color *destination_color);
     void (*destroy)(gsr_video_encoder *encoder, AVCodecContext *video_codec_context);
@@ -20,7 +21,13 @@ struct gsr_video_encoder {
 };
 
 bool gsr_video_encoder_start(gsr_video_encoder *encoder, AVCodecContext *video_codec_context, AVFrame *frame);
-void gsr_video_encoder_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion);
+/*
+    Returns false if the encoder delays the frame and there is no frame to encode yet (the software encoder reads back the frames asynchronously).
+    A delayed frame keeps the pts that |frame| had when it was copied, set the pts before this call.
+*/
+bool gsr_video_encoder_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion);
+/* Sets |frame| to the oldest frame that is still delayed by the encoder, with its pts. Returns false if there are none. Call until it returns false at the end of the recording */
+bool gsr_video_encoder_get_delayed_frame(gsr_video_encoder *encoder, AVFrame *frame);
 void gsr_video_encoder_get_textures(gsr_video_encoder *encoder, unsigned int *textures, int *num_textures, gsr_destination_color *destination_color);
 void gsr_video_encoder_destroy(gsr_video_encoder *encoder, AVCodecContext *video_codec_context);
 
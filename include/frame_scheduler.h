@@ -0,0 +1,48 @@
+#ifndef GSR_FRAME_SCHEDULER_H
+#define GSR_FRAME_SCHEDULER_H
+
+#include <stdbool.h>
+
+#define GSR_FRAME_SCHEDULER_MAX_EVENT_FDS 8
+
+typedef enum {
+    GSR_FRAME_SCHEDULER_WAKE_DEADLINE,   /* The deadline was reached */
+    GSR_FRAME_SCHEDULER_WAKE_EVENT,      /* One of the event fds became readable */
+    GSR_FRAME_SCHEDULER_WAKE_INTERRUPTED /* Woken up with the wake fd (see gsr_frame_scheduler_get_wake_fd), or the wait failed */
+} gsr_frame_scheduler_wake_reason;
+
+/*
+    Sleeps until an absolute deadline on the monotonic clock (the clock of |clock_get_monotonic_seconds|) with a timerfd,
+    so the time spent in the main loop doesn't add up to the sleep time like it does with relative sleeps.
+    The wait can also be woken up early by event fds (for example the display server connection).
+*/
+typedef struct {
+    int timer_fd;
+    int wake_fd;
+    int event_fds[GSR_FRAME_SCHEDULER_MAX_EVENT_FDS];
+    int num_event_fds;
+} gsr_frame_scheduler;
+
+bool gsr_frame_scheduler_init(gsr_frame_scheduler *self);
+void gsr_frame_scheduler_deinit(gsr_frame_scheduler *self);
+
+/*
+    Writing a uint64_t to this eventfd wakes up the current or the next wait, also when it doesn't wake on events. The scheduler clears it.
+    write is async signal safe, so signal handlers can wake up the wait no matter which thread the signal is delivered to.
+*/
+int gsr_frame_scheduler_get_wake_fd(gsr_frame_scheduler *self);
+/* The fd is not read by the scheduler, the owner of the fd has to consume the event. The fd is not closed by the scheduler */
+bool gsr_frame_scheduler_add_event_fd(gsr_frame_scheduler *self, int fd);
+/* Waits until |deadline_seconds| or, if |wake_on_events| is true, until one of the event fds is readable. Returns immediately if the deadline has already passed */
+gsr_frame_scheduler_wake_reason gsr_frame_scheduler_wait(gsr_frame_scheduler *self, double deadline_seconds, bool wake_on_events);
+
+/*
+    When static frames are skipped (-skip-static-frames) nothing is captured or encoded while nothing changes, but the previous frame is encoded again once in a while
+    so that the video doesn't get very long frames and so that the last frame that changed gets out of the cpu encoder readback buffers.
+    Returns the time without changes after which the previous frame is encoded again, which is at least |frame_time_seconds|.
+*/
+double gsr_frame_scheduler_get_static_frame_repeat_interval(double frame_time_seconds);
+/* Returns true if the previous frame should be encoded again. |seconds_since_last_frame| is the time since a frame was last encoded */
+bool gsr_frame_scheduler_should_repeat_static_frame(bool changed, bool has_previous_frame, double seconds_since_last_frame, double frame_time_seconds);
+
+#endif /* GSR_FRAME_SCHEDULER_H */
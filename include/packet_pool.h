@@ -0,0 +1,54 @@
+#ifndef GSR_PACKET_POOL_H
+#define GSR_PACKET_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct AVPacket AVPacket;
+typedef struct AVCodecContext AVCodecContext;
+typedef struct AVBufferPool AVBufferPool;
+
+/* Payload sizes are rounded up to a power of two between 1 KiB and 32 MiB, larger payloads are not pooled */
+#define GSR_PACKET_POOL_NUM_PAYLOAD_SIZE_CLASSES 16
+
+/*
+    Reuses AVPacket objects and their payloads so that receiving and writing packets doesn't allocate once recording has started.
+    Packets are taken by the encoding threads and returned by the thread that is done with them (for example the packet writer thread),
+    so the pool is shared between the threads instead of being per thread. The mutex is only held to push or pop a pointer.
+*/
+typedef struct {
+    AVPacket **packets;
+    size_t capacity;
+    size_t num_packets;
+    pthread_mutex_t mutex;
+    uint64_t num_allocations;
+
+    AVBufferPool *payload_pools[GSR_PACKET_POOL_NUM_PAYLOAD_SIZE_CLASSES]; /* Thread safe */
+    uint64_t num_payload_allocations;
+} gsr_packet_pool;
+
+bool gsr_packet_pool_init(gsr_packet_pool *self, size_t capacity);
+/* All packets have to be returned before this is called */
+void gsr_packet_pool_deinit(gsr_packet_pool *self);
+
+/* Returns an empty packet, or NULL on failure. The packet has to be returned with |gsr_packet_pool_put| */
+AVPacket* gsr_packet_pool_get(gsr_packet_pool *self);
+/* Unrefs the packet and returns it to the pool. The packet is freed if the pool is full */
+void gsr_packet_pool_put(gsr_packet_pool *self, AVPacket *packet);
+
+/*
+    Makes the encoder allocate the packet payloads from the pool, if the encoder supports it (AV_CODEC_CAP_DR1). Otherwise the encoder allocates every payload itself.
+    Call this before the codec is opened.
+*/
+void gsr_packet_pool_set_payload_allocator(gsr_packet_pool *self, AVCodecContext *codec_context);
+/* Counts the payload of a packet that was received from |codec_context| as an allocation if the encoder allocated it itself. Can be called from any thread */
+void gsr_packet_pool_count_received_payload(gsr_packet_pool *self, const AVCodecContext *codec_context, const AVPacket *packet);
+
+/* The number of packets that have been allocated because the pool was empty. Can be called from any thread */
+uint64_t gsr_packet_pool_get_num_allocations(gsr_packet_pool *self);
+/* The number of packet payloads that have been allocated, by the pool or by encoders that don't use the pool. Can be called from any thread */
+uint64_t gsr_packet_pool_get_num_payload_allocations(gsr_packet_pool *self);
+
+#endif /* GSR_PACKET_POOL_H */
@@ -0,0 +1,71 @@
+#ifndef GSR_PACKET_QUEUE_H
+#define GSR_PACKET_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <semaphore.h>
+#include "packet_pool.h"
+
+typedef enum {
+    GSR_PACKET_QUEUE_FULL_BLOCK, /* Wait until the writer has made room for the packet */
+    GSR_PACKET_QUEUE_FULL_DROP   /* Drop the packet. Video packets are then dropped until the next video keyframe */
+} gsr_packet_queue_full_policy;
+
+typedef struct {
+    size_t sequence;
+    AVPacket *packet;
+} gsr_packet_queue_slot;
+
+/*
+    Bounded lock-free queue of packets with multiple producers (the encoders) and a single consumer (the writer thread).
+    All fields that are shared between threads are accessed with atomic builtins.
+*/
+typedef struct {
+    gsr_packet_queue_slot *slots;
+    size_t capacity; /* Power of two */
+    gsr_packet_queue_full_policy full_policy;
+    int video_stream_index;
+    gsr_packet_pool *packet_pool;
+    bool video_waiting_for_keyframe; /* Only accessed by the thread that pushes video packets */
+
+    size_t enqueue_pos;
+    size_t dequeue_pos;
+    sem_t num_packets_sem;
+    sem_t num_free_slots_sem; /* Pushing waits on this when the queue is full, instead of polling */
+    bool closed;
+
+    uint64_t num_packets_written; /* Counted with |gsr_packet_queue_count_written_packet| */
+    uint64_t num_packets_dropped;
+    size_t max_num_packets; /* The highest number of packets that have been waiting in the queue */
+} gsr_packet_queue;
+
+typedef struct {
+    size_t num_packets;
+    size_t max_num_packets;
+    uint64_t num_packets_written;
+    uint64_t num_packets_dropped;
+} gsr_packet_queue_stats;
+
+/* |capacity| is rounded up to a power of two. Dropped packets are returned to |packet_pool| */
+bool gsr_packet_queue_init(gsr_packet_queue *self, size_t capacity, gsr_packet_queue_full_policy full_policy, int video_stream_index, gsr_packet_pool *packet_pool);
+/* Returns the packets that are still in the queue to the packet pool */
+void gsr_packet_queue_deinit(gsr_packet_queue *self);
+
+/* Takes ownership of |packet|, it's returned to the packet pool if it's dropped. Returns false if the packet was dropped */
+bool gsr_packet_queue_push(gsr_packet_queue *self, AVPacket *packet);
+/*
+    Waits until there is a packet in the queue. Only one thread should call this. The caller has to return the packet to the packet pool.
+    Returns NULL when the queue has been closed and there are no more packets.
+*/
+AVPacket* gsr_packet_queue_pop(gsr_packet_queue *self);
+/* Should be called by the thread that pops the packets after a packet has been written successfully, for the stats */
+void gsr_packet_queue_count_written_packet(gsr_packet_queue *self);
+/* Makes |gsr_packet_queue_pop| return NULL once all packets have been popped. Nothing should be pushed after this */
+void gsr_packet_queue_close(gsr_packet_queue *self);
+
+size_t gsr_packet_queue_get_num_packets(gsr_packet_queue *self);
+/* Can be called from any thread */
+gsr_packet_queue_stats gsr_packet_queue_get_stats(gsr_packet_queue *self);
+
+#endif /* GSR_PACKET_QUEUE_H */
@@ -5,12 +5,15 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include "vec2.h"
+
 #include <spa/utils/hook.h>
 #include <spa/param/video/format.h>
 
 #define GSR_PIPEWIRE_VIDEO_MAX_MODIFIERS 1024
 #define GSR_PIPEWIRE_VIDEO_NUM_VIDEO_FORMATS 6
 #define GSR_PIPEWIRE_VIDEO_DMABUF_MAX_PLANES 4
+#define GSR_PIPEWIRE_VIDEO_MAX_DAMAGE_REGIONS 16
 
 typedef struct gsr_egl gsr_egl;
 
@@ -36,6 +39,13 @@ typedef struct {
     int width, height;
 } gsr_pipewire_video_region;
 
+/* Damage of the buffers received since the previous |gsr_pipewire_video_map_texture|, in buffer coordinates */
+typedef struct {
+    gsr_rectangle regions[GSR_PIPEWIRE_VIDEO_MAX_DAMAGE_REGIONS];
+    int num_regions;
+    bool full; /* The damage is not known (the compositor doesn't send damage metadata), everything has to be redrawn */
+} gsr_pipewire_video_damage;
+
 typedef struct {
     enum spa_video_format format;
     size_t modifiers_index;
@@ -66,6 +76,8 @@ typedef struct {
     int server_version_sync;
     bool negotiated;
     bool damaged;
+    int damage_event_fd; /* eventfd that is readable while |damaged| is true */
+    gsr_pipewire_video_damage damage;
 
     struct {
         bool visible;
@@ -104,9 +116,11 @@ typedef struct {
 bool gsr_pipewire_video_init(gsr_pipewire_video *self, int pipewire_fd, uint32_t pipewire_node, int fps, bool capture_cursor, gsr_egl *egl);
 void gsr_pipewire_video_deinit(gsr_pipewire_video *self);
 
-/* |dmabuf_data| should be at least GSR_PIPEWIRE_VIDEO_DMABUF_MAX_PLANES in size */
-bool gsr_pipewire_video_map_texture(gsr_pipewire_video *self, gsr_texture_map texture_map, gsr_pipewire_video_region *region, gsr_pipewire_video_region *cursor_region, gsr_pipewire_video_dmabuf_data *dmabuf_data, int *num_dmabuf_data, uint32_t *fourcc, uint64_t *modifiers, bool *using_external_image);
+/* |dmabuf_data| should be at least GSR_PIPEWIRE_VIDEO_DMABUF_MAX_PLANES in size. |damage| is set to the damage since the previous call */
+bool gsr_pipewire_video_map_texture(gsr_pipewire_video *self, gsr_texture_map texture_map, gsr_pipewire_video_region *region, gsr_pipewire_video_region *cursor_region, gsr_pipewire_video_damage *damage, gsr_pipewire_video_dmabuf_data *dmabuf_data, int *num_dmabuf_data, uint32_t *fourcc, uint64_t *modifiers, bool *using_external_image);
 bool gsr_pipewire_video_is_damaged(gsr_pipewire_video *self);
 void gsr_pipewire_video_clear_damage(gsr_pipewire_video *self);
+/* Returns an fd that becomes readable when a new frame arrives, until |gsr_pipewire_video_clear_damage| is called */
+int gsr_pipewire_video_get_damage_fd(gsr_pipewire_video *self);
 
 #endif /* GSR_PIPEWIRE_VIDEO_H */
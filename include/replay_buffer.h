@@ -0,0 +1,130 @@
+#ifndef GSR_REPLAY_BUFFER_H
+#define GSR_REPLAY_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct AVPacket AVPacket;
+
+/* Packets larger than this get a slab of their own that is not recycled */
+#define GSR_REPLAY_BUFFER_SLAB_SIZE (4 * 1024 * 1024)
+
+typedef enum {
+    GSR_REPLAY_STORAGE_RAM,
+    GSR_REPLAY_STORAGE_DISK /* Packet data is stored in a memory mapped file. The packet index is still stored in RAM */
+} gsr_replay_storage;
+
+typedef struct {
+    int64_t pts;
+    double timestamp; /* In the same clock as the timestamp given to |gsr_replay_buffer_append| */
+    uint32_t offset; /* Offset to the packet data in the slab */
+    uint32_t size;
+    int stream_index;
+    int flags;
+} gsr_replay_packet;
+
+/*
+    A slab is a chunk of packet data together with the index of the packets stored in it.
+    A slab that is referenced (by a replay that is being saved) is immutable, new packets go to the next slab.
+*/
+typedef struct {
+    uint8_t *data;
+    size_t data_size;
+    size_t data_capacity;
+    off_t file_offset; /* -1 if |data| is not mapped from the storage file */
+
+    gsr_replay_packet *packets;
+    size_t num_packets;
+    size_t packets_capacity;
+    uint64_t first_packet_seq; /* Sequence number of packets[0], every appended packet gets the next sequence number */
+
+    int refcount;
+    bool detached; /* Evicted while it was still referenced. It's recycled when the last reference is removed */
+} gsr_replay_slab;
+
+typedef struct {
+    uint64_t packet_seq;
+    double timestamp;
+} gsr_replay_keyframe;
+
+typedef struct {
+    gsr_replay_storage storage;
+    int storage_fd; /* Only valid for GSR_REPLAY_STORAGE_DISK. The file is unlinked after it's created */
+    off_t storage_file_size;
+    off_t *free_file_offsets; /* Regions in the storage file that are not used by any slab */
+    size_t free_file_offsets_capacity;
+    size_t num_free_file_offsets;
+
+    size_t max_bytes; /* Limit for the slab data, including jumbo slabs. 0 means that the size is only limited by |max_duration_seconds| */
+    double max_duration_seconds;
+
+    gsr_replay_slab **slabs; /* Ring buffer, oldest slab first */
+    size_t slabs_capacity;
+    size_t slabs_head;
+    size_t num_slabs;
+    size_t slabs_bytes; /* Data capacity of the slabs in |slabs| */
+    size_t first_packet_index; /* Index of the oldest packet that hasn't been evicted in the oldest slab */
+
+    gsr_replay_slab **free_slabs;
+    size_t free_slabs_capacity;
+    size_t num_free_slabs;
+    size_t num_allocated_bytes; /* Data capacity of every slab that hasn't been destroyed, including free and detached slabs */
+
+    int video_stream_index;
+    gsr_replay_keyframe *keyframes; /* Ring buffer of the video keyframes that haven't been evicted, oldest keyframe first */
+    size_t keyframes_capacity;
+    size_t keyframes_head;
+    size_t num_keyframes;
+    uint64_t next_packet_seq;
+
+    size_t num_packets; /* Modified with atomic builtins so that it can be read without locking the replay buffer */
+    size_t num_bytes; /* Modified with atomic builtins so that it can be read without locking the replay buffer */
+    bool packets_erased;
+} gsr_replay_buffer;
+
+/*
+    A range of packets in the replay buffer. The slabs are referenced so the packets can be read without locking the replay buffer,
+    until the snapshot is released.
+*/
+typedef struct {
+    gsr_replay_slab **slabs;
+    size_t num_slabs;
+    size_t first_packet_index; /* Index of the first packet in slabs[0] */
+    bool starts_at_keyframe; /* If this is false then the snapshot starts at the first packet that was added to the replay buffer, which might be an audio packet */
+} gsr_replay_snapshot;
+
+/*
+    |storage_dir| is the directory where the storage file is created when |storage| is GSR_REPLAY_STORAGE_DISK, it's ignored otherwise.
+    |max_bytes| can be 0, in which case the size is only limited by |max_duration_seconds|. Otherwise it has to be at least 2 * GSR_REPLAY_BUFFER_SLAB_SIZE.
+    The limit can only be exceeded by slabs that are referenced by a snapshot after they have been evicted, and by a single packet that is larger than |max_bytes|.
+*/
+bool gsr_replay_buffer_init(gsr_replay_buffer *self, gsr_replay_storage storage, const char *storage_dir, size_t max_bytes, double max_duration_seconds, int video_stream_index);
+/* Every snapshot has to be released before this is called */
+void gsr_replay_buffer_deinit(gsr_replay_buffer *self);
+
+/*
+    Copies the packet data into the replay buffer. Packets that are older than |max_duration_seconds| compared to |timestamp| are evicted
+    and if the replay buffer is full then the oldest slab is evicted.
+*/
+bool gsr_replay_buffer_append(gsr_replay_buffer *self, const AVPacket *av_packet, double timestamp);
+
+/*
+    Takes a snapshot of the packets in the replay buffer, starting at the video keyframe that is closest before |start_timestamp|,
+    or the oldest video keyframe if there is no keyframe before |start_timestamp| (for example 0). This doesn't copy any packets.
+    Returns false if there is no video keyframe in the replay buffer, in which case the snapshot doesn't have to be released.
+*/
+bool gsr_replay_buffer_snapshot(gsr_replay_buffer *self, double start_timestamp, gsr_replay_snapshot *snapshot);
+void gsr_replay_buffer_snapshot_release(gsr_replay_buffer *self, gsr_replay_snapshot *snapshot);
+
+/* |index| 0 is the oldest slab */
+gsr_replay_slab* gsr_replay_buffer_get_slab(gsr_replay_buffer *self, size_t index);
+void gsr_replay_buffer_ref_slab(gsr_replay_buffer *self, gsr_replay_slab *slab);
+void gsr_replay_buffer_unref_slab(gsr_replay_buffer *self, gsr_replay_slab *slab);
+
+/* These can be called from any thread without locking the replay buffer, for example to report stats */
+size_t gsr_replay_buffer_get_num_packets(gsr_replay_buffer *self);
+size_t gsr_replay_buffer_get_num_bytes(gsr_replay_buffer *self);
+
+#endif /* GSR_REPLAY_BUFFER_H */
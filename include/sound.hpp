@@ -21,6 +21,10 @@
 #include <vector>
 #include <string>
 
+typedef struct {
+    void *handle;
+} SoundMainloop;
+
 typedef struct {
     void *handle;
     unsigned int frames;
@@ -59,19 +63,32 @@ typedef enum {
     F32
 } AudioFormat;
 
+/*
+    All sound devices are created with a mainloop and the sound devices that share a mainloop have to be read from the same thread.
+    Returns 0 on success, or a negative value on failure.
+*/
+int sound_mainloop_create(SoundMainloop *mainloop);
+/* All sound devices created with the mainloop have to be closed before this is called */
+void sound_mainloop_destroy(SoundMainloop *mainloop);
+/*
+    Waits until there is new data for one of the sound devices or until |timeout_sec| has passed.
+    Returns 0 on success, or a negative value on failure.
+*/
+int sound_mainloop_wait(SoundMainloop *mainloop, double timeout_sec);
+
 /*
     Get a sound device by name, returning the device into the |device| parameter.
     Returns 0 on success, or a negative value on failure.
 */
-int sound_device_get_by_name(SoundDevice *device, const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format);
+int sound_device_get_by_name(SoundDevice *device, SoundMainloop *mainloop, const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format);
 
 void sound_device_close(SoundDevice *device);
 
 /*
-    Returns the next chunk of audio into @buffer.
-    Returns the number of frames read, or a negative value on failure.
+    Returns the next chunk of audio into @buffer. This doesn't block, use |sound_mainloop_wait| to wait for more data.
+    Returns the number of frames read, 0 if there isn't a whole chunk of audio available yet, or a negative value on failure.
 */
-int sound_device_read_next_chunk(SoundDevice *device, void **buffer, double timeout_sec, double *latency_seconds);
+int sound_device_read_next_chunk(SoundDevice *device, void **buffer, double *latency_seconds);
 
 AudioDevices get_pulseaudio_inputs();
 bool pulseaudio_server_is_pipewire();
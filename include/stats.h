@@ -0,0 +1,78 @@
+#ifndef GSR_STATS_H
+#define GSR_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Timings above this number of samples per report interval are only included in the count and max, not in the percentiles */
+#define GSR_STATS_MAX_TIMING_SAMPLES 1024
+
+/* Counters are reset after every report */
+typedef enum {
+    GSR_STATS_COUNTER_FRAMES_CAPTURED,
+    GSR_STATS_COUNTER_FRAME_DEADLINE_MISSED, /* Main loop iterations that took longer than the frame time */
+    GSR_STATS_COUNTER_PACKETS_WRITTEN,       /* Packets written to the output file/stream or to a saved replay */
+    GSR_STATS_COUNTER_BYTES_WRITTEN,
+    GSR_STATS_COUNTER_AUDIO_UNDERRUNS,       /* Times an audio device didn't provide audio in time and frames had to be added */
+    GSR_STATS_COUNTER_AUDIO_SILENCE_FILLS,   /* Audio frames of silence added for audio devices that didn't provide audio in time */
+    GSR_STATS_COUNTER_STATIC_FRAMES_REPEATED, /* Frames that were encoded again without being captured, with -skip-static-frames */
+    GSR_STATS_NUM_COUNTERS
+} gsr_stats_counter;
+
+typedef enum {
+    GSR_STATS_TIMING_CAPTURE,
+    GSR_STATS_TIMING_COLOR_CONVERSION,
+    GSR_STATS_TIMING_READBACK,
+    GSR_STATS_TIMING_ENCODER_SUBMIT,
+    GSR_STATS_TIMING_WRITE_OUTPUT_MUTEX_WAIT,
+    GSR_STATS_TIMING_PACING_JITTER, /* How late the main loop woke up after waiting for a frame deadline */
+    GSR_STATS_NUM_TIMINGS
+} gsr_stats_timing;
+
+typedef struct {
+    double samples[GSR_STATS_MAX_TIMING_SAMPLES]; /* In seconds */
+    int num_samples;
+    uint64_t count;
+    double max;
+} gsr_stats_timing_samples;
+
+/* Values that are sampled at the time of the report instead of being counted */
+typedef struct {
+    int update_fps;
+    int damage_fps;
+    size_t packet_queue_packets;
+    uint64_t packet_queue_dropped;
+    size_t replay_buffer_bytes;
+    size_t replay_buffer_packets;
+} gsr_stats_gauges;
+
+/*
+    Writes a json object per line with the counters, timing percentiles (in microseconds) and gauges since the last report,
+    to a fifo, a unix domain socket or a regular file. A fifo is created if the path doesn't exist.
+    The output is never waited on: a report is dropped if the fifo/socket is full or if nobody is reading it, and the fifo/socket is reopened on the next report.
+    Counters and timings can be added from any thread.
+*/
+typedef struct {
+    bool enabled;
+    char *path;
+    int fd;
+    double last_report_time;
+
+    uint64_t counters[GSR_STATS_NUM_COUNTERS];
+    pthread_mutex_t timings_mutex;
+    gsr_stats_timing_samples *timings; /* GSR_STATS_NUM_TIMINGS */
+    gsr_stats_timing_samples *report_timings; /* GSR_STATS_NUM_TIMINGS. Copy of |timings| that is sorted when reporting */
+} gsr_stats;
+
+/* |path| can be NULL, in which case the stats are disabled and the functions below do nothing */
+bool gsr_stats_init(gsr_stats *self, const char *path);
+void gsr_stats_deinit(gsr_stats *self);
+
+void gsr_stats_add_counter(gsr_stats *self, gsr_stats_counter counter, uint64_t value);
+void gsr_stats_add_timing(gsr_stats *self, gsr_stats_timing timing, double seconds);
+/* Should be called about once per second */
+void gsr_stats_report(gsr_stats *self, const gsr_stats_gauges *gauges);
+
+#endif /* GSR_STATS_H */
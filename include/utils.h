@@ -20,6 +20,7 @@ typedef struct {
     uint32_t connector_id; /* Only on x11 and drm */
     gsr_monitor_rotation rotation; /* Only on x11 and wayland */
     uint32_t monitor_identifier; /* On x11 this is the crtc id */
+    int scale; /* Only on wayland, where the position is in logical (scaled) coordinates and the size is in pixels. 1 otherwise */
 } gsr_monitor;
 
 typedef struct {
@@ -44,6 +45,10 @@ void for_each_active_monitor_output_x11_not_cached(Display *display, active_moni
 void for_each_active_monitor_output(const gsr_window *window, const char *card_path, gsr_connection_type connection_type, active_monitor_callback callback, void *userdata);
 bool get_monitor_by_name(const gsr_egl *egl, gsr_connection_type connection_type, const char *name, gsr_monitor *monitor);
 gsr_monitor_rotation drm_monitor_get_display_server_rotation(const gsr_window *window, const gsr_monitor *monitor);
+/* Returns the position of the monitor in the display server (the drm position if the monitor is not found), which is where the monitor is in the desktop on wayland */
+vec2i drm_monitor_get_display_server_position(const gsr_window *window, const gsr_monitor *monitor);
+/* Returns the scale of the monitor in the display server, 1 if the monitor is not scaled or not found */
+int drm_monitor_get_display_server_scale(const gsr_window *window, const gsr_monitor *monitor);
 
 int get_connector_type_by_name(const char *name);
 drm_connector_type_count* drm_connector_types_get_index(drm_connector_type_count *type_counts, int *num_type_counts, int connector_type);
@@ -68,4 +73,15 @@ bool vaapi_copy_egl_image_to_video_surface(gsr_egl *egl, EGLImage image, vec2i s
 
 vec2i scale_keep_aspect_ratio(vec2i from, vec2i to);
 
+bool gsr_rectangle_is_empty(gsr_rectangle rect);
+/* Returns an empty rectangle if they don't intersect */
+gsr_rectangle gsr_rectangle_intersection(gsr_rectangle rect1, gsr_rectangle rect2);
+/* Adds |rect| to |rects|, which has space for |max_rects|. When |rects| is full they are all merged into one rectangle that covers all of them */
+void gsr_rectangle_list_add(gsr_rectangle *rects, int *num_rects, int max_rects, gsr_rectangle rect);
+/*
+    Maps |rect| in a source of |source_size| to where it ends up when the source is drawn scaled to |dest_pos|+|dest_size|.
+    The result is grown by |padding| pixels (for texture filtering when scaling) and clamped to the destination area.
+*/
+gsr_rectangle gsr_rectangle_map_to_area(gsr_rectangle rect, vec2i source_size, vec2i dest_pos, vec2i dest_size, int padding);
+
 #endif /* GSR_UTILS_H */
@@ -13,4 +13,9 @@ typedef struct {
     double x, y;
 } vec2d;
 
+typedef struct {
+    vec2i pos;
+    vec2i size;
+} gsr_rectangle;
+
 #endif /* VEC2_H */
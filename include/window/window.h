@@ -16,6 +16,10 @@ struct gsr_window {
     void (*destroy)(gsr_window *self);
     /* Returns true if an event is available */
     bool (*process_event)(gsr_window *self);
+    /* The fd becomes readable when new events arrive from the display server. Returns -1 if there is no such fd */
+    int (*get_event_fd)(gsr_window *self);
+    /* Flushes pending requests and returns true if events have already been read from the fd but not processed, in which case waiting on the fd could miss them */
+    bool (*has_queued_events)(gsr_window *self);
     XEvent* (*get_event_data)(gsr_window *self); /* can be NULL */
     gsr_display_server (*get_display_server)(void);
     void* (*get_display)(gsr_window *self);
@@ -29,6 +33,8 @@ void gsr_window_destroy(gsr_window *self);
 /* Returns true if an event is available */
 bool gsr_window_process_event(gsr_window *self);
 XEvent* gsr_window_get_event_data(gsr_window *self);
+int gsr_window_get_event_fd(gsr_window *self);
+bool gsr_window_has_queued_events(gsr_window *self);
 gsr_display_server gsr_window_get_display_server(const gsr_window *self);
 void* gsr_window_get_display(gsr_window *self);
 void* gsr_window_get_window(gsr_window *self);
@@ -13,6 +13,7 @@
 #include <sys/wait.h>
 #include <poll.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/capability.h>
 
 #define GSR_SOCKET_PAIR_LOCAL  0
@@ -65,7 +66,9 @@ static int send_msg_to_server(int server_fd, gsr_kms_request *request) {
     return sendmsg(server_fd, &response_message, 0);
 }
 
-static int recv_msg_from_server(int server_pid, int server_fd, gsr_kms_response *response) {
+/* |fds| has to be able to hold GSR_KMS_MAX_ITEMS * GSR_KMS_MAX_DMA_BUFS fds */
+static int recv_msg_with_fds_from_server(int server_pid, int server_fd, gsr_kms_response *response, int *fds, int *num_fds) {
+    *num_fds = 0;
     struct iovec iov;
     iov.iov_base = response;
     iov.iov_len = sizeof(*response);
@@ -98,22 +101,36 @@ static int recv_msg_from_server(int server_pid, int server_fd, gsr_kms_response
         }
     }
 
-    if(res > 0 && response->num_items > 0) {
+    if(res > 0) {
         struct cmsghdr *cmsg = CMSG_FIRSTHDR(&response_message);
-        if(cmsg) {
-            int *fds = (int*)CMSG_DATA(cmsg);
-            int fd_index = 0;
-            for(int i = 0; i < response->num_items; ++i) {
-                for(int j = 0; j < response->items[i].num_dma_bufs; ++j) {
-                    gsr_kms_response_dma_buf *dma_buf = &response->items[i].dma_buf[j];
-                    dma_buf->fd = fds[fd_index++];
-                }
-            }
-        } else {
-            close_fds(response);
+        if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *num_fds);
+        }
+    }
+
+    return res;
+}
+
+static int recv_msg_from_server(int server_pid, int server_fd, gsr_kms_response *response) {
+    int fds[GSR_KMS_MAX_ITEMS * GSR_KMS_MAX_DMA_BUFS];
+    int num_fds = 0;
+    const int res = recv_msg_with_fds_from_server(server_pid, server_fd, response, fds, &num_fds);
+    if(res <= 0)
+        return res;
+
+    int fd_index = 0;
+    for(int i = 0; i < response->num_items; ++i) {
+        for(int j = 0; j < response->items[i].num_dma_bufs; ++j) {
+            gsr_kms_response_dma_buf *dma_buf = &response->items[i].dma_buf[j];
+            dma_buf->fd = (response->items[i].dma_buf_cached || fd_index >= num_fds) ? -1 : fds[fd_index++];
         }
     }
 
+    for(; fd_index < num_fds; ++fd_index) {
+        close(fds[fd_index]);
+    }
+
     return res;
 }
 
@@ -211,6 +228,11 @@ int gsr_kms_client_init(gsr_kms_client *self, const char *card_path) {
     self->initial_socket_path[0] = '\0';
     self->socket_pair[0] = -1;
     self->socket_pair[1] = -1;
+    self->reset_framebuffer_cache = true;
+    self->shared_state = NULL;
+    self->update_event_fd = -1;
+    self->num_framebuffer_updates_received = 0;
+    self->last_read_sequence = 0;
     struct sockaddr_un local_addr = {0};
     struct sockaddr_un remote_addr = {0};
 
@@ -269,7 +291,8 @@ int gsr_kms_client_init(gsr_kms_client *self, const char *card_path) {
         }
     }
 
-    if(socketpair(AF_UNIX, SOCK_STREAM, 0, self->socket_pair) == -1) {
+    /* Seqpacket so that a message is either sent whole or not at all. The server pushes framebuffer updates without blocking in subscription mode */
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, self->socket_pair) == -1) {
         fprintf(stderr, "gsr error: gsr_kms_client_init: socketpair failed, error: %s\n", strerror(errno));
         goto err;
     }
@@ -399,6 +422,16 @@ void cleanup_socket(gsr_kms_client *self, bool kill_server) {
 }
 
 void gsr_kms_client_deinit(gsr_kms_client *self) {
+    if(self->shared_state) {
+        munmap(self->shared_state, sizeof(gsr_kms_shared_state));
+        self->shared_state = NULL;
+    }
+
+    if(self->update_event_fd > 0) {
+        close(self->update_event_fd);
+        self->update_event_fd = -1;
+    }
+
     cleanup_socket(self, true);
 }
 
@@ -412,6 +445,7 @@ int gsr_kms_client_replace_connection(gsr_kms_client *self) {
     request.version = GSR_KMS_PROTOCOL_VERSION;
     request.type = KMS_REQUEST_TYPE_REPLACE_CONNECTION;
     request.new_connection_fd = self->socket_pair[GSR_SOCKET_PAIR_REMOTE];
+    request.reset_framebuffer_cache = false;
     if(send_msg_to_server(self->initial_client_fd, &request) == -1) {
         fprintf(stderr, "gsr error: gsr_kms_client_replace_connection: failed to send request message to server\n");
         return -1;
@@ -439,11 +473,17 @@ int gsr_kms_client_get_kms(gsr_kms_client *self, gsr_kms_response *response) {
     response->version = 0;
     response->result = KMS_RESULT_FAILED_TO_SEND;
     response->err_msg[0] = '\0';
+    response->num_items = 0;
+    response->num_removed_fb_ids = 0;
+    response->framebuffer_cache_cleared = false;
 
     gsr_kms_request request;
     request.version = GSR_KMS_PROTOCOL_VERSION;
     request.type = KMS_REQUEST_TYPE_GET_KMS;
     request.new_connection_fd = 0;
+    request.reset_framebuffer_cache = self->reset_framebuffer_cache;
+    /* If the request or response is lost then it's not known which framebuffers the server thinks we have */
+    self->reset_framebuffer_cache = true;
     if(send_msg_to_server(self->socket_pair[GSR_SOCKET_PAIR_LOCAL], &request) == -1) {
         fprintf(stderr, "gsr error: gsr_kms_client_get_kms: failed to send request message to server\n");
         strcpy(response->err_msg, "failed to send");
@@ -468,5 +508,160 @@ int gsr_kms_client_get_kms(gsr_kms_client *self, gsr_kms_response *response) {
         return -1;
     }
 
+    self->reset_framebuffer_cache = false;
     return 0;
 }
+
+static int gsr_kms_client_send_subscribe_request(gsr_kms_client *self, int update_rate, bool reset_framebuffer_cache) {
+    gsr_kms_request request;
+    request.version = GSR_KMS_PROTOCOL_VERSION;
+    request.type = KMS_REQUEST_TYPE_SUBSCRIBE;
+    request.new_connection_fd = 0;
+    request.reset_framebuffer_cache = reset_framebuffer_cache;
+    request.update_rate = update_rate;
+    return send_msg_to_server(self->socket_pair[GSR_SOCKET_PAIR_LOCAL], &request);
+}
+
+void gsr_kms_client_reset_framebuffer_cache(gsr_kms_client *self) {
+    if(self->shared_state) {
+        if(gsr_kms_client_send_subscribe_request(self, self->update_rate, true) == -1)
+            fprintf(stderr, "gsr error: gsr_kms_client_reset_framebuffer_cache: failed to send request message to server\n");
+    } else {
+        self->reset_framebuffer_cache = true;
+    }
+}
+
+int gsr_kms_client_subscribe(gsr_kms_client *self, int update_rate) {
+    if(gsr_kms_client_send_subscribe_request(self, update_rate, true) == -1) {
+        fprintf(stderr, "gsr error: gsr_kms_client_subscribe: failed to send request message to server\n");
+        return -1;
+    }
+
+    gsr_kms_response response;
+    response.version = 0;
+    response.result = KMS_RESULT_FAILED_TO_SEND;
+    response.err_msg[0] = '\0';
+    response.num_items = 0;
+
+    int fds[GSR_KMS_MAX_ITEMS * GSR_KMS_MAX_DMA_BUFS];
+    int num_fds = 0;
+    const int recv_res = recv_msg_with_fds_from_server(self->kms_server_pid, self->socket_pair[GSR_SOCKET_PAIR_LOCAL], &response, fds, &num_fds);
+    if(recv_res <= 0) {
+        fprintf(stderr, "gsr error: gsr_kms_client_subscribe: failed to receive response\n");
+        return -1;
+    }
+
+    int result = -1;
+    if(response.version != GSR_KMS_PROTOCOL_VERSION) {
+        fprintf(stderr, "gsr error: gsr_kms_client_subscribe: expected gsr-kms-server protocol version to be %u, but it's %u. please reinstall gpu screen recorder\n", GSR_KMS_PROTOCOL_VERSION, response.version);
+        goto done;
+    }
+
+    if(response.result != KMS_RESULT_OK || num_fds != 2) {
+        fprintf(stderr, "gsr error: gsr_kms_client_subscribe: failed to subscribe, error: %d (%s)\n", response.result, response.err_msg);
+        goto done;
+    }
+
+    gsr_kms_shared_state *shared_state = mmap(NULL, sizeof(gsr_kms_shared_state), PROT_READ, MAP_SHARED, fds[0], 0);
+    if(shared_state == MAP_FAILED) {
+        fprintf(stderr, "gsr error: gsr_kms_client_subscribe: mmap failed, error: %s\n", strerror(errno));
+        goto done;
+    }
+
+    self->shared_state = shared_state;
+    self->update_event_fd = fds[1];
+    fds[1] = -1;
+    self->update_rate = update_rate;
+    self->num_framebuffer_updates_received = 0;
+    self->last_read_sequence = 0;
+
+    /* The server writes the first state right after the response. The update event is not cleared, it's cleared when the state is captured */
+    struct pollfd poll_fd = { .fd = self->update_event_fd, .events = POLLIN, .revents = 0 };
+    if(poll(&poll_fd, 1, 1000) <= 0)
+        fprintf(stderr, "gsr warning: gsr_kms_client_subscribe: the kms server didn't write the plane state in time\n");
+    result = 0;
+
+    done:
+    /* The shared memory stays mapped after the memfd is closed */
+    for(int i = 0; i < num_fds; ++i) {
+        if(fds[i] > 0)
+            close(fds[i]);
+    }
+    return result;
+}
+
+/* Returns 1 if a framebuffer update was received, 0 if the server hasn't sent it and -1 on error */
+static int gsr_kms_client_recv_framebuffer_update(gsr_kms_client *self, gsr_kms_response *response) {
+    const int recv_res = recv_msg_from_server(self->kms_server_pid, self->socket_pair[GSR_SOCKET_PAIR_LOCAL], response);
+    if(recv_res == 0) {
+        fprintf(stderr, "gsr warning: gsr_kms_client_get_framebuffer_update: kms server shut down\n");
+        return -1;
+    } else if(recv_res == -1) {
+        fprintf(stderr, "gsr error: gsr_kms_client_get_framebuffer_update: failed to receive framebuffers\n");
+        return -1;
+    }
+
+    if(response->version != GSR_KMS_PROTOCOL_VERSION) {
+        fprintf(stderr, "gsr error: gsr_kms_client_get_framebuffer_update: expected gsr-kms-server protocol version to be %u, but it's %u. please reinstall gpu screen recorder\n", GSR_KMS_PROTOCOL_VERSION, response->version);
+        close_fds(response);
+        return -1;
+    }
+
+    ++self->num_framebuffer_updates_received;
+    return 1;
+}
+
+bool gsr_kms_client_get_state(gsr_kms_client *self, gsr_kms_response *state, uint32_t *num_framebuffer_updates) {
+    if(!self->shared_state)
+        return false;
+
+    /* The server only holds the seqlock for the time it takes to copy the state */
+    for(int attempt = 0; attempt < 10000; ++attempt) {
+        const uint32_t sequence = __atomic_load_n(&self->shared_state->sequence, __ATOMIC_ACQUIRE);
+        if(sequence == 0)
+            return false;
+
+        if(sequence & 1)
+            continue;
+
+        *num_framebuffer_updates = self->shared_state->num_framebuffer_updates;
+        *state = self->shared_state->state;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&self->shared_state->sequence, __ATOMIC_RELAXED) == sequence) {
+            self->last_read_sequence = sequence;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "gsr error: gsr_kms_client_get_state: failed to read the state\n");
+    return false;
+}
+
+int gsr_kms_client_get_framebuffer_update(gsr_kms_client *self, uint32_t num_framebuffer_updates, gsr_kms_response *response) {
+    /* The server sends the framebuffers before it writes the state that uses them, so they are already in the socket */
+    if((int32_t)(num_framebuffer_updates - self->num_framebuffer_updates_received) <= 0)
+        return 0;
+    return gsr_kms_client_recv_framebuffer_update(self, response);
+}
+
+uint32_t gsr_kms_client_get_num_framebuffer_updates(gsr_kms_client *self) {
+    if(!self->shared_state)
+        return 0;
+    return __atomic_load_n(&self->shared_state->num_framebuffer_updates, __ATOMIC_ACQUIRE);
+}
+
+bool gsr_kms_client_has_new_state(gsr_kms_client *self) {
+    return self->shared_state && __atomic_load_n(&self->shared_state->sequence, __ATOMIC_ACQUIRE) != self->last_read_sequence;
+}
+
+int gsr_kms_client_get_update_fd(gsr_kms_client *self) {
+    return self->update_event_fd > 0 ? self->update_event_fd : -1;
+}
+
+void gsr_kms_client_clear_update_event(gsr_kms_client *self) {
+    if(self->update_event_fd <= 0)
+        return;
+
+    uint64_t value = 0;
+    if(read(self->update_event_fd, &value, sizeof(value)) != sizeof(value)) {}
+}
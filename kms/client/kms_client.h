@@ -4,6 +4,7 @@
 #include "../kms_shared.h"
 #include <sys/types.h>
 #include <limits.h>
+#include <stdbool.h>
 
 typedef struct gsr_kms_client gsr_kms_client;
 
@@ -13,12 +14,51 @@ struct gsr_kms_client {
     int initial_client_fd;
     char initial_socket_path[PATH_MAX];
     int socket_pair[2];
+    bool reset_framebuffer_cache;
+
+    /* Subscription mode, see gsr_kms_shared_state */
+    gsr_kms_shared_state *shared_state; /* NULL if not subscribed */
+    int update_event_fd;
+    int update_rate;
+    uint32_t num_framebuffer_updates_received;
+    uint32_t last_read_sequence;
 };
 
 /* |card_path| should be a path to card, for example /dev/dri/card0 */
 int gsr_kms_client_init(gsr_kms_client *self, const char *card_path);
 void gsr_kms_client_deinit(gsr_kms_client *self);
 
+/*
+    The dma buf fds of a framebuffer are only in the response the first time the framebuffer is received (see gsr_kms_response_item).
+    The caller takes ownership of the fds. The framebuffers have to be kept until they are removed in a response (|removed_fb_ids| and |framebuffer_cache_cleared|).
+    All framebuffers are cleared in the first response and in the response after a failed call.
+*/
 int gsr_kms_client_get_kms(gsr_kms_client *self, gsr_kms_response *response);
+/* Makes the server clear its framebuffer cache and send the dma buf fds of every framebuffer again in the next response, for example if the caller lost a framebuffer */
+void gsr_kms_client_reset_framebuffer_cache(gsr_kms_client *self);
+
+/*
+    Makes the server check the planes |update_rate| times per second and push the state when it changes, instead of using gsr_kms_client_get_kms.
+    The first state has all framebuffers. Returns 0 on success.
+*/
+int gsr_kms_client_subscribe(gsr_kms_client *self, int update_rate);
+/*
+    Copies the latest state that the server has pushed, without a request to the server. The dma buf fds in |state| are -1.
+    The framebuffer updates up to |num_framebuffer_updates| have to be received with gsr_kms_client_get_framebuffer_update to get the dma buf fds of the framebuffers in the state.
+    Returns false if not subscribed or if there is no state yet.
+*/
+bool gsr_kms_client_get_state(gsr_kms_client *self, gsr_kms_response *state, uint32_t *num_framebuffer_updates);
+/*
+    Receives the next framebuffer update that is needed for the state, in the same format as gsr_kms_client_get_kms (|removed_fb_ids|, |framebuffer_cache_cleared|
+    and the dma buf fds of new framebuffers). Returns 1 if |response| was set, 0 if all framebuffer updates up to |num_framebuffer_updates| have been received and -1 on error.
+*/
+int gsr_kms_client_get_framebuffer_update(gsr_kms_client *self, uint32_t num_framebuffer_updates, gsr_kms_response *response);
+/* Returns the number of framebuffer updates that the server has sent, including the ones for states that haven't been read yet */
+uint32_t gsr_kms_client_get_num_framebuffer_updates(gsr_kms_client *self);
+/* Returns true if the server has pushed a state that hasn't been read with gsr_kms_client_get_state */
+bool gsr_kms_client_has_new_state(gsr_kms_client *self);
+/* Becomes readable when the server pushes a new state. Returns -1 if not subscribed */
+int gsr_kms_client_get_update_fd(gsr_kms_client *self);
+void gsr_kms_client_clear_update_event(gsr_kms_client *self);
 
 #endif /* #define GSR_KMS_CLIENT_H */
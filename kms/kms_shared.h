@@ -5,10 +5,12 @@
 #include <stdbool.h>
 #include <drm_mode.h>
 
-#define GSR_KMS_PROTOCOL_VERSION 4
+#define GSR_KMS_PROTOCOL_VERSION 6
 
 #define GSR_KMS_MAX_ITEMS 8
 #define GSR_KMS_MAX_DMA_BUFS 4
+/* The client has to be able to keep this many framebuffers, the server removes the least recently used framebuffer when it needs to send a new one */
+#define GSR_KMS_MAX_CACHED_FRAMEBUFFERS 16
 
 typedef struct gsr_kms_response_dma_buf gsr_kms_response_dma_buf;
 typedef struct gsr_kms_response_item gsr_kms_response_item;
@@ -16,7 +18,8 @@ typedef struct gsr_kms_response gsr_kms_response;
 
 typedef enum {
     KMS_REQUEST_TYPE_REPLACE_CONNECTION,
-    KMS_REQUEST_TYPE_GET_KMS
+    KMS_REQUEST_TYPE_GET_KMS,
+    KMS_REQUEST_TYPE_SUBSCRIBE /* See gsr_kms_shared_state */
 } gsr_kms_request_type;
 
 typedef enum {
@@ -24,13 +27,16 @@ typedef enum {
     KMS_RESULT_INVALID_REQUEST,
     KMS_RESULT_FAILED_TO_GET_PLANE,
     KMS_RESULT_FAILED_TO_GET_PLANES,
-    KMS_RESULT_FAILED_TO_SEND
+    KMS_RESULT_FAILED_TO_SEND,
+    KMS_RESULT_FAILED_TO_SUBSCRIBE
 } gsr_kms_result;
 
 typedef struct {
     uint32_t version; /* GSR_KMS_PROTOCOL_VERSION */
     int type;         /* gsr_kms_request_type */
     int new_connection_fd;
+    bool reset_framebuffer_cache; /* Set by the client when it doesn't have the framebuffers that it received before, the server then sends the dma buf fds again */
+    int update_rate;              /* KMS_REQUEST_TYPE_SUBSCRIBE: how many times per second the server checks the planes for changes */
 } gsr_kms_request;
 
 struct gsr_kms_response_dma_buf {
@@ -39,9 +45,16 @@ struct gsr_kms_response_dma_buf {
     uint32_t offset;
 };
 
+/*
+    The dma buf fds are only sent the first time a framebuffer is in a response (|dma_buf_cached| is false).
+    After that the fds are -1 and the client should use the fds it got before for |fb_id|, until the framebuffer is removed with |removed_fb_ids|.
+    The pitch and offset of the dma bufs are always set.
+*/
 struct gsr_kms_response_item {
     gsr_kms_response_dma_buf dma_buf[GSR_KMS_MAX_DMA_BUFS];
     int num_dma_bufs;
+    uint32_t fb_id;
+    bool dma_buf_cached;
     uint32_t width;
     uint32_t height;
     uint32_t pixel_format;
@@ -62,6 +75,25 @@ struct gsr_kms_response {
     char err_msg[128];
     gsr_kms_response_item items[GSR_KMS_MAX_ITEMS];
     int num_items;
+    /* The client should remove these framebuffers before adding the framebuffers in |items|, the same fb_id can be in both when the framebuffer id has been reused */
+    uint32_t removed_fb_ids[GSR_KMS_MAX_CACHED_FRAMEBUFFERS];
+    int num_removed_fb_ids;
+    bool framebuffer_cache_cleared; /* The client should remove all framebuffers, before |removed_fb_ids| */
 };
 
+/*
+    After a KMS_REQUEST_TYPE_SUBSCRIBE request the server responds once with two fds: a memfd with this struct and an eventfd.
+    The server then checks the planes |update_rate| times per second. When the planes have changed (for example after a page flip or a cursor move)
+    the new state is written to |state| and the eventfd is signaled, so the client can read the latest state without a request to the server.
+    The dma buf fds of new framebuffers (and the removed framebuffers) can't be put in shared memory. They are sent on the socket as a gsr_kms_response before the state
+    that uses them is written, and |num_framebuffer_updates| is the number of these responses that have been sent. The dma buf fds in |state| are always -1.
+    Sending another KMS_REQUEST_TYPE_SUBSCRIBE request changes the update rate and resets the framebuffer cache if |reset_framebuffer_cache| is set, the server doesn't respond to it.
+    |sequence| is odd while the server is writing the state. The state has been written at least once when |sequence| is not 0.
+*/
+typedef struct {
+    uint32_t sequence;
+    uint32_t num_framebuffer_updates;
+    gsr_kms_response state;
+} gsr_kms_shared_state;
+
 #endif /* #define GSR_KMS_SHARED_H */
@@ -14,6 +14,11 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <linux/netlink.h>
 #include <time.h>
 
 #include <xf86drm.h>
@@ -22,6 +27,10 @@
 #include <drm_fourcc.h>
 
 #define MAX_CONNECTORS 32
+/* Framebuffers that haven't been on a plane for this many requests are removed from the client, so that the client doesn't keep old buffers alive */
+#define CLIENT_FRAMEBUFFER_MAX_UNUSED_REQUESTS 120
+/* The topology is rebuilt at most this often when a plane is on a crtc that isn't connected to a connector in the topology, or periodically if hotplug events can't be received */
+#define DRM_TOPOLOGY_MIN_REBUILD_INTERVAL_SECONDS 2.0
 
 typedef struct {
     int drmfd;
@@ -31,7 +40,11 @@ typedef struct {
 typedef struct {
     uint32_t connector_id;
     uint64_t crtc_id;
+    uint32_t hdr_metadata_prop_id; /* 0 if the connector doesn't have the HDR_OUTPUT_METADATA property */
     uint64_t hdr_metadata_blob_id;
+    bool has_hdr_metadata; /* The contents of |hdr_metadata_blob_id|, a property blob can't be modified */
+    struct hdr_output_metadata hdr_metadata;
+    uint64_t hdr_metadata_update_request; /* The request in which |hdr_metadata_blob_id| was last checked */
 } connector_crtc_pair;
 
 typedef struct {
@@ -39,19 +52,81 @@ typedef struct {
     int num_maps;
 } connector_to_crtc_map;
 
+typedef enum {
+    PLANE_TYPE_OTHER,
+    PLANE_TYPE_PRIMARY,
+    PLANE_TYPE_CURSOR
+} plane_type;
+
+/* The property ids are 0 if the plane doesn't have the property */
+typedef struct {
+    uint32_t plane_id;
+    plane_type type;
+    uint32_t crtc_x_prop_id;
+    uint32_t crtc_y_prop_id;
+    uint32_t src_x_prop_id;
+    uint32_t src_y_prop_id;
+    uint32_t src_w_prop_id;
+    uint32_t src_h_prop_id;
+    uint32_t last_fb_id; /* The framebuffer that was on the plane in the previous request, 0 if none */
+} plane_topology;
+
+/*
+    The parts of the drm state that only change when monitors are connected/disconnected (or the compositor does a modeset), so that they don't have to be queried on every request.
+    The plane positions are still queried on every request, the framebuffers are queried when they change (see kms_get_fb).
+*/
+typedef struct {
+    plane_topology *planes;
+    int num_planes;
+    connector_to_crtc_map c2crtc_map;
+    bool valid;
+    double last_rebuild_time;
+    int uevent_fd; /* Kernel uevents, to invalidate the topology on hotplug. -1 if it couldn't be created */
+} drm_topology;
+
+typedef struct {
+    uint32_t fb_id;
+    dev_t dma_buf_dev;
+    ino_t dma_buf_ino;
+    uint64_t last_used_request;
+
+    /* The framebuffer as it was last sent to the client */
+    int num_dma_bufs;
+    uint32_t pitches[GSR_KMS_MAX_DMA_BUFS];
+    uint32_t offsets[GSR_KMS_MAX_DMA_BUFS];
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_format;
+    uint64_t modifier;
+} client_framebuffer;
+
+/* The framebuffers that the client has the dma buf fds of */
+typedef struct {
+    client_framebuffer framebuffers[GSR_KMS_MAX_CACHED_FRAMEBUFFERS];
+    int num_framebuffers;
+    uint64_t request_counter;
+    bool clear_on_next_response;
+    bool disabled; /* fstat doesn't work on the dma bufs on this system, the fds are always sent */
+} client_framebuffer_cache;
+
+/* KMS_REQUEST_TYPE_SUBSCRIBE, see gsr_kms_shared_state */
+typedef struct {
+    bool active;
+    int shared_state_fd;
+    gsr_kms_shared_state *shared_state;
+    int update_event_fd;
+    double update_interval;
+    double next_update_time;
+    bool reset_framebuffer_cache;
+    bool has_published_state;
+    gsr_kms_response published_state;
+} kms_subscription;
+
 static int max_int(int a, int b) {
     return a > b ? a : b;
 }
 
-static int count_num_fds(const gsr_kms_response *response) {
-    int num_fds = 0;
-    for(int i = 0; i < response->num_items; ++i) {
-        num_fds += response->items[i].num_dma_bufs;
-    }
-    return num_fds;
-}
-
-static int send_msg_to_client(int client_fd, gsr_kms_response *response) {
+static int send_msg_with_fds_to_client(int client_fd, gsr_kms_response *response, const int *fds_to_send, int num_fds, int flags) {
     struct iovec iov;
     iov.iov_base = response;
     iov.iov_len = sizeof(*response);
@@ -60,7 +135,6 @@ static int send_msg_to_client(int client_fd, gsr_kms_response *response) {
     response_message.msg_iov = &iov;
     response_message.msg_iovlen = 1;
 
-    const int num_fds = count_num_fds(response);
     char cmsgbuf[CMSG_SPACE(sizeof(int) * max_int(1, num_fds))];
     memset(cmsgbuf, 0, sizeof(cmsgbuf));
 
@@ -73,18 +147,29 @@ static int send_msg_to_client(int client_fd, gsr_kms_response *response) {
         cmsg->cmsg_type = SCM_RIGHTS;
         cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
 
-        int *fds = (int*)CMSG_DATA(cmsg);
-        int fd_index = 0;
-        for(int i = 0; i < response->num_items; ++i) {
-            for(int j = 0; j < response->items[i].num_dma_bufs; ++j) {
-                fds[fd_index++] = response->items[i].dma_buf[j].fd;
-            }
-        }
-
+        memcpy(CMSG_DATA(cmsg), fds_to_send, sizeof(int) * num_fds);
         response_message.msg_controllen = cmsg->cmsg_len;
     }
 
-    return sendmsg(client_fd, &response_message, 0);
+    return sendmsg(client_fd, &response_message, flags);
+}
+
+static int send_msg_to_client_with_flags(int client_fd, gsr_kms_response *response, int flags) {
+    int fds[GSR_KMS_MAX_ITEMS * GSR_KMS_MAX_DMA_BUFS];
+    int num_fds = 0;
+    for(int i = 0; i < response->num_items; ++i) {
+        if(response->items[i].dma_buf_cached)
+            continue;
+
+        for(int j = 0; j < response->items[i].num_dma_bufs; ++j) {
+            fds[num_fds++] = response->items[i].dma_buf[j].fd;
+        }
+    }
+    return send_msg_with_fds_to_client(client_fd, response, fds, num_fds, flags);
+}
+
+static int send_msg_to_client(int client_fd, gsr_kms_response *response) {
+    return send_msg_to_client_with_flags(client_fd, response, 0);
 }
 
 static int recv_msg_from_client(int client_fd, gsr_kms_request *request) {
@@ -121,19 +206,20 @@ static int recv_msg_from_client(int client_fd, gsr_kms_request *request) {
     return res;
 }
 
-static bool connector_get_property_by_name(int drmfd, drmModeConnectorPtr props, const char *name, uint64_t *result) {
+/* Returns the property id, or 0 if the connector doesn't have the property */
+static uint32_t connector_get_property_by_name(int drmfd, drmModeConnectorPtr props, const char *name, uint64_t *result) {
     for(int i = 0; i < props->count_props; ++i) {
         drmModePropertyPtr prop = drmModeGetProperty(drmfd, props->props[i]);
         if(prop) {
             if(strcmp(name, prop->name) == 0) {
                 *result = props->prop_values[i];
                 drmModeFreeProperty(prop);
-                return true;
+                return props->props[i];
             }
             drmModeFreeProperty(prop);
         }
     }
-    return false;
+    return 0;
 }
 
 typedef enum {
@@ -147,55 +233,42 @@ typedef enum {
     PLANE_PROPERTY_IS_PRIMARY = 1 << 7,
 } plane_property_mask;
 
-/* Returns plane_property_mask */
-static uint32_t plane_get_properties(int drmfd, uint32_t plane_id, int *x, int *y, int *src_x, int *src_y, int *src_w, int *src_h) {
-    *x = 0;
-    *y = 0;
-    *src_x = 0;
-    *src_y = 0;
-    *src_w = 0;
-    *src_h = 0;
-
-    plane_property_mask property_mask = 0;
+static void plane_topology_init(int drmfd, uint32_t plane_id, plane_topology *plane) {
+    memset(plane, 0, sizeof(*plane));
+    plane->plane_id = plane_id;
+    plane->type = PLANE_TYPE_OTHER;
 
     drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drmfd, plane_id, DRM_MODE_OBJECT_PLANE);
     if(!props)
-        return property_mask;
+        return;
 
-    // TODO: Dont do this every frame
     for(uint32_t i = 0; i < props->count_props; ++i) {
         drmModePropertyPtr prop = drmModeGetProperty(drmfd, props->props[i]);
         if(!prop)
             continue;
 
-        // SRC_* values are fixed 16.16 points
         const uint32_t type = prop->flags & (DRM_MODE_PROP_LEGACY_TYPE | DRM_MODE_PROP_EXTENDED_TYPE);
         if((type & DRM_MODE_PROP_SIGNED_RANGE) && strcmp(prop->name, "CRTC_X") == 0) {
-            *x = (int)props->prop_values[i];
-            property_mask |= PLANE_PROPERTY_X;
+            plane->crtc_x_prop_id = prop->prop_id;
         } else if((type & DRM_MODE_PROP_SIGNED_RANGE) && strcmp(prop->name, "CRTC_Y") == 0) {
-            *y = (int)props->prop_values[i];
-            property_mask |= PLANE_PROPERTY_Y;
+            plane->crtc_y_prop_id = prop->prop_id;
         } else if((type & DRM_MODE_PROP_RANGE) && strcmp(prop->name, "SRC_X") == 0) {
-            *src_x = (int)(props->prop_values[i] >> 16);
-            property_mask |= PLANE_PROPERTY_SRC_X;
+            plane->src_x_prop_id = prop->prop_id;
         } else if((type & DRM_MODE_PROP_RANGE) && strcmp(prop->name, "SRC_Y") == 0) {
-            *src_y = (int)(props->prop_values[i] >> 16);
-            property_mask |= PLANE_PROPERTY_SRC_Y;
+            plane->src_y_prop_id = prop->prop_id;
         } else if((type & DRM_MODE_PROP_RANGE) && strcmp(prop->name, "SRC_W") == 0) {
-            *src_w = (int)(props->prop_values[i] >> 16);
-            property_mask |= PLANE_PROPERTY_SRC_W;
+            plane->src_w_prop_id = prop->prop_id;
         } else if((type & DRM_MODE_PROP_RANGE) && strcmp(prop->name, "SRC_H") == 0) {
-            *src_h = (int)(props->prop_values[i] >> 16);
-            property_mask |= PLANE_PROPERTY_SRC_H;
+            plane->src_h_prop_id = prop->prop_id;
         } else if((type & DRM_MODE_PROP_ENUM) && strcmp(prop->name, "type") == 0) {
+            /* The plane type is immutable */
             const uint64_t current_enum_value = props->prop_values[i];
             for(int j = 0; j < prop->count_enums; ++j) {
                 if(prop->enums[j].value == current_enum_value && strcmp(prop->enums[j].name, "Primary") == 0) {
-                    property_mask |= PLANE_PROPERTY_IS_PRIMARY;
+                    plane->type = PLANE_TYPE_PRIMARY;
                     break;
                 } else if(prop->enums[j].value == current_enum_value && strcmp(prop->enums[j].name, "Cursor") == 0) {
-                    property_mask |= PLANE_PROPERTY_IS_CURSOR;
+                    plane->type = PLANE_TYPE_CURSOR;
                     break;
                 }
             }
@@ -204,12 +277,58 @@ static uint32_t plane_get_properties(int drmfd, uint32_t plane_id, int *x, int *
         drmModeFreeProperty(prop);
     }
 
+    drmModeFreeObjectProperties(props);
+}
+
+/* Returns plane_property_mask */
+static uint32_t plane_get_properties(int drmfd, const plane_topology *plane, int *x, int *y, int *src_x, int *src_y, int *src_w, int *src_h) {
+    *x = 0;
+    *y = 0;
+    *src_x = 0;
+    *src_y = 0;
+    *src_w = 0;
+    *src_h = 0;
+
+    plane_property_mask property_mask = 0;
+    if(plane->type == PLANE_TYPE_PRIMARY)
+        property_mask |= PLANE_PROPERTY_IS_PRIMARY;
+    else if(plane->type == PLANE_TYPE_CURSOR)
+        property_mask |= PLANE_PROPERTY_IS_CURSOR;
+
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drmfd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
+    if(!props)
+        return property_mask;
+
+    // SRC_* values are fixed 16.16 points
+    for(uint32_t i = 0; i < props->count_props; ++i) {
+        const uint32_t prop_id = props->props[i];
+        if(prop_id == plane->crtc_x_prop_id) {
+            *x = (int)props->prop_values[i];
+            property_mask |= PLANE_PROPERTY_X;
+        } else if(prop_id == plane->crtc_y_prop_id) {
+            *y = (int)props->prop_values[i];
+            property_mask |= PLANE_PROPERTY_Y;
+        } else if(prop_id == plane->src_x_prop_id) {
+            *src_x = (int)(props->prop_values[i] >> 16);
+            property_mask |= PLANE_PROPERTY_SRC_X;
+        } else if(prop_id == plane->src_y_prop_id) {
+            *src_y = (int)(props->prop_values[i] >> 16);
+            property_mask |= PLANE_PROPERTY_SRC_Y;
+        } else if(prop_id == plane->src_w_prop_id) {
+            *src_w = (int)(props->prop_values[i] >> 16);
+            property_mask |= PLANE_PROPERTY_SRC_W;
+        } else if(prop_id == plane->src_h_prop_id) {
+            *src_h = (int)(props->prop_values[i] >> 16);
+            property_mask |= PLANE_PROPERTY_SRC_H;
+        }
+    }
+
     drmModeFreeObjectProperties(props);
     return property_mask;
 }
 
 /* Returns 0 if not found */
-static const connector_crtc_pair* get_connector_pair_by_crtc_id(const connector_to_crtc_map *c2crtc_map, uint32_t crtc_id) {
+static connector_crtc_pair* get_connector_pair_by_crtc_id(connector_to_crtc_map *c2crtc_map, uint32_t crtc_id) {
     for(int i = 0; i < c2crtc_map->num_maps; ++i) {
         if(c2crtc_map->maps[i].crtc_id == crtc_id)
             return &c2crtc_map->maps[i];
@@ -217,6 +336,18 @@ static const connector_crtc_pair* get_connector_pair_by_crtc_id(const connector_
     return NULL;
 }
 
+static bool get_hdr_metadata(int drm_fd, uint64_t hdr_metadata_blob_id, struct hdr_output_metadata *hdr_metadata) {
+    drmModePropertyBlobPtr hdr_metadata_blob = drmModeGetPropertyBlob(drm_fd, hdr_metadata_blob_id);
+    if(!hdr_metadata_blob)
+        return false;
+
+    if(hdr_metadata_blob->length >= sizeof(struct hdr_output_metadata))
+        *hdr_metadata = *(struct hdr_output_metadata*)hdr_metadata_blob->data;
+
+    drmModeFreePropertyBlob(hdr_metadata_blob);
+    return true;
+}
+
 static void map_crtc_to_connector_ids(gsr_drm *drm, connector_to_crtc_map *c2crtc_map) {
     c2crtc_map->num_maps = 0;
     drmModeResPtr resources = drmModeGetResources(drm->drmfd);
@@ -232,11 +363,15 @@ static void map_crtc_to_connector_ids(gsr_drm *drm, connector_to_crtc_map *c2crt
         connector_get_property_by_name(drm->drmfd, connector, "CRTC_ID", &crtc_id);
 
         uint64_t hdr_output_metadata_blob_id = 0;
-        connector_get_property_by_name(drm->drmfd, connector, "HDR_OUTPUT_METADATA", &hdr_output_metadata_blob_id);
-
-        c2crtc_map->maps[c2crtc_map->num_maps].connector_id = connector->connector_id;
-        c2crtc_map->maps[c2crtc_map->num_maps].crtc_id = crtc_id;
-        c2crtc_map->maps[c2crtc_map->num_maps].hdr_metadata_blob_id = hdr_output_metadata_blob_id;
+        const uint32_t hdr_output_metadata_prop_id = connector_get_property_by_name(drm->drmfd, connector, "HDR_OUTPUT_METADATA", &hdr_output_metadata_blob_id);
+
+        connector_crtc_pair *crtc_pair = &c2crtc_map->maps[c2crtc_map->num_maps];
+        crtc_pair->connector_id = connector->connector_id;
+        crtc_pair->crtc_id = crtc_id;
+        crtc_pair->hdr_metadata_prop_id = hdr_output_metadata_prop_id;
+        crtc_pair->hdr_metadata_update_request = 0;
+        crtc_pair->hdr_metadata_blob_id = hdr_output_metadata_blob_id;
+        crtc_pair->has_hdr_metadata = hdr_output_metadata_blob_id && get_hdr_metadata(drm->drmfd, hdr_output_metadata_blob_id, &crtc_pair->hdr_metadata);
         ++c2crtc_map->num_maps;
 
         drmModeFreeConnector(connector);
@@ -244,6 +379,148 @@ static void map_crtc_to_connector_ids(gsr_drm *drm, connector_to_crtc_map *c2crt
     drmModeFreeResources(resources);
 }
 
+/*
+    The compositor sets a new blob when it changes the hdr metadata (for example when a game enables hdr), which doesn't cause a hotplug event.
+    Only the blob id is queried, the blob is only read again when the id changed.
+*/
+static void connector_crtc_pair_update_hdr_metadata(gsr_drm *drm, connector_crtc_pair *crtc_pair, uint64_t request) {
+    if(!crtc_pair->hdr_metadata_prop_id || crtc_pair->hdr_metadata_update_request == request)
+        return;
+    crtc_pair->hdr_metadata_update_request = request;
+
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drm->drmfd, crtc_pair->connector_id, DRM_MODE_OBJECT_CONNECTOR);
+    if(!props)
+        return;
+
+    uint64_t hdr_metadata_blob_id = 0;
+    for(uint32_t i = 0; i < props->count_props; ++i) {
+        if(props->props[i] == crtc_pair->hdr_metadata_prop_id) {
+            hdr_metadata_blob_id = props->prop_values[i];
+            break;
+        }
+    }
+    drmModeFreeObjectProperties(props);
+
+    if(hdr_metadata_blob_id == crtc_pair->hdr_metadata_blob_id)
+        return;
+
+    crtc_pair->hdr_metadata_blob_id = hdr_metadata_blob_id;
+    crtc_pair->has_hdr_metadata = hdr_metadata_blob_id && get_hdr_metadata(drm->drmfd, hdr_metadata_blob_id, &crtc_pair->hdr_metadata);
+}
+
+static double clock_get_monotonic_seconds(void) {
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+static int open_uevent_socket(void) {
+    const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if(fd == -1)
+        return -1;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 1; /* Kernel uevents */
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void drm_topology_init(drm_topology *topology) {
+    memset(topology, 0, sizeof(*topology));
+    topology->uevent_fd = open_uevent_socket();
+    if(topology->uevent_fd == -1)
+        fprintf(stderr, "kms server warning: failed to listen to hotplug events, error: %s. Monitor changes will be checked periodically instead\n", strerror(errno));
+}
+
+static void drm_topology_deinit(drm_topology *topology) {
+    free(topology->planes);
+    topology->planes = NULL;
+    topology->num_planes = 0;
+    topology->valid = false;
+
+    if(topology->uevent_fd != -1) {
+        close(topology->uevent_fd);
+        topology->uevent_fd = -1;
+    }
+}
+
+static void drm_topology_invalidate(drm_topology *topology) {
+    topology->valid = false;
+}
+
+/* Kernel uevents are "action@devpath" followed by KEY=VALUE strings, all null terminated */
+static bool uevent_is_drm_hotplug(const char *data, size_t size) {
+    bool subsystem_drm = false;
+    bool hotplug = false;
+    for(size_t offset = 0; offset < size;) {
+        const char *str = data + offset;
+        const size_t str_len = strnlen(str, size - offset);
+        if(str_len == strlen("SUBSYSTEM=drm") && memcmp(str, "SUBSYSTEM=drm", str_len) == 0)
+            subsystem_drm = true;
+        else if(str_len == strlen("HOTPLUG=1") && memcmp(str, "HOTPLUG=1", str_len) == 0)
+            hotplug = true;
+        offset += str_len + 1;
+    }
+    return subsystem_drm && hotplug;
+}
+
+static void drm_topology_check_hotplug(drm_topology *topology) {
+    if(topology->uevent_fd == -1)
+        return;
+
+    char buffer[4096];
+    for(;;) {
+        const ssize_t bytes_read = recv(topology->uevent_fd, buffer, sizeof(buffer), 0);
+        if(bytes_read <= 0)
+            break;
+
+        if(uevent_is_drm_hotplug(buffer, bytes_read))
+            drm_topology_invalidate(topology);
+    }
+}
+
+static bool drm_topology_rebuild(gsr_drm *drm, drm_topology *topology) {
+    topology->last_rebuild_time = clock_get_monotonic_seconds();
+
+    if(topology->num_planes != (int)drm->planes->count_planes) {
+        plane_topology *new_planes = realloc(topology->planes, max_int(1, drm->planes->count_planes) * sizeof(plane_topology));
+        if(!new_planes) {
+            fprintf(stderr, "kms server error: failed to allocate memory for %u planes\n", drm->planes->count_planes);
+            return false;
+        }
+        topology->planes = new_planes;
+        topology->num_planes = drm->planes->count_planes;
+    }
+
+    for(int i = 0; i < topology->num_planes; ++i) {
+        plane_topology_init(drm->drmfd, drm->planes->planes[i], &topology->planes[i]);
+    }
+
+    map_crtc_to_connector_ids(drm, &topology->c2crtc_map);
+    topology->valid = true;
+    return true;
+}
+
+static bool drm_topology_update(gsr_drm *drm, drm_topology *topology) {
+    drm_topology_check_hotplug(topology);
+    if(topology->valid && topology->uevent_fd == -1 && clock_get_monotonic_seconds() - topology->last_rebuild_time >= DRM_TOPOLOGY_MIN_REBUILD_INTERVAL_SECONDS)
+        drm_topology_invalidate(topology);
+
+    if(topology->valid)
+        return true;
+
+    return drm_topology_rebuild(drm, topology);
+}
+
 static void drm_mode_cleanup_handles(int drmfd, drmModeFB2Ptr drmfb) {
     for(int i = 0; i < 4; ++i) {
         if(!drmfb->handles[i])
@@ -264,18 +541,6 @@ static void drm_mode_cleanup_handles(int drmfd, drmModeFB2Ptr drmfb) {
     }
 }
 
-static bool get_hdr_metadata(int drm_fd, uint64_t hdr_metadata_blob_id, struct hdr_output_metadata *hdr_metadata) {
-    drmModePropertyBlobPtr hdr_metadata_blob = drmModeGetPropertyBlob(drm_fd, hdr_metadata_blob_id);
-    if(!hdr_metadata_blob)
-        return false;
-
-    if(hdr_metadata_blob->length >= sizeof(struct hdr_output_metadata))
-        *hdr_metadata = *(struct hdr_output_metadata*)hdr_metadata_blob->data;
-
-    drmModeFreePropertyBlob(hdr_metadata_blob);
-    return true;
-}
-
 /* Returns the number of drm handles that we managed to get */
 static int drm_prime_handles_to_fds(gsr_drm *drm, drmModeFB2Ptr drmfb, int *fb_fds) {
     for(int i = 0; i < GSR_KMS_MAX_DMA_BUFS; ++i) {
@@ -289,106 +554,293 @@ static int drm_prime_handles_to_fds(gsr_drm *drm, drmModeFB2Ptr drmfb, int *fb_f
     return GSR_KMS_MAX_DMA_BUFS;
 }
 
-static int kms_get_fb(gsr_drm *drm, gsr_kms_response *response, connector_to_crtc_map *c2crtc_map) {
+static void client_framebuffer_cache_remove(client_framebuffer_cache *cache, int index, gsr_kms_response *response) {
+    /* Only framebuffers that were in the cache at the start of the request are removed (each one at most once), so this can't be full */
+    if(response->num_removed_fb_ids < GSR_KMS_MAX_CACHED_FRAMEBUFFERS)
+        response->removed_fb_ids[response->num_removed_fb_ids++] = cache->framebuffers[index].fb_id;
+
+    cache->framebuffers[index] = cache->framebuffers[cache->num_framebuffers - 1];
+    --cache->num_framebuffers;
+}
+
+/*
+    Returns true if the client already has the dma bufs of the framebuffer, in which case the fds don't have to be sent.
+    Otherwise the framebuffer is added to the cache (removing the least recently used framebuffer if the cache is full) and the fds have to be sent.
+    Framebuffer ids are reused by the kernel after a framebuffer is removed, so the dma buf inode is used to check that it's still the same buffer.
+
+    Two framebuffers can have the same dma buf inode, for example when they are created from the same gem buffer (or on kernels older than 5.3
+    where every dma buf has the same inode). Then it's not known which of them the inode belongs to, so only the conflicting framebuffers are
+    removed from the cache instead of disabling the cache for the rest of the session. If the conflicting framebuffer is also used in this request
+    then it's kept and this framebuffer isn't cached, so that the two don't evict each other on every request.
+*/
+static bool client_framebuffer_cache_use(client_framebuffer_cache *cache, uint32_t fb_id, int dma_buf_fd, gsr_kms_response *response) {
+    if(cache->disabled)
+        return false;
+
+    struct stat dma_buf_stat;
+    if(fstat(dma_buf_fd, &dma_buf_stat) == -1) {
+        fprintf(stderr, "kms server warning: fstat on dma buf failed, error: %s. The dma bufs will be sent on every request\n", strerror(errno));
+        cache->disabled = true;
+        cache->clear_on_next_response = true;
+        return false;
+    }
+
+    bool cached = false;
+    bool cacheable = true;
+    for(int i = 0; i < cache->num_framebuffers;) {
+        client_framebuffer *framebuffer = &cache->framebuffers[i];
+        const bool same_dma_buf = framebuffer->dma_buf_dev == dma_buf_stat.st_dev && framebuffer->dma_buf_ino == dma_buf_stat.st_ino;
+        if(framebuffer->fb_id == fb_id && same_dma_buf) {
+            framebuffer->last_used_request = cache->request_counter;
+            cached = true;
+            ++i;
+        } else if(same_dma_buf && framebuffer->fb_id != fb_id && framebuffer->last_used_request == cache->request_counter) {
+            cacheable = false;
+            ++i;
+        } else if(framebuffer->fb_id == fb_id || same_dma_buf) {
+            /* The framebuffer id has been reused for another buffer, or another framebuffer has the same dma buf inode */
+            client_framebuffer_cache_remove(cache, i, response);
+        } else {
+            ++i;
+        }
+    }
+
+    if(cached)
+        return true;
+
+    if(!cacheable)
+        return false;
+
+    if(cache->num_framebuffers == GSR_KMS_MAX_CACHED_FRAMEBUFFERS) {
+        int least_recently_used_index = 0;
+        for(int i = 1; i < cache->num_framebuffers; ++i) {
+            if(cache->framebuffers[i].last_used_request < cache->framebuffers[least_recently_used_index].last_used_request)
+                least_recently_used_index = i;
+        }
+        client_framebuffer_cache_remove(cache, least_recently_used_index, response);
+    }
+
+    client_framebuffer *framebuffer = &cache->framebuffers[cache->num_framebuffers++];
+    framebuffer->fb_id = fb_id;
+    framebuffer->dma_buf_dev = dma_buf_stat.st_dev;
+    framebuffer->dma_buf_ino = dma_buf_stat.st_ino;
+    framebuffer->last_used_request = cache->request_counter;
+    return false;
+}
+
+static client_framebuffer* client_framebuffer_cache_find(client_framebuffer_cache *cache, uint32_t fb_id) {
+    if(cache->disabled)
+        return NULL;
+
+    for(int i = 0; i < cache->num_framebuffers; ++i) {
+        if(cache->framebuffers[i].fb_id == fb_id)
+            return &cache->framebuffers[i];
+    }
+    return NULL;
+}
+
+static void client_framebuffer_cache_remove_unused(client_framebuffer_cache *cache, gsr_kms_response *response) {
+    for(int i = 0; i < cache->num_framebuffers;) {
+        if(cache->request_counter - cache->framebuffers[i].last_used_request > CLIENT_FRAMEBUFFER_MAX_UNUSED_REQUESTS)
+            client_framebuffer_cache_remove(cache, i, response);
+        else
+            ++i;
+    }
+}
+
+/*
+    Queries the framebuffer and exports its dma bufs. The dma buf fds are only set in |item| if the client doesn't have them already.
+    Returns false on failure, |response| has the error set if it's an error that should be reported.
+*/
+static bool kms_get_framebuffer(gsr_drm *drm, uint32_t fb_id, client_framebuffer_cache *fb_cache, gsr_kms_response_item *item, gsr_kms_response *response) {
+    drmModeFB2Ptr drmfb = drmModeGetFB2(drm->drmfd, fb_id);
+    if(!drmfb) {
+        // Commented out for now because we get here if the cursor is moved to another monitor and we dont care about the cursor
+        //response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
+        //snprintf(response->err_msg, sizeof(response->err_msg), "drmModeGetFB2 failed, error: %s", strerror(errno));
+        //fprintf(stderr, "kms server error: %s\n", response->err_msg);
+        return false;
+    }
+
+    bool success = false;
+    int fb_fds[GSR_KMS_MAX_DMA_BUFS];
+    int num_fb_fds = 0;
+
+    if(!drmfb->handles[0]) {
+        response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
+        snprintf(response->err_msg, sizeof(response->err_msg), "drmfb handle is NULL");
+        fprintf(stderr, "kms server error: %s\n", response->err_msg);
+        goto done;
+    }
+
+    // TODO: Support other plane formats than rgb (with multiple planes, such as direct YUV420 on wayland).
+
+    num_fb_fds = drm_prime_handles_to_fds(drm, drmfb, fb_fds);
+    if(num_fb_fds == 0) {
+        response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
+        snprintf(response->err_msg, sizeof(response->err_msg), "failed to get fd from drm handle, error: %s", strerror(errno));
+        fprintf(stderr, "kms server error: %s\n", response->err_msg);
+        goto done;
+    }
+
+    item->dma_buf_cached = client_framebuffer_cache_use(fb_cache, fb_id, fb_fds[0], response);
+    for(int j = 0; j < num_fb_fds; ++j) {
+        if(item->dma_buf_cached) {
+            close(fb_fds[j]);
+            fb_fds[j] = -1;
+        }
+        item->dma_buf[j].fd = fb_fds[j];
+        item->dma_buf[j].pitch = drmfb->pitches[j];
+        item->dma_buf[j].offset = drmfb->offsets[j];
+    }
+    item->num_dma_bufs = num_fb_fds;
+    item->fb_id = fb_id;
+    item->width = drmfb->width;
+    item->height = drmfb->height;
+    item->pixel_format = drmfb->pixel_format;
+    item->modifier = drmfb->flags & DRM_MODE_FB_MODIFIERS ? drmfb->modifier : DRM_FORMAT_MOD_INVALID;
+
+    client_framebuffer *framebuffer = client_framebuffer_cache_find(fb_cache, fb_id);
+    if(framebuffer) {
+        framebuffer->num_dma_bufs = item->num_dma_bufs;
+        for(int j = 0; j < item->num_dma_bufs; ++j) {
+            framebuffer->pitches[j] = item->dma_buf[j].pitch;
+            framebuffer->offsets[j] = item->dma_buf[j].offset;
+        }
+        framebuffer->width = item->width;
+        framebuffer->height = item->height;
+        framebuffer->pixel_format = item->pixel_format;
+        framebuffer->modifier = item->modifier;
+    }
+    success = true;
+
+    done:
+    drm_mode_cleanup_handles(drm->drmfd, drmfb);
+    drmModeFreeFB2(drmfb);
+    return success;
+}
+
+static void client_framebuffer_to_response_item(const client_framebuffer *framebuffer, gsr_kms_response_item *item) {
+    for(int j = 0; j < framebuffer->num_dma_bufs; ++j) {
+        item->dma_buf[j].fd = -1;
+        item->dma_buf[j].pitch = framebuffer->pitches[j];
+        item->dma_buf[j].offset = framebuffer->offsets[j];
+    }
+    item->num_dma_bufs = framebuffer->num_dma_bufs;
+    item->fb_id = framebuffer->fb_id;
+    item->dma_buf_cached = true;
+    item->width = framebuffer->width;
+    item->height = framebuffer->height;
+    item->pixel_format = framebuffer->pixel_format;
+    item->modifier = framebuffer->modifier;
+}
+
+static int kms_get_fb(gsr_drm *drm, gsr_kms_response *response, drm_topology *topology, client_framebuffer_cache *fb_cache, bool reset_framebuffer_cache) {
     int result = -1;
 
     response->result = KMS_RESULT_OK;
     response->err_msg[0] = '\0';
     response->num_items = 0;
+    response->num_removed_fb_ids = 0;
+    response->framebuffer_cache_cleared = false;
+
+    ++fb_cache->request_counter;
+    if(reset_framebuffer_cache || fb_cache->clear_on_next_response) {
+        fb_cache->num_framebuffers = 0;
+        fb_cache->clear_on_next_response = false;
+        response->framebuffer_cache_cleared = true;
+    }
+
+    if(!drm_topology_update(drm, topology)) {
+        response->result = KMS_RESULT_FAILED_TO_GET_PLANES;
+        snprintf(response->err_msg, sizeof(response->err_msg), "failed to get the drm topology");
+        return -1;
+    }
 
-    for(uint32_t i = 0; i < drm->planes->count_planes && response->num_items < GSR_KMS_MAX_ITEMS; ++i) {
+    bool unknown_crtc = false;
+    for(int i = 0; i < topology->num_planes && response->num_items < GSR_KMS_MAX_ITEMS; ++i) {
+        plane_topology *plane_topo = &topology->planes[i];
         drmModePlanePtr plane = NULL;
-        drmModeFB2Ptr drmfb = NULL;
 
-        plane = drmModeGetPlane(drm->drmfd, drm->planes->planes[i]);
+        if(plane_topo->type == PLANE_TYPE_OTHER)
+            continue;
+
+        plane = drmModeGetPlane(drm->drmfd, plane_topo->plane_id);
         if(!plane) {
+            plane_topo->last_fb_id = 0;
             response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
-            snprintf(response->err_msg, sizeof(response->err_msg), "failed to get drm plane with id %u, error: %s\n", drm->planes->planes[i], strerror(errno));
+            snprintf(response->err_msg, sizeof(response->err_msg), "failed to get drm plane with id %u, error: %s\n", plane_topo->plane_id, strerror(errno));
             fprintf(stderr, "kms server error: %s\n", response->err_msg);
             goto next;
         }
 
+        const bool same_fb_as_last_request = plane->fb_id == plane_topo->last_fb_id;
+        plane_topo->last_fb_id = plane->fb_id;
         if(!plane->fb_id)
             goto next;
 
-        drmfb = drmModeGetFB2(drm->drmfd, plane->fb_id);
-        if(!drmfb) {
-            // Commented out for now because we get here if the cursor is moved to another monitor and we dont care about the cursor
-            //response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
-            //snprintf(response->err_msg, sizeof(response->err_msg), "drmModeGetFB2 failed, error: %s", strerror(errno));
-            //fprintf(stderr, "kms server error: %s\n", response->err_msg);
+        const int item_index = response->num_items;
+        gsr_kms_response_item *item = &response->items[item_index];
+
+        /*
+            If the framebuffer stayed on the plane since the last request and the client has its dma bufs then it's not queried again (GetFB2, prime export and fstat).
+            A framebuffer id can only be reused by the kernel after the framebuffer has been removed, which can't happen while it's on a plane.
+            A framebuffer that comes back to a plane is queried again, which also catches reused framebuffer ids.
+        */
+        client_framebuffer *cached_framebuffer = same_fb_as_last_request ? client_framebuffer_cache_find(fb_cache, plane->fb_id) : NULL;
+        if(cached_framebuffer) {
+            cached_framebuffer->last_used_request = fb_cache->request_counter;
+            client_framebuffer_to_response_item(cached_framebuffer, item);
+        } else if(!kms_get_framebuffer(drm, plane->fb_id, fb_cache, item, response)) {
+            plane_topo->last_fb_id = 0;
             goto next;
         }
 
-        if(!drmfb->handles[0]) {
-            response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
-            snprintf(response->err_msg, sizeof(response->err_msg), "drmfb handle is NULL");
-            fprintf(stderr, "kms server error: %s\n", response->err_msg);
-            goto cleanup_handles;
-        }
-
         // TODO: Check if dimensions have changed by comparing width and height to previous time this was called.
-        // TODO: Support other plane formats than rgb (with multiple planes, such as direct YUV420 on wayland).
 
         int x = 0, y = 0, src_x = 0, src_y = 0, src_w = 0, src_h = 0;
-        plane_property_mask property_mask = plane_get_properties(drm->drmfd, plane->plane_id, &x, &y, &src_x, &src_y, &src_w, &src_h);
-        if(!(property_mask & PLANE_PROPERTY_IS_PRIMARY) && !(property_mask & PLANE_PROPERTY_IS_CURSOR))
-            continue;
+        plane_property_mask property_mask = plane_get_properties(drm->drmfd, plane_topo, &x, &y, &src_x, &src_y, &src_w, &src_h);
 
-        int fb_fds[GSR_KMS_MAX_DMA_BUFS];
-        const int num_fb_fds = drm_prime_handles_to_fds(drm, drmfb, fb_fds);
-        if(num_fb_fds == 0) {
-            response->result = KMS_RESULT_FAILED_TO_GET_PLANE;
-            snprintf(response->err_msg, sizeof(response->err_msg), "failed to get fd from drm handle, error: %s", strerror(errno));
-            fprintf(stderr, "kms server error: %s\n", response->err_msg);
-            goto cleanup_handles;
-        }
+        connector_crtc_pair *crtc_pair = get_connector_pair_by_crtc_id(&topology->c2crtc_map, plane->crtc_id);
+        if(!crtc_pair && plane_topo->type == PLANE_TYPE_PRIMARY)
+            unknown_crtc = true;
 
-        const int item_index = response->num_items;
+        if(crtc_pair)
+            connector_crtc_pair_update_hdr_metadata(drm, crtc_pair, fb_cache->request_counter);
 
-        const connector_crtc_pair *crtc_pair = get_connector_pair_by_crtc_id(c2crtc_map, plane->crtc_id);
-        if(crtc_pair && crtc_pair->hdr_metadata_blob_id) {
-            response->items[item_index].has_hdr_metadata = get_hdr_metadata(drm->drmfd, crtc_pair->hdr_metadata_blob_id, &response->items[item_index].hdr_metadata);
+        if(crtc_pair && crtc_pair->has_hdr_metadata) {
+            item->has_hdr_metadata = true;
+            item->hdr_metadata = crtc_pair->hdr_metadata;
         } else {
-            response->items[item_index].has_hdr_metadata = false;
+            item->has_hdr_metadata = false;
         }
 
-        for(int j = 0; j < num_fb_fds; ++j) {
-            response->items[item_index].dma_buf[j].fd = fb_fds[j];
-            response->items[item_index].dma_buf[j].pitch = drmfb->pitches[j];
-            response->items[item_index].dma_buf[j].offset = drmfb->offsets[j];
-        }
-        response->items[item_index].num_dma_bufs = num_fb_fds;
-
-        response->items[item_index].width = drmfb->width;
-        response->items[item_index].height = drmfb->height;
-        response->items[item_index].pixel_format = drmfb->pixel_format;
-        response->items[item_index].modifier = drmfb->flags & DRM_MODE_FB_MODIFIERS ? drmfb->modifier : DRM_FORMAT_MOD_INVALID;
-        response->items[item_index].connector_id = crtc_pair ? crtc_pair->connector_id : 0;
-        response->items[item_index].is_cursor = property_mask & PLANE_PROPERTY_IS_CURSOR;
+        item->connector_id = crtc_pair ? crtc_pair->connector_id : 0;
+        item->is_cursor = property_mask & PLANE_PROPERTY_IS_CURSOR;
         if(property_mask & PLANE_PROPERTY_IS_CURSOR) {
-            response->items[item_index].x = x;
-            response->items[item_index].y = y;
-            response->items[item_index].src_w = 0;
-            response->items[item_index].src_h = 0;
+            item->x = x;
+            item->y = y;
+            item->src_w = 0;
+            item->src_h = 0;
         } else {
-            response->items[item_index].x = src_x;
-            response->items[item_index].y = src_y;
-            response->items[item_index].src_w = src_w;
-            response->items[item_index].src_h = src_h;
+            item->x = src_x;
+            item->y = src_y;
+            item->src_w = src_w;
+            item->src_h = src_h;
         }
         ++response->num_items;
 
-        cleanup_handles:
-        drm_mode_cleanup_handles(drm->drmfd, drmfb);
-
         next:
-        if(drmfb)
-            drmModeFreeFB2(drmfb);
         if(plane)
             drmModeFreePlane(plane);
     }
 
+    client_framebuffer_cache_remove_unused(fb_cache, response);
+
+    /* The compositor moved a monitor to another crtc without a hotplug event */
+    if(unknown_crtc && clock_get_monotonic_seconds() - topology->last_rebuild_time >= DRM_TOPOLOGY_MIN_REBUILD_INTERVAL_SECONDS)
+        drm_topology_invalidate(topology);
+
     if(response->num_items > 0)
         response->result = KMS_RESULT_OK;
 
@@ -411,12 +863,185 @@ static int kms_get_fb(gsr_drm *drm, gsr_kms_response *response, connector_to_crt
     return result;
 }
 
-static double clock_get_monotonic_seconds(void) {
-    struct timespec ts;
-    ts.tv_sec = 0;
-    ts.tv_nsec = 0;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+static void close_response_fds(gsr_kms_response *response) {
+    for(int i = 0; i < response->num_items; ++i) {
+        for(int j = 0; j < response->items[i].num_dma_bufs; ++j) {
+            gsr_kms_response_dma_buf *dma_buf = &response->items[i].dma_buf[j];
+            if(dma_buf->fd > 0) {
+                close(dma_buf->fd);
+                dma_buf->fd = -1;
+            }
+        }
+    }
+}
+
+static void kms_subscription_set_update_rate(kms_subscription *subscription, int update_rate) {
+    if(update_rate < 1)
+        update_rate = 1;
+    else if(update_rate > 1000)
+        update_rate = 1000;
+    subscription->update_interval = 1.0 / (double)update_rate;
+}
+
+static bool kms_subscription_init(kms_subscription *subscription, int update_rate) {
+    memset(subscription, 0, sizeof(*subscription));
+    subscription->shared_state_fd = -1;
+    subscription->update_event_fd = -1;
+
+    subscription->shared_state_fd = memfd_create("gsr-kms-shared-state", MFD_CLOEXEC);
+    if(subscription->shared_state_fd == -1) {
+        fprintf(stderr, "kms server error: memfd_create failed, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    if(ftruncate(subscription->shared_state_fd, sizeof(gsr_kms_shared_state)) == -1) {
+        fprintf(stderr, "kms server error: ftruncate failed, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    subscription->shared_state = mmap(NULL, sizeof(gsr_kms_shared_state), PROT_READ | PROT_WRITE, MAP_SHARED, subscription->shared_state_fd, 0);
+    if(subscription->shared_state == MAP_FAILED) {
+        subscription->shared_state = NULL;
+        fprintf(stderr, "kms server error: mmap failed, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    subscription->update_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(subscription->update_event_fd == -1) {
+        fprintf(stderr, "kms server error: eventfd failed, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    kms_subscription_set_update_rate(subscription, update_rate);
+    subscription->next_update_time = clock_get_monotonic_seconds();
+    subscription->active = true;
+    return true;
+
+    err:
+    if(subscription->shared_state)
+        munmap(subscription->shared_state, sizeof(gsr_kms_shared_state));
+    if(subscription->shared_state_fd > 0)
+        close(subscription->shared_state_fd);
+    if(subscription->update_event_fd > 0)
+        close(subscription->update_event_fd);
+    memset(subscription, 0, sizeof(*subscription));
+    return false;
+}
+
+static void kms_subscription_deinit(kms_subscription *subscription) {
+    if(!subscription->active)
+        return;
+
+    munmap(subscription->shared_state, sizeof(gsr_kms_shared_state));
+    close(subscription->shared_state_fd);
+    close(subscription->update_event_fd);
+    memset(subscription, 0, sizeof(*subscription));
+}
+
+/* The fds have to be closed first. The framebuffer updates are not part of the state */
+static void kms_response_to_plane_state(gsr_kms_response *response) {
+    for(int i = 0; i < response->num_items; ++i) {
+        response->items[i].dma_buf_cached = true;
+    }
+    response->num_removed_fb_ids = 0;
+    response->framebuffer_cache_cleared = false;
+}
+
+static bool kms_response_needs_framebuffer_update(const gsr_kms_response *response) {
+    if(response->framebuffer_cache_cleared || response->num_removed_fb_ids > 0)
+        return true;
+
+    for(int i = 0; i < response->num_items; ++i) {
+        if(!response->items[i].dma_buf_cached)
+            return true;
+    }
+    return false;
+}
+
+static void kms_subscription_publish_state(kms_subscription *subscription, const gsr_kms_response *state, bool framebuffer_update_sent) {
+    gsr_kms_shared_state *shared_state = subscription->shared_state;
+    const uint32_t sequence = shared_state->sequence;
+
+    /* Seqlock, the client retries the read if the sequence is odd or has changed while it was reading */
+    __atomic_store_n(&shared_state->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if(framebuffer_update_sent)
+        ++shared_state->num_framebuffer_updates;
+    shared_state->state = *state;
+    __atomic_store_n(&shared_state->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/*
+    Pushes the plane state to the client if it has changed since the last update. Framebuffers that the client doesn't have are sent on the socket first.
+    The socket is not waited on, if the client doesn't read it then the state is not updated and all framebuffers are sent again when the client reads it.
+*/
+static void kms_subscription_update(kms_subscription *subscription, gsr_drm *drm, drm_topology *topology, client_framebuffer_cache *fb_cache, int socket_fd) {
+    gsr_kms_response response;
+    memset(&response, 0, sizeof(response));
+    response.version = GSR_KMS_PROTOCOL_VERSION;
+    kms_get_fb(drm, &response, topology, fb_cache, subscription->reset_framebuffer_cache);
+    subscription->reset_framebuffer_cache = false;
+
+    const bool framebuffer_update = kms_response_needs_framebuffer_update(&response);
+    const int send_res = framebuffer_update ? send_msg_to_client_with_flags(socket_fd, &response, MSG_DONTWAIT) : (int)sizeof(response);
+    if(send_res != (int)sizeof(response)) {
+        /* The socket is a seqpacket socketpair so a message is never sent partially, but a short write would make the client read the following messages wrong */
+        if(send_res == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+            fprintf(stderr, "kms server error: failed to send framebuffers to the client, error: %s\n", strerror(errno));
+        else if(send_res != -1)
+            fprintf(stderr, "kms server error: sent %d of %d bytes of the framebuffers to the client\n", send_res, (int)sizeof(response));
+        fb_cache->clear_on_next_response = true;
+        close_response_fds(&response);
+        return;
+    }
+
+    close_response_fds(&response);
+    kms_response_to_plane_state(&response);
+
+    /* The response is zero initialized so the padding is the same */
+    if(subscription->has_published_state && !framebuffer_update && memcmp(&response, &subscription->published_state, sizeof(response)) == 0)
+        return;
+
+    kms_subscription_publish_state(subscription, &response, framebuffer_update);
+    subscription->published_state = response;
+    subscription->has_published_state = true;
+
+    const uint64_t value = 1;
+    if(write(subscription->update_event_fd, &value, sizeof(value)) != sizeof(value)) {}
+}
+
+/* Starts the subscription and sends the shared state and update event fds to the client, or changes the update rate if the client is already subscribed */
+static void kms_subscription_handle_request(kms_subscription *subscription, const gsr_kms_request *request, int socket_fd) {
+    if(subscription->active) {
+        kms_subscription_set_update_rate(subscription, request->update_rate);
+        subscription->reset_framebuffer_cache |= request->reset_framebuffer_cache;
+        subscription->next_update_time = clock_get_monotonic_seconds();
+        return;
+    }
+
+    gsr_kms_response response;
+    response.version = GSR_KMS_PROTOCOL_VERSION;
+    response.err_msg[0] = '\0';
+    response.num_items = 0;
+    response.num_removed_fb_ids = 0;
+    response.framebuffer_cache_cleared = false;
+
+    if(kms_subscription_init(subscription, request->update_rate)) {
+        response.result = KMS_RESULT_OK;
+        const int fds[2] = { subscription->shared_state_fd, subscription->update_event_fd };
+        if(send_msg_with_fds_to_client(socket_fd, &response, fds, 2, 0) == -1) {
+            fprintf(stderr, "kms server error: failed to respond to client KMS_REQUEST_TYPE_SUBSCRIBE request\n");
+            kms_subscription_deinit(subscription);
+            return;
+        }
+        /* The first update sends all framebuffers */
+        subscription->reset_framebuffer_cache = true;
+    } else {
+        response.result = KMS_RESULT_FAILED_TO_SUBSCRIBE;
+        snprintf(response.err_msg, sizeof(response.err_msg), "failed to create the shared memory");
+        if(send_msg_to_client(socket_fd, &response) == -1)
+            fprintf(stderr, "kms server error: failed to respond to client KMS_REQUEST_TYPE_SUBSCRIBE request\n");
+    }
 }
 
 // static bool readlink_realpath(const char *filepath, char *buffer) {
@@ -501,6 +1126,13 @@ int main(int argc, char **argv) {
     drm.drmfd = 0;
     drm.planes = NULL;
 
+    kms_subscription subscription;
+    memset(&subscription, 0, sizeof(subscription));
+
+    drm_topology topology;
+    memset(&topology, 0, sizeof(topology));
+    topology.uevent_fd = -1;
+
     if(argc != 3) {
         fprintf(stderr, "usage: gsr-kms-server <domain_socket_path> <card_path>\n");
         return 1;
@@ -539,9 +1171,14 @@ int main(int argc, char **argv) {
         goto done;
     }
 
-    connector_to_crtc_map c2crtc_map;
-    c2crtc_map.num_maps = 0;
-    map_crtc_to_connector_ids(&drm, &c2crtc_map);
+    drm_topology_init(&topology);
+    if(!drm_topology_rebuild(&drm, &topology)) {
+        res = 2;
+        goto done;
+    }
+
+    client_framebuffer_cache fb_cache;
+    memset(&fb_cache, 0, sizeof(fb_cache));
 
     fprintf(stderr, "kms server info: connecting to the client\n");
     bool connected = false;
@@ -583,10 +1220,29 @@ int main(int argc, char **argv) {
     // }
 
     for(;;) {
+        if(subscription.active) {
+            const double time_now = clock_get_monotonic_seconds();
+            if(time_now >= subscription.next_update_time) {
+                kms_subscription_update(&subscription, &drm, &topology, &fb_cache, socket_fd);
+                subscription.next_update_time += subscription.update_interval;
+                /* Doesn't try to catch up if the update took too long */
+                if(subscription.next_update_time < time_now)
+                    subscription.next_update_time = time_now + subscription.update_interval;
+            }
+
+            struct pollfd poll_fd = { .fd = socket_fd, .events = POLLIN, .revents = 0 };
+            const double time_until_update = subscription.next_update_time - clock_get_monotonic_seconds();
+            const int timeout_ms = max_int(0, (int)(time_until_update * 1000.0 + 0.999));
+            if(poll(&poll_fd, 1, timeout_ms) <= 0)
+                continue;
+        }
+
         gsr_kms_request request;
         request.version = 0;
         request.type = -1;
         request.new_connection_fd = 0;
+        request.reset_framebuffer_cache = false;
+        request.update_rate = 0;
 
         const int recv_res = recv_msg_from_client(socket_fd, &request);
         if(recv_res == 0) {
@@ -618,6 +1274,8 @@ int main(int argc, char **argv) {
                 gsr_kms_response response;
                 response.version = GSR_KMS_PROTOCOL_VERSION;
                 response.num_items = 0;
+                response.num_removed_fb_ids = 0;
+                response.framebuffer_cache_cleared = false;
 
                 if(request.new_connection_fd > 0) {
                     if(socket_fd > 0)
@@ -641,13 +1299,14 @@ int main(int argc, char **argv) {
                 gsr_kms_response response;
                 response.version = GSR_KMS_PROTOCOL_VERSION;
                 response.num_items = 0;
+                response.num_removed_fb_ids = 0;
+                response.framebuffer_cache_cleared = false;
                 
-                if(kms_get_fb(&drm, &response, &c2crtc_map) == 0) {
-                    if(send_msg_to_client(socket_fd, &response) == -1)
-                        fprintf(stderr, "kms server error: failed to respond to client KMS_REQUEST_TYPE_GET_KMS request\n");
-                } else {
-                    if(send_msg_to_client(socket_fd, &response) == -1)
-                        fprintf(stderr, "kms server error: failed to respond to client KMS_REQUEST_TYPE_GET_KMS request\n");
+                kms_get_fb(&drm, &response, &topology, &fb_cache, request.reset_framebuffer_cache);
+                if(send_msg_to_client(socket_fd, &response) == -1) {
+                    fprintf(stderr, "kms server error: failed to respond to client KMS_REQUEST_TYPE_GET_KMS request\n");
+                    /* The client didn't get the dma bufs or the removed framebuffers */
+                    fb_cache.clear_on_next_response = true;
                 }
 
                 for(int i = 0; i < response.num_items; ++i) {
@@ -664,11 +1323,17 @@ int main(int argc, char **argv) {
 
                 break;
             }
+            case KMS_REQUEST_TYPE_SUBSCRIBE: {
+                kms_subscription_handle_request(&subscription, &request, socket_fd);
+                break;
+            }
             default: {
                 gsr_kms_response response;
                 response.version = GSR_KMS_PROTOCOL_VERSION;
                 response.result = KMS_RESULT_INVALID_REQUEST;
                 response.num_items = 0;
+                response.num_removed_fb_ids = 0;
+                response.framebuffer_cache_cleared = false;
 
                 snprintf(response.err_msg, sizeof(response.err_msg), "invalid request type %d, expected %d (%s)", request.type, KMS_REQUEST_TYPE_GET_KMS, "KMS_REQUEST_TYPE_GET_KMS");
                 fprintf(stderr, "kms server error: %s\n", response.err_msg);
@@ -681,6 +1346,8 @@ int main(int argc, char **argv) {
     }
 
     done:
+    kms_subscription_deinit(&subscription);
+    drm_topology_deinit(&topology);
     if(drm.planes)
         drmModeFreePlaneResources(drm.planes);
     if(drm.drmfd > 0)
@@ -0,0 +1,152 @@
+#include "../include/audio_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The loops are written so that the compiler can vectorize them */
+
+static void mix_add_interleaved_f32(float *restrict dst, const float *restrict src, int num_samples) {
+    for(int i = 0; i < num_samples; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+static void mix_add_interleaved_s16(float *restrict dst, const int16_t *restrict src, int num_samples) {
+    const float scale = 1.0f / 32768.0f;
+    for(int i = 0; i < num_samples; ++i) {
+        dst[i] += (float)src[i] * scale;
+    }
+}
+
+static void mix_add_planar_f32(float *restrict dst, const float *restrict src, int num_samples, int num_channels) {
+    for(int i = 0; i < num_samples; ++i) {
+        dst[i * num_channels] += src[i];
+    }
+}
+
+static void mix_output_interleaved_f32(float *restrict dst, const float *restrict src, int num_samples, float scale) {
+    for(int i = 0; i < num_samples; ++i) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+static void mix_output_interleaved_s16(int16_t *restrict dst, const float *restrict src, int num_samples, float scale) {
+    scale *= 32768.0f;
+    for(int i = 0; i < num_samples; ++i) {
+        float sample = src[i] * scale;
+        sample = sample < -32768.0f ? -32768.0f : sample;
+        sample = sample > 32767.0f ? 32767.0f : sample;
+        dst[i] = (int16_t)sample;
+    }
+}
+
+static void mix_output_planar_f32(float *restrict dst, const float *restrict src, int num_samples, int num_channels, float scale) {
+    for(int i = 0; i < num_samples; ++i) {
+        dst[i] = src[i * num_channels] * scale;
+    }
+}
+
+bool gsr_audio_mixer_init(gsr_audio_mixer *self, int num_sources, int num_samples, int num_channels, enum AVSampleFormat sample_format) {
+    memset(self, 0, sizeof(*self));
+    if(sample_format != AV_SAMPLE_FMT_FLT && sample_format != AV_SAMPLE_FMT_FLTP && sample_format != AV_SAMPLE_FMT_S16) {
+        fprintf(stderr, "gsr error: gsr_audio_mixer_init: unsupported sample format: %s\n", av_get_sample_fmt_name(sample_format));
+        return false;
+    }
+
+    self->num_sources = num_sources;
+    self->num_samples = num_samples;
+    self->num_channels = num_channels;
+    self->sample_format = sample_format;
+
+    self->pending_frames = calloc((size_t)GSR_AUDIO_MIXER_MAX_PENDING_FRAMES * num_samples * num_channels, sizeof(float));
+    self->source_next_frame_index = calloc(num_sources, sizeof(int64_t));
+    if(!self->pending_frames || !self->source_next_frame_index) {
+        fprintf(stderr, "gsr error: gsr_audio_mixer_init: failed to allocate memory\n");
+        gsr_audio_mixer_deinit(self);
+        return false;
+    }
+
+    return true;
+}
+
+void gsr_audio_mixer_deinit(gsr_audio_mixer *self) {
+    free(self->pending_frames);
+    free(self->source_next_frame_index);
+    memset(self, 0, sizeof(*self));
+}
+
+static float* gsr_audio_mixer_get_pending_frame(gsr_audio_mixer *self, int64_t frame_index) {
+    return self->pending_frames + (frame_index % GSR_AUDIO_MIXER_MAX_PENDING_FRAMES) * self->num_samples * self->num_channels;
+}
+
+void gsr_audio_mixer_add_frame(gsr_audio_mixer *self, int source_index, uint8_t *const *data) {
+    const int64_t frame_index = self->source_next_frame_index[source_index]++;
+    /* Can only happen if |gsr_audio_mixer_get_frame| isn't called after every added frame */
+    if(frame_index < self->first_pending_frame_index || frame_index >= self->first_pending_frame_index + GSR_AUDIO_MIXER_MAX_PENDING_FRAMES)
+        return;
+
+    float *pending_frame = gsr_audio_mixer_get_pending_frame(self, frame_index);
+    const int num_interleaved_samples = self->num_samples * self->num_channels;
+    switch(self->sample_format) {
+        case AV_SAMPLE_FMT_FLT:
+            mix_add_interleaved_f32(pending_frame, (const float*)data[0], num_interleaved_samples);
+            break;
+        case AV_SAMPLE_FMT_S16:
+            mix_add_interleaved_s16(pending_frame, (const int16_t*)data[0], num_interleaved_samples);
+            break;
+        case AV_SAMPLE_FMT_FLTP:
+            for(int channel = 0; channel < self->num_channels; ++channel) {
+                mix_add_planar_f32(pending_frame + channel, (const float*)data[channel], self->num_samples, self->num_channels);
+            }
+            break;
+        default:
+            break;
+    }
+    ++self->num_pending_frame_sources[frame_index % GSR_AUDIO_MIXER_MAX_PENDING_FRAMES];
+}
+
+bool gsr_audio_mixer_get_frame(gsr_audio_mixer *self, uint8_t *const *data) {
+    const int64_t frame_index = self->first_pending_frame_index;
+    int *num_frame_sources = &self->num_pending_frame_sources[frame_index % GSR_AUDIO_MIXER_MAX_PENDING_FRAMES];
+    if(*num_frame_sources < self->num_sources) {
+        int64_t newest_frame_index = frame_index;
+        for(int i = 0; i < self->num_sources; ++i) {
+            if(self->source_next_frame_index[i] - 1 > newest_frame_index)
+                newest_frame_index = self->source_next_frame_index[i] - 1;
+        }
+
+        if(newest_frame_index - frame_index < GSR_AUDIO_MIXER_MAX_PENDING_FRAMES - 1)
+            return false;
+
+        /* A source is too far behind. Skip this frame for that source, it will be silent in this frame */
+        for(int i = 0; i < self->num_sources; ++i) {
+            if(self->source_next_frame_index[i] <= frame_index)
+                self->source_next_frame_index[i] = frame_index + 1;
+        }
+    }
+
+    float *pending_frame = gsr_audio_mixer_get_pending_frame(self, frame_index);
+    const int num_interleaved_samples = self->num_samples * self->num_channels;
+    const float scale = 1.0f / (float)self->num_sources;
+    switch(self->sample_format) {
+        case AV_SAMPLE_FMT_FLT:
+            mix_output_interleaved_f32((float*)data[0], pending_frame, num_interleaved_samples, scale);
+            break;
+        case AV_SAMPLE_FMT_S16:
+            mix_output_interleaved_s16((int16_t*)data[0], pending_frame, num_interleaved_samples, scale);
+            break;
+        case AV_SAMPLE_FMT_FLTP:
+            for(int channel = 0; channel < self->num_channels; ++channel) {
+                mix_output_planar_f32((float*)data[channel], pending_frame + channel, self->num_samples, self->num_channels, scale);
+            }
+            break;
+        default:
+            break;
+    }
+
+    memset(pending_frame, 0, num_interleaved_samples * sizeof(float));
+    *num_frame_sources = 0;
+    ++self->first_pending_frame_index;
+    return true;
+}
@@ -48,6 +48,27 @@ bool gsr_capture_set_hdr_metadata(gsr_capture *cap, AVMasteringDisplayMetadata *
         return false;
 }
 
+int gsr_capture_get_damage_fd(gsr_capture *cap) {
+    if(cap->get_damage_fd)
+        return cap->get_damage_fd(cap);
+    else
+        return -1;
+}
+
+void gsr_capture_set_damage_regions(gsr_capture *cap, const gsr_rectangle *regions, int num_regions) {
+    if(cap->set_damage_regions)
+        cap->set_damage_regions(cap, regions, num_regions);
+}
+
+bool gsr_capture_get_frame_damage_regions(gsr_capture *cap, const gsr_rectangle **regions, int *num_regions) {
+    *regions = NULL;
+    *num_regions = 0;
+    if(cap->get_frame_damage_regions)
+        return cap->get_frame_damage_regions(cap, regions, num_regions);
+    else
+        return false;
+}
+
 void gsr_capture_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
     cap->destroy(cap, video_codec_context);
 }
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include <xf86drm.h>
 #include <libdrm/drm_fourcc.h>
@@ -24,17 +25,42 @@
 #define HDMI_EOTF_SMPTE_ST2084 2
 
 #define MAX_CONNECTOR_IDS 32
+/* Every monitor has a primary plane item in the kms response and can have a cursor plane item, so half of the items are left for the cursors */
+#define MAX_COMPOSITED_MONITORS (GSR_KMS_MAX_ITEMS / 2)
+/* The drawn monitors are tracked in a uint32_t bitmask */
+_Static_assert(MAX_COMPOSITED_MONITORS <= 32, "MAX_COMPOSITED_MONITORS doesn't fit in drawn_monitors_mask");
 
 typedef struct {
     uint32_t connector_ids[MAX_CONNECTOR_IDS];
     int num_connector_ids;
 } MonitorId;
 
+/* A monitor when all monitors are captured */
+typedef struct {
+    uint32_t connector_id;
+    vec2i pos;  /* Position in the captured image, the top left monitor is at 0,0 */
+    vec2i size; /* Rotated */
+    gsr_monitor_rotation rotation;
+} gsr_capture_kms_monitor;
+
+/* A framebuffer that the kms server has sent the dma bufs of, see gsr_kms_response_item */
+typedef struct {
+    uint32_t fb_id; /* 0 if unused */
+    int dma_buf_fds[GSR_KMS_MAX_DMA_BUFS];
+    int num_dma_buf_fds;
+    unsigned int texture_id; /* 0 until the framebuffer is drawn with opengl */
+    bool external_texture;
+    uint64_t last_used_frame;
+} gsr_capture_kms_framebuffer;
+
 typedef struct {
     gsr_capture_kms_params params;
     
     gsr_kms_client kms_client;
-    gsr_kms_response kms_response;
+    gsr_kms_response kms_response; /* The dma buf fds in this are owned by |framebuffers| */
+    gsr_capture_kms_framebuffer framebuffers[GSR_KMS_MAX_CACHED_FRAMEBUFFERS];
+    uint64_t frame_counter;
+    bool subscribed; /* The kms server pushes the plane state instead of it being requested every frame */
 
     vec2i capture_pos;
     vec2i capture_size;
@@ -42,9 +68,12 @@ typedef struct {
 
     gsr_monitor_rotation monitor_rotation;
 
-    unsigned int input_texture_id;
-    unsigned int external_input_texture_id;
-    unsigned int cursor_texture_id;
+    /* "screen" on wayland, where every monitor has its own plane. The monitors are drawn into one image where they are in the desktop */
+    bool capture_all_monitors;
+    gsr_capture_kms_monitor monitors[MAX_COMPOSITED_MONITORS];
+    int num_monitors;
+    uint32_t prev_drawn_monitors_mask;
+    bool all_monitors_cleared;
 
     bool no_modifiers_fallback;
     bool external_texture_fallback;
@@ -70,42 +99,122 @@ typedef struct {
     double last_time_monitor_check;
 } gsr_capture_kms;
 
-static void gsr_capture_kms_cleanup_kms_fds(gsr_capture_kms *self) {
-    for(int i = 0; i < self->kms_response.num_items; ++i) {
-        for(int j = 0; j < self->kms_response.items[i].num_dma_bufs; ++j) {
-            gsr_kms_response_dma_buf *dma_buf = &self->kms_response.items[i].dma_buf[j];
-            if(dma_buf->fd > 0) {
-                close(dma_buf->fd);
-                dma_buf->fd = -1;
-            }
-        }
-        self->kms_response.items[i].num_dma_bufs = 0;
+static void gsr_capture_kms_framebuffer_free(gsr_capture_kms *self, gsr_capture_kms_framebuffer *framebuffer) {
+    if(framebuffer->texture_id)
+        self->params.egl->glDeleteTextures(1, &framebuffer->texture_id);
+
+    for(int i = 0; i < framebuffer->num_dma_buf_fds; ++i) {
+        if(framebuffer->dma_buf_fds[i] > 0)
+            close(framebuffer->dma_buf_fds[i]);
     }
-    self->kms_response.num_items = 0;
+
+    memset(framebuffer, 0, sizeof(*framebuffer));
 }
 
-static void gsr_capture_kms_stop(gsr_capture_kms *self) {
-    if(self->input_texture_id) {
-        self->params.egl->glDeleteTextures(1, &self->input_texture_id);
-        self->input_texture_id = 0;
+static void gsr_capture_kms_clear_framebuffers(gsr_capture_kms *self) {
+    for(int i = 0; i < GSR_KMS_MAX_CACHED_FRAMEBUFFERS; ++i) {
+        if(self->framebuffers[i].fb_id)
+            gsr_capture_kms_framebuffer_free(self, &self->framebuffers[i]);
+    }
+}
+
+static gsr_capture_kms_framebuffer* gsr_capture_kms_find_framebuffer(gsr_capture_kms *self, uint32_t fb_id) {
+    for(int i = 0; i < GSR_KMS_MAX_CACHED_FRAMEBUFFERS; ++i) {
+        if(self->framebuffers[i].fb_id == fb_id)
+            return &self->framebuffers[i];
+    }
+    return NULL;
+}
+
+/* The server removes framebuffers before it sends more than GSR_KMS_MAX_CACHED_FRAMEBUFFERS, so the least recently used framebuffer is only removed here if the cache has been reset */
+static gsr_capture_kms_framebuffer* gsr_capture_kms_get_unused_framebuffer(gsr_capture_kms *self) {
+    gsr_capture_kms_framebuffer *least_recently_used = &self->framebuffers[0];
+    for(int i = 0; i < GSR_KMS_MAX_CACHED_FRAMEBUFFERS; ++i) {
+        if(!self->framebuffers[i].fb_id)
+            return &self->framebuffers[i];
+
+        if(self->framebuffers[i].last_used_frame < least_recently_used->last_used_frame)
+            least_recently_used = &self->framebuffers[i];
     }
 
-    if(self->external_input_texture_id) {
-        self->params.egl->glDeleteTextures(1, &self->external_input_texture_id);
-        self->external_input_texture_id = 0;
+    gsr_capture_kms_framebuffer_free(self, least_recently_used);
+    return least_recently_used;
+}
+
+/* Removes the framebuffers that the kms server removed and takes the dma buf fds of new framebuffers */
+static void gsr_capture_kms_apply_framebuffer_update(gsr_capture_kms *self, const gsr_kms_response *response) {
+    if(response->framebuffer_cache_cleared)
+        gsr_capture_kms_clear_framebuffers(self);
+
+    for(int i = 0; i < response->num_removed_fb_ids; ++i) {
+        gsr_capture_kms_framebuffer *framebuffer = gsr_capture_kms_find_framebuffer(self, response->removed_fb_ids[i]);
+        if(framebuffer)
+            gsr_capture_kms_framebuffer_free(self, framebuffer);
     }
 
-    if(self->cursor_texture_id) {
-        self->params.egl->glDeleteTextures(1, &self->cursor_texture_id);
-        self->cursor_texture_id = 0;
+    for(int i = 0; i < response->num_items; ++i) {
+        const gsr_kms_response_item *item = &response->items[i];
+        if(item->dma_buf_cached)
+            continue;
+
+        gsr_capture_kms_framebuffer *framebuffer = gsr_capture_kms_find_framebuffer(self, item->fb_id);
+        if(framebuffer)
+            gsr_capture_kms_framebuffer_free(self, framebuffer);
+
+        framebuffer = gsr_capture_kms_get_unused_framebuffer(self);
+        framebuffer->fb_id = item->fb_id;
+        for(int j = 0; j < item->num_dma_bufs; ++j) {
+            framebuffer->dma_buf_fds[j] = item->dma_buf[j].fd;
+        }
+        framebuffer->num_dma_buf_fds = item->num_dma_bufs;
+        /* The new framebuffer shouldn't be the least recently used one before it has been used */
+        framebuffer->last_used_frame = self->frame_counter;
     }
+}
 
+/* Takes the framebuffers that the kms server has pushed (in subscription mode) so that the server doesn't have to wait for the socket */
+static int gsr_capture_kms_receive_framebuffer_updates(gsr_capture_kms *self, uint32_t num_framebuffer_updates) {
+    gsr_kms_response update;
+    for(;;) {
+        const int res = gsr_kms_client_get_framebuffer_update(&self->kms_client, num_framebuffer_updates, &update);
+        if(res <= 0)
+            return res;
+        gsr_capture_kms_apply_framebuffer_update(self, &update);
+    }
+}
+
+/* Sets the dma buf fds of the framebuffers in the response. Items with framebuffers that were not received are removed */
+static void gsr_capture_kms_resolve_framebuffers(gsr_capture_kms *self) {
+    gsr_kms_response *response = &self->kms_response;
+    ++self->frame_counter;
+
+    for(int i = 0; i < response->num_items;) {
+        gsr_kms_response_item *item = &response->items[i];
+        gsr_capture_kms_framebuffer *framebuffer = gsr_capture_kms_find_framebuffer(self, item->fb_id);
+        if(!framebuffer) {
+            fprintf(stderr, "gsr error: gsr_capture_kms_resolve_framebuffers: framebuffer %u was not received before, getting all framebuffers again\n", item->fb_id);
+            gsr_kms_client_reset_framebuffer_cache(&self->kms_client);
+            memmove(&response->items[i], &response->items[i + 1], (response->num_items - i - 1) * sizeof(gsr_kms_response_item));
+            --response->num_items;
+            continue;
+        }
+
+        framebuffer->last_used_frame = self->frame_counter;
+        for(int j = 0; j < item->num_dma_bufs && j < framebuffer->num_dma_buf_fds; ++j) {
+            item->dma_buf[j].fd = framebuffer->dma_buf_fds[j];
+        }
+        ++i;
+    }
+}
+
+static void gsr_capture_kms_stop(gsr_capture_kms *self) {
+    self->subscribed = false;
     // if(self->drm_fd > 0) {
     //     close(self->drm_fd);
     //     self->drm_fd = -1;
     // }
 
-    gsr_capture_kms_cleanup_kms_fds(self);
+    gsr_capture_kms_clear_framebuffers(self);
     gsr_kms_client_deinit(&self->kms_client);
     gsr_cursor_deinit(&self->x11_cursor);
 }
@@ -114,33 +223,21 @@ static int max_int(int a, int b) {
     return a > b ? a : b;
 }
 
-static void gsr_capture_kms_create_input_texture_ids(gsr_capture_kms *self) {
-    self->params.egl->glGenTextures(1, &self->input_texture_id);
-    self->params.egl->glBindTexture(GL_TEXTURE_2D, self->input_texture_id);
-    self->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    self->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    self->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    self->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
-
-    self->params.egl->glGenTextures(1, &self->external_input_texture_id);
-    self->params.egl->glBindTexture(GL_TEXTURE_EXTERNAL_OES, self->external_input_texture_id);
-    self->params.egl->glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    self->params.egl->glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    self->params.egl->glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    self->params.egl->glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    self->params.egl->glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
-
-    const bool cursor_texture_id_is_external = self->params.egl->gpu_info.vendor == GSR_GPU_VENDOR_NVIDIA;
-    const int cursor_texture_id_target = cursor_texture_id_is_external ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
 
-    self->params.egl->glGenTextures(1, &self->cursor_texture_id);
-    self->params.egl->glBindTexture(cursor_texture_id_target, self->cursor_texture_id);
-    self->params.egl->glTexParameteri(cursor_texture_id_target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    self->params.egl->glTexParameteri(cursor_texture_id_target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    self->params.egl->glTexParameteri(cursor_texture_id_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    self->params.egl->glTexParameteri(cursor_texture_id_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    self->params.egl->glBindTexture(cursor_texture_id_target, 0);
+static unsigned int gsr_capture_kms_create_texture(gsr_capture_kms *self, bool external_texture) {
+    const int texture_target = external_texture ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+    unsigned int texture_id = 0;
+    self->params.egl->glGenTextures(1, &texture_id);
+    self->params.egl->glBindTexture(texture_target, texture_id);
+    self->params.egl->glTexParameteri(texture_target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    self->params.egl->glTexParameteri(texture_target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    self->params.egl->glTexParameteri(texture_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    self->params.egl->glTexParameteri(texture_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    self->params.egl->glBindTexture(texture_target, 0);
+    return texture_id;
 }
 
 /* TODO: On monitor reconfiguration, find monitor x, y, width and height again. Do the same for nvfbc. */
@@ -168,20 +265,101 @@ static void monitor_callback(const gsr_monitor *monitor, void *userdata) {
         fprintf(stderr, "gsr warning: reached max connector ids\n");
 }
 
+static vec2i rotate_size_if_rotated(gsr_monitor_rotation rotation, vec2i size) {
+    if(rotation == GSR_MONITOR_ROT_90 || rotation == GSR_MONITOR_ROT_270) {
+        int tmp_x = size.x;
+        size.x = size.y;
+        size.y = tmp_x;
+    }
+    return size;
+}
+
 static vec2i rotate_capture_size_if_rotated(gsr_capture_kms *self, vec2i capture_size) {
-    if(self->monitor_rotation == GSR_MONITOR_ROT_90 || self->monitor_rotation == GSR_MONITOR_ROT_270) {
-        int tmp_x = capture_size.x;
-        capture_size.x = capture_size.y;
-        capture_size.y = tmp_x;
+    return rotate_size_if_rotated(self->monitor_rotation, capture_size);
+}
+
+typedef struct {
+    gsr_monitor monitors[MAX_COMPOSITED_MONITORS];
+    char monitor_names[MAX_COMPOSITED_MONITORS][64];
+    int num_monitors;
+} AllMonitorsCallbackUserdata;
+
+static void all_monitors_callback(const gsr_monitor *monitor, void *userdata) {
+    AllMonitorsCallbackUserdata *all_monitors = userdata;
+    if(all_monitors->num_monitors == MAX_COMPOSITED_MONITORS) {
+        fprintf(stderr, "gsr warning: only %d monitors can be captured at the same time, ignoring monitor %.*s\n", MAX_COMPOSITED_MONITORS, monitor->name_len, monitor->name);
+        return;
     }
-    return capture_size;
+
+    /* The name is only valid in the callback */
+    const int index = all_monitors->num_monitors++;
+    snprintf(all_monitors->monitor_names[index], sizeof(all_monitors->monitor_names[index]), "%.*s", monitor->name_len, monitor->name);
+    all_monitors->monitors[index] = *monitor;
+    all_monitors->monitors[index].name = all_monitors->monitor_names[index];
+    all_monitors->monitors[index].name_len = strlen(all_monitors->monitor_names[index]);
+}
+
+/* Lays out the monitors like they are in the desktop, which the display server knows (drm doesn't) */
+static bool gsr_capture_kms_init_all_monitors(gsr_capture_kms *self) {
+    AllMonitorsCallbackUserdata all_monitors;
+    all_monitors.num_monitors = 0;
+    for_each_active_monitor_output(self->params.egl->window, self->params.egl->card_path, GSR_CONNECTION_DRM, all_monitors_callback, &all_monitors);
+    if(all_monitors.num_monitors == 0) {
+        fprintf(stderr, "gsr error: gsr_capture_kms_init_all_monitors: no monitors found\n");
+        return false;
+    }
+
+    /*
+        The wayland output positions are in logical (scaled) coordinates while the framebuffers are in pixels, so the positions are multiplied by the largest output scale.
+        A monitor is never larger than its logical size times the largest scale so the monitors don't overlap, but monitors with a smaller scale (or a fractional scale) get black space next to them.
+    */
+    int scales[MAX_COMPOSITED_MONITORS];
+    int max_scale = 1;
+    for(int i = 0; i < all_monitors.num_monitors; ++i) {
+        scales[i] = drm_monitor_get_display_server_scale(self->params.egl->window, &all_monitors.monitors[i]);
+        max_scale = max_int(max_scale, scales[i]);
+    }
+
+    for(int i = 0; i < all_monitors.num_monitors; ++i) {
+        if(scales[i] != max_scale) {
+            fprintf(stderr, "gsr warning: gsr_capture_kms_init_all_monitors: the monitors have different scales, there will be black space next to the monitors with a smaller scale\n");
+            break;
+        }
+    }
+
+    vec2i top_left = { INT_MAX, INT_MAX };
+    vec2i bottom_right = { INT_MIN, INT_MIN };
+    for(int i = 0; i < all_monitors.num_monitors; ++i) {
+        const gsr_monitor *monitor = &all_monitors.monitors[i];
+        gsr_capture_kms_monitor *capture_monitor = &self->monitors[i];
+        capture_monitor->connector_id = monitor->connector_id;
+        capture_monitor->rotation = drm_monitor_get_display_server_rotation(self->params.egl->window, monitor);
+        capture_monitor->size = rotate_size_if_rotated(capture_monitor->rotation, monitor->size);
+        capture_monitor->pos = drm_monitor_get_display_server_position(self->params.egl->window, monitor);
+        capture_monitor->pos.x *= max_scale;
+        capture_monitor->pos.y *= max_scale;
+
+        top_left.x = min_int(top_left.x, capture_monitor->pos.x);
+        top_left.y = min_int(top_left.y, capture_monitor->pos.y);
+        bottom_right.x = max_int(bottom_right.x, capture_monitor->pos.x + capture_monitor->size.x);
+        bottom_right.y = max_int(bottom_right.y, capture_monitor->pos.y + capture_monitor->size.y);
+    }
+
+    self->num_monitors = all_monitors.num_monitors;
+    for(int i = 0; i < self->num_monitors; ++i) {
+        self->monitors[i].pos.x -= top_left.x;
+        self->monitors[i].pos.y -= top_left.y;
+    }
+
+    self->monitor_rotation = GSR_MONITOR_ROT_0;
+    self->capture_pos = (vec2i){ 0, 0 };
+    self->capture_size = (vec2i){ bottom_right.x - top_left.x, bottom_right.y - top_left.y };
+    return true;
 }
 
 static int gsr_capture_kms_start(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame *frame) {
     gsr_capture_kms *self = cap->priv;
 
-    gsr_capture_kms_create_input_texture_ids(self);
-
     gsr_monitor monitor;
     self->monitor_id.num_connector_ids = 0;
 
@@ -196,28 +374,36 @@ static int gsr_capture_kms_start(gsr_capture *cap, AVCodecContext *video_codec_c
         gsr_cursor_init(&self->x11_cursor, self->params.egl, display);
     }
 
-    MonitorCallbackUserdata monitor_callback_userdata = {
-        &self->monitor_id,
-        self->params.display_to_capture, strlen(self->params.display_to_capture),
-        0,
-    };
-    for_each_active_monitor_output(self->params.egl->window, self->params.egl->card_path, connection_type, monitor_callback, &monitor_callback_userdata);
-
-    if(!get_monitor_by_name(self->params.egl, connection_type, self->params.display_to_capture, &monitor)) {
-        fprintf(stderr, "gsr error: gsr_capture_kms_start: failed to find monitor by name \"%s\"\n", self->params.display_to_capture);
-        gsr_capture_kms_stop(self);
-        return -1;
-    }
+    self->capture_all_monitors = !self->is_x11 && strcmp(self->params.display_to_capture, "screen") == 0;
+    if(self->capture_all_monitors) {
+        if(!gsr_capture_kms_init_all_monitors(self)) {
+            gsr_capture_kms_stop(self);
+            return -1;
+        }
+    } else {
+        MonitorCallbackUserdata monitor_callback_userdata = {
+            &self->monitor_id,
+            self->params.display_to_capture, strlen(self->params.display_to_capture),
+            0,
+        };
+        for_each_active_monitor_output(self->params.egl->window, self->params.egl->card_path, connection_type, monitor_callback, &monitor_callback_userdata);
+
+        if(!get_monitor_by_name(self->params.egl, connection_type, self->params.display_to_capture, &monitor)) {
+            fprintf(stderr, "gsr error: gsr_capture_kms_start: failed to find monitor by name \"%s\"\n", self->params.display_to_capture);
+            gsr_capture_kms_stop(self);
+            return -1;
+        }
 
-    monitor.name = self->params.display_to_capture;
-    self->monitor_rotation = drm_monitor_get_display_server_rotation(self->params.egl->window, &monitor);
+        monitor.name = self->params.display_to_capture;
+        self->monitor_rotation = drm_monitor_get_display_server_rotation(self->params.egl->window, &monitor);
 
-    self->capture_pos = monitor.pos;
-    /* Monitor size is already rotated on x11 when the monitor is rotated, no need to apply it ourselves */
-    if(self->is_x11)
-        self->capture_size = monitor.size;
-    else
-        self->capture_size = rotate_capture_size_if_rotated(self, monitor.size);
+        self->capture_pos = monitor.pos;
+        /* Monitor size is already rotated on x11 when the monitor is rotated, no need to apply it ourselves */
+        if(self->is_x11)
+            self->capture_size = monitor.size;
+        else
+            self->capture_size = rotate_capture_size_if_rotated(self, monitor.size);
+    }
 
     /* Disable vsync */
     self->params.egl->eglSwapInterval(self->params.egl->egl_display, 0);
@@ -241,11 +427,29 @@ static int gsr_capture_kms_start(gsr_capture *cap, AVCodecContext *video_codec_c
     frame->width = video_codec_context->width;
     frame->height = video_codec_context->height;
 
+    /* Checks the planes twice per frame so that a new frame is seen without up to a frame of delay */
+    self->subscribed = gsr_kms_client_subscribe(&self->kms_client, max_int(1, self->params.fps * 2)) == 0;
+    if(!self->subscribed)
+        fprintf(stderr, "gsr warning: gsr_capture_kms_start: failed to subscribe to plane changes, requesting planes every frame instead\n");
+
     self->video_codec_context = video_codec_context;
     self->last_time_monitor_check = clock_get_monotonic_seconds();
     return 0;
 }
 
+static void gsr_capture_kms_tick(gsr_capture *cap) {
+    gsr_capture_kms *self = cap->priv;
+    if(!self->subscribed)
+        return;
+
+    if(gsr_capture_kms_receive_framebuffer_updates(self, gsr_kms_client_get_num_framebuffer_updates(&self->kms_client)) != 0)
+        return;
+
+    /* The update event is only consumed by |clear_damage|, this makes sure that the main loop isn't woken up again for a state that has already been captured */
+    if(!gsr_kms_client_has_new_state(&self->kms_client))
+        gsr_kms_client_clear_update_event(&self->kms_client);
+}
+
 static void gsr_capture_kms_on_event(gsr_capture *cap, gsr_egl *egl) {
     gsr_capture_kms *self = cap->priv;
     if(!self->is_x11)
@@ -344,7 +548,19 @@ static vec2i swap_vec2i(vec2i value) {
     return value;
 }
 
-static EGLImage gsr_capture_kms_create_egl_image(gsr_capture_kms *self, const gsr_kms_response_item *drm_fd, const int *fds, const uint32_t *offsets, const uint32_t *pitches, const uint64_t *modifiers, bool use_modifiers) {
+static EGLImage gsr_capture_kms_create_egl_image(gsr_capture_kms *self, const gsr_kms_response_item *drm_fd, bool use_modifiers) {
+    int fds[GSR_KMS_MAX_DMA_BUFS];
+    uint32_t offsets[GSR_KMS_MAX_DMA_BUFS];
+    uint32_t pitches[GSR_KMS_MAX_DMA_BUFS];
+    uint64_t modifiers[GSR_KMS_MAX_DMA_BUFS];
+
+    for(int i = 0; i < drm_fd->num_dma_bufs; ++i) {
+        fds[i] = drm_fd->dma_buf[i].fd;
+        offsets[i] = drm_fd->dma_buf[i].offset;
+        pitches[i] = drm_fd->dma_buf[i].pitch;
+        modifiers[i] = drm_fd->modifier;
+    }
+
     intptr_t img_attr[44];
     setup_dma_buf_attrs(img_attr, drm_fd->pixel_format, drm_fd->width, drm_fd->height, fds, offsets, pitches, modifiers, drm_fd->num_dma_bufs, use_modifiers);
     while(self->params.egl->eglGetError() != EGL_SUCCESS){}
@@ -377,27 +593,15 @@ static EGLImage gsr_capture_kms_create_egl_image_with_fallback(gsr_capture_kms *
     // Assertion pic->display_order == pic->encode_order failed at libavcodec/vaapi_encode_h265.c:765
     // kms server info: kms client shutdown, shutting down the server
 
-    int fds[GSR_KMS_MAX_DMA_BUFS];
-    uint32_t offsets[GSR_KMS_MAX_DMA_BUFS];
-    uint32_t pitches[GSR_KMS_MAX_DMA_BUFS];
-    uint64_t modifiers[GSR_KMS_MAX_DMA_BUFS];
-
-    for(int i = 0; i < drm_fd->num_dma_bufs; ++i) {
-        fds[i] = drm_fd->dma_buf[i].fd;
-        offsets[i] = drm_fd->dma_buf[i].offset;
-        pitches[i] = drm_fd->dma_buf[i].pitch;
-        modifiers[i] = drm_fd->modifier;
-    }
-
     EGLImage image = NULL;
     if(self->no_modifiers_fallback) {
-        image = gsr_capture_kms_create_egl_image(self, drm_fd, fds, offsets, pitches, modifiers, false);
+        image = gsr_capture_kms_create_egl_image(self, drm_fd, false);
     } else {
-        image = gsr_capture_kms_create_egl_image(self, drm_fd, fds, offsets, pitches, modifiers, true);
+        image = gsr_capture_kms_create_egl_image(self, drm_fd, true);
         if(!image) {
             fprintf(stderr, "gsr error: gsr_capture_kms_create_egl_image_with_fallback: failed to create egl image with modifiers, trying without modifiers\n");
             self->no_modifiers_fallback = true;
-            image = gsr_capture_kms_create_egl_image(self, drm_fd, fds, offsets, pitches, modifiers, false);
+            image = gsr_capture_kms_create_egl_image(self, drm_fd, false);
         }
     }
     return image;
@@ -413,16 +617,52 @@ static bool gsr_capture_kms_bind_image_to_texture(gsr_capture_kms *self, EGLImag
     return success;
 }
 
-static void gsr_capture_kms_bind_image_to_input_texture_with_fallback(gsr_capture_kms *self, EGLImage image) {
-    if(self->external_texture_fallback) {
-        gsr_capture_kms_bind_image_to_texture(self, image, self->external_input_texture_id, true);
-    } else {
-        if(!gsr_capture_kms_bind_image_to_texture(self, image, self->input_texture_id, false)) {
-            fprintf(stderr, "gsr error: gsr_capture_kms_capture: failed to bind image to texture, trying with external texture\n");
-            self->external_texture_fallback = true;
-            gsr_capture_kms_bind_image_to_texture(self, image, self->external_input_texture_id, true);
+static void gsr_capture_kms_bind_image_to_framebuffer_texture_with_fallback(gsr_capture_kms *self, EGLImage image, gsr_capture_kms_framebuffer *framebuffer) {
+    if(!self->external_texture_fallback) {
+        framebuffer->texture_id = gsr_capture_kms_create_texture(self, false);
+        framebuffer->external_texture = false;
+        if(gsr_capture_kms_bind_image_to_texture(self, image, framebuffer->texture_id, false))
+            return;
+
+        fprintf(stderr, "gsr error: gsr_capture_kms_capture: failed to bind image to texture, trying with external texture\n");
+        self->external_texture_fallback = true;
+        self->params.egl->glDeleteTextures(1, &framebuffer->texture_id);
+    }
+
+    framebuffer->texture_id = gsr_capture_kms_create_texture(self, true);
+    framebuffer->external_texture = true;
+    gsr_capture_kms_bind_image_to_texture(self, image, framebuffer->texture_id, true);
+}
+
+/*
+    The framebuffer is imported the first time it's drawn and the texture is kept until the kms server removes the framebuffer,
+    since compositors flip between a few framebuffers. Returns 0 if the framebuffer can't be imported.
+*/
+static unsigned int gsr_capture_kms_get_framebuffer_texture(gsr_capture_kms *self, const gsr_kms_response_item *drm_fd, bool *external_texture) {
+    *external_texture = false;
+    gsr_capture_kms_framebuffer *framebuffer = gsr_capture_kms_find_framebuffer(self, drm_fd->fb_id);
+    if(!framebuffer)
+        return 0;
+
+    if(!framebuffer->texture_id) {
+        EGLImage image = drm_fd->is_cursor ? gsr_capture_kms_create_egl_image(self, drm_fd, true) : gsr_capture_kms_create_egl_image_with_fallback(self, drm_fd);
+        if(!image)
+            return 0;
+
+        if(drm_fd->is_cursor) {
+            framebuffer->external_texture = self->params.egl->gpu_info.vendor == GSR_GPU_VENDOR_NVIDIA;
+            framebuffer->texture_id = gsr_capture_kms_create_texture(self, framebuffer->external_texture);
+            gsr_capture_kms_bind_image_to_texture(self, image, framebuffer->texture_id, framebuffer->external_texture);
+        } else {
+            gsr_capture_kms_bind_image_to_framebuffer_texture_with_fallback(self, image, framebuffer);
         }
+
+        /* The texture keeps the buffer */
+        self->params.egl->eglDestroyImage(self->params.egl->egl_display, image);
     }
+
+    *external_texture = framebuffer->external_texture;
+    return framebuffer->texture_id;
 }
 
 static gsr_kms_response_item* find_monitor_drm(gsr_capture_kms *self, bool *capture_is_combined_plane) {
@@ -451,35 +691,41 @@ static gsr_kms_response_item* find_cursor_drm_if_on_monitor(gsr_capture_kms *sel
     return cursor_drm_fd;
 }
 
-static void render_drm_cursor(gsr_capture_kms *self, gsr_color_conversion *color_conversion, const gsr_kms_response_item *cursor_drm_fd, vec2i target_pos, float texture_rotation, vec2i output_size) {
+/* |monitor_size| is the rotated size of the monitor that the cursor is on, which is drawn at |target_pos| with the size |output_size| */
+static void render_drm_cursor(gsr_capture_kms *self, gsr_color_conversion *color_conversion, const gsr_kms_response_item *cursor_drm_fd, gsr_monitor_rotation monitor_rotation, vec2i monitor_size, vec2i target_pos, vec2i output_size) {
     const vec2d scale = {
-        self->capture_size.x == 0 ? 0 : (double)output_size.x / (double)self->capture_size.x,
-        self->capture_size.y == 0 ? 0 : (double)output_size.y / (double)self->capture_size.y
+        monitor_size.x == 0 ? 0 : (double)output_size.x / (double)monitor_size.x,
+        monitor_size.y == 0 ? 0 : (double)output_size.y / (double)monitor_size.y
     };
+    const float texture_rotation = monitor_rotation_to_radians(monitor_rotation);
+
+    bool cursor_texture_id_is_external = false;
+    const unsigned int cursor_texture_id = gsr_capture_kms_get_framebuffer_texture(self, cursor_drm_fd, &cursor_texture_id_is_external);
+    if(!cursor_texture_id)
+        return;
 
-    const bool cursor_texture_id_is_external = self->params.egl->gpu_info.vendor == GSR_GPU_VENDOR_NVIDIA;
     const vec2i cursor_size = {cursor_drm_fd->width, cursor_drm_fd->height};
 
     vec2i cursor_pos = {cursor_drm_fd->x, cursor_drm_fd->y};
-    switch(self->monitor_rotation) {
+    switch(monitor_rotation) {
         case GSR_MONITOR_ROT_0:
             break;
         case GSR_MONITOR_ROT_90:
             cursor_pos = swap_vec2i(cursor_pos);
-            cursor_pos.x = self->capture_size.x - cursor_pos.x;
+            cursor_pos.x = monitor_size.x - cursor_pos.x;
             // TODO: Remove this horrible hack
             cursor_pos.x -= cursor_size.x;
             break;
         case GSR_MONITOR_ROT_180:
-            cursor_pos.x = self->capture_size.x - cursor_pos.x;
-            cursor_pos.y = self->capture_size.y - cursor_pos.y;
+            cursor_pos.x = monitor_size.x - cursor_pos.x;
+            cursor_pos.y = monitor_size.y - cursor_pos.y;
             // TODO: Remove this horrible hack
             cursor_pos.x -= cursor_size.x;
             cursor_pos.y -= cursor_size.y;
             break;
         case GSR_MONITOR_ROT_270:
             cursor_pos = swap_vec2i(cursor_pos);
-            cursor_pos.y = self->capture_size.y - cursor_pos.y;
+            cursor_pos.y = monitor_size.y - cursor_pos.y;
             // TODO: Remove this horrible hack
             cursor_pos.y -= cursor_size.y;
             break;
@@ -491,40 +737,14 @@ static void render_drm_cursor(gsr_capture_kms *self, gsr_color_conversion *color
     cursor_pos.x += target_pos.x;
     cursor_pos.y += target_pos.y;
 
-    int fds[GSR_KMS_MAX_DMA_BUFS];
-    uint32_t offsets[GSR_KMS_MAX_DMA_BUFS];
-    uint32_t pitches[GSR_KMS_MAX_DMA_BUFS];
-    uint64_t modifiers[GSR_KMS_MAX_DMA_BUFS];
+    gsr_color_conversion_set_clip(color_conversion, &(gsr_rectangle){ target_pos, output_size });
 
-    for(int i = 0; i < cursor_drm_fd->num_dma_bufs; ++i) {
-        fds[i] = cursor_drm_fd->dma_buf[i].fd;
-        offsets[i] = cursor_drm_fd->dma_buf[i].offset;
-        pitches[i] = cursor_drm_fd->dma_buf[i].pitch;
-        modifiers[i] = cursor_drm_fd->modifier;
-    }
-
-    intptr_t img_attr_cursor[44];
-    setup_dma_buf_attrs(img_attr_cursor, cursor_drm_fd->pixel_format, cursor_drm_fd->width, cursor_drm_fd->height,
-        fds, offsets, pitches, modifiers, cursor_drm_fd->num_dma_bufs, true);
-
-    EGLImage cursor_image = self->params.egl->eglCreateImage(self->params.egl->egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr_cursor);
-    const int target = cursor_texture_id_is_external ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
-    self->params.egl->glBindTexture(target, self->cursor_texture_id);
-    self->params.egl->glEGLImageTargetTexture2DOES(target, cursor_image);
-    self->params.egl->glBindTexture(target, 0);
-
-    if(cursor_image)
-        self->params.egl->eglDestroyImage(self->params.egl->egl_display, cursor_image);
-
-    self->params.egl->glEnable(GL_SCISSOR_TEST);
-    self->params.egl->glScissor(target_pos.x, target_pos.y, output_size.x, output_size.y);
-
-    gsr_color_conversion_draw(color_conversion, self->cursor_texture_id,
+    gsr_color_conversion_draw_batched(color_conversion, cursor_texture_id,
         cursor_pos, (vec2i){cursor_size.x * scale.x, cursor_size.y * scale.y},
         (vec2i){0, 0}, cursor_size,
         texture_rotation, cursor_texture_id_is_external, GSR_SOURCE_COLOR_RGB);
 
-    self->params.egl->glDisable(GL_SCISSOR_TEST);
+    gsr_color_conversion_set_clip(color_conversion, NULL);
 }
 
 static void render_x11_cursor(gsr_capture_kms *self, gsr_color_conversion *color_conversion, vec2i capture_pos, vec2i target_pos, vec2i output_size) {
@@ -544,15 +764,14 @@ static void render_x11_cursor(gsr_capture_kms *self, gsr_color_conversion *color
         target_pos.y + (self->x11_cursor.position.y - self->x11_cursor.hotspot.y - capture_pos.y) * scale.y
     };
 
-    self->params.egl->glEnable(GL_SCISSOR_TEST);
-    self->params.egl->glScissor(target_pos.x, target_pos.y, output_size.x, output_size.y);
+    gsr_color_conversion_set_clip(color_conversion, &(gsr_rectangle){ target_pos, output_size });
 
-    gsr_color_conversion_draw(color_conversion, self->x11_cursor.texture_id,
+    gsr_color_conversion_draw_batched(color_conversion, self->x11_cursor.texture_id,
         cursor_pos, (vec2i){self->x11_cursor.size.x * scale.x, self->x11_cursor.size.y * scale.y},
         (vec2i){0, 0}, self->x11_cursor.size,
         0.0f, false, GSR_SOURCE_COLOR_RGB);
 
-    self->params.egl->glDisable(GL_SCISSOR_TEST);
+    gsr_color_conversion_set_clip(color_conversion, NULL);
 }
 
 static void gsr_capture_kms_update_capture_size_change(gsr_capture_kms *self, gsr_color_conversion *color_conversion, vec2i target_pos, const gsr_kms_response_item *drm_fd) {
@@ -612,16 +831,126 @@ static void gsr_capture_kms_fail_fast_path_if_not_fast(gsr_capture_kms *self, ui
     }
 }
 
+static int gsr_capture_kms_find_monitor_index_by_connector_id(const gsr_capture_kms *self, uint32_t connector_id) {
+    for(int i = 0; i < self->num_monitors; ++i) {
+        if(self->monitors[i].connector_id == connector_id)
+            return i;
+    }
+    return -1;
+}
+
+/* Draws the primary plane of every monitor and the cursor with one batch */
+static int gsr_capture_kms_capture_all_monitors(gsr_capture_kms *self, AVFrame *frame, gsr_color_conversion *color_conversion) {
+    const bool is_scaled = self->params.output_resolution.x > 0 && self->params.output_resolution.y > 0;
+    vec2i output_size = is_scaled ? self->params.output_resolution : self->capture_size;
+    output_size = scale_keep_aspect_ratio(self->capture_size, output_size);
+
+    const vec2d scale = {
+        self->capture_size.x == 0 ? 0 : (double)output_size.x / (double)self->capture_size.x,
+        self->capture_size.y == 0 ? 0 : (double)output_size.y / (double)self->capture_size.y
+    };
+    const vec2i target_pos = { max_int(0, frame->width / 2 - output_size.x / 2), max_int(0, frame->height / 2 - output_size.y / 2) };
+
+    const gsr_kms_response_item *monitor_drm_fds[MAX_COMPOSITED_MONITORS];
+    uint32_t drawn_monitors_mask = 0;
+    for(int i = 0; i < self->num_monitors; ++i) {
+        monitor_drm_fds[i] = find_drm_by_connector_id(&self->kms_response, self->monitors[i].connector_id);
+        if(monitor_drm_fds[i])
+            drawn_monitors_mask |= 1u << i;
+    }
+
+    if(drawn_monitors_mask == 0)
+        return -1;
+
+    /* The area between monitors of different sizes and monitors that are turned off would otherwise keep what was drawn there before */
+    if(!self->all_monitors_cleared || drawn_monitors_mask != self->prev_drawn_monitors_mask) {
+        self->all_monitors_cleared = true;
+        self->prev_drawn_monitors_mask = drawn_monitors_mask;
+        gsr_color_conversion_clear(color_conversion);
+    }
+
+    for(int i = 0; i < self->num_monitors; ++i) {
+        const gsr_kms_response_item *drm_fd = monitor_drm_fds[i];
+        if(drm_fd && drm_fd->has_hdr_metadata && self->params.hdr && hdr_metadata_is_supported_format(&drm_fd->hdr_metadata)) {
+            gsr_kms_set_hdr_metadata(self, drm_fd);
+            break;
+        }
+    }
+
+    self->params.egl->glFlush();
+    self->params.egl->glFinish();
+
+    for(int i = 0; i < self->num_monitors; ++i) {
+        const gsr_kms_response_item *drm_fd = monitor_drm_fds[i];
+        if(!drm_fd)
+            continue;
+
+        bool external_texture = false;
+        const unsigned int texture_id = gsr_capture_kms_get_framebuffer_texture(self, drm_fd, &external_texture);
+        if(!texture_id)
+            continue;
+
+        const gsr_capture_kms_monitor *monitor = &self->monitors[i];
+        const vec2i monitor_target_pos = { target_pos.x + monitor->pos.x * scale.x, target_pos.y + monitor->pos.y * scale.y };
+        const vec2i monitor_output_size = { monitor->size.x * scale.x, monitor->size.y * scale.y };
+        gsr_color_conversion_draw_batched(color_conversion, texture_id,
+            monitor_target_pos, monitor_output_size,
+            (vec2i){drm_fd->x, drm_fd->y}, rotate_size_if_rotated(monitor->rotation, (vec2i){drm_fd->src_w, drm_fd->src_h}),
+            monitor_rotation_to_radians(monitor->rotation), external_texture, GSR_SOURCE_COLOR_RGB);
+    }
+
+    if(self->params.record_cursor) {
+        for(int i = 0; i < self->kms_response.num_items; ++i) {
+            const gsr_kms_response_item *cursor_drm_fd = &self->kms_response.items[i];
+            if(!cursor_drm_fd->is_cursor)
+                continue;
+
+            const int monitor_index = gsr_capture_kms_find_monitor_index_by_connector_id(self, cursor_drm_fd->connector_id);
+            if(monitor_index == -1 || !monitor_drm_fds[monitor_index])
+                continue;
+
+            const gsr_capture_kms_monitor *monitor = &self->monitors[monitor_index];
+            const vec2i monitor_target_pos = { target_pos.x + monitor->pos.x * scale.x, target_pos.y + monitor->pos.y * scale.y };
+            const vec2i monitor_output_size = { monitor->size.x * scale.x, monitor->size.y * scale.y };
+            render_drm_cursor(self, color_conversion, cursor_drm_fd, monitor->rotation, monitor->size, monitor_target_pos, monitor_output_size);
+        }
+    }
+
+    gsr_color_conversion_flush(color_conversion);
+    self->params.egl->glFlush();
+    self->params.egl->glFinish();
+
+    return 0;
+}
+
 static int gsr_capture_kms_capture(gsr_capture *cap, AVFrame *frame, gsr_color_conversion *color_conversion) {
     gsr_capture_kms *self = cap->priv;
 
-    gsr_capture_kms_cleanup_kms_fds(self);
+    if(self->subscribed) {
+        uint32_t num_framebuffer_updates = 0;
+        if(!gsr_kms_client_get_state(&self->kms_client, &self->kms_response, &num_framebuffer_updates)) {
+            fprintf(stderr, "gsr error: gsr_capture_kms_capture: no plane state has been received from the kms server\n");
+            self->kms_response.num_items = 0;
+            return -1;
+        }
 
-    if(gsr_kms_client_get_kms(&self->kms_client, &self->kms_response) != 0) {
-        fprintf(stderr, "gsr error: gsr_capture_kms_capture: failed to get kms, error: %d (%s)\n", self->kms_response.result, self->kms_response.err_msg);
-        return -1;
+        if(gsr_capture_kms_receive_framebuffer_updates(self, num_framebuffer_updates) != 0) {
+            fprintf(stderr, "gsr error: gsr_capture_kms_capture: failed to receive framebuffers\n");
+            self->kms_response.num_items = 0;
+            return -1;
+        }
+    } else {
+        if(gsr_kms_client_get_kms(&self->kms_client, &self->kms_response) != 0) {
+            fprintf(stderr, "gsr error: gsr_capture_kms_capture: failed to get kms, error: %d (%s)\n", self->kms_response.result, self->kms_response.err_msg);
+            self->kms_response.num_items = 0;
+            return -1;
+        }
+
+        gsr_capture_kms_apply_framebuffer_update(self, &self->kms_response);
     }
 
+    gsr_capture_kms_resolve_framebuffers(self);
+
     if(self->kms_response.num_items == 0) {
         static bool error_shown = false;
         if(!error_shown) {
@@ -631,14 +960,15 @@ static int gsr_capture_kms_capture(gsr_capture *cap, AVFrame *frame, gsr_color_c
         return -1;
     }
 
+    if(self->capture_all_monitors)
+        return gsr_capture_kms_capture_all_monitors(self, frame, color_conversion);
+
     gsr_capture_kms_update_connector_ids(self);
 
     bool capture_is_combined_plane = false;
     const gsr_kms_response_item *drm_fd = find_monitor_drm(self, &capture_is_combined_plane);
-    if(!drm_fd) {
-        gsr_capture_kms_cleanup_kms_fds(self);
+    if(!drm_fd)
         return -1;
-    }
 
     if(drm_fd->has_hdr_metadata && self->params.hdr && hdr_metadata_is_supported_format(&drm_fd->hdr_metadata))
         gsr_kms_set_hdr_metadata(self, drm_fd);
@@ -690,16 +1020,14 @@ static int gsr_capture_kms_capture(gsr_capture *cap, AVFrame *frame, gsr_color_c
     }
 
     if(self->fast_path_failed) {
-        EGLImage image = gsr_capture_kms_create_egl_image_with_fallback(self, drm_fd);
-        if(image) {
-            gsr_capture_kms_bind_image_to_input_texture_with_fallback(self, image);
-            self->params.egl->eglDestroyImage(self->params.egl->egl_display, image);
+        bool external_texture = false;
+        const unsigned int texture_id = gsr_capture_kms_get_framebuffer_texture(self, drm_fd, &external_texture);
+        if(texture_id) {
+            gsr_color_conversion_draw_batched(color_conversion, texture_id,
+                target_pos, output_size,
+                capture_pos, self->capture_size,
+                texture_rotation, external_texture, GSR_SOURCE_COLOR_RGB);
         }
-
-        gsr_color_conversion_draw(color_conversion, self->external_texture_fallback ? self->external_input_texture_id : self->input_texture_id,
-            target_pos, output_size,
-            capture_pos, self->capture_size,
-            texture_rotation, self->external_texture_fallback, GSR_SOURCE_COLOR_RGB);
     }
 
     if(self->params.record_cursor) {
@@ -712,15 +1040,14 @@ static int gsr_capture_kms_capture(gsr_capture *cap, AVFrame *frame, gsr_color_c
             const vec2i cursor_monitor_offset = self->capture_pos;
             render_x11_cursor(self, color_conversion, cursor_monitor_offset, target_pos, output_size);
         } else if(cursor_drm_fd) {
-            render_drm_cursor(self, color_conversion, cursor_drm_fd, target_pos, texture_rotation, output_size);
+            render_drm_cursor(self, color_conversion, cursor_drm_fd, self->monitor_rotation, self->capture_size, target_pos, output_size);
         }
     }
 
+    gsr_color_conversion_flush(color_conversion);
     self->params.egl->glFlush();
     self->params.egl->glFinish();
 
-    gsr_capture_kms_cleanup_kms_fds(self);
-
     return 0;
 }
 
@@ -762,15 +1089,21 @@ static bool gsr_capture_kms_set_hdr_metadata(gsr_capture *cap, AVMasteringDispla
     return true;
 }
 
-// static bool gsr_capture_kms_is_damaged(gsr_capture *cap) {
-//     gsr_capture_kms *self = cap->priv;
-//     return self->damaged;
-// }
+/* A plane changes when a new frame is page flipped or when the cursor moves */
+static bool gsr_capture_kms_is_damaged(gsr_capture *cap) {
+    gsr_capture_kms *self = cap->priv;
+    return !self->subscribed || gsr_kms_client_has_new_state(&self->kms_client);
+}
 
-// static void gsr_capture_kms_clear_damage(gsr_capture *cap) {
-//     gsr_capture_kms *self = cap->priv;
-//     self->damaged = false;
-// }
+static void gsr_capture_kms_clear_damage(gsr_capture *cap) {
+    gsr_capture_kms *self = cap->priv;
+    gsr_kms_client_clear_update_event(&self->kms_client);
+}
+
+static int gsr_capture_kms_get_damage_fd(gsr_capture *cap) {
+    gsr_capture_kms *self = cap->priv;
+    return self->subscribed ? gsr_kms_client_get_update_fd(&self->kms_client) : -1;
+}
 
 static void gsr_capture_kms_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
     (void)video_codec_context;
@@ -810,17 +1143,21 @@ gsr_capture* gsr_capture_kms_create(const gsr_capture_kms_params *params) {
 
     cap_kms->params = *params;
     cap_kms->params.display_to_capture = display_to_capture;
+
+    /* On x11 the damage is tracked with xdamage instead, which also sees changes that don't cause a page flip */
+    const bool track_plane_damage = gsr_window_get_display_server(params->egl->window) != GSR_DISPLAY_SERVER_X11;
     
     *cap = (gsr_capture) {
         .start = gsr_capture_kms_start,
         .on_event = gsr_capture_kms_on_event,
-        //.tick = gsr_capture_kms_tick,
+        .tick = gsr_capture_kms_tick,
         .should_stop = gsr_capture_kms_should_stop,
         .capture = gsr_capture_kms_capture,
         .uses_external_image = gsr_capture_kms_uses_external_image,
         .set_hdr_metadata = gsr_capture_kms_set_hdr_metadata,
-        //.is_damaged = gsr_capture_kms_is_damaged,
-        //.clear_damage = gsr_capture_kms_clear_damage,
+        .is_damaged = track_plane_damage ? gsr_capture_kms_is_damaged : NULL,
+        .clear_damage = track_plane_damage ? gsr_capture_kms_clear_damage : NULL,
+        .get_damage_fd = track_plane_damage ? gsr_capture_kms_get_damage_fd : NULL,
         .destroy = gsr_capture_kms_destroy,
         .priv = cap_kms
     };
@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 
@@ -28,6 +29,16 @@ typedef struct {
     AVCodecContext *video_codec_context;
     bool fast_path_failed;
     bool mesa_supports_compute_only_vaapi_copy;
+
+    /* The destination textures have the previous frame drawn with opengl, so only the damaged regions have to be drawn again */
+    bool previous_frame_drawn;
+    vec2i previous_region_pos;
+    gsr_rectangle previous_cursor_rect; /* Where the cursor was drawn in the previous frame, in the destination textures */
+
+    /* The regions that were drawn again in the last capture, for |gsr_capture_portal_get_frame_damage_regions| */
+    gsr_rectangle frame_damage_regions[GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS];
+    int num_frame_damage_regions;
+    bool frame_damage_regions_known;
 } gsr_capture_portal;
 
 static void gsr_capture_portal_cleanup_plane_fds(gsr_capture_portal *self) {
@@ -243,7 +254,8 @@ static bool gsr_capture_portal_get_frame_dimensions(gsr_capture_portal *self) {
         bool uses_external_image = false;
         uint32_t fourcc = 0;
         uint64_t modifiers = 0;
-        if(gsr_pipewire_video_map_texture(&self->pipewire, self->texture_map, &region, &cursor_region, self->dmabuf_data, &self->num_dmabuf_data, &fourcc, &modifiers, &uses_external_image)) {
+        gsr_pipewire_video_damage damage;
+        if(gsr_pipewire_video_map_texture(&self->pipewire, self->texture_map, &region, &cursor_region, &damage, self->dmabuf_data, &self->num_dmabuf_data, &fourcc, &modifiers, &uses_external_image)) {
             gsr_capture_portal_cleanup_plane_fds(self);
             self->capture_size.x = region.width;
             self->capture_size.y = region.height;
@@ -346,14 +358,16 @@ static int gsr_capture_portal_capture(gsr_capture *cap, AVFrame *frame, gsr_colo
     /* TODO: Handle formats other than RGB(a) */
     gsr_pipewire_video_region region = {0, 0, 0, 0};
     gsr_pipewire_video_region cursor_region = {0, 0, 0, 0};
+    gsr_pipewire_video_damage damage;
     uint32_t pipewire_fourcc = 0;
     uint64_t pipewire_modifiers = 0;
     bool using_external_image = false;
-    if(gsr_pipewire_video_map_texture(&self->pipewire, self->texture_map, &region, &cursor_region, self->dmabuf_data, &self->num_dmabuf_data, &pipewire_fourcc, &pipewire_modifiers, &using_external_image)) {
+    if(gsr_pipewire_video_map_texture(&self->pipewire, self->texture_map, &region, &cursor_region, &damage, self->dmabuf_data, &self->num_dmabuf_data, &pipewire_fourcc, &pipewire_modifiers, &using_external_image)) {
         if(region.width != self->capture_size.x || region.height != self->capture_size.y) {
             self->capture_size.x = region.width;
             self->capture_size.y = region.height;
             gsr_color_conversion_clear(color_conversion);
+            self->previous_frame_drawn = false;
         }
     } else {
         return 0;
@@ -392,33 +406,70 @@ static int gsr_capture_portal_capture(gsr_capture *cap, AVFrame *frame, gsr_colo
         self->fast_path_failed = true;
     }
 
-    if(self->fast_path_failed) {
-        gsr_color_conversion_draw(color_conversion, using_external_image ? self->texture_map.external_texture_id : self->texture_map.texture_id,
+    const vec2d scale = {
+        self->capture_size.x == 0 ? 0 : (double)output_size.x / (double)self->capture_size.x,
+        self->capture_size.y == 0 ? 0 : (double)output_size.y / (double)self->capture_size.y
+    };
+
+    const vec2i cursor_pos = {
+        target_pos.x + (cursor_region.x * scale.x),
+        target_pos.y + (cursor_region.y * scale.y)
+    };
+
+    const bool draw_cursor = self->params.record_cursor && self->texture_map.cursor_texture_id > 0 && cursor_region.width > 0;
+    gsr_rectangle cursor_rect = { (vec2i){0, 0}, (vec2i){0, 0} };
+    if(draw_cursor)
+        cursor_rect = gsr_rectangle_intersection((gsr_rectangle){ cursor_pos, (vec2i){cursor_region.width * scale.x + 1, cursor_region.height * scale.y + 1} }, (gsr_rectangle){ target_pos, output_size });
+
+    /*
+        Only the regions that changed since the previous frame are converted again when the previous frame is still in the destination textures.
+        That includes where the cursor was and where it is now.
+    */
+    bool draw_frame = true;
+    self->num_frame_damage_regions = 0;
+    self->frame_damage_regions_known = false;
+    if(self->fast_path_failed && self->previous_frame_drawn && !damage.full && region.x == self->previous_region_pos.x && region.y == self->previous_region_pos.y) {
+        const bool is_output_scaled = output_size.x != self->capture_size.x || output_size.y != self->capture_size.y;
+        gsr_rectangle damage_regions[GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS];
+        int num_damage_regions = 0;
+        for(int i = 0; i < damage.num_regions; ++i) {
+            const gsr_rectangle damage_region = { (vec2i){damage.regions[i].pos.x - region.x, damage.regions[i].pos.y - region.y}, damage.regions[i].size };
+            gsr_rectangle_list_add(damage_regions, &num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS,
+                gsr_rectangle_map_to_area(damage_region, self->capture_size, target_pos, output_size, is_output_scaled ? 2 : 0));
+        }
+        gsr_rectangle_list_add(damage_regions, &num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS, self->previous_cursor_rect);
+        gsr_rectangle_list_add(damage_regions, &num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS, cursor_rect);
+
+        draw_frame = num_damage_regions > 0;
+        gsr_color_conversion_set_damage_regions(color_conversion, damage_regions, num_damage_regions);
+
+        memcpy(self->frame_damage_regions, damage_regions, num_damage_regions * sizeof(gsr_rectangle));
+        self->num_frame_damage_regions = num_damage_regions;
+        self->frame_damage_regions_known = true;
+    }
+
+    if(self->fast_path_failed && draw_frame) {
+        gsr_color_conversion_draw_batched(color_conversion, using_external_image ? self->texture_map.external_texture_id : self->texture_map.texture_id,
             target_pos, output_size,
             (vec2i){region.x, region.y}, self->capture_size,
             0.0f, using_external_image, GSR_SOURCE_COLOR_RGB);
     }
 
-    if(self->params.record_cursor && self->texture_map.cursor_texture_id > 0 && cursor_region.width > 0) {
-        const vec2d scale = {
-            self->capture_size.x == 0 ? 0 : (double)output_size.x / (double)self->capture_size.x,
-            self->capture_size.y == 0 ? 0 : (double)output_size.y / (double)self->capture_size.y
-        };
-
-        const vec2i cursor_pos = {
-            target_pos.x + (cursor_region.x * scale.x),
-            target_pos.y + (cursor_region.y * scale.y)
-        };
-
-        self->params.egl->glEnable(GL_SCISSOR_TEST);
-        self->params.egl->glScissor(target_pos.x, target_pos.y, output_size.x, output_size.y);
-        gsr_color_conversion_draw(color_conversion, self->texture_map.cursor_texture_id,
+    if(draw_cursor && draw_frame) {
+        gsr_color_conversion_set_clip(color_conversion, &(gsr_rectangle){ target_pos, output_size });
+        gsr_color_conversion_draw_batched(color_conversion, self->texture_map.cursor_texture_id,
             (vec2i){cursor_pos.x, cursor_pos.y}, (vec2i){cursor_region.width * scale.x, cursor_region.height * scale.y},
             (vec2i){0, 0}, (vec2i){cursor_region.width, cursor_region.height},
             0.0f, false, GSR_SOURCE_COLOR_RGB);
-        self->params.egl->glDisable(GL_SCISSOR_TEST);
+        gsr_color_conversion_set_clip(color_conversion, NULL);
     }
 
+    gsr_color_conversion_flush(color_conversion);
+    gsr_color_conversion_set_damage_regions(color_conversion, NULL, 0);
+    self->previous_frame_drawn = self->fast_path_failed;
+    self->previous_region_pos = (vec2i){region.x, region.y};
+    self->previous_cursor_rect = cursor_rect;
+
     self->params.egl->glFlush();
     self->params.egl->glFinish();
 
@@ -432,11 +483,23 @@ static bool gsr_capture_portal_uses_external_image(gsr_capture *cap) {
     return true;
 }
 
+static bool gsr_capture_portal_get_frame_damage_regions(gsr_capture *cap, const gsr_rectangle **regions, int *num_regions) {
+    gsr_capture_portal *self = cap->priv;
+    *regions = self->frame_damage_regions;
+    *num_regions = self->num_frame_damage_regions;
+    return self->frame_damage_regions_known;
+}
+
 static bool gsr_capture_portal_is_damaged(gsr_capture *cap) {
     gsr_capture_portal *self = cap->priv;
     return gsr_pipewire_video_is_damaged(&self->pipewire);
 }
 
+static int gsr_capture_portal_get_damage_fd(gsr_capture *cap) {
+    gsr_capture_portal *self = cap->priv;
+    return gsr_pipewire_video_get_damage_fd(&self->pipewire);
+}
+
 static void gsr_capture_portal_clear_damage(gsr_capture *cap) {
     gsr_capture_portal *self = cap->priv;
     gsr_pipewire_video_clear_damage(&self->pipewire);
@@ -479,6 +542,8 @@ gsr_capture* gsr_capture_portal_create(const gsr_capture_portal_params *params)
         .uses_external_image = gsr_capture_portal_uses_external_image,
         .is_damaged = gsr_capture_portal_is_damaged,
         .clear_damage = gsr_capture_portal_clear_damage,
+        .get_damage_fd = gsr_capture_portal_get_damage_fd,
+        .get_frame_damage_regions = gsr_capture_portal_get_frame_damage_regions,
         .destroy = gsr_capture_portal_destroy,
         .priv = cap_portal
     };
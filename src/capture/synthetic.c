@@ -0,0 +1,260 @@
+#include "../../include/capture/synthetic.h"
+#include "../../include/egl.h"
+#include "../../include/utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavcodec/avcodec.h>
+
+typedef struct {
+    gsr_capture_synthetic_params params;
+
+    unsigned int texture_id;
+    unsigned int framebuffer;
+
+    double start_time;
+    int64_t pattern_step;
+    int64_t drawn_pattern_step;
+    bool damaged;
+} gsr_capture_synthetic;
+
+static void gsr_capture_synthetic_stop(gsr_capture_synthetic *self) {
+    if(self->framebuffer) {
+        self->params.egl->glDeleteFramebuffers(1, &self->framebuffer);
+        self->framebuffer = 0;
+    }
+
+    if(self->texture_id) {
+        self->params.egl->glDeleteTextures(1, &self->texture_id);
+        self->texture_id = 0;
+    }
+}
+
+static int gsr_capture_synthetic_start(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame *frame) {
+    gsr_capture_synthetic *self = cap->priv;
+    gsr_egl *egl = self->params.egl;
+
+    egl->glGenTextures(1, &self->texture_id);
+    egl->glBindTexture(GL_TEXTURE_2D, self->texture_id);
+    egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, self->params.size.x, self->params.size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    if(self->texture_id == 0) {
+        fprintf(stderr, "gsr error: gsr_capture_synthetic_start: failed to create texture\n");
+        return -1;
+    }
+
+    egl->glGenFramebuffers(1, &self->framebuffer);
+    egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffer);
+    egl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, self->texture_id, 0);
+    const unsigned int framebuffer_status = egl->glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(framebuffer_status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "gsr error: gsr_capture_synthetic_start: failed to create framebuffer\n");
+        gsr_capture_synthetic_stop(self);
+        return -1;
+    }
+
+    video_codec_context->width = FFALIGN(self->params.size.x, 2);
+    video_codec_context->height = FFALIGN(self->params.size.y, 2);
+
+    frame->width = video_codec_context->width;
+    frame->height = video_codec_context->height;
+
+    self->start_time = clock_get_monotonic_seconds();
+    self->pattern_step = 0;
+    self->drawn_pattern_step = -1;
+    self->damaged = true;
+    return 0;
+}
+
+/* Deterministic color for |index|, with each component in the range [0.0, 1.0] */
+static void pattern_color(uint32_t index, float *r, float *g, float *b) {
+    uint32_t hash = index * 2654435761u;
+    hash ^= hash >> 15;
+    *r = (float)((hash >> 0) & 0xFF) / 255.0f;
+    *g = (float)((hash >> 8) & 0xFF) / 255.0f;
+    *b = (float)((hash >> 16) & 0xFF) / 255.0f;
+}
+
+static void fill_rect(gsr_egl *egl, int x, int y, int width, int height, float r, float g, float b) {
+    egl->glScissor(x, y, width, height);
+    egl->glClearColor(r, g, b, 1.0f);
+    egl->glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static int bounce(int64_t step, int range) {
+    if(range <= 0)
+        return 0;
+    const int64_t position = step % (range * 2);
+    return position < range ? (int)position : (int)(range * 2 - position);
+}
+
+static void gsr_capture_synthetic_draw_pattern(gsr_capture_synthetic *self) {
+    gsr_egl *egl = self->params.egl;
+    const vec2i size = self->params.size;
+    float r, g, b;
+
+    egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffer);
+    egl->glViewport(0, 0, size.x, size.y);
+    egl->glEnable(GL_SCISSOR_TEST);
+
+    switch(self->params.pattern) {
+        case GSR_SYNTHETIC_PATTERN_BARS: {
+            const int num_bars = 8;
+            for(int i = 0; i < num_bars; ++i) {
+                pattern_color(i, &r, &g, &b);
+                const int bar_x = size.x * i / num_bars;
+                fill_rect(egl, bar_x, 0, size.x * (i + 1) / num_bars - bar_x, size.y, r, g, b);
+            }
+
+            const vec2i box_size = { size.x / 8, size.y / 8 };
+            const int box_speed = 8;
+            fill_rect(egl, bounce(self->pattern_step * box_speed, size.x - box_size.x), bounce(self->pattern_step * box_speed / 2, size.y - box_size.y), box_size.x, box_size.y, 1.0f, 1.0f, 1.0f);
+            break;
+        }
+        case GSR_SYNTHETIC_PATTERN_CHECKER: {
+            const int square_size = (size.x > size.y ? size.x : size.y) / 16 + 1;
+            const int offset = (int)((self->pattern_step * 4) % (square_size * 2));
+            fill_rect(egl, 0, 0, size.x, size.y, 0.0f, 0.0f, 0.0f);
+            for(int y = -2; y * square_size < size.y; ++y) {
+                for(int x = -2; x * square_size < size.x; ++x) {
+                    if((x + y) & 1)
+                        continue;
+
+                    const int square_x = x * square_size + offset;
+                    const int square_y = y * square_size + offset;
+                    if(square_x + square_size <= 0 || square_y + square_size <= 0)
+                        continue;
+                    fill_rect(egl, square_x, square_y, square_size, square_size, 1.0f, 1.0f, 1.0f);
+                }
+            }
+            break;
+        }
+        case GSR_SYNTHETIC_PATTERN_SOLID: {
+            pattern_color(self->pattern_step, &r, &g, &b);
+            fill_rect(egl, 0, 0, size.x, size.y, r, g, b);
+            break;
+        }
+    }
+
+    egl->glDisable(GL_SCISSOR_TEST);
+    egl->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static void gsr_capture_synthetic_tick(gsr_capture *cap) {
+    gsr_capture_synthetic *self = cap->priv;
+    const int64_t pattern_step = (int64_t)((clock_get_monotonic_seconds() - self->start_time) * self->params.damage_fps);
+    if(pattern_step != self->pattern_step) {
+        self->pattern_step = pattern_step;
+        self->damaged = true;
+    }
+}
+
+static bool gsr_capture_synthetic_is_damaged(gsr_capture *cap) {
+    gsr_capture_synthetic *self = cap->priv;
+    return self->damaged;
+}
+
+static void gsr_capture_synthetic_clear_damage(gsr_capture *cap) {
+    gsr_capture_synthetic *self = cap->priv;
+    self->damaged = false;
+}
+
+static int gsr_capture_synthetic_capture(gsr_capture *cap, AVFrame *frame, gsr_color_conversion *color_conversion) {
+    gsr_capture_synthetic *self = cap->priv;
+    (void)frame;
+
+    if(self->pattern_step != self->drawn_pattern_step) {
+        gsr_capture_synthetic_draw_pattern(self);
+        self->drawn_pattern_step = self->pattern_step;
+    }
+
+    gsr_color_conversion_draw(color_conversion, self->texture_id,
+        (vec2i){0, 0}, self->params.size,
+        (vec2i){0, 0}, self->params.size,
+        0.0f, false, GSR_SOURCE_COLOR_RGB);
+
+    return 0;
+}
+
+static void gsr_capture_synthetic_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    (void)video_codec_context;
+    if(cap->priv) {
+        gsr_capture_synthetic_stop(cap->priv);
+        free(cap->priv);
+        cap->priv = NULL;
+    }
+    free(cap);
+}
+
+gsr_capture* gsr_capture_synthetic_create(const gsr_capture_synthetic_params *params) {
+    if(!params) {
+        fprintf(stderr, "gsr error: gsr_capture_synthetic_create params is NULL\n");
+        return NULL;
+    }
+
+    if(params->size.x <= 0 || params->size.y <= 0 || params->fps <= 0 || params->damage_fps <= 0) {
+        fprintf(stderr, "gsr error: gsr_capture_synthetic_create: invalid params\n");
+        return NULL;
+    }
+
+    gsr_capture *cap = calloc(1, sizeof(gsr_capture));
+    if(!cap)
+        return NULL;
+
+    gsr_capture_synthetic *cap_synthetic = calloc(1, sizeof(gsr_capture_synthetic));
+    if(!cap_synthetic) {
+        free(cap);
+        return NULL;
+    }
+
+    cap_synthetic->params = *params;
+    if(cap_synthetic->params.damage_fps > cap_synthetic->params.fps)
+        cap_synthetic->params.damage_fps = cap_synthetic->params.fps;
+
+    *cap = (gsr_capture) {
+        .start = gsr_capture_synthetic_start,
+        .tick = gsr_capture_synthetic_tick,
+        .capture = gsr_capture_synthetic_capture,
+        .is_damaged = gsr_capture_synthetic_is_damaged,
+        .clear_damage = gsr_capture_synthetic_clear_damage,
+        .destroy = gsr_capture_synthetic_destroy,
+        .priv = cap_synthetic
+    };
+
+    return cap;
+}
+
+bool gsr_capture_synthetic_parse_options(const char *str, gsr_capture_synthetic_params *params) {
+    int width = 0;
+    int height = 0;
+    char pattern[32];
+    int damage_fps = 0;
+    pattern[0] = '\0';
+
+    const int num_matched = sscanf(str, "%dx%d:%31[a-z]:%d", &width, &height, pattern, &damage_fps);
+    if(num_matched < 3 || width <= 0 || height <= 0)
+        return false;
+
+    if(strcmp(pattern, "bars") == 0)
+        params->pattern = GSR_SYNTHETIC_PATTERN_BARS;
+    else if(strcmp(pattern, "checker") == 0)
+        params->pattern = GSR_SYNTHETIC_PATTERN_CHECKER;
+    else if(strcmp(pattern, "solid") == 0)
+        params->pattern = GSR_SYNTHETIC_PATTERN_SOLID;
+    else
+        return false;
+
+    if(num_matched == 4 && damage_fps <= 0)
+        return false;
+
+    params->size = (vec2i){ width, height };
+    params->damage_fps = num_matched == 4 ? damage_fps : params->fps;
+    return true;
+}
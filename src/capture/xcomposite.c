@@ -39,6 +39,20 @@ typedef struct {
 
     bool clear_background;
     bool fast_path_failed;
+
+    /* Set by |gsr_capture_xcomposite_set_damage_regions|, relative to the window */
+    gsr_rectangle damage_regions[GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS];
+    int num_damage_regions;
+    bool damage_regions_known;
+
+    /* The destination textures have the previous frame drawn with opengl, so only the damaged regions have to be drawn again */
+    bool previous_frame_drawn;
+    gsr_rectangle previous_cursor_rect; /* Where the cursor was drawn in the previous frame, in the destination textures */
+
+    /* The regions that were drawn again in the last capture, for |gsr_capture_xcomposite_get_frame_damage_regions| */
+    gsr_rectangle frame_damage_regions[GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS];
+    int num_frame_damage_regions;
+    bool frame_damage_regions_known;
 } gsr_capture_xcomposite;
 
 static void gsr_capture_xcomposite_stop(gsr_capture_xcomposite *self) {
@@ -262,6 +276,7 @@ static int gsr_capture_xcomposite_capture(gsr_capture *cap, AVFrame *frame, gsr_
     if(self->clear_background) {
         self->clear_background = false;
         gsr_color_conversion_clear(color_conversion);
+        self->previous_frame_drawn = false;
     }
 
     const bool is_scaled = self->params.output_resolution.x > 0 && self->params.output_resolution.y > 0;
@@ -283,43 +298,96 @@ static int gsr_capture_xcomposite_capture(gsr_capture *cap, AVFrame *frame, gsr_
         self->fast_path_failed = true;
     }
 
-    if(self->fast_path_failed) {
-        gsr_color_conversion_draw(color_conversion, window_texture_get_opengl_texture_id(&self->window_texture),
+    const bool draw_cursor = self->params.record_cursor && self->cursor.visible;
+    const vec2d scale = {
+        self->texture_size.x == 0 ? 0 : (double)output_size.x / (double)self->texture_size.x,
+        self->texture_size.y == 0 ? 0 : (double)output_size.y / (double)self->texture_size.y
+    };
+
+    if(draw_cursor)
+        gsr_cursor_tick(&self->cursor, self->window);
+
+    const vec2i cursor_pos = {
+        target_pos.x + (self->cursor.position.x - self->cursor.hotspot.x) * scale.x,
+        target_pos.y + (self->cursor.position.y - self->cursor.hotspot.y) * scale.y
+    };
+
+    gsr_rectangle cursor_rect = { (vec2i){0, 0}, (vec2i){0, 0} };
+    if(draw_cursor)
+        cursor_rect = gsr_rectangle_intersection((gsr_rectangle){ cursor_pos, (vec2i){self->cursor.size.x * scale.x + 1, self->cursor.size.y * scale.y + 1} }, (gsr_rectangle){ target_pos, output_size });
+
+    /*
+        Only the regions that changed since the previous frame are converted again when the previous frame is still in the destination textures.
+        That includes where the cursor was and where it is now.
+    */
+    bool draw_frame = true;
+    self->num_frame_damage_regions = 0;
+    self->frame_damage_regions_known = false;
+    if(self->fast_path_failed && self->previous_frame_drawn && self->damage_regions_known) {
+        const bool is_output_scaled = output_size.x != self->texture_size.x || output_size.y != self->texture_size.y;
+        gsr_rectangle damage_regions[GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS];
+        int num_damage_regions = 0;
+        for(int i = 0; i < self->num_damage_regions; ++i) {
+            gsr_rectangle_list_add(damage_regions, &num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS,
+                gsr_rectangle_map_to_area(self->damage_regions[i], self->texture_size, target_pos, output_size, is_output_scaled ? 2 : 0));
+        }
+        gsr_rectangle_list_add(damage_regions, &num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS, self->previous_cursor_rect);
+        gsr_rectangle_list_add(damage_regions, &num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS, cursor_rect);
+
+        draw_frame = num_damage_regions > 0;
+        gsr_color_conversion_set_damage_regions(color_conversion, damage_regions, num_damage_regions);
+
+        memcpy(self->frame_damage_regions, damage_regions, num_damage_regions * sizeof(gsr_rectangle));
+        self->num_frame_damage_regions = num_damage_regions;
+        self->frame_damage_regions_known = true;
+    }
+
+    if(self->fast_path_failed && draw_frame) {
+        gsr_color_conversion_draw_batched(color_conversion, window_texture_get_opengl_texture_id(&self->window_texture),
             target_pos, output_size,
             (vec2i){0, 0}, self->texture_size,
             0.0f, false, GSR_SOURCE_COLOR_RGB);
     }
 
-    if(self->params.record_cursor && self->cursor.visible) {
-        const vec2d scale = {
-            self->texture_size.x == 0 ? 0 : (double)output_size.x / (double)self->texture_size.x,
-            self->texture_size.y == 0 ? 0 : (double)output_size.y / (double)self->texture_size.y
-        };
-
-        gsr_cursor_tick(&self->cursor, self->window);
-
-        const vec2i cursor_pos = {
-            target_pos.x + (self->cursor.position.x - self->cursor.hotspot.x) * scale.x,
-            target_pos.y + (self->cursor.position.y - self->cursor.hotspot.y) * scale.y
-        };
+    if(draw_cursor && draw_frame) {
+        gsr_color_conversion_set_clip(color_conversion, &(gsr_rectangle){ target_pos, output_size });
 
-        self->params.egl->glEnable(GL_SCISSOR_TEST);
-        self->params.egl->glScissor(target_pos.x, target_pos.y, output_size.x, output_size.y);
-
-        gsr_color_conversion_draw(color_conversion, self->cursor.texture_id,
+        gsr_color_conversion_draw_batched(color_conversion, self->cursor.texture_id,
             cursor_pos, (vec2i){self->cursor.size.x * scale.x, self->cursor.size.y * scale.y},
             (vec2i){0, 0}, self->cursor.size,
             0.0f, false, GSR_SOURCE_COLOR_RGB);
 
-        self->params.egl->glDisable(GL_SCISSOR_TEST);
+        gsr_color_conversion_set_clip(color_conversion, NULL);
     }
 
+    gsr_color_conversion_flush(color_conversion);
+    gsr_color_conversion_set_damage_regions(color_conversion, NULL, 0);
+    self->previous_frame_drawn = self->fast_path_failed;
+    self->previous_cursor_rect = cursor_rect;
+    self->damage_regions_known = false;
+
     self->params.egl->glFlush();
     self->params.egl->glFinish();
 
     return 0;
 }
 
+static void gsr_capture_xcomposite_set_damage_regions(gsr_capture *cap, const gsr_rectangle *regions, int num_regions) {
+    gsr_capture_xcomposite *self = cap->priv;
+    self->num_damage_regions = 0;
+    self->damage_regions_known = regions != NULL;
+    for(int i = 0; i < num_regions && regions; ++i) {
+        gsr_rectangle_list_add(self->damage_regions, &self->num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS, regions[i]);
+    }
+}
+
+static bool gsr_capture_xcomposite_get_frame_damage_regions(gsr_capture *cap, const gsr_rectangle **regions, int *num_regions) {
+    gsr_capture_xcomposite *self = cap->priv;
+    *regions = self->frame_damage_regions;
+    *num_regions = self->num_frame_damage_regions;
+    return self->frame_damage_regions_known;
+}
+
 static uint64_t gsr_capture_xcomposite_get_window_id(gsr_capture *cap) {
     gsr_capture_xcomposite *self = cap->priv;
     return self->window;
@@ -362,6 +430,8 @@ gsr_capture* gsr_capture_xcomposite_create(const gsr_capture_xcomposite_params *
         .capture = gsr_capture_xcomposite_capture,
         .uses_external_image = NULL,
         .get_window_id = gsr_capture_xcomposite_get_window_id,
+        .set_damage_regions = gsr_capture_xcomposite_set_damage_regions,
+        .get_frame_damage_regions = gsr_capture_xcomposite_get_frame_damage_regions,
         .destroy = gsr_capture_xcomposite_destroy,
         .priv = cap_xcomp
     };
@@ -1,5 +1,6 @@
 #include "../include/color_conversion.h"
 #include "../include/egl.h"
+#include "../include/utils.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -14,12 +15,8 @@ static float abs_f(float v) {
     return v >= 0.0f ? v : -v;
 }
 
-#define ROTATE_Z   "mat4 rotate_z(in float angle) {\n"                        \
-                   "    return mat4(cos(angle), -sin(angle), 0.0, 0.0,\n"     \
-                   "                sin(angle),  cos(angle), 0.0, 0.0,\n"     \
-                   "                0.0,           0.0,      1.0, 0.0,\n"     \
-                   "                0.0,           0.0,      0.0, 1.0);\n"    \
-                   "}\n"
+/* Every quad is two triangles with a position (xy) and texture coordinates (xy) per vertex */
+#define QUAD_NUM_FLOATS 24
 
 /* https://en.wikipedia.org/wiki/YCbCr, see study/color_space_transform_matrix.png */
 
@@ -75,7 +72,7 @@ static const char* color_format_range_get_transform_matrix(gsr_destination_color
     return NULL;
 }
 
-static int load_shader_y(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *uniforms, gsr_destination_color color_format, gsr_color_range color_range, bool external_texture) {
+static int load_shader_y(gsr_shader *shader, gsr_egl *egl, gsr_destination_color color_format, gsr_color_range color_range, bool external_texture) {
     const char *color_transform_matrix = color_format_range_get_transform_matrix(color_format, color_range);
 
     char vertex_shader[2048];
@@ -84,13 +81,10 @@ static int load_shader_y(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *u
         "in vec2 pos;                                      \n"
         "in vec2 texcoords;                                \n"
         "out vec2 texcoords_out;                           \n"
-        "uniform vec2 offset;                              \n"
-        "uniform float rotation;                           \n"
-        ROTATE_Z
         "void main()                                       \n"
         "{                                                 \n"
-        "  texcoords_out = (vec4(texcoords.x - 0.5, texcoords.y - 0.5, 0.0, 0.0) * rotate_z(rotation)).xy + vec2(0.5, 0.5);  \n"
-        "  gl_Position = vec4(offset.x, offset.y, 0.0, 0.0) + vec4(pos.x, pos.y, 0.0, 1.0);    \n"
+        "  texcoords_out = texcoords;                      \n"
+        "  gl_Position = vec4(pos.x, pos.y, 0.0, 1.0);     \n"
         "}                                                 \n");
 
     char fragment_shader[2048];
@@ -131,12 +125,10 @@ static int load_shader_y(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *u
 
     gsr_shader_bind_attribute_location(shader, "pos", 0);
     gsr_shader_bind_attribute_location(shader, "texcoords", 1);
-    uniforms->offset = egl->glGetUniformLocation(shader->program_id, "offset");
-    uniforms->rotation = egl->glGetUniformLocation(shader->program_id, "rotation");
     return 0;
 }
 
-static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *uniforms, gsr_destination_color color_format, gsr_color_range color_range, bool external_texture) {
+static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, gsr_destination_color color_format, gsr_color_range color_range, bool external_texture) {
     const char *color_transform_matrix = color_format_range_get_transform_matrix(color_format, color_range);
 
     char vertex_shader[2048];
@@ -145,13 +137,10 @@ static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, gsr_color_u
         "in vec2 pos;                                    \n"
         "in vec2 texcoords;                              \n"
         "out vec2 texcoords_out;                         \n"
-        "uniform vec2 offset;                              \n"
-        "uniform float rotation;                         \n"
-        ROTATE_Z
         "void main()                                     \n"
         "{                                               \n"
-        "  texcoords_out = (vec4(texcoords.x - 0.5, texcoords.y - 0.5, 0.0, 0.0) * rotate_z(rotation)).xy + vec2(0.5, 0.5);                      \n"
-        "  gl_Position = (vec4(offset.x, offset.y, 0.0, 0.0) + vec4(pos.x, pos.y, 0.0, 1.0)) * vec4(0.5, 0.5, 1.0, 1.0) - vec4(0.5, 0.5, 0.0, 0.0);   \n"
+        "  texcoords_out = texcoords;                    \n"
+        "  gl_Position = vec4(pos.x, pos.y, 0.0, 1.0) * vec4(0.5, 0.5, 1.0, 1.0) - vec4(0.5, 0.5, 0.0, 0.0);   \n"
         "}                                               \n");
 
     char fragment_shader[2048];
@@ -192,8 +181,6 @@ static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, gsr_color_u
 
     gsr_shader_bind_attribute_location(shader, "pos", 0);
     gsr_shader_bind_attribute_location(shader, "texcoords", 1);
-    uniforms->offset = egl->glGetUniformLocation(shader->program_id, "offset");
-    uniforms->rotation = egl->glGetUniformLocation(shader->program_id, "rotation");
     return 0;
 }
 
@@ -234,7 +221,7 @@ static int create_vertices(gsr_color_conversion *self) {
 
     self->params.egl->glGenBuffers(1, &self->vertex_buffer_object_id);
     self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
-    self->params.egl->glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    self->params.egl->glBufferData(GL_ARRAY_BUFFER, GSR_COLOR_CONVERSION_MAX_QUADS * QUAD_NUM_FLOATS * sizeof(float), NULL, GL_DYNAMIC_DRAW);
 
     self->params.egl->glEnableVertexAttribArray(0);
     self->params.egl->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
@@ -261,23 +248,23 @@ int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conver
                 return -1;
             }
 
-            if(load_shader_y(&self->shaders[0], self->params.egl, &self->uniforms[0], params->destination_color, params->color_range, false) != 0) {
+            if(load_shader_y(&self->shaders[0], self->params.egl, params->destination_color, params->color_range, false) != 0) {
                 fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load Y shader\n");
                 goto err;
             }
 
-            if(load_shader_uv(&self->shaders[1], self->params.egl, &self->uniforms[1], params->destination_color, params->color_range, false) != 0) {
+            if(load_shader_uv(&self->shaders[1], self->params.egl, params->destination_color, params->color_range, false) != 0) {
                 fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load UV shader\n");
                 goto err;
             }
 
             if(self->params.load_external_image_shader) {
-                if(load_shader_y(&self->shaders[2], self->params.egl, &self->uniforms[2], params->destination_color, params->color_range, true) != 0) {
+                if(load_shader_y(&self->shaders[2], self->params.egl, params->destination_color, params->color_range, true) != 0) {
                     fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load Y shader\n");
                     goto err;
                 }
 
-                if(load_shader_uv(&self->shaders[3], self->params.egl, &self->uniforms[3], params->destination_color, params->color_range, true) != 0) {
+                if(load_shader_uv(&self->shaders[3], self->params.egl, params->destination_color, params->color_range, true) != 0) {
                     fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load UV shader\n");
                     goto err;
                 }
@@ -289,6 +276,12 @@ int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conver
     if(load_framebuffers(self) != 0)
         goto err;
 
+    /* The destination textures don't change size, so this is only queried once */
+    self->params.egl->glBindTexture(GL_TEXTURE_2D, self->params.destination_textures[0]);
+    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &self->destination_texture_size.x);
+    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &self->destination_texture_size.y);
+    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+
     if(create_vertices(self) != 0)
         goto err;
 
@@ -303,6 +296,8 @@ void gsr_color_conversion_deinit(gsr_color_conversion *self) {
     if(!self->params.egl)
         return;
 
+    self->num_quads = 0;
+
     if(self->vertex_buffer_object_id) {
         self->params.egl->glDeleteBuffers(1, &self->vertex_buffer_object_id);
         self->vertex_buffer_object_id = 0;
@@ -339,31 +334,51 @@ static void gsr_color_conversion_swizzle_reset(gsr_color_conversion *self, gsr_s
     }
 }
 
-/* |source_pos| is in pixel coordinates and |source_size|  */
-void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture, gsr_source_color source_color) {
-    // TODO: Remove this crap
-    rotation = M_PI*2.0f - rotation;
+static bool gsr_color_conversion_quad_same_texture(const gsr_color_conversion_quad *a, const gsr_color_conversion_quad *b) {
+    return a->texture_id == b->texture_id && a->external_texture == b->external_texture && a->source_color == b->source_color;
+}
 
-    /* TODO: Do not call this every frame? */
-    vec2i dest_texture_size = {0, 0};
-    self->params.egl->glBindTexture(GL_TEXTURE_2D, self->params.destination_textures[0]);
-    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &dest_texture_size.x);
-    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &dest_texture_size.y);
-    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+static bool gsr_color_conversion_quad_same_draw(const gsr_color_conversion_quad *a, const gsr_color_conversion_quad *b) {
+    if(!gsr_color_conversion_quad_same_texture(a, b) || a->has_clip != b->has_clip)
+        return false;
+    return !a->has_clip || memcmp(&a->clip, &b->clip, sizeof(a->clip)) == 0;
+}
 
-    const int texture_target = external_texture ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+/* |rect| is in pixels of the y plane and |divisor| is the subsampling of the destination texture */
+static void gsr_color_conversion_scissor(gsr_color_conversion *self, gsr_rectangle rect, int divisor) {
+    const int left = rect.pos.x / divisor;
+    const int top = rect.pos.y / divisor;
+    const int right = (rect.pos.x + rect.size.x + divisor - 1) / divisor;
+    const int bottom = (rect.pos.y + rect.size.y + divisor - 1) / divisor;
+    self->params.egl->glScissor(left, top, right - left, bottom - top);
+}
+
+/*
+    Draws |num_vertices| vertices once for every damage region (limited to |clip|), or once without damage regions.
+    |clip| can be NULL. The scissor test has to be enabled when there are damage regions or a clip rectangle in the batch.
+*/
+static void gsr_color_conversion_draw_damage_regions(gsr_color_conversion *self, const gsr_rectangle *clip, bool scissor_enabled, int divisor, int first_vertex, int num_vertices) {
+    if(self->num_damage_regions == 0) {
+        if(scissor_enabled)
+            gsr_color_conversion_scissor(self, clip ? *clip : (gsr_rectangle){ (vec2i){0, 0}, self->destination_texture_size }, divisor);
+        self->params.egl->glDrawArrays(GL_TRIANGLES, first_vertex, num_vertices);
+        return;
+    }
 
-    self->params.egl->glBindTexture(texture_target, texture_id);
+    for(int i = 0; i < self->num_damage_regions; ++i) {
+        const gsr_rectangle region = clip ? gsr_rectangle_intersection(self->damage_regions[i], *clip) : self->damage_regions[i];
+        if(gsr_rectangle_is_empty(region))
+            continue;
 
-    vec2i source_texture_size = {0, 0};
-    if(external_texture) {
-        assert(self->params.load_external_image_shader);
-        source_texture_size = source_size;
-    } else {
-        /* TODO: Do not call this every frame? */
-        self->params.egl->glGetTexLevelParameteriv(texture_target, 0, GL_TEXTURE_WIDTH, &source_texture_size.x);
-        self->params.egl->glGetTexLevelParameteriv(texture_target, 0, GL_TEXTURE_HEIGHT, &source_texture_size.y);
+        gsr_color_conversion_scissor(self, region, divisor);
+        self->params.egl->glDrawArrays(GL_TRIANGLES, first_vertex, num_vertices);
     }
+}
+
+/* Fills in the vertices of |quad|. |source_texture_size| is the size of the quad texture */
+static void gsr_color_conversion_quad_get_vertices(const gsr_color_conversion *self, const gsr_color_conversion_quad *quad, vec2i source_texture_size, float *vertices) {
+    // TODO: Remove this crap
+    const float rotation = M_PI*2.0f - quad->rotation;
 
     // TODO: Remove this crap
     if(abs_f(M_PI * 0.5f - rotation) <= 0.001f || abs_f(M_PI * 1.5f - rotation) <= 0.001f) {
@@ -372,76 +387,172 @@ void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_
         source_texture_size.y = tmp;
     }
 
+    const vec2i dest_texture_size = self->destination_texture_size;
     const vec2f pos_norm = {
-        ((float)source_pos.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
-        ((float)source_pos.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
+        ((float)quad->source_pos.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
+        ((float)quad->source_pos.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
     };
 
     const vec2f size_norm = {
-        ((float)source_size.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
-        ((float)source_size.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
+        ((float)quad->source_size.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
+        ((float)quad->source_size.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
     };
 
     const vec2f texture_pos_norm = {
-        (float)texture_pos.x / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
-        (float)texture_pos.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
+        (float)quad->texture_pos.x / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
+        (float)quad->texture_pos.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
     };
 
     const vec2f texture_size_norm = {
-        (float)texture_size.x / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
-        (float)texture_size.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
+        (float)quad->texture_size.x / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
+        (float)quad->texture_size.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
     };
 
-    const float vertices[] = {
-        -1.0f + 0.0f,               -1.0f + 0.0f + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
-        -1.0f + 0.0f,               -1.0f + 0.0f,               texture_pos_norm.x,                       texture_pos_norm.y,
-        -1.0f + 0.0f + size_norm.x, -1.0f + 0.0f,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
+    const float left = -1.0f + pos_norm.x;
+    const float bottom = -1.0f + pos_norm.y;
+    const float quad_vertices[QUAD_NUM_FLOATS] = {
+        left,               bottom + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
+        left,               bottom,               texture_pos_norm.x,                       texture_pos_norm.y,
+        left + size_norm.x, bottom,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
 
-        -1.0f + 0.0f,               -1.0f + 0.0f + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
-        -1.0f + 0.0f + size_norm.x, -1.0f + 0.0f,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
-        -1.0f + 0.0f + size_norm.x, -1.0f + 0.0f + size_norm.y, texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y + texture_size_norm.y
+        left,               bottom + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
+        left + size_norm.x, bottom,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
+        left + size_norm.x, bottom + size_norm.y, texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y + texture_size_norm.y
     };
 
-    gsr_color_conversion_swizzle_texture_source(self, source_color);
+    /* The texture coordinates are rotated around the center of the texture, the same in every vertex of the quad so it's done here instead of in the vertex shader */
+    const float rotation_cos = cosf(rotation);
+    const float rotation_sin = sinf(rotation);
+    for(int i = 0; i < QUAD_NUM_FLOATS; i += 4) {
+        const float texcoord_x = quad_vertices[i + 2] - 0.5f;
+        const float texcoord_y = quad_vertices[i + 3] - 0.5f;
+        vertices[i + 0] = quad_vertices[i + 0];
+        vertices[i + 1] = quad_vertices[i + 1];
+        vertices[i + 2] = texcoord_x * rotation_cos - texcoord_y * rotation_sin + 0.5f;
+        vertices[i + 3] = texcoord_x * rotation_sin + texcoord_y * rotation_cos + 0.5f;
+    }
+}
 
-    self->params.egl->glBindVertexArray(self->vertex_array_object_id);
-    self->params.egl->glViewport(0, 0, dest_texture_size.x, dest_texture_size.y);
+/* Draws the queued quads to one destination texture. Quads next to each other with the same texture and clip are drawn with one draw call */
+static void gsr_color_conversion_draw_quads_to_framebuffer(gsr_color_conversion *self, bool scissor_enabled, int framebuffer_index, int divisor) {
+    self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[framebuffer_index]);
+
+    int bound_shader_index = -1;
+    int quad_index = 0;
+    while(quad_index < self->num_quads) {
+        const gsr_color_conversion_quad *quad = &self->quads[quad_index];
+        int num_quads_same_texture = 1;
+        while(quad_index + num_quads_same_texture < self->num_quads && gsr_color_conversion_quad_same_draw(quad, &self->quads[quad_index + num_quads_same_texture])) {
+            ++num_quads_same_texture;
+        }
 
-    /* TODO: this, also cleanup */
-    //self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
-    self->params.egl->glBufferSubData(GL_ARRAY_BUFFER, 0, 24 * sizeof(float), vertices);
+        const int texture_target = quad->external_texture ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+        self->params.egl->glBindTexture(texture_target, quad->texture_id);
 
-    {
-        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[0]);
-        //cap_xcomp->params.egl->glClear(GL_COLOR_BUFFER_BIT); // TODO: Do this in a separate clear_ function. We want to do that when using multiple drm to create the final image (multiple monitors for example)
+        /* The first shader of each pair is Y and the second is UV */
+        const int shader_index = (quad->external_texture ? 2 : 0) + framebuffer_index;
+        if(shader_index != bound_shader_index) {
+            gsr_shader_use(&self->shaders[shader_index]);
+            bound_shader_index = shader_index;
+        }
 
-        const int shader_index = external_texture ? 2 : 0;
-        gsr_shader_use(&self->shaders[shader_index]);
-        self->params.egl->glUniform1f(self->uniforms[shader_index].rotation, rotation);
-        self->params.egl->glUniform2f(self->uniforms[shader_index].offset, pos_norm.x, pos_norm.y);
-        self->params.egl->glDrawArrays(GL_TRIANGLES, 0, 6);
+        gsr_color_conversion_draw_damage_regions(self, quad->has_clip ? &quad->clip : NULL, scissor_enabled, divisor, quad_index * 6, num_quads_same_texture * 6);
+        quad_index += num_quads_same_texture;
     }
+}
 
-    if(self->params.num_destination_textures > 1) {
-        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[1]);
-        //cap_xcomp->params.egl->glClear(GL_COLOR_BUFFER_BIT);
+void gsr_color_conversion_flush(gsr_color_conversion *self) {
+    if(self->num_quads == 0)
+        return;
 
-        const int shader_index = external_texture ? 3 : 1;
-        gsr_shader_use(&self->shaders[shader_index]);
-        self->params.egl->glUniform1f(self->uniforms[shader_index].rotation, rotation);
-        self->params.egl->glUniform2f(self->uniforms[shader_index].offset, pos_norm.x, pos_norm.y);
-        self->params.egl->glDrawArrays(GL_TRIANGLES, 0, 6);
+    const double draw_start_time = clock_get_monotonic_seconds();
+
+    /* The source texture size is only queried once for quads that use the same texture after each other, like the tiles of a texture */
+    float vertices[GSR_COLOR_CONVERSION_MAX_QUADS * QUAD_NUM_FLOATS];
+    bool uses_external_texture = false;
+    bool uses_clip = false;
+    vec2i source_texture_size = {0, 0};
+    for(int i = 0; i < self->num_quads; ++i) {
+        const gsr_color_conversion_quad *quad = &self->quads[i];
+        uses_clip |= quad->has_clip;
+        const bool same_texture_as_previous = i > 0 && gsr_color_conversion_quad_same_texture(quad, &self->quads[i - 1]);
+        if(quad->external_texture) {
+            assert(self->params.load_external_image_shader);
+            uses_external_texture = true;
+            source_texture_size = quad->source_size;
+        } else if(!same_texture_as_previous) {
+            self->params.egl->glBindTexture(GL_TEXTURE_2D, quad->texture_id);
+            self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &source_texture_size.x);
+            self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &source_texture_size.y);
+            gsr_color_conversion_swizzle_texture_source(self, quad->source_color);
+        }
+        gsr_color_conversion_quad_get_vertices(self, quad, source_texture_size, vertices + i * QUAD_NUM_FLOATS);
     }
 
+    self->params.egl->glBindVertexArray(self->vertex_array_object_id);
+    self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
+    self->params.egl->glBufferSubData(GL_ARRAY_BUFFER, 0, self->num_quads * QUAD_NUM_FLOATS * sizeof(float), vertices);
+    self->params.egl->glViewport(0, 0, self->destination_texture_size.x, self->destination_texture_size.y);
+
+    const bool scissor_enabled = self->num_damage_regions > 0 || uses_clip;
+    if(scissor_enabled)
+        self->params.egl->glEnable(GL_SCISSOR_TEST);
+
+    gsr_color_conversion_draw_quads_to_framebuffer(self, scissor_enabled, 0, 1);
+    /* The uv plane is half the size of the y plane */
+    if(self->params.num_destination_textures > 1)
+        gsr_color_conversion_draw_quads_to_framebuffer(self, scissor_enabled, 1, 2);
+
+    if(scissor_enabled)
+        self->params.egl->glDisable(GL_SCISSOR_TEST);
+
     self->params.egl->glBindVertexArray(0);
     gsr_shader_use_none(&self->shaders[0]);
-    self->params.egl->glBindTexture(texture_target, 0);
     self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    gsr_color_conversion_swizzle_reset(self, source_color);
+    for(int i = 0; i < self->num_quads; ++i) {
+        const gsr_color_conversion_quad *quad = &self->quads[i];
+        if(quad->source_color == GSR_SOURCE_COLOR_BGR && !quad->external_texture && (i == 0 || !gsr_color_conversion_quad_same_texture(quad, &self->quads[i - 1]))) {
+            self->params.egl->glBindTexture(GL_TEXTURE_2D, quad->texture_id);
+            gsr_color_conversion_swizzle_reset(self, quad->source_color);
+        }
+    }
+
+    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+    if(uses_external_texture)
+        self->params.egl->glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+    self->num_quads = 0;
+    self->draw_time_seconds += clock_get_monotonic_seconds() - draw_start_time;
+}
+
+void gsr_color_conversion_draw_batched(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture, gsr_source_color source_color) {
+    if(self->num_quads == GSR_COLOR_CONVERSION_MAX_QUADS)
+        gsr_color_conversion_flush(self);
+
+    gsr_color_conversion_quad *quad = &self->quads[self->num_quads++];
+    quad->texture_id = texture_id;
+    quad->source_pos = source_pos;
+    quad->source_size = source_size;
+    quad->texture_pos = texture_pos;
+    quad->texture_size = texture_size;
+    quad->rotation = rotation;
+    quad->external_texture = external_texture;
+    quad->source_color = source_color;
+    quad->has_clip = self->has_clip;
+    quad->clip = self->clip;
+}
+
+/* |source_pos| is in pixel coordinates and |source_size|  */
+void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture, gsr_source_color source_color) {
+    gsr_color_conversion_draw_batched(self, texture_id, source_pos, source_size, texture_pos, texture_size, rotation, external_texture, source_color);
+    gsr_color_conversion_flush(self);
 }
 
 void gsr_color_conversion_clear(gsr_color_conversion *self) {
+    gsr_color_conversion_flush(self);
+    self->num_damage_regions = 0;
+
     float color1[4] = {0.0f, 0.0f, 0.0f, 1.0f};
     float color2[4] = {0.0f, 0.0f, 0.0f, 1.0f};
 
@@ -468,3 +579,18 @@ void gsr_color_conversion_clear(gsr_color_conversion *self) {
 
     self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
+
+void gsr_color_conversion_set_damage_regions(gsr_color_conversion *self, const gsr_rectangle *regions, int num_regions) {
+    /* The queued quads are drawn with the regions they were queued with */
+    gsr_color_conversion_flush(self);
+    self->num_damage_regions = 0;
+    for(int i = 0; i < num_regions; ++i) {
+        gsr_rectangle_list_add(self->damage_regions, &self->num_damage_regions, GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS, regions[i]);
+    }
+}
+
+void gsr_color_conversion_set_clip(gsr_color_conversion *self, const gsr_rectangle *clip) {
+    self->has_clip = clip != NULL;
+    if(clip)
+        self->clip = *clip;
+}
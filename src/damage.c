@@ -7,11 +7,6 @@
 #include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xrandr.h>
 
-typedef struct {
-    vec2i pos;
-    vec2i size;
-} gsr_rectangle;
-
 static bool rectangles_intersect(gsr_rectangle rect1, gsr_rectangle rect2) {
     return rect1.pos.x < rect2.pos.x + rect2.size.x && rect1.pos.x + rect1.size.x > rect2.pos.x &&
         rect1.pos.y < rect2.pos.y + rect2.size.y && rect1.pos.y + rect1.size.y > rect2.pos.y;
@@ -26,10 +21,11 @@ static bool xrandr_is_supported(Display *display) {
     return major_version > 1 || (major_version == 1 && minor_version >= 2);
 }
 
-bool gsr_damage_init(gsr_damage *self, gsr_egl *egl, bool track_cursor) {
+bool gsr_damage_init(gsr_damage *self, gsr_egl *egl, bool track_cursor, bool track_regions) {
     memset(self, 0, sizeof(*self));
     self->egl = egl;
     self->track_cursor = track_cursor;
+    self->track_regions = track_regions;
 
     if(gsr_window_get_display_server(egl->window) != GSR_DISPLAY_SERVER_X11) {
         fprintf(stderr, "gsr warning: gsr_damage_init: damage tracking is not supported on wayland\n");
@@ -61,6 +57,7 @@ bool gsr_damage_init(gsr_damage *self, gsr_egl *egl, bool track_cursor) {
     XRRSelectInput(self->display, DefaultRootWindow(self->display), RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
 
     self->damaged = true;
+    self->regions_unknown = true;
     return true;
 }
 
@@ -115,6 +112,7 @@ bool gsr_damage_set_target_window(gsr_damage *self, uint64_t window) {
     if(self->damage) {
         XDamageSubtract(self->display, self->damage, None, None);
         self->damaged = true;
+        self->regions_unknown = true;
         self->track_type = GSR_DAMAGE_TRACK_WINDOW;
         return true;
     } else {
@@ -150,6 +148,7 @@ bool gsr_damage_set_target_monitor(gsr_damage *self, const char *monitor_name) {
     if(self->damage) {
         XDamageSubtract(self->display, self->damage, None, None);
         self->damaged = true;
+        self->regions_unknown = true;
         snprintf(self->monitor_name, sizeof(self->monitor_name), "%s", monitor_name);
         self->track_type = GSR_DAMAGE_TRACK_MONITOR;
         return true;
@@ -228,25 +227,37 @@ static void gsr_damage_on_randr_event(gsr_damage *self, XEvent *xev) {
 
 static void gsr_damage_on_damage_event(gsr_damage *self, XEvent *xev) {
     const XDamageNotifyEvent *de = (XDamageNotifyEvent*)xev;
+    const bool damage_everything = self->track_type == GSR_DAMAGE_TRACK_WINDOW || (self->track_type == GSR_DAMAGE_TRACK_MONITOR && self->monitor.connector_id == 0);
+    if(damage_everything)
+        self->damaged = true;
+
+    /* Fetching the region is a synchronous round trip to the X server, skip it when the rectangles wouldn't be used */
+    if(damage_everything && !self->track_regions) {
+        /* Subtract all the damage, repairing the window */
+        XDamageSubtract(self->display, de->damage, None, None);
+        XFlush(self->display);
+        self->regions_unknown = true;
+        return;
+    }
+
     XserverRegion region = XFixesCreateRegion(self->display, NULL, 0);
     /* Subtract all the damage, repairing the window */
     XDamageSubtract(self->display, de->damage, None, region);
 
-    if(self->track_type == GSR_DAMAGE_TRACK_WINDOW || (self->track_type == GSR_DAMAGE_TRACK_MONITOR && self->monitor.connector_id == 0)) {
-        self->damaged = true;
-    } else {
-        int num_rectangles = 0;
-        XRectangle *rectangles = XFixesFetchRegion(self->display, region, &num_rectangles);
-        if(rectangles) {
-            const gsr_rectangle monitor_region = { self->monitor.pos, self->monitor.size };
-            for(int i = 0; i < num_rectangles; ++i) {
-                const gsr_rectangle damage_region = { (vec2i){rectangles[i].x, rectangles[i].y}, (vec2i){rectangles[i].width, rectangles[i].height} };
-                self->damaged = rectangles_intersect(monitor_region, damage_region);
-                if(self->damaged)
-                    break;
+    int num_rectangles = 0;
+    XRectangle *rectangles = XFixesFetchRegion(self->display, region, &num_rectangles);
+    if(rectangles) {
+        const gsr_rectangle monitor_region = { self->monitor.pos, self->monitor.size };
+        for(int i = 0; i < num_rectangles; ++i) {
+            const gsr_rectangle damage_region = { (vec2i){rectangles[i].x, rectangles[i].y}, (vec2i){rectangles[i].width, rectangles[i].height} };
+            if(damage_everything || rectangles_intersect(monitor_region, damage_region)) {
+                self->damaged = true;
+                gsr_rectangle_list_add(self->regions, &self->num_regions, GSR_DAMAGE_MAX_REGIONS, damage_region);
             }
-            XFree(rectangles);
         }
+        XFree(rectangles);
+    } else if(damage_everything) {
+        self->regions_unknown = true;
     }
 
     XFixesDestroyRegion(self->display, region);
@@ -324,4 +335,18 @@ bool gsr_damage_is_damaged(gsr_damage *self) {
 
 void gsr_damage_clear(gsr_damage *self) {
     self->damaged = false;
+    self->num_regions = 0;
+    self->regions_unknown = false;
+}
+
+bool gsr_damage_get_regions(gsr_damage *self, const gsr_rectangle **regions, int *num_regions) {
+    *regions = self->regions;
+    *num_regions = self->num_regions;
+    return self->damage_event != 0 && self->damage && self->track_type != GSR_DAMAGE_TRACK_NONE && !self->regions_unknown;
+}
+
+bool gsr_damage_needs_polling(gsr_damage *self) {
+    if(self->damage_event == 0 || self->track_type == GSR_DAMAGE_TRACK_NONE)
+        return false;
+    return self->track_cursor && self->cursor.visible;
 }
@@ -332,6 +332,9 @@ static bool gsr_egl_load_gl(gsr_egl *self, void *library) {
         { (void**)&self->glReadPixels, "glReadPixels" },
         { (void**)&self->glMapBuffer, "glMapBuffer" },
         { (void**)&self->glUnmapBuffer, "glUnmapBuffer" },
+        { (void**)&self->glFenceSync, "glFenceSync" },
+        { (void**)&self->glClientWaitSync, "glClientWaitSync" },
+        { (void**)&self->glDeleteSync, "glDeleteSync" },
 
         { NULL, NULL }
     };
@@ -355,10 +358,11 @@ static void debug_callback(unsigned int source, unsigned int type, unsigned int
         fprintf(stderr, "gsr info: gl callback: %s type = 0x%x, severity = 0x%x, message = %s\n", type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : "", type, severity, message);
 }
 
-bool gsr_egl_load(gsr_egl *self, gsr_window *window, bool is_monitor_capture, bool enable_debug) {
+bool gsr_egl_load(gsr_egl *self, gsr_window *window, bool is_monitor_capture, bool enable_debug, bool allow_software_renderer) {
     memset(self, 0, sizeof(gsr_egl));
     self->context_type = GSR_GL_CONTEXT_TYPE_EGL;
     self->window = window;
+    self->allow_software_renderer = allow_software_renderer;
 
     dlerror(); /* clear */
     self->egl_library = dlopen("libEGL.so.1", RTLD_LAZY);
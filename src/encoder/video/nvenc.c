@@ -174,7 +174,7 @@ void gsr_video_encoder_nvenc_stop(gsr_video_encoder_nvenc *self, AVCodecContext
     gsr_cuda_unload(&self->cuda);
 }
 
-static void gsr_video_encoder_nvenc_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion) {
+static bool gsr_video_encoder_nvenc_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion) {
     gsr_video_encoder_nvenc *self = encoder->priv;
     const int div[2] = {1, 2}; // divide UV texture size by 2 because chroma is half size
     for(int i = 0; i < 2; ++i) {
@@ -199,6 +199,7 @@ static void gsr_video_encoder_nvenc_copy_textures_to_frame(gsr_video_encoder *en
 
     // TODO: needed?
     self->cuda.cuStreamSynchronize(self->cuda_stream);
+    return true;
 }
 
 static void gsr_video_encoder_nvenc_get_textures(gsr_video_encoder *encoder, unsigned int *textures, int *num_textures, gsr_destination_color *destination_color) {
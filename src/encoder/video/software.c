@@ -5,13 +5,32 @@
 #include <libavutil/frame.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #define LINESIZE_ALIGNMENT 4
 
+/* Roughly the number of pixels per second one core can encode with the veryfast preset */
+#define PIXELS_PER_SECOND_PER_THREAD (1920 * 1080 * 15)
+/* More threads than this makes the quality worse without making libx264 faster */
+#define MAX_AUTO_THREADS 16
+
 typedef struct {
     gsr_video_encoder_software_params params;
 
     unsigned int target_textures[2];
+    size_t plane_row_sizes[2];
+    int plane_num_rows[2];
+    size_t plane_offsets[2];
+
+    /* The textures are read back into pixel buffer objects asynchronously and copied to the frame |num_readback_buffers|-1 frames later */
+    int num_readback_buffers;
+    unsigned int readback_buffers[GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS];
+    GLsync readback_fences[GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS];
+    AVBufferRef *readback_regions_of_interest[GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS]; /* The AV_FRAME_DATA_REGIONS_OF_INTEREST of the frame in the readback buffer, can be NULL */
+    int64_t readback_pts[GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS]; /* The pts of the frame in the readback buffer */
+    int readback_index;
+    int num_pending_readbacks;
 } gsr_video_encoder_software;
 
 static unsigned int gl_create_texture(gsr_egl *egl, int width, int height, int internal_format, unsigned int format) {
@@ -46,14 +65,34 @@ static bool gsr_video_encoder_software_setup_textures(gsr_video_encoder_software
     const unsigned int internal_formats_p010[2] = { GL_R16, GL_RG16 };
     const unsigned int formats[2] = { GL_RED, GL_RG };
     const int div[2] = {1, 2}; // divide UV texture size by 2 because chroma is half size
+    const int bytes_per_pixel[2] = {1, 2}; // The textures are read back as GL_UNSIGNED_BYTE
 
+    size_t readback_buffer_size = 0;
     for(int i = 0; i < 2; ++i) {
         self->target_textures[i] = gl_create_texture(self->params.egl, video_codec_context->width / div[i], video_codec_context->height / div[i], self->params.color_depth == GSR_COLOR_DEPTH_8_BITS ? internal_formats_nv12[i] : internal_formats_p010[i], formats[i]);
         if(self->target_textures[i] == 0) {
             fprintf(stderr, "gsr error: gsr_capture_kms_setup_cuda_textures: failed to create opengl texture\n");
             return false;
         }
+
+        // The width is aligned to LINESIZE_ALIGNMENT so the rows are already aligned to the default GL_PACK_ALIGNMENT (4)
+        self->plane_row_sizes[i] = (size_t)(video_codec_context->width / div[i]) * bytes_per_pixel[i];
+        self->plane_num_rows[i] = video_codec_context->height / div[i];
+        self->plane_offsets[i] = readback_buffer_size;
+        readback_buffer_size += self->plane_row_sizes[i] * self->plane_num_rows[i];
+    }
+
+    self->params.egl->glGenBuffers(self->num_readback_buffers, self->readback_buffers);
+    for(int i = 0; i < self->num_readback_buffers; ++i) {
+        if(self->readback_buffers[i] == 0) {
+            fprintf(stderr, "gsr error: gsr_video_encoder_software_setup_textures: failed to create opengl pixel buffer\n");
+            return false;
+        }
+
+        self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, self->readback_buffers[i]);
+        self->params.egl->glBufferData(GL_PIXEL_PACK_BUFFER, readback_buffer_size, NULL, GL_STREAM_READ);
     }
+    self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
     return true;
 }
@@ -82,23 +121,110 @@ void gsr_video_encoder_software_stop(gsr_video_encoder_software *self, AVCodecCo
     self->params.egl->glDeleteTextures(2, self->target_textures);
     self->target_textures[0] = 0;
     self->target_textures[1] = 0;
+
+    for(int i = 0; i < self->num_readback_buffers; ++i) {
+        if(self->readback_fences[i]) {
+            self->params.egl->glDeleteSync(self->readback_fences[i]);
+            self->readback_fences[i] = NULL;
+        }
+        av_buffer_unref(&self->readback_regions_of_interest[i]);
+    }
+    self->params.egl->glDeleteBuffers(self->num_readback_buffers, self->readback_buffers);
+    memset(self->readback_buffers, 0, sizeof(self->readback_buffers));
+    self->num_pending_readbacks = 0;
 }
 
-static void gsr_video_encoder_software_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion) {
-    gsr_video_encoder_software *self = encoder->priv;
+static void gsr_video_encoder_software_start_readback(gsr_video_encoder_software *self, AVFrame *frame) {
+    // The pts and the regions of interest set for this frame have to follow the frame data, which is encoded later
+    self->readback_pts[self->readback_index] = frame->pts;
+    av_buffer_unref(&self->readback_regions_of_interest[self->readback_index]);
+    AVFrameSideData *regions_of_interest = av_frame_get_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if(regions_of_interest) {
+        self->readback_regions_of_interest[self->readback_index] = av_buffer_ref(regions_of_interest->buf);
+        av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    }
+
     // TODO: hdr support
     const unsigned int formats[2] = { GL_RED, GL_RG };
+    self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, self->readback_buffers[self->readback_index]);
     for(int i = 0; i < 2; ++i) {
         self->params.egl->glBindTexture(GL_TEXTURE_2D, self->target_textures[i]);
         // We could use glGetTexSubImage and then we wouldn't have to use a specific linesize (LINESIZE_ALIGNMENT) that adds padding,
         // but glGetTexSubImage is only available starting from opengl 4.5.
-        self->params.egl->glGetTexImage(GL_TEXTURE_2D, 0, formats[i], GL_UNSIGNED_BYTE, frame->data[i]);
+        // With a pixel pack buffer bound the last argument is an offset into the buffer and the call doesn't wait for the gpu.
+        self->params.egl->glGetTexImage(GL_TEXTURE_2D, 0, formats[i], GL_UNSIGNED_BYTE, (void*)(uintptr_t)self->plane_offsets[i]);
     }
     self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
-    // cap_kms->kms.base.egl->eglSwapBuffers(cap_kms->kms.base.egl->egl_display, cap_kms->kms.base.egl->egl_surface);
+    self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
+    self->readback_fences[self->readback_index] = self->params.egl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Start the readback now instead of when the buffer is mapped
     self->params.egl->glFlush();
-    self->params.egl->glFinish();
+
+    self->readback_index = (self->readback_index + 1) % self->num_readback_buffers;
+    ++self->num_pending_readbacks;
+}
+
+static void gsr_video_encoder_software_finish_readback(gsr_video_encoder_software *self, AVFrame *frame) {
+    const int index = (self->readback_index - self->num_pending_readbacks + self->num_readback_buffers) % self->num_readback_buffers;
+    --self->num_pending_readbacks;
+
+    if(self->readback_fences[index]) {
+        // Usually already signaled unless only one readback buffer is used
+        if(self->params.egl->glClientWaitSync(self->readback_fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL) == GL_WAIT_FAILED)
+            fprintf(stderr, "gsr error: gsr_video_encoder_software_finish_readback: glClientWaitSync failed\n");
+        self->params.egl->glDeleteSync(self->readback_fences[index]);
+        self->readback_fences[index] = NULL;
+    }
+
+    self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, self->readback_buffers[index]);
+    const uint8_t *data = self->params.egl->glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if(data) {
+        for(int i = 0; i < 2; ++i) {
+            const uint8_t *plane_data = data + self->plane_offsets[i];
+            if((size_t)frame->linesize[i] == self->plane_row_sizes[i]) {
+                memcpy(frame->data[i], plane_data, self->plane_row_sizes[i] * self->plane_num_rows[i]);
+            } else {
+                for(int row = 0; row < self->plane_num_rows[i]; ++row) {
+                    memcpy(frame->data[i] + (size_t)row * frame->linesize[i], plane_data + row * self->plane_row_sizes[i], self->plane_row_sizes[i]);
+                }
+            }
+        }
+        self->params.egl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        fprintf(stderr, "gsr error: gsr_video_encoder_software_finish_readback: failed to map pixel buffer\n");
+    }
+    self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    frame->pts = self->readback_pts[index];
+    if(self->readback_regions_of_interest[index]) {
+        if(av_frame_new_side_data_from_buf(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, self->readback_regions_of_interest[index]))
+            self->readback_regions_of_interest[index] = NULL;
+        else
+            av_buffer_unref(&self->readback_regions_of_interest[index]);
+    }
+}
+
+static bool gsr_video_encoder_software_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion) {
+    gsr_video_encoder_software *self = encoder->priv;
+    // The readback of this frame overlaps with the color conversion of the next frames. The frame that is encoded now is the oldest
+    // readback, which is |num_readback_buffers|-1 frames old. With one readback buffer this waits for the gpu like glFinish.
+    // There is no frame to encode until the first |num_readback_buffers| frames have been copied.
+    gsr_video_encoder_software_start_readback(self, frame);
+    if(self->num_pending_readbacks < self->num_readback_buffers)
+        return false;
+
+    gsr_video_encoder_software_finish_readback(self, frame);
+    return true;
+}
+
+static bool gsr_video_encoder_software_get_delayed_frame(gsr_video_encoder *encoder, AVFrame *frame) {
+    gsr_video_encoder_software *self = encoder->priv;
+    if(self->num_pending_readbacks == 0)
+        return false;
+
+    gsr_video_encoder_software_finish_readback(self, frame);
+    return true;
 }
 
 static void gsr_video_encoder_software_get_textures(gsr_video_encoder *encoder, unsigned int *textures, int *num_textures, gsr_destination_color *destination_color) {
@@ -127,10 +253,16 @@ gsr_video_encoder* gsr_video_encoder_software_create(const gsr_video_encoder_sof
     }
 
     encoder_software->params = *params;
+    encoder_software->num_readback_buffers = params->num_readback_buffers;
+    if(encoder_software->num_readback_buffers < 1)
+        encoder_software->num_readback_buffers = 1;
+    else if(encoder_software->num_readback_buffers > GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS)
+        encoder_software->num_readback_buffers = GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS;
 
     *encoder = (gsr_video_encoder) {
         .start = gsr_video_encoder_software_start,
         .copy_textures_to_frame = gsr_video_encoder_software_copy_textures_to_frame,
+        .get_delayed_frame = gsr_video_encoder_software_get_delayed_frame,
         .get_textures = gsr_video_encoder_software_get_textures,
         .destroy = gsr_video_encoder_software_destroy,
         .priv = encoder_software
@@ -138,3 +270,37 @@ gsr_video_encoder* gsr_video_encoder_software_create(const gsr_video_encoder_sof
 
     return encoder;
 }
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static int gsr_video_encoder_software_get_auto_num_threads(const AVCodecContext *codec_context) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_cores < 1)
+        num_cores = 1;
+    const int64_t fps = codec_context->framerate.num > 0 ? codec_context->framerate.num : 1;
+    const int64_t pixels_per_second = (int64_t)codec_context->width * (int64_t)codec_context->height * fps;
+    /* One thread more than needed to handle scenes that are more expensive to encode */
+    const int num_threads = (int)((pixels_per_second + PIXELS_PER_SECOND_PER_THREAD - 1) / PIXELS_PER_SECOND_PER_THREAD) + 1;
+    return min_int(min_int(num_threads, (int)num_cores), MAX_AUTO_THREADS);
+}
+
+int gsr_video_encoder_software_set_codec_options(AVCodecContext *codec_context, int num_threads, bool slice_threads, AVDictionary **options) {
+    if(num_threads == 0)
+        num_threads = gsr_video_encoder_software_get_auto_num_threads(codec_context);
+
+    codec_context->thread_count = num_threads;
+    codec_context->thread_type = slice_threads ? FF_THREAD_SLICE : FF_THREAD_FRAME;
+
+    av_dict_set(options, "preset", "veryfast", 0);
+    /* zerolatency makes libx264 use slice threads and disables the frame lookahead */
+    av_dict_set(options, "tune", slice_threads ? "film,zerolatency" : "film", 0);
+
+    if(codec_context->codec_id == AV_CODEC_ID_H264) {
+        av_dict_set(options, "coder", "cabac", 0); // TODO: cavlc is faster than cabac but worse compression. Which to use?
+    }
+
+    av_dict_set(options, "strict", "experimental", 0);
+    return num_threads;
+}
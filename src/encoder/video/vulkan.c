@@ -193,7 +193,7 @@ static void nop_free(void *opaque, uint8_t *data) {
 
 }
 
-static void gsr_video_encoder_vulkan_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion) {
+static bool gsr_video_encoder_vulkan_copy_textures_to_frame(gsr_video_encoder *encoder, AVFrame *frame, gsr_color_conversion *color_conversion) {
     gsr_video_encoder_vulkan *self = encoder->priv;
 
     static int counter = 0;
@@ -272,6 +272,7 @@ static void gsr_video_encoder_vulkan_copy_textures_to_frame(gsr_video_encoder *e
     self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, self->pbo_y[next_pbo_uv]);
     self->params.egl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
     self->params.egl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
 }
 
 static void gsr_video_encoder_vulkan_get_textures(gsr_video_encoder *encoder, unsigned int *textures, int *num_textures, gsr_destination_color *destination_color) {
@@ -0,0 +1,117 @@
+#include "../include/frame_scheduler.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+bool gsr_frame_scheduler_init(gsr_frame_scheduler *self) {
+    memset(self, 0, sizeof(*self));
+    self->wake_fd = -1;
+    self->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(self->timer_fd == -1) {
+        fprintf(stderr, "gsr error: gsr_frame_scheduler_init: timerfd_create failed, error: %s\n", strerror(errno));
+        return false;
+    }
+
+    self->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(self->wake_fd == -1) {
+        fprintf(stderr, "gsr error: gsr_frame_scheduler_init: eventfd failed, error: %s\n", strerror(errno));
+        gsr_frame_scheduler_deinit(self);
+        return false;
+    }
+    return true;
+}
+
+void gsr_frame_scheduler_deinit(gsr_frame_scheduler *self) {
+    if(self->timer_fd != -1) {
+        close(self->timer_fd);
+        self->timer_fd = -1;
+    }
+    if(self->wake_fd != -1) {
+        close(self->wake_fd);
+        self->wake_fd = -1;
+    }
+    self->num_event_fds = 0;
+}
+
+int gsr_frame_scheduler_get_wake_fd(gsr_frame_scheduler *self) {
+    return self->wake_fd;
+}
+
+bool gsr_frame_scheduler_add_event_fd(gsr_frame_scheduler *self, int fd) {
+    if(fd < 0)
+        return false;
+
+    if(self->num_event_fds == GSR_FRAME_SCHEDULER_MAX_EVENT_FDS) {
+        fprintf(stderr, "gsr error: gsr_frame_scheduler_add_event_fd: too many event fds\n");
+        return false;
+    }
+
+    self->event_fds[self->num_event_fds++] = fd;
+    return true;
+}
+
+gsr_frame_scheduler_wake_reason gsr_frame_scheduler_wait(gsr_frame_scheduler *self, double deadline_seconds, bool wake_on_events) {
+    if(deadline_seconds < 0.0)
+        deadline_seconds = 0.0;
+
+    /* A deadline that is in the past makes the timer expire immediately. A zero it_value would disarm the timer instead */
+    struct itimerspec timer_spec;
+    memset(&timer_spec, 0, sizeof(timer_spec));
+    timer_spec.it_value.tv_sec = (time_t)deadline_seconds;
+    timer_spec.it_value.tv_nsec = (long)((deadline_seconds - (double)timer_spec.it_value.tv_sec) * 1000000000.0);
+    if(timer_spec.it_value.tv_nsec >= 1000000000L)
+        timer_spec.it_value.tv_nsec = 999999999L;
+    if(timer_spec.it_value.tv_sec == 0 && timer_spec.it_value.tv_nsec == 0)
+        timer_spec.it_value.tv_nsec = 1;
+
+    if(timerfd_settime(self->timer_fd, TFD_TIMER_ABSTIME, &timer_spec, NULL) == -1) {
+        fprintf(stderr, "gsr error: gsr_frame_scheduler_wait: timerfd_settime failed, error: %s\n", strerror(errno));
+        return GSR_FRAME_SCHEDULER_WAKE_INTERRUPTED;
+    }
+
+    struct pollfd poll_fds[2 + GSR_FRAME_SCHEDULER_MAX_EVENT_FDS];
+    int num_poll_fds = 0;
+    poll_fds[num_poll_fds++] = (struct pollfd){ .fd = self->timer_fd, .events = POLLIN, .revents = 0 };
+    poll_fds[num_poll_fds++] = (struct pollfd){ .fd = self->wake_fd, .events = POLLIN, .revents = 0 };
+    if(wake_on_events) {
+        for(int i = 0; i < self->num_event_fds; ++i) {
+            poll_fds[num_poll_fds++] = (struct pollfd){ .fd = self->event_fds[i], .events = POLLIN, .revents = 0 };
+        }
+    }
+
+    const int result = poll(poll_fds, num_poll_fds, -1);
+
+    /* Clears the expiration (if any) so the timer fd isn't readable the next time */
+    uint64_t num_expirations = 0;
+    const bool deadline_reached = read(self->timer_fd, &num_expirations, sizeof(num_expirations)) == sizeof(num_expirations);
+
+    if(result <= 0)
+        return GSR_FRAME_SCHEDULER_WAKE_INTERRUPTED;
+
+    if(poll_fds[1].revents) {
+        uint64_t num_wakes = 0;
+        if(read(self->wake_fd, &num_wakes, sizeof(num_wakes)) != sizeof(num_wakes)) {}
+        return GSR_FRAME_SCHEDULER_WAKE_INTERRUPTED;
+    }
+
+    for(int i = 2; i < num_poll_fds; ++i) {
+        if(poll_fds[i].revents)
+            return GSR_FRAME_SCHEDULER_WAKE_EVENT;
+    }
+
+    return deadline_reached ? GSR_FRAME_SCHEDULER_WAKE_DEADLINE : GSR_FRAME_SCHEDULER_WAKE_INTERRUPTED;
+}
+
+double gsr_frame_scheduler_get_static_frame_repeat_interval(double frame_time_seconds) {
+    return frame_time_seconds > 0.5 ? frame_time_seconds : 0.5;
+}
+
+bool gsr_frame_scheduler_should_repeat_static_frame(bool changed, bool has_previous_frame, double seconds_since_last_frame, double frame_time_seconds) {
+    return !changed && has_previous_frame && seconds_since_last_frame >= gsr_frame_scheduler_get_static_frame_repeat_interval(frame_time_seconds);
+}
@@ -2,6 +2,7 @@ extern "C" {
 #include "../include/capture/nvfbc.h"
 #include "../include/capture/xcomposite.h"
 #include "../include/capture/kms.h"
+#include "../include/capture/synthetic.h"
 #ifdef GSR_PORTAL
 #include "../include/capture/portal.h"
 #include "../include/dbus.h"
@@ -22,6 +23,12 @@ extern "C" {
 #include "../include/utils.h"
 #include "../include/damage.h"
 #include "../include/color_conversion.h"
+#include "../include/replay_buffer.h"
+#include "../include/packet_queue.h"
+#include "../include/packet_pool.h"
+#include "../include/audio_mixer.h"
+#include "../include/stats.h"
+#include "../include/frame_scheduler.h"
 }
 
 #include <assert.h>
@@ -32,6 +39,7 @@ extern "C" {
 #include <unordered_map>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <map>
 #include <signal.h>
 #include <sys/stat.h>
@@ -51,12 +59,8 @@ extern "C" {
 #include <libavutil/avutil.h>
 #include <libavutil/time.h>
 #include <libavutil/mastering_display_metadata.h>
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersink.h>
-#include <libavfilter/buffersrc.h>
 }
 
-#include <deque>
 #include <future>
 
 #ifndef GSR_VERSION
@@ -138,6 +142,12 @@ enum class BitrateMode {
     CBR
 };
 
+enum class CpuThreadMode {
+    AUTO,
+    FRAME,
+    SLICE
+};
+
 static int x11_error_handler(Display*, XErrorEvent*) {
     return 0;
 }
@@ -216,79 +226,58 @@ static bool video_codec_is_vulkan(VideoCodec video_codec) {
     }
 }
 
-struct PacketData {
-    PacketData() {}
-    PacketData(const PacketData&) = delete;
-    PacketData& operator=(const PacketData&) = delete;
-
-    ~PacketData() {
-        av_free(data.data);
-    }
-
-    AVPacket data;
-};
-
-// |stream| is only required for non-replay mode
+// |stream| and |packet_queue| are only required for non-replay mode. |replay_buffer| is only set in replay mode
 static void receive_frames(AVCodecContext *av_codec_context, int stream_index, AVStream *stream, int64_t pts,
-                           AVFormatContext *av_format_context,
-                           double replay_start_time,
-                           std::deque<std::shared_ptr<PacketData>> &frame_data_queue,
-                           int replay_buffer_size_secs,
-                           bool &frames_erased,
+                           gsr_packet_pool *packet_pool,
+                           gsr_packet_queue *packet_queue,
+                           gsr_replay_buffer *replay_buffer,
                            std::mutex &write_output_mutex,
+                           gsr_stats *stats,
                            double paused_time_offset) {
     for (;;) {
-        AVPacket *av_packet = av_packet_alloc();
+        // Packets are reused, so there are no allocations here once recording has started.
+        // The payloads are reused as well unless the encoder doesn't allocate them from the packet pool
+        AVPacket *av_packet = gsr_packet_pool_get(packet_pool);
         if(!av_packet)
             break;
 
-        av_packet->data = NULL;
-        av_packet->size = 0;
         int res = avcodec_receive_packet(av_codec_context, av_packet);
         if (res == 0) { // we have a packet, send the packet to the muxer
+            gsr_packet_pool_count_received_payload(packet_pool, av_codec_context, av_packet);
             av_packet->stream_index = stream_index;
             av_packet->pts = pts;
             av_packet->dts = pts;
 
-            std::lock_guard<std::mutex> lock(write_output_mutex);
-            if(replay_buffer_size_secs != -1) {
-                // TODO: Preallocate all frames data and use those instead.
+            if(replay_buffer) {
                 // Why are we doing this you ask? there is a new ffmpeg bug that causes cpu usage to increase over time when you have
                 // packets that are not being free'd until later. So we copy the packet data, free the packet and then reconstruct
                 // the packet later on when we need it, to keep packets alive only for a short period.
-                auto new_packet = std::make_shared<PacketData>();
-                new_packet->data = *av_packet;
-                new_packet->data.data = (uint8_t*)av_malloc(av_packet->size);
-                memcpy(new_packet->data.data, av_packet->data, av_packet->size);
-
-                double time_now = clock_get_monotonic_seconds() - paused_time_offset;
-                double replay_time_elapsed = time_now - replay_start_time;
-
-                frame_data_queue.push_back(std::move(new_packet));
-                if(replay_time_elapsed >= replay_buffer_size_secs) {
-                    frame_data_queue.pop_front();
-                    frames_erased = true;
-                }
+                // The data is copied into preallocated slabs so there are no allocations once the replay buffer is full.
+                const double lock_start_time = clock_get_monotonic_seconds();
+                std::lock_guard<std::mutex> lock(write_output_mutex);
+                const double lock_time = clock_get_monotonic_seconds();
+                gsr_stats_add_timing(stats, GSR_STATS_TIMING_WRITE_OUTPUT_MUTEX_WAIT, lock_time - lock_start_time);
+                const double time_now = lock_time - paused_time_offset;
+                if(!gsr_replay_buffer_append(replay_buffer, av_packet, time_now))
+                    fprintf(stderr, "Error: failed to add packet to replay buffer\n");
+                gsr_packet_pool_put(packet_pool, av_packet);
             } else {
                 av_packet_rescale_ts(av_packet, av_codec_context->time_base, stream->time_base);
                 av_packet->stream_index = stream->index;
-                // TODO: Is av_interleaved_write_frame needed?. Answer: might be needed for mkv but dont use it! it causes frames to be inconsistent, skipping frames and duplicating frames
-                int ret = av_write_frame(av_format_context, av_packet);
-                if(ret < 0) {
-                    fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", av_packet->stream_index, av_error_to_string(ret), ret);
-                }
+                // The packet is written to the output by the packet writer thread, so that a slow disk or network doesn't block the encoding.
+                // The packet queue takes ownership of the packet
+                gsr_packet_queue_push(packet_queue, av_packet);
             }
-            av_packet_free(&av_packet);
         } else if (res == AVERROR(EAGAIN)) { // we have no packet
                                              // fprintf(stderr, "No packet!\n");
-            av_packet_free(&av_packet);
+            gsr_packet_pool_put(packet_pool, av_packet);
             break;
         } else if (res == AVERROR_EOF) { // this is the end of the stream
-            av_packet_free(&av_packet);
+            gsr_packet_pool_put(packet_pool, av_packet);
             fprintf(stderr, "End of stream!\n");
             break;
         } else {
-            av_packet_free(&av_packet);
+            gsr_packet_pool_put(packet_pool, av_packet);
             fprintf(stderr, "Unexpected error: %d\n", res);
             break;
         }
@@ -352,7 +341,7 @@ static AVSampleFormat audio_codec_get_sample_format(AVCodecContext *audio_codec_
             }
             #endif
 
-            // Amix only works with float audio
+            // Audio is mixed in float
             if(mix_audio)
                 supports_s16 = false;
 
@@ -715,6 +704,13 @@ static AVFrame* create_audio_frame(AVCodecContext *audio_codec_context) {
     return frame;
 }
 
+// The frame buffer is only reallocated if the encoder still references it
+static int audio_frame_make_writable(AVFrame *frame, std::atomic<uint64_t> &num_allocations) {
+    if(!av_frame_is_writable(frame))
+        num_allocations.fetch_add(1, std::memory_order_relaxed);
+    return av_frame_make_writable(frame);
+}
+
 static void dict_set_profile(AVCodecContext *codec_context, gsr_gpu_vendor vendor, gsr_color_depth color_depth, AVDictionary **options) {
     #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(61, 17, 100)
     if(codec_context->codec_id == AV_CODEC_ID_H264) {
@@ -810,22 +806,21 @@ static void video_software_set_qp(AVCodecContext *codec_context, VideoQuality vi
     }
 }
 
-static void open_video_software(AVCodecContext *codec_context, VideoQuality video_quality, PixelFormat pixel_format, bool hdr, gsr_color_depth color_depth, BitrateMode bitrate_mode) {
+static void open_video_software(AVCodecContext *codec_context, VideoQuality video_quality, PixelFormat pixel_format, bool hdr, gsr_color_depth color_depth, BitrateMode bitrate_mode, CpuThreadMode thread_mode, int num_threads, bool is_livestream) {
     (void)pixel_format; // TODO:
     AVDictionary *options = nullptr;
 
     if(bitrate_mode == BitrateMode::QP)
         video_software_set_qp(codec_context, video_quality, hdr, &options);
 
-    av_dict_set(&options, "preset", "veryfast", 0);
-    av_dict_set(&options, "tune", "film", 0);
-    dict_set_profile(codec_context, GSR_GPU_VENDOR_INTEL, color_depth, &options);
-
-    if(codec_context->codec_id == AV_CODEC_ID_H264) {
-        av_dict_set(&options, "coder", "cabac", 0); // TODO: cavlc is faster than cabac but worse compression. Which to use?
-    }
+    // Frame threads delay the output by one frame per thread, slice threads don't add latency but scale worse.
+    // Livestreams use slice threads by default to keep the latency low
+    if(thread_mode == CpuThreadMode::AUTO)
+        thread_mode = is_livestream ? CpuThreadMode::SLICE : CpuThreadMode::FRAME;
 
-    av_dict_set(&options, "strict", "experimental", 0);
+    num_threads = gsr_video_encoder_software_set_codec_options(codec_context, num_threads, thread_mode == CpuThreadMode::SLICE, &options);
+    fprintf(stderr, "gsr info: encoding with %d %s thread(s) on the cpu\n", num_threads, thread_mode == CpuThreadMode::SLICE ? "slice" : "frame");
+    dict_set_profile(codec_context, GSR_GPU_VENDOR_INTEL, color_depth, &options);
 
     int ret = avcodec_open2(codec_context, codec_context->codec, &options);
     if (ret < 0) {
@@ -1069,7 +1064,7 @@ static void open_video_hardware(AVCodecContext *codec_context, VideoQuality vide
 static void usage_header() {
     const bool inside_flatpak = getenv("FLATPAK_ID") != NULL;
     const char *program_name = inside_flatpak ? "flatpak run --command=gpu-screen-recorder com.dec05eba.gpu_screen_recorder" : "gpu-screen-recorder";
-    printf("usage: %s -w <window_id|monitor|focused|portal> [-c <container_format>] [-s WxH] -f <fps> [-a <audio_input>] [-q <quality>] [-r <replay_buffer_size_sec>] [-k h264|hevc|av1|vp8|vp9|hevc_hdr|av1_hdr|hevc_10bit|av1_10bit] [-ac aac|opus|flac] [-ab <bitrate>] [-oc yes|no] [-fm cfr|vfr|content] [-bm auto|qp|vbr|cbr] [-cr limited|full] [-df yes|no] [-sc <script_path>] [-cursor yes|no] [-keyint <value>] [-restore-portal-session yes|no] [-portal-session-token-filepath filepath] [-encoder gpu|cpu] [-o <output_file>] [--list-capture-options [card_path] [vendor]] [--list-audio-devices] [--list-application-audio] [-v yes|no] [-gl-debug yes|no] [--version] [-h|--help]\n", program_name);
+    printf("usage: %s -w <window_id|monitor|focused|portal|synthetic:WxH:pattern> [-c <container_format>] [-s WxH] -f <fps> [-a <audio_input>] [-q <quality>] [-r <replay_buffer_size_sec>] [-replay-storage ram|disk] [-replay-storage-dir <directory>] [-replay-storage-mb <size_mb>] [-k h264|hevc|av1|vp8|vp9|hevc_hdr|av1_hdr|hevc_10bit|av1_10bit] [-ac aac|opus|flac] [-ab <bitrate>] [-oc yes|no] [-fm cfr|vfr|content] [-skip-static-frames yes|no] [-bm auto|qp|vbr|cbr] [-cr limited|full] [-df yes|no] [-sc <script_path>] [-cursor yes|no] [-keyint <value>] [-restore-portal-session yes|no] [-portal-session-token-filepath filepath] [-encoder gpu|cpu] [-cpu-readback-buffers <count>] [-cpu-thread-mode auto|frame|slice] [-cpu-threads auto|<count>] [-o <output_file>] [--list-capture-options [card_path] [vendor]] [--list-audio-devices] [--list-application-audio] [-v yes|no] [-stats <path>] [-gl-debug yes|no] [--version] [-h|--help]\n", program_name);
     fflush(stdout);
 }
 
@@ -1084,11 +1079,14 @@ static void usage_full() {
     printf("        If this is \"portal\" then xdg desktop screencast portal with PipeWire will be used. Portal option is only available on Wayland.\n");
     printf("        If you select to save the session (token) in the desktop portal capture popup then the session will be saved for the next time you use \"portal\",\n");
     printf("        but the session will be ignored unless you run GPU Screen Recorder with the '-restore-portal-session yes' option.\n");
-    printf("        If this is \"screen\" then the first monitor found is recorded.\n");
+    printf("        If this is \"screen\" then the first monitor found is recorded, except on Wayland on AMD/Intel and Nvidia where all monitors are recorded in one video, placed like they are on the desktop.\n");
     printf("        \"screen-direct\" can only be used on Nvidia X11, to allow recording without breaking VRR (G-SYNC). This also records all of your monitors.\n");
     printf("        Using this \"screen-direct\" option is not recommended unless you use VRR (G-SYNC) as there are Nvidia driver issues that can cause your system or games to freeze/crash.\n");
     printf("        The \"screen-direct\" option is not needed on AMD, Intel nor Nvidia on Wayland as VRR works properly in those cases.\n");
     printf("        Run GPU Screen Recorder with the --list-capture-options option to list valid values for this option.\n");
+    printf("        If this is \"synthetic:WxH:pattern\" or \"synthetic:WxH:pattern:damage_fps\" then a test pattern is recorded instead, for benchmarking.\n");
+    printf("        The pattern should be either \"bars\", \"checker\" or \"solid\" and changes damage_fps times per second (every frame by default).\n");
+    printf("        The synthetic option doesn't need a gpu (it works with llvmpipe) and always uses '-encoder cpu'. A X11 server (such as Xvfb) or a Wayland compositor is still needed.\n");
     printf("\n");
     printf("  -c    Container format for output file, for example mp4, or flv. Only required if no output file is specified or if recording in replay buffer mode.\n");
     printf("        If an output file is specified and -c is not used then the container format is determined from the output filename extension.\n");
@@ -1127,9 +1125,24 @@ static void usage_full() {
     printf("\n");
     printf("  -r    Replay buffer time in seconds. If this is set, then only the last seconds as set by this option will be stored\n");
     printf("        and the video will only be saved when the gpu-screen-recorder is closed. This feature is similar to Nvidia's instant replay feature This option has be between 5 and 1200.\n");
+    printf("        When using '-replay-storage disk' this option has to be between 5 and 86400 instead.\n");
     printf("        Note that the video data is stored in RAM, so don't use too long replay buffer time and use constant bitrate option (-bm cbr) to prevent RAM usage from going too high in busy scenes.\n");
     printf("        Optional, disabled by default.\n");
     printf("\n");
+    printf("  -replay-storage\n");
+    printf("        Where the replay buffer video data is stored. Should be either 'ram' or 'disk'. Optional, set to 'ram' by default.\n");
+    printf("        When this is set to 'disk' the video data is stored in a memory mapped file in the directory set by the -replay-storage-dir option. The file is removed automatically.\n");
+    printf("        This allows for a much longer replay buffer time (see the -r option) without using a lot of RAM, the operating system writes the data to the file when it needs the memory.\n");
+    printf("\n");
+    printf("  -replay-storage-dir\n");
+    printf("        The directory where the replay buffer file is stored when using '-replay-storage disk'. Optional, set to $XDG_RUNTIME_DIR by default (or /tmp if $XDG_RUNTIME_DIR is not set).\n");
+    printf("        Note that $XDG_RUNTIME_DIR and /tmp are usually stored in RAM (tmpfs), set this to a directory on a disk for long replay buffers.\n");
+    printf("\n");
+    printf("  -replay-storage-mb\n");
+    printf("        Max size of the replay buffer in megabytes. If the replay buffer becomes larger than this then the oldest video data is removed,\n");
+    printf("        even if it's within the replay buffer time set with the -r option. This can be used to limit RAM (or disk) usage in busy scenes when not using constant bitrate.\n");
+    printf("        Has to be at least 8. Optional, unlimited by default (only limited by the -r option). This option is only used when -r is set.\n");
+    printf("\n");
     printf("  -k    Video codec to use. Should be either 'auto', 'h264', 'hevc', 'av1', 'vp8', 'vp9', 'hevc_hdr', 'av1_hdr', 'hevc_10bit' or 'av1_10bit'.\n");
     printf("        Optional, set to 'auto' by default which defaults to 'h264'. Forcefully set to 'h264' if the file container type is 'flv'.\n");
     printf("        'hevc_hdr' and 'av1_hdr' option is not available on X11 nor when using the portal capture option.\n");
@@ -1150,7 +1163,12 @@ static void usage_full() {
     printf("\n");
     printf("  -fm   Framerate mode. Should be either 'cfr' (constant frame rate), 'vfr' (variable frame rate) or 'content'. Optional, set to 'vfr' by default.\n");
     printf("        'vfr' is recommended for recording for less issue with very high system load but some applications such as video editors may not support it properly.\n");
-    printf("        'content' is currently only supported on X11 or when using portal capture option. The 'content' option matches the recording frame rate to the captured content.\n");
+    printf("        'content' is currently only supported on X11, when recording a monitor or when using portal capture option. The 'content' option matches the recording frame rate to the captured content.\n");
+    printf("\n");
+    printf("  -skip-static-frames\n");
+    printf("        Don't capture and encode frames when nothing changed on the screen, the previous frame is shown longer instead. Should be either 'yes' or 'no'. Only works with '-fm vfr'.\n");
+    printf("        When nothing changes the previous frame is encoded again twice per second, which is cheap because it doesn't have to be captured again.\n");
+    printf("        This option only works on X11, when recording a monitor or when using portal capture option, like '-fm content'. Optional, set to 'no' by default.\n");
     printf("\n");
     printf("  -bm   Bitrate mode. Should be either 'auto', 'qp' (constant quality), 'vbr' (variable bitrate) or 'cbr' (constant bitrate). Optional, set to 'auto' by default which defaults to 'qp' on all devices\n");
     printf("        except steam deck that has broken drivers and doesn't support qp.\n");
@@ -1189,6 +1207,21 @@ static void usage_full() {
     printf("        Which device should be used for video encoding. Should either be 'gpu' or 'cpu'. 'cpu' option currently only work with h264 codec option (-k).\n");
     printf("        Optional, set to 'gpu' by default.\n");
     printf("\n");
+    printf("  -cpu-readback-buffers\n");
+    printf("        The number of frames that are copied from the gpu at the same time when using '-encoder cpu'. Should be between 1 and %d.\n", GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS);
+    printf("        With 1 the recording waits for the gpu to finish every frame. A higher value increases the fps that can be recorded\n");
+    printf("        but the video is delayed by (value - 1) frames. Optional, set to 2 by default.\n");
+    printf("\n");
+    printf("  -cpu-thread-mode\n");
+    printf("        How the video is split between threads when using '-encoder cpu'. Should be either 'auto', 'frame' or 'slice'.\n");
+    printf("        'frame' encodes multiple frames at the same time, which is the fastest but delays the video by one frame per thread.\n");
+    printf("        'slice' splits every frame between the threads and uses the zerolatency tune, which has lower latency but is slower and has worse quality.\n");
+    printf("        Optional, set to 'auto' by default which uses 'slice' for livestreams and 'frame' otherwise.\n");
+    printf("\n");
+    printf("  -cpu-threads\n");
+    printf("        The number of threads to use when using '-encoder cpu'. Should be either 'auto' or between 1 and %d.\n", SOFTWARE_ENCODER_MAX_THREADS);
+    printf("        Optional, set to 'auto' by default which picks the number of threads from the resolution, fps and number of cpu cores.\n");
+    printf("\n");
     printf("  --info\n");
     printf("        List info about the system. Lists the following information (prints them to stdout and exits):\n");
     printf("        Supported video codecs (h264, h264_software, hevc, hevc_hdr, hevc_10bit, av1, av1_hdr, av1_10bit, vp8, vp9 (if supported)).\n");
@@ -1227,7 +1260,13 @@ static void usage_full() {
     printf("        In replay mode this has to be a directory instead of a file.\n");
     printf("        Note: the directory to the file is created automatically if it doesn't already exist.\n");
     printf("\n");
-    printf("  -v    Prints fps and damage info once per second. Optional, set to 'yes' by default.\n");
+    printf("  -v    Prints fps and damage info once per second. When recording or streaming the number of queued, written and dropped packets is also printed. Optional, set to 'yes' by default.\n");
+    printf("\n");
+    printf("  -stats\n");
+    printf("        Writes statistics once per second as a json object per line to the given fifo, unix domain socket or regular file. A fifo is created if the path doesn't exist.\n");
+    printf("        Each line has the counters since the previous line (captured frames, missed frame deadlines, packets and bytes written, audio underruns and silence fills),\n");
+    printf("        the p50, p99 and max time in microseconds of capture, color conversion, readback, encoder submit, waiting for the output lock and how late the frame pacing woke up,\n");
+    printf("        and the current fps, damage fps, packet queue and replay buffer size. Lines are dropped instead of waiting if the reader is too slow or not connected. Optional, disabled by default.\n");
     printf("\n");
     printf("  -gl-debug\n");
     printf("        Print opengl debug output. Optional, set to 'no' by default.\n");
@@ -1238,6 +1277,8 @@ static void usage_full() {
     printf("NOTES:\n");
     printf("  Send signal SIGINT to gpu-screen-recorder (Ctrl+C, or killall -SIGINT gpu-screen-recorder) to stop and save the recording. When in replay mode this stops recording without saving.\n");
     printf("  Send signal SIGUSR1 to gpu-screen-recorder (killall -SIGUSR1 gpu-screen-recorder) to save a replay (when in replay mode).\n");
+    printf("  Send signal SIGRTMIN+1 to SIGRTMIN+6 to gpu-screen-recorder (killall -SIGRTMIN+1 gpu-screen-recorder) to only save the last 10 seconds, 30 seconds, 1 minute, 5 minutes, 10 minutes or 30 minutes of the replay.\n");
+    printf("  The number of seconds to save can also be sent as the value of SIGUSR1 with sigqueue (/usr/bin/kill -s SIGUSR1 -q 30 <pid>).\n");
     printf("  Send signal SIGUSR2 to gpu-screen-recorder (killall -SIGUSR2 gpu-screen-recorder) to pause/unpause recording. Only applicable and useful when recording (not streaming nor replay).\n");
     printf("\n");
     printf("EXAMPLES:\n");
@@ -1263,18 +1304,46 @@ static void usage() {
 
 static sig_atomic_t running = 1;
 static sig_atomic_t save_replay = 0;
+static sig_atomic_t save_replay_seconds = 0;
 static sig_atomic_t toggle_pause = 0;
+// The wake fd of the frame scheduler. Signals can be delivered to any thread, so the main loop isn't woken up by the signal itself
+static sig_atomic_t signal_wake_fd = -1;
+
+// Signal SIGRTMIN+1 saves the last 10 seconds, SIGRTMIN+2 the last 30 seconds and so on
+static const int save_replay_duration_signal_seconds[] = { 10, 30, 60, 5*60, 10*60, 30*60 };
+
+static void wake_main_loop() {
+    const int wake_fd = signal_wake_fd;
+    if(wake_fd == -1)
+        return;
+
+    const int prev_errno = errno;
+    const uint64_t value = 1;
+    if(write(wake_fd, &value, sizeof(value)) != sizeof(value)) {}
+    errno = prev_errno;
+}
 
 static void stop_handler(int) {
     running = 0;
+    wake_main_loop();
 }
 
-static void save_replay_handler(int) {
+// The number of seconds to save can be sent as the signal value with sigqueue, otherwise the whole replay is saved
+static void save_replay_handler(int, siginfo_t *info, void*) {
+    save_replay_seconds = (info && info->si_code == SI_QUEUE && info->si_value.sival_int > 0) ? info->si_value.sival_int : 0;
     save_replay = 1;
+    wake_main_loop();
+}
+
+static void save_replay_duration_handler(int signum) {
+    save_replay_seconds = save_replay_duration_signal_seconds[signum - (SIGRTMIN + 1)];
+    save_replay = 1;
+    wake_main_loop();
 }
 
 static void toggle_pause_handler(int) {
     toggle_pause = 1;
+    wake_main_loop();
 }
 
 static bool is_hex_num(char c) {
@@ -1402,12 +1471,15 @@ static double audio_codec_get_desired_delay(AudioCodec audio_codec, int fps) {
     return std::max(0.0, base - fps_inv);
 }
 
+// All audio devices are read from the same thread
 struct AudioDeviceData {
     SoundDevice sound_device;
     AudioInput audio_input;
-    AVFilterContext *src_filter_ctx = nullptr;
+    int mixer_source_index = 0;
     AVFrame *frame = nullptr;
-    std::thread thread; // TODO: Instead of having a thread for each track, have one thread for all threads and read the data with non-blocking read
+    SwrContext *swr = nullptr;
+    bool first_frame = true;
+    int64_t num_received_frames = 0;
 };
 
 // TODO: Cleanup
@@ -1417,12 +1489,64 @@ struct AudioTrack {
     AVStream *stream = nullptr;
 
     std::vector<AudioDeviceData> audio_devices;
-    AVFilterGraph *graph = nullptr;
-    AVFilterContext *sink = nullptr;
+    gsr_audio_mixer *mixer = nullptr; // Only set when the audio devices are mixed into one track
+    AVFrame *mixed_frame = nullptr;
     int stream_index = 0;
     int64_t pts = 0;
 };
 
+// The regions that didn't change get a higher qp, the regions that changed keep the qp of the frame. x264 and x265 scale the offset by 25 qp, so this is 2.5 qp
+static const AVRational static_region_of_interest_qoffset = { 1, 10 };
+
+// The damage regions and one region for the whole frame
+#define MAX_VIDEO_FRAME_REGIONS_OF_INTEREST (GSR_COLOR_CONVERSION_MAX_DAMAGE_REGIONS + 1)
+
+static AVBufferPool* create_regions_of_interest_pool() {
+    return av_buffer_pool_init(MAX_VIDEO_FRAME_REGIONS_OF_INTEREST * sizeof(AVRegionOfInterest), nullptr);
+}
+
+// Makes the encoder spend less bits on the regions of the frame that didn't change since the previous frame, which are coded mostly as skip blocks anyways.
+// Only encoders that support regions of interest use them (x264 and x265, and vaapi when the driver supports it), others ignore the side data.
+// The captures only know which regions changed when they convert the frame with opengl, so there are no regions of interest with the vaapi copy on amd.
+// The side data buffer is taken from |pool| so that it's not allocated for every frame. The cpu encoder keeps it until the frame is encoded.
+static void set_video_frame_damage_regions_of_interest(AVFrame *video_frame, gsr_capture *capture, AVBufferPool *pool) {
+    av_frame_remove_side_data(video_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+    const gsr_rectangle *damage_regions = nullptr;
+    int num_damage_regions = 0;
+    if(!pool || !gsr_capture_get_frame_damage_regions(capture, &damage_regions, &num_damage_regions) || num_damage_regions == 0)
+        return;
+
+    num_damage_regions = std::min(num_damage_regions, MAX_VIDEO_FRAME_REGIONS_OF_INTEREST - 1);
+    AVBufferRef *buffer = av_buffer_pool_get(pool);
+    if(!buffer)
+        return;
+
+    // When regions overlap the first one is used, so the damage regions are before the region for the whole frame
+    AVRegionOfInterest *regions_of_interest = (AVRegionOfInterest*)buffer->data;
+    for(int i = 0; i < num_damage_regions; ++i) {
+        regions_of_interest[i].self_size = sizeof(AVRegionOfInterest);
+        regions_of_interest[i].left = damage_regions[i].pos.x;
+        regions_of_interest[i].top = damage_regions[i].pos.y;
+        regions_of_interest[i].right = damage_regions[i].pos.x + damage_regions[i].size.x;
+        regions_of_interest[i].bottom = damage_regions[i].pos.y + damage_regions[i].size.y;
+        regions_of_interest[i].qoffset = av_make_q(0, 1);
+    }
+
+    AVRegionOfInterest *static_region = &regions_of_interest[num_damage_regions];
+    static_region->self_size = sizeof(AVRegionOfInterest);
+    static_region->left = 0;
+    static_region->top = 0;
+    static_region->right = video_frame->width;
+    static_region->bottom = video_frame->height;
+    static_region->qoffset = static_region_of_interest_qoffset;
+
+    // The number of regions is the size of the side data. The pool gives buffers of the max size
+    buffer->size = (num_damage_regions + 1) * sizeof(AVRegionOfInterest);
+    if(!av_frame_new_side_data_from_buf(video_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, buffer))
+        av_buffer_unref(&buffer);
+}
+
 static bool add_hdr_metadata_to_video_stream(gsr_capture *cap, AVStream *video_stream) {
     size_t light_metadata_size = 0;
     size_t mastering_display_metadata_size = 0;
@@ -1475,50 +1599,37 @@ static bool add_hdr_metadata_to_video_stream(gsr_capture *cap, AVStream *video_s
 }
 
 static std::future<void> save_replay_thread;
-static std::vector<std::shared_ptr<PacketData>> save_replay_packets;
+static gsr_replay_snapshot save_replay_snapshot;
 static std::string save_replay_output_filepath;
 
-static void save_replay_async(AVCodecContext *video_codec_context, int video_stream_index, std::vector<AudioTrack> &audio_tracks, std::deque<std::shared_ptr<PacketData>> &frame_data_queue, bool frames_erased, std::string output_dir, const char *container_format, const std::string &file_extension, std::mutex &write_output_mutex, bool date_folders, bool hdr, gsr_capture *capture) {
+// |write_output_mutex| has to be locked when calling this
+static void save_replay_release(gsr_replay_buffer *replay_buffer) {
+    gsr_replay_buffer_snapshot_release(replay_buffer, &save_replay_snapshot);
+}
+
+static void replay_snapshot_for_each_packet(const gsr_replay_snapshot &snapshot, std::function<bool(const gsr_replay_packet &packet, const uint8_t *data)> callback) {
+    for(size_t slab_index = 0; slab_index < snapshot.num_slabs; ++slab_index) {
+        const gsr_replay_slab *slab = snapshot.slabs[slab_index];
+        const size_t first_packet_index = slab_index == 0 ? snapshot.first_packet_index : 0;
+        for(size_t i = first_packet_index; i < slab->num_packets; ++i) {
+            if(!callback(slab->packets[i], slab->data + slab->packets[i].offset))
+                return;
+        }
+    }
+}
+
+// Only the last |save_replay_seconds| seconds of the replay buffer are saved, or the whole replay buffer if it's 0
+static void save_replay_async(AVCodecContext *video_codec_context, int video_stream_index, std::vector<AudioTrack> &audio_tracks, gsr_replay_buffer *replay_buffer, int save_replay_seconds, double paused_time_offset, std::string output_dir, const char *container_format, const std::string &file_extension, std::mutex &write_output_mutex, gsr_stats *stats, bool date_folders, bool hdr, gsr_capture *capture) {
     if(save_replay_thread.valid())
         return;
-    
-    size_t start_index = (size_t)-1;
-    int64_t video_pts_offset = 0;
-    int64_t audio_pts_offset = 0;
 
     {
+        // The snapshot only references the slabs in the replay buffer, the packets are not copied
+        // Same clock as the timestamps given to the replay buffer in receive_frames
+        const double start_timestamp = save_replay_seconds > 0 ? clock_get_monotonic_seconds() - paused_time_offset - save_replay_seconds : 0.0;
         std::lock_guard<std::mutex> lock(write_output_mutex);
-        start_index = (size_t)-1;
-        for(size_t i = 0; i < frame_data_queue.size(); ++i) {
-            const AVPacket &av_packet = frame_data_queue[i]->data;
-            if((av_packet.flags & AV_PKT_FLAG_KEY) && av_packet.stream_index == video_stream_index) {
-                start_index = i;
-                break;
-            }
-        }
-
-        if(start_index == (size_t)-1)
+        if(!gsr_replay_buffer_snapshot(replay_buffer, start_timestamp, &save_replay_snapshot))
             return;
-
-        if(frames_erased) {
-            video_pts_offset = frame_data_queue[start_index]->data.pts;
-            
-            // Find the next audio packet to use as audio pts offset
-            for(size_t i = start_index; i < frame_data_queue.size(); ++i) {
-                const AVPacket &av_packet = frame_data_queue[i]->data;
-                if(av_packet.stream_index != video_stream_index) {
-                    audio_pts_offset = av_packet.pts;
-                    break;
-                }
-            }
-        } else {
-            start_index = 0;
-        }
-
-        save_replay_packets.resize(frame_data_queue.size());
-        for(size_t i = 0; i < frame_data_queue.size(); ++i) {
-            save_replay_packets[i] = frame_data_queue[i];
-        }
     }
 
     if (date_folders) {
@@ -1549,6 +1660,9 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
     const int open_ret = avio_open(&av_format_context->pb, save_replay_output_filepath.c_str(), AVIO_FLAG_WRITE);
     if (open_ret < 0) {
         fprintf(stderr, "Error: Could not open '%s': %s. Make sure %s is an existing directory with write access\n", save_replay_output_filepath.c_str(), av_error_to_string(open_ret), save_replay_output_filepath.c_str());
+        avformat_free_context(av_format_context);
+        std::lock_guard<std::mutex> lock(write_output_mutex);
+        save_replay_release(replay_buffer);
         return;
     }
 
@@ -1561,25 +1675,44 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
         avio_close(av_format_context->pb);
         avformat_free_context(av_format_context);
         av_dict_free(&options);
+        std::lock_guard<std::mutex> lock(write_output_mutex);
+        save_replay_release(replay_buffer);
         return;
     }
 
     if(hdr)
         add_hdr_metadata_to_video_stream(capture, video_stream);
 
-    save_replay_thread = std::async(std::launch::async, [video_stream_index, video_stream, start_index, video_pts_offset, audio_pts_offset, video_codec_context, &audio_tracks, stream_index_to_audio_track_map, av_format_context, options]() mutable {
-        for(size_t i = start_index; i < save_replay_packets.size(); ++i) {
+    save_replay_thread = std::async(std::launch::async, [video_stream_index, video_stream, video_codec_context, &audio_tracks, stream_index_to_audio_track_map, av_format_context, options, stats]() mutable {
+        int64_t video_pts_offset = 0;
+        int64_t audio_pts_offset = 0;
+        if(save_replay_snapshot.starts_at_keyframe) {
+            // The snapshot starts at a video keyframe, use the next audio packet as audio pts offset
+            bool first_packet = true;
+            replay_snapshot_for_each_packet(save_replay_snapshot, [&](const gsr_replay_packet &packet, const uint8_t*) {
+                if(first_packet) {
+                    video_pts_offset = packet.pts;
+                    first_packet = false;
+                }
+
+                if(packet.stream_index != video_stream_index) {
+                    audio_pts_offset = packet.pts;
+                    return false;
+                }
+                return true;
+            });
+        }
+
+        replay_snapshot_for_each_packet(save_replay_snapshot, [&](const gsr_replay_packet &packet, const uint8_t *data) {
             // TODO: Check if successful
             AVPacket av_packet;
             memset(&av_packet, 0, sizeof(av_packet));
-            //av_packet_from_data(av_packet, save_replay_packets[i]->data.data, save_replay_packets[i]->data.size);
-            av_packet.data = save_replay_packets[i]->data.data;
-            av_packet.size = save_replay_packets[i]->data.size;
-            av_packet.stream_index = save_replay_packets[i]->data.stream_index;
-            av_packet.pts = save_replay_packets[i]->data.pts;
-            av_packet.dts = save_replay_packets[i]->data.pts;
-            av_packet.flags = save_replay_packets[i]->data.flags;
-            //av_packet.duration = save_replay_packets[i]->data.duration;
+            av_packet.data = (uint8_t*)data;
+            av_packet.size = packet.size;
+            av_packet.stream_index = packet.stream_index;
+            av_packet.pts = packet.pts;
+            av_packet.dts = packet.pts;
+            av_packet.flags = packet.flags;
 
             AVStream *stream = video_stream;
             AVCodecContext *codec_context = video_codec_context;
@@ -1600,11 +1733,14 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
             av_packet_rescale_ts(&av_packet, codec_context->time_base, stream->time_base);
 
             const int ret = av_write_frame(av_format_context, &av_packet);
-            if(ret < 0)
+            if(ret < 0) {
                 fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", stream->index, av_error_to_string(ret), ret);
-
-            //av_packet_free(&av_packet);
-        }
+            } else {
+                gsr_stats_add_counter(stats, GSR_STATS_COUNTER_PACKETS_WRITTEN, 1);
+                gsr_stats_add_counter(stats, GSR_STATS_COUNTER_BYTES_WRITTEN, packet.size);
+            }
+            return true;
+        });
 
         if (av_write_trailer(av_format_context) != 0)
             fprintf(stderr, "Failed to write trailer\n");
@@ -1710,117 +1846,14 @@ static bool is_livestream_path(const char *str) {
         return false;
 }
 
-// TODO: Proper cleanup
-static int init_filter_graph(AVCodecContext *audio_codec_context, AVFilterGraph **graph, AVFilterContext **sink, std::vector<AVFilterContext*> &src_filter_ctx, size_t num_sources) {
-    char ch_layout[64];
-    int err = 0;
-    ch_layout[0] = '\0';
- 
-    AVFilterGraph *filter_graph = avfilter_graph_alloc();
-    if (!filter_graph) {
-        fprintf(stderr, "Unable to create filter graph.\n");
-        return AVERROR(ENOMEM);
-    }
- 
-    for(size_t i = 0; i < num_sources; ++i) {
-        const AVFilter *abuffer = avfilter_get_by_name("abuffer");
-        if (!abuffer) {
-            fprintf(stderr, "Could not find the abuffer filter.\n");
-            return AVERROR_FILTER_NOT_FOUND;
-        }
-    
-        AVFilterContext *abuffer_ctx = avfilter_graph_alloc_filter(filter_graph, abuffer, NULL);
-        if (!abuffer_ctx) {
-            fprintf(stderr, "Could not allocate the abuffer instance.\n");
-            return AVERROR(ENOMEM);
-        }
-    
-        #if LIBAVCODEC_VERSION_MAJOR < 60
-        av_get_channel_layout_string(ch_layout, sizeof(ch_layout), 0, AV_CH_LAYOUT_STEREO);
-        #else
-        av_channel_layout_describe(&audio_codec_context->ch_layout, ch_layout, sizeof(ch_layout));
-        #endif
-        av_opt_set    (abuffer_ctx, "channel_layout", ch_layout,                                               AV_OPT_SEARCH_CHILDREN);
-        av_opt_set    (abuffer_ctx, "sample_fmt",     av_get_sample_fmt_name(audio_codec_context->sample_fmt), AV_OPT_SEARCH_CHILDREN);
-        av_opt_set_q  (abuffer_ctx, "time_base",      audio_codec_context->time_base,                          AV_OPT_SEARCH_CHILDREN);
-        av_opt_set_int(abuffer_ctx, "sample_rate",    audio_codec_context->sample_rate,                        AV_OPT_SEARCH_CHILDREN);
-        av_opt_set_int(abuffer_ctx, "bit_rate",       audio_codec_context->bit_rate,                           AV_OPT_SEARCH_CHILDREN);
-    
-        err = avfilter_init_str(abuffer_ctx, NULL);
-        if (err < 0) {
-            fprintf(stderr, "Could not initialize the abuffer filter.\n");
-            return err;
-        }
-
-        src_filter_ctx.push_back(abuffer_ctx);
-    }
-
-    const AVFilter *mix_filter = avfilter_get_by_name("amix");
-    if (!mix_filter) {
-        av_log(NULL, AV_LOG_ERROR, "Could not find the mix filter.\n");
-        return AVERROR_FILTER_NOT_FOUND;
-    }
-    
-    char args[512];
-    snprintf(args, sizeof(args), "inputs=%d", (int)num_sources);
-    
-    AVFilterContext *mix_ctx;
-    err = avfilter_graph_create_filter(&mix_ctx, mix_filter, "amix", args, NULL, filter_graph);
-    if (err < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot create audio amix filter\n");
-        return err;
-    }
- 
-    const AVFilter *abuffersink = avfilter_get_by_name("abuffersink");
-    if (!abuffersink) {
-        fprintf(stderr, "Could not find the abuffersink filter.\n");
-        return AVERROR_FILTER_NOT_FOUND;
-    }
- 
-    AVFilterContext *abuffersink_ctx = avfilter_graph_alloc_filter(filter_graph, abuffersink, "sink");
-    if (!abuffersink_ctx) {
-        fprintf(stderr, "Could not allocate the abuffersink instance.\n");
-        return AVERROR(ENOMEM);
-    }
- 
-    err = avfilter_init_str(abuffersink_ctx, NULL);
-    if (err < 0) {
-        fprintf(stderr, "Could not initialize the abuffersink instance.\n");
-        return err;
-    }
- 
-    err = 0;
-    for(size_t i = 0; i < src_filter_ctx.size(); ++i) {
-        AVFilterContext *src_ctx = src_filter_ctx[i];
-        if (err >= 0)
-            err = avfilter_link(src_ctx, 0, mix_ctx, i);
-    }
-    if (err >= 0)
-        err = avfilter_link(mix_ctx, 0, abuffersink_ctx, 0);
-    if (err < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Error connecting filters\n");
-        return err;
-    }
- 
-    err = avfilter_graph_config(filter_graph, NULL);
-    if (err < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Error configuring the filter graph\n");
-        return err;
-    }
- 
-    *graph = filter_graph;
-    *sink  = abuffersink_ctx;
- 
-    return 0;
-}
-
-static gsr_video_encoder* create_video_encoder(gsr_egl *egl, bool overclock, gsr_color_depth color_depth, bool use_software_video_encoder, VideoCodec video_codec) {
+static gsr_video_encoder* create_video_encoder(gsr_egl *egl, bool overclock, gsr_color_depth color_depth, bool use_software_video_encoder, int cpu_readback_buffers, VideoCodec video_codec) {
     gsr_video_encoder *video_encoder = nullptr;
 
     if(use_software_video_encoder) {
         gsr_video_encoder_software_params params;
         params.egl = egl;
         params.color_depth = color_depth;
+        params.num_readback_buffers = cpu_readback_buffers;
         video_encoder = gsr_video_encoder_software_create(&params);
         return video_encoder;
     }
@@ -1850,6 +1883,10 @@ static gsr_video_encoder* create_video_encoder(gsr_egl *egl, bool overclock, gsr
             video_encoder = gsr_video_encoder_nvenc_create(&params);
             break;
         }
+        case GSR_GPU_VENDOR_SOFTWARE: {
+            fprintf(stderr, "Error: gpu video encoding is not available with software rendering, use -encoder cpu\n");
+            break;
+        }
     }
 
     return video_encoder;
@@ -1872,6 +1909,8 @@ static bool get_supported_video_codecs(gsr_egl *egl, VideoCodec video_codec, boo
             return gsr_get_supported_video_codecs_vaapi(video_codecs, egl->card_path, cleanup);
         case GSR_GPU_VENDOR_NVIDIA:
             return gsr_get_supported_video_codecs_nvenc(video_codecs, cleanup);
+        case GSR_GPU_VENDOR_SOFTWARE:
+            return false;
     }
 
     return false;
@@ -1942,6 +1981,9 @@ static void list_gpu_info(gsr_egl *egl) {
         case GSR_GPU_VENDOR_NVIDIA:
             printf("vendor|nvidia\n");
             break;
+        case GSR_GPU_VENDOR_SOFTWARE:
+            printf("vendor|software\n");
+            break;
     }
     printf("card_path|%s\n", egl->card_path);
 }
@@ -2043,6 +2085,8 @@ static void list_supported_video_codecs(gsr_egl *egl, bool wayland) {
 }
 
 static bool monitor_capture_use_drm(const gsr_window *window, gsr_gpu_vendor vendor) {
+    if(vendor == GSR_GPU_VENDOR_SOFTWARE)
+        return false;
     return gsr_window_get_display_server(window) == GSR_DISPLAY_SERVER_WAYLAND || vendor != GSR_GPU_VENDOR_NVIDIA;
 }
 
@@ -2125,7 +2169,7 @@ static void info_command() {
     }
 
     gsr_egl egl;
-    if(!gsr_egl_load(&egl, window, false, false)) {
+    if(!gsr_egl_load(&egl, window, false, false, false)) {
         fprintf(stderr, "gsr error: failed to load opengl\n");
         _exit(22);
     }
@@ -2237,7 +2281,7 @@ static void list_capture_options_command(const char *card_path, gsr_gpu_vendor v
         list_supported_capture_options(window, card_path, true);
     } else {
         gsr_egl egl;
-        if(!gsr_egl_load(&egl, window, false, false)) {
+        if(!gsr_egl_load(&egl, window, false, false, false)) {
             fprintf(stderr, "gsr error: failed to load opengl\n");
             _exit(1);
         }
@@ -2291,7 +2335,10 @@ static void validate_monitor_get_valid(const gsr_egl *egl, std::string &window_s
         for_each_active_monitor_output(egl->window, egl->card_path, connection_type, get_first_output, &first_output);
 
         if(first_output.output_name) {
-            window_str = first_output.output_name;
+            /* kms capture on wayland draws every monitor into the video, everything else records the first monitor */
+            if(!capture_use_drm || is_x11)
+                window_str = first_output.output_name;
+            free(first_output.output_name);
         } else {
             fprintf(stderr, "Error: no usable output found\n");
             _exit(51);
@@ -2329,6 +2376,17 @@ static gsr_capture* create_capture_impl(std::string &window_str, vec2i output_re
         }
 
         follow_focused = true;
+    } else if(strncmp(window_str.c_str(), "synthetic:", 10) == 0) {
+        gsr_capture_synthetic_params synthetic_params;
+        synthetic_params.egl = egl;
+        synthetic_params.fps = fps;
+        if(!gsr_capture_synthetic_parse_options(window_str.c_str() + 10, &synthetic_params)) {
+            fprintf(stderr, "Error: invalid value for option -w '%s', expected 'synthetic:WxH:pattern' or 'synthetic:WxH:pattern:damage_fps' where pattern is 'bars', 'checker' or 'solid'\n", window_str.c_str());
+            usage();
+        }
+        capture = gsr_capture_synthetic_create(&synthetic_params);
+        if(!capture)
+            _exit(1);
     } else if(strcmp(window_str.c_str(), "portal") == 0) {
 #ifdef GSR_PORTAL
         // Desktop portal capture on x11 doesn't seem to be hardware accelerated
@@ -2869,24 +2927,21 @@ static const AVCodec* select_video_codec_with_fallback(VideoCodec *video_codec,
     return pick_video_codec(video_codec, egl, use_software_video_encoder, video_codec_auto, video_codec_to_use, is_flv, low_power);
 }
 
-static std::vector<AudioDeviceData> create_device_audio_inputs(const std::vector<AudioInput> &audio_inputs, AVCodecContext *audio_codec_context, int num_channels, double num_audio_frames_shift, std::vector<AVFilterContext*> &src_filter_ctx, bool use_amix) {
+static std::vector<AudioDeviceData> create_device_audio_inputs(const std::vector<AudioInput> &audio_inputs, AVCodecContext *audio_codec_context, int num_channels, double num_audio_frames_shift, SoundMainloop *sound_mainloop) {
     std::vector<AudioDeviceData> audio_track_audio_devices;
     for(size_t i = 0; i < audio_inputs.size(); ++i) {
         const auto &audio_input = audio_inputs[i];
-        AVFilterContext *src_ctx = nullptr;
-        if(use_amix)
-            src_ctx = src_filter_ctx[i];
 
         AudioDeviceData audio_device;
         audio_device.audio_input = audio_input;
-        audio_device.src_filter_ctx = src_ctx;
+        audio_device.mixer_source_index = i;
 
         if(audio_input.name.empty()) {
             audio_device.sound_device.handle = NULL;
             audio_device.sound_device.frames = 0;
         } else {
             const std::string description = "gsr-" + audio_input.name;
-            if(sound_device_get_by_name(&audio_device.sound_device, audio_input.name.c_str(), description.c_str(), num_channels, audio_codec_context->frame_size, audio_codec_context_get_audio_format(audio_codec_context)) != 0) {
+            if(sound_device_get_by_name(&audio_device.sound_device, sound_mainloop, audio_input.name.c_str(), description.c_str(), num_channels, audio_codec_context->frame_size, audio_codec_context_get_audio_format(audio_codec_context)) != 0) {
                 fprintf(stderr, "Error: failed to get \"%s\" audio device\n", audio_input.name.c_str());
                 _exit(1);
             }
@@ -2901,7 +2956,7 @@ static std::vector<AudioDeviceData> create_device_audio_inputs(const std::vector
 }
 
 #ifdef GSR_APP_AUDIO
-static AudioDeviceData create_application_audio_audio_input(const MergedAudioInputs &merged_audio_inputs, AVCodecContext *audio_codec_context, int num_channels, double num_audio_frames_shift, gsr_pipewire_audio *pipewire_audio) {
+static AudioDeviceData create_application_audio_audio_input(const MergedAudioInputs &merged_audio_inputs, AVCodecContext *audio_codec_context, int num_channels, double num_audio_frames_shift, gsr_pipewire_audio *pipewire_audio, SoundMainloop *sound_mainloop) {
     AudioDeviceData audio_device;
     audio_device.frame = create_audio_frame(audio_codec_context);
     audio_device.frame->pts = -audio_codec_context->frame_size * num_audio_frames_shift;
@@ -2921,7 +2976,7 @@ static AudioDeviceData create_application_audio_audio_input(const MergedAudioInp
 
     combined_sink_name += ".monitor";
 
-    if(sound_device_get_by_name(&audio_device.sound_device, combined_sink_name.c_str(), "gpu-screen-recorder", num_channels, audio_codec_context->frame_size, audio_codec_context_get_audio_format(audio_codec_context)) != 0) {
+    if(sound_device_get_by_name(&audio_device.sound_device, sound_mainloop, combined_sink_name.c_str(), "gpu-screen-recorder", num_channels, audio_codec_context->frame_size, audio_codec_context_get_audio_format(audio_codec_context)) != 0) {
         fprintf(stderr, "Error: failed to setup audio recording to combined sink\n");
         _exit(1);
     }
@@ -2968,9 +3023,19 @@ int main(int argc, char **argv) {
     setlocale(LC_ALL, "C"); // Sigh... stupid C
 
     signal(SIGINT, stop_handler);
-    signal(SIGUSR1, save_replay_handler);
     signal(SIGUSR2, toggle_pause_handler);
 
+    struct sigaction save_replay_action;
+    memset(&save_replay_action, 0, sizeof(save_replay_action));
+    save_replay_action.sa_sigaction = save_replay_handler;
+    save_replay_action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&save_replay_action.sa_mask);
+    sigaction(SIGUSR1, &save_replay_action, nullptr);
+
+    for(size_t i = 0; i < sizeof(save_replay_duration_signal_seconds)/sizeof(save_replay_duration_signal_seconds[0]); ++i) {
+        signal(SIGRTMIN + 1 + i, save_replay_duration_handler);
+    }
+
     // Stop nvidia driver from buffering frames
     setenv("__GL_MaxFramesAllowed", "1", true);
     // If this is set to 1 then cuGraphicsGLRegisterImage will fail for egl context with error: invalid OpenGL or DirectX context,
@@ -3055,14 +3120,19 @@ int main(int argc, char **argv) {
         { "-q", Arg { {}, true, false } },
         { "-o", Arg { {}, true, false } },
         { "-r", Arg { {}, true, false } },
+        { "-replay-storage", Arg { {}, true, false } },
+        { "-replay-storage-dir", Arg { {}, true, false } },
+        { "-replay-storage-mb", Arg { {}, true, false } },
         { "-k", Arg { {}, true, false } },
         { "-ac", Arg { {}, true, false } },
         { "-ab", Arg { {}, true, false } },
         { "-oc", Arg { {}, true, false } },
         { "-fm", Arg { {}, true, false } },
+        { "-skip-static-frames", Arg { {}, true, false } },
         { "-bm", Arg { {}, true, false } },
         { "-pixfmt", Arg { {}, true, false } },
         { "-v", Arg { {}, true, false } },
+        { "-stats", Arg { {}, true, false } },
         { "-gl-debug", Arg { {}, true, false } },
         { "-df", Arg { {}, true, false } },
         { "-sc", Arg { {}, true, false } },
@@ -3072,6 +3142,9 @@ int main(int argc, char **argv) {
         { "-restore-portal-session", Arg { {}, true, false } },
         { "-portal-session-token-filepath", Arg { {}, true, false } },
         { "-encoder", Arg { {}, true, false } },
+        { "-cpu-readback-buffers", Arg { {}, true, false } },
+        { "-cpu-thread-mode", Arg { {}, true, false } },
+        { "-cpu-threads", Arg { {}, true, false } },
     };
 
     for(int i = 1; i < argc; i += 2) {
@@ -3203,6 +3276,42 @@ int main(int argc, char **argv) {
         }
     }
 
+    int cpu_readback_buffers = 2;
+    const char *cpu_readback_buffers_str = args["-cpu-readback-buffers"].value();
+    if(cpu_readback_buffers_str) {
+        cpu_readback_buffers = atoi(cpu_readback_buffers_str);
+        if(cpu_readback_buffers < 1 || cpu_readback_buffers > GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS) {
+            fprintf(stderr, "Error: option -cpu-readback-buffers is expected to be between 1 and %d, was: %s\n", GSR_VIDEO_ENCODER_SOFTWARE_MAX_READBACK_BUFFERS, cpu_readback_buffers_str);
+            usage();
+        }
+    }
+
+    CpuThreadMode cpu_thread_mode = CpuThreadMode::AUTO;
+    const char *cpu_thread_mode_str = args["-cpu-thread-mode"].value();
+    if(!cpu_thread_mode_str)
+        cpu_thread_mode_str = "auto";
+
+    if(strcmp(cpu_thread_mode_str, "auto") == 0) {
+        cpu_thread_mode = CpuThreadMode::AUTO;
+    } else if(strcmp(cpu_thread_mode_str, "frame") == 0) {
+        cpu_thread_mode = CpuThreadMode::FRAME;
+    } else if(strcmp(cpu_thread_mode_str, "slice") == 0) {
+        cpu_thread_mode = CpuThreadMode::SLICE;
+    } else {
+        fprintf(stderr, "Error: -cpu-thread-mode should either be either 'auto', 'frame' or 'slice', got: '%s'\n", cpu_thread_mode_str);
+        usage();
+    }
+
+    int cpu_threads = 0;
+    const char *cpu_threads_str = args["-cpu-threads"].value();
+    if(cpu_threads_str && strcmp(cpu_threads_str, "auto") != 0) {
+        cpu_threads = atoi(cpu_threads_str);
+        if(cpu_threads < 1 || cpu_threads > SOFTWARE_ENCODER_MAX_THREADS) {
+            fprintf(stderr, "Error: option -cpu-threads is expected to be 'auto' or between 1 and %d, was: %s\n", SOFTWARE_ENCODER_MAX_THREADS, cpu_threads_str);
+            usage();
+        }
+    }
+
     bool overclock = false;
     const char *overclock_str = args["-oc"].value();
     if(!overclock_str)
@@ -3231,6 +3340,8 @@ int main(int argc, char **argv) {
         usage();
     }
 
+    const char *stats_path = args["-stats"].value();
+
     bool gl_debug = false;
     const char *gl_debug_str = args["-gl-debug"].value();
     if(!gl_debug_str)
@@ -3370,19 +3481,56 @@ int main(int argc, char **argv) {
     if(fps < 1)
         fps = 1;
 
+    gsr_replay_storage replay_storage = GSR_REPLAY_STORAGE_RAM;
+    const char *replay_storage_str = args["-replay-storage"].value();
+    if(!replay_storage_str)
+        replay_storage_str = "ram";
+
+    if(strcmp(replay_storage_str, "ram") == 0) {
+        replay_storage = GSR_REPLAY_STORAGE_RAM;
+    } else if(strcmp(replay_storage_str, "disk") == 0) {
+        replay_storage = GSR_REPLAY_STORAGE_DISK;
+    } else {
+        fprintf(stderr, "Error: -replay-storage is expected to be 'ram' or 'disk', was '%s'\n", replay_storage_str);
+        usage();
+    }
+
+    const char *replay_storage_dir = args["-replay-storage-dir"].value();
+    if(!replay_storage_dir)
+        replay_storage_dir = getenv("XDG_RUNTIME_DIR");
+    if(!replay_storage_dir)
+        replay_storage_dir = "/tmp";
+
+    const int replay_buffer_max_size_secs = replay_storage == GSR_REPLAY_STORAGE_DISK ? 86400 : 1200;
     int replay_buffer_size_secs = -1;
     const char *replay_buffer_size_secs_str = args["-r"].value();
     if(replay_buffer_size_secs_str) {
         replay_buffer_size_secs = atoi(replay_buffer_size_secs_str);
-        if(replay_buffer_size_secs < 5 || replay_buffer_size_secs > 1200) {
-            fprintf(stderr, "Error: option -r has to be between 5 and 1200, was: %s\n", replay_buffer_size_secs_str);
+        if(replay_buffer_size_secs < 5 || replay_buffer_size_secs > replay_buffer_max_size_secs) {
+            fprintf(stderr, "Error: option -r has to be between 5 and %d, was: %s\n", replay_buffer_max_size_secs, replay_buffer_size_secs_str);
             _exit(1);
         }
         replay_buffer_size_secs += std::ceil(keyint); // Add a few seconds to account of lost packets because of non-keyframe packets skipped
     }
 
+    int64_t replay_storage_mb = 0;
+    const char *replay_storage_mb_str = args["-replay-storage-mb"].value();
+    if(replay_storage_mb_str) {
+        replay_storage_mb = atoll(replay_storage_mb_str);
+        if(replay_storage_mb < 8) {
+            fprintf(stderr, "Error: option -replay-storage-mb has to be at least 8, was: %s\n", replay_storage_mb_str);
+            _exit(1);
+        }
+    }
+
     std::string window_str = args["-w"].value();
     const bool is_portal_capture = strcmp(window_str.c_str(), "portal") == 0;
+    const bool is_synthetic_capture = strncmp(window_str.c_str(), "synthetic:", 10) == 0;
+
+    if(is_synthetic_capture && !use_software_video_encoder) {
+        fprintf(stderr, "gsr info: option '-w synthetic' is used, using '-encoder cpu'\n");
+        use_software_video_encoder = true;
+    }
 
     if(!restore_portal_session && is_portal_capture) {
         fprintf(stderr, "gsr info: option '-w portal' was used without '-restore-portal-session yes'. The previous screencast session will be ignored\n");
@@ -3425,9 +3573,9 @@ int main(int argc, char **argv) {
         _exit(1);
     }
 
-    const bool is_monitor_capture = strcmp(window_str.c_str(), "focused") != 0 && !is_portal_capture && contains_non_hex_number(window_str.c_str());
+    const bool is_monitor_capture = strcmp(window_str.c_str(), "focused") != 0 && !is_portal_capture && !is_synthetic_capture && contains_non_hex_number(window_str.c_str());
     gsr_egl egl;
-    if(!gsr_egl_load(&egl, window, is_monitor_capture, gl_debug)) {
+    if(!gsr_egl_load(&egl, window, is_monitor_capture, gl_debug, is_synthetic_capture)) {
         fprintf(stderr, "gsr error: failed to load opengl\n");
         _exit(1);
     }
@@ -3487,8 +3635,32 @@ int main(int argc, char **argv) {
         usage();
     }
 
-    if(framerate_mode == FramerateMode::CONTENT && wayland && !is_portal_capture) {
-        fprintf(stderr, "Error: -fm 'content' is currently only supported on X11 or when using portal capture option\n");
+    if(framerate_mode == FramerateMode::CONTENT && wayland && !is_portal_capture && !is_synthetic_capture && !is_monitor_capture) {
+        fprintf(stderr, "Error: -fm 'content' is currently only supported on X11, when recording a monitor or when using portal capture option\n");
+        usage();
+    }
+
+    bool skip_static_frames = false;
+    const char *skip_static_frames_str = args["-skip-static-frames"].value();
+    if(!skip_static_frames_str)
+        skip_static_frames_str = "no";
+
+    if(strcmp(skip_static_frames_str, "yes") == 0) {
+        skip_static_frames = true;
+    } else if(strcmp(skip_static_frames_str, "no") == 0) {
+        skip_static_frames = false;
+    } else {
+        fprintf(stderr, "Error: -skip-static-frames should either be either 'yes' or 'no', got: '%s'\n", skip_static_frames_str);
+        usage();
+    }
+
+    if(skip_static_frames && framerate_mode != FramerateMode::VARIABLE) {
+        fprintf(stderr, "Error: -skip-static-frames is only supported with -fm 'vfr'\n");
+        usage();
+    }
+
+    if(skip_static_frames && wayland && !is_portal_capture && !is_synthetic_capture && !is_monitor_capture) {
+        fprintf(stderr, "Error: -skip-static-frames is currently only supported on X11, when recording a monitor or when using portal capture option\n");
         usage();
     }
 
@@ -3697,6 +3869,13 @@ int main(int argc, char **argv) {
     }
 
     AVStream *video_stream = nullptr;
+    SoundMainloop sound_mainloop;
+    sound_mainloop.handle = NULL;
+    if(!requested_audio_inputs.empty() && sound_mainloop_create(&sound_mainloop) != 0) {
+        fprintf(stderr, "Error: failed to create sound mainloop\n");
+        _exit(1);
+    }
+
     std::vector<AudioTrack> audio_tracks;
     const bool hdr = video_codec_is_hdr(video_codec);
     const bool low_latency_recording = is_livestream || is_output_piped;
@@ -3726,7 +3905,7 @@ int main(int argc, char **argv) {
         _exit(capture_result);
     }
 
-    gsr_video_encoder *video_encoder = create_video_encoder(&egl, overclock, color_depth, use_software_video_encoder, video_codec);
+    gsr_video_encoder *video_encoder = create_video_encoder(&egl, overclock, color_depth, use_software_video_encoder, cpu_readback_buffers, video_codec);
     if(!video_encoder) {
         fprintf(stderr, "Error: failed to create video encoder\n");
         _exit(1);
@@ -3752,8 +3931,17 @@ int main(int argc, char **argv) {
 
     gsr_color_conversion_clear(&color_conversion);
 
+    // Enough for a full packet queue and the packets that are being encoded
+    gsr_packet_pool packet_pool;
+    if(!gsr_packet_pool_init(&packet_pool, 1024 + 64)) {
+        fprintf(stderr, "Error: failed to create packet pool\n");
+        _exit(1);
+    }
+
+    // The encoders allocate the packet payloads from the packet pool, this has to be set before the codecs are opened
+    gsr_packet_pool_set_payload_allocator(&packet_pool, video_codec_context);
     if(use_software_video_encoder) {
-        open_video_software(video_codec_context, quality, pixel_format, hdr, color_depth, bitrate_mode);
+        open_video_software(video_codec_context, quality, pixel_format, hdr, color_depth, bitrate_mode, cpu_thread_mode, cpu_threads, is_livestream);
     } else {
         open_video_hardware(video_codec_context, quality, very_old_gpu, egl.gpu_info.vendor, pixel_format, hdr, color_depth, bitrate_mode, video_codec, low_power);
     }
@@ -3773,6 +3961,7 @@ int main(int argc, char **argv) {
         if(audio_stream && !merged_audio_inputs.track_name.empty())
             av_dict_set(&audio_stream->metadata, "title", merged_audio_inputs.track_name.c_str(), 0);
 
+        gsr_packet_pool_set_payload_allocator(&packet_pool, audio_codec_context);
         open_audio(audio_codec_context);
         if(audio_stream)
             avcodec_parameters_from_context(audio_stream->codecpar, audio_codec_context);
@@ -3785,15 +3974,15 @@ int main(int argc, char **argv) {
 
         //audio_frame->sample_rate = audio_codec_context->sample_rate;
 
-        std::vector<AVFilterContext*> src_filter_ctx;
-        AVFilterGraph *graph = nullptr;
-        AVFilterContext *sink = nullptr;
+        gsr_audio_mixer *mixer = nullptr;
+        AVFrame *mixed_frame = nullptr;
         if(use_amix) {
-            int err = init_filter_graph(audio_codec_context, &graph, &sink, src_filter_ctx, merged_audio_inputs.audio_inputs.size());
-            if(err < 0) {
-                fprintf(stderr, "Error: failed to create audio filter\n");
+            mixer = (gsr_audio_mixer*)calloc(1, sizeof(gsr_audio_mixer));
+            if(!mixer || !gsr_audio_mixer_init(mixer, merged_audio_inputs.audio_inputs.size(), audio_codec_context->frame_size, num_channels, audio_codec_context->sample_fmt)) {
+                fprintf(stderr, "Error: failed to create audio mixer\n");
                 _exit(1);
             }
+            mixed_frame = create_audio_frame(audio_codec_context);
         }
 
         // TODO: Cleanup above
@@ -3808,10 +3997,10 @@ int main(int argc, char **argv) {
         if(audio_inputs_has_app_audio(merged_audio_inputs.audio_inputs)) {
             assert(!use_amix);
 #ifdef GSR_APP_AUDIO
-            audio_track_audio_devices.push_back(create_application_audio_audio_input(merged_audio_inputs, audio_codec_context, num_channels, num_audio_frames_shift, &pipewire_audio));
+            audio_track_audio_devices.push_back(create_application_audio_audio_input(merged_audio_inputs, audio_codec_context, num_channels, num_audio_frames_shift, &pipewire_audio, &sound_mainloop));
 #endif
         } else {
-            audio_track_audio_devices = create_device_audio_inputs(merged_audio_inputs.audio_inputs, audio_codec_context, num_channels, num_audio_frames_shift, src_filter_ctx, use_amix);
+            audio_track_audio_devices = create_device_audio_inputs(merged_audio_inputs.audio_inputs, audio_codec_context, num_channels, num_audio_frames_shift, &sound_mainloop);
         }
 
         AudioTrack audio_track;
@@ -3819,8 +4008,8 @@ int main(int argc, char **argv) {
         audio_track.codec_context = audio_codec_context;
         audio_track.stream = audio_stream;
         audio_track.audio_devices = std::move(audio_track_audio_devices);
-        audio_track.graph = graph;
-        audio_track.sink = sink;
+        audio_track.mixer = mixer;
+        audio_track.mixed_frame = mixed_frame;
         audio_track.stream_index = audio_stream_index;
         audio_track.pts = -audio_codec_context->frame_size * num_audio_frames_shift;
         audio_tracks.push_back(std::move(audio_track));
@@ -3857,17 +4046,64 @@ int main(int argc, char **argv) {
     //double frame_timer_start = fps_start_time;
     int fps_counter = 0;
     int damage_fps_counter = 0;
+    uint64_t prev_num_packet_allocations = 0;
+    uint64_t prev_num_payload_allocations = 0;
+    uint64_t prev_num_audio_frame_allocations = 0;
 
     bool paused = false;
     double paused_time_offset = 0.0;
     double paused_time_start = 0.0;
 
     std::mutex write_output_mutex;
-    std::mutex audio_filter_mutex;
+
+    gsr_stats stats;
+    if(!gsr_stats_init(&stats, stats_path)) {
+        fprintf(stderr, "Error: failed to create stats output\n");
+        _exit(1);
+    }
 
     const double record_start_time = clock_get_monotonic_seconds();
-    std::deque<std::shared_ptr<PacketData>> frame_data_queue;
-    bool frames_erased = false;
+    gsr_replay_buffer replay_buffer;
+    gsr_replay_buffer *replay_buffer_ptr = nullptr;
+    if(replay_buffer_size_secs != -1) {
+        if(!gsr_replay_buffer_init(&replay_buffer, replay_storage, replay_storage_dir, (size_t)replay_storage_mb * 1024 * 1024, replay_buffer_size_secs, VIDEO_STREAM_INDEX)) {
+            fprintf(stderr, "Error: failed to create replay buffer\n");
+            _exit(1);
+        }
+        replay_buffer_ptr = &replay_buffer;
+    }
+
+    AVBufferPool *regions_of_interest_pool = create_regions_of_interest_pool();
+    if(!regions_of_interest_pool)
+        fprintf(stderr, "Warning: failed to create the regions of interest pool, the encoder won't get the regions of the frame that changed\n");
+
+    // Livestreams drop packets when the network can't keep up instead of delaying the capture. Other outputs wait for the writer
+    gsr_packet_queue packet_queue;
+    gsr_packet_queue *packet_queue_ptr = nullptr;
+    std::thread packet_writer_thread;
+    if(replay_buffer_size_secs == -1) {
+        if(!gsr_packet_queue_init(&packet_queue, 1024, is_livestream ? GSR_PACKET_QUEUE_FULL_DROP : GSR_PACKET_QUEUE_FULL_BLOCK, VIDEO_STREAM_INDEX, &packet_pool)) {
+            fprintf(stderr, "Error: failed to create packet queue\n");
+            _exit(1);
+        }
+        packet_queue_ptr = &packet_queue;
+
+        packet_writer_thread = std::thread([&]() {
+            AVPacket *av_packet = nullptr;
+            while((av_packet = gsr_packet_queue_pop(&packet_queue))) {
+                // TODO: Is av_interleaved_write_frame needed?. Answer: might be needed for mkv but dont use it! it causes frames to be inconsistent, skipping frames and duplicating frames
+                const int ret = av_write_frame(av_format_context, av_packet);
+                if(ret < 0) {
+                    fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", av_packet->stream_index, av_error_to_string(ret), ret);
+                } else {
+                    gsr_packet_queue_count_written_packet(&packet_queue);
+                    gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_PACKETS_WRITTEN, 1);
+                    gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_BYTES_WRITTEN, av_packet->size);
+                }
+                gsr_packet_pool_put(&packet_pool, av_packet);
+            }
+        });
+    }
 
     const size_t audio_buffer_size = audio_max_frame_size * 4 * 2; // max 4 bytes/sample, 2 channels
     uint8_t *empty_audio = (uint8_t*)malloc(audio_buffer_size);
@@ -3877,191 +4113,191 @@ int main(int argc, char **argv) {
     }
     memset(empty_audio, 0, audio_buffer_size);
 
-    for(AudioTrack &audio_track : audio_tracks) {
-        for(AudioDeviceData &audio_device : audio_track.audio_devices) {
-            audio_device.thread = std::thread([&]() mutable {
+    std::atomic<uint64_t> num_audio_frame_allocations(0);
+    std::thread audio_thread;
+    if(!audio_tracks.empty()) {
+        audio_thread = std::thread([&]() mutable {
+            double timeout_sec = 1.0;
+            for(AudioTrack &audio_track : audio_tracks) {
                 const AVSampleFormat sound_device_sample_format = audio_format_to_sample_format(audio_codec_context_get_audio_format(audio_track.codec_context));
-                // TODO: Always do conversion for now. This fixes issue with stuttering audio on pulseaudio with opus + multiple audio sources merged
-                const bool needs_audio_conversion = true;//audio_track.codec_context->sample_fmt != sound_device_sample_format;
-                SwrContext *swr = nullptr;
-                if(needs_audio_conversion) {
-                    swr = swr_alloc();
-                    if(!swr) {
-                        fprintf(stderr, "Failed to create SwrContext\n");
-                        _exit(1);
+                for(AudioDeviceData &audio_device : audio_track.audio_devices) {
+                    // When the formats match the audio data is copied into the frame instead. The frame data can't point to the sound device buffer
+                    // because the sound device buffer is overwritten on the next read
+                    const bool needs_audio_conversion = audio_track.codec_context->sample_fmt != sound_device_sample_format;
+                    if(needs_audio_conversion) {
+                        SwrContext *swr = swr_alloc();
+                        if(!swr) {
+                            fprintf(stderr, "Failed to create SwrContext\n");
+                            _exit(1);
+                        }
+                        #if LIBAVUTIL_VERSION_MAJOR <= 56
+                        av_opt_set_channel_layout(swr, "in_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+                        av_opt_set_channel_layout(swr, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+                        #elif LIBAVUTIL_VERSION_MAJOR >= 59
+                        av_opt_set_chlayout(swr, "in_chlayout", &audio_track.codec_context->ch_layout, 0);
+                        av_opt_set_chlayout(swr, "out_chlayout", &audio_track.codec_context->ch_layout, 0);
+                        #else
+                        av_opt_set_chlayout(swr, "in_channel_layout", &audio_track.codec_context->ch_layout, 0);
+                        av_opt_set_chlayout(swr, "out_channel_layout", &audio_track.codec_context->ch_layout, 0);
+                        #endif
+                        av_opt_set_int(swr, "in_sample_rate", audio_track.codec_context->sample_rate, 0);
+                        av_opt_set_int(swr, "out_sample_rate", audio_track.codec_context->sample_rate, 0);
+                        av_opt_set_sample_fmt(swr, "in_sample_fmt", sound_device_sample_format, 0);
+                        av_opt_set_sample_fmt(swr, "out_sample_fmt", audio_track.codec_context->sample_fmt, 0);
+                        swr_init(swr);
+                        audio_device.swr = swr;
                     }
-                    #if LIBAVUTIL_VERSION_MAJOR <= 56
-                    av_opt_set_channel_layout(swr, "in_channel_layout", AV_CH_LAYOUT_STEREO, 0);
-                    av_opt_set_channel_layout(swr, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
-                    #elif LIBAVUTIL_VERSION_MAJOR >= 59
-                    av_opt_set_chlayout(swr, "in_chlayout", &audio_track.codec_context->ch_layout, 0);
-                    av_opt_set_chlayout(swr, "out_chlayout", &audio_track.codec_context->ch_layout, 0);
-                    #else
-                    av_opt_set_chlayout(swr, "in_channel_layout", &audio_track.codec_context->ch_layout, 0);
-                    av_opt_set_chlayout(swr, "out_channel_layout", &audio_track.codec_context->ch_layout, 0);
-                    #endif
-                    av_opt_set_int(swr, "in_sample_rate", audio_track.codec_context->sample_rate, 0);
-                    av_opt_set_int(swr, "out_sample_rate", audio_track.codec_context->sample_rate, 0);
-                    av_opt_set_sample_fmt(swr, "in_sample_fmt", sound_device_sample_format, 0);
-                    av_opt_set_sample_fmt(swr, "out_sample_fmt", audio_track.codec_context->sample_fmt, 0);
-                    swr_init(swr);
                 }
 
                 const double audio_fps = (double)audio_track.codec_context->sample_rate / (double)audio_track.codec_context->frame_size;
-                const int64_t timeout_ms = std::round(1000.0 / audio_fps);
-                const double timeout_sec = 1000.0 / audio_fps / 1000.0;
-                bool first_frame = true;
-                int64_t num_received_frames = 0;
-
-                while(running) {
-                    void *sound_buffer;
-                    int sound_buffer_size = -1;
-                    //const double time_before_read_seconds = clock_get_monotonic_seconds();
-                    if(audio_device.sound_device.handle) {
-                        // TODO: use this instead of calculating time to read. But this can fluctuate and we dont want to go back in time,
-                        // also it's 0.0 for some users???
-                        double latency_seconds = 0.0;
-                        sound_buffer_size = sound_device_read_next_chunk(&audio_device.sound_device, &sound_buffer, timeout_sec * 2.0, &latency_seconds);
-                    }
-
-                    const bool got_audio_data = sound_buffer_size >= 0;
-                    //fprintf(stderr, "got audio data: %s\n", got_audio_data ? "yes" : "no");
-                    //const double time_after_read_seconds = clock_get_monotonic_seconds();
-                    //const double time_to_read_seconds = time_after_read_seconds - time_before_read_seconds;
-                    //fprintf(stderr, "time to read: %f, %s, %f\n", time_to_read_seconds, got_audio_data ? "yes" : "no", timeout_sec);
-                    const double this_audio_frame_time = clock_get_monotonic_seconds() - paused_time_offset;
+                timeout_sec = std::min(timeout_sec, 1000.0 / audio_fps / 1000.0);
+            }
 
-                    if(paused) {
-                        if(!audio_device.sound_device.handle)
-                            av_usleep(timeout_ms * 1000);
+            auto encode_audio_frame = [&](AudioTrack &audio_track, AVFrame *frame) {
+                const int ret = avcodec_send_frame(audio_track.codec_context, frame);
+                if(ret >= 0) {
+                    receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, frame->pts, &packet_pool, packet_queue_ptr, replay_buffer_ptr, write_output_mutex, &stats, paused_time_offset);
+                } else {
+                    fprintf(stderr, "Failed to encode audio!\n");
+                }
+            };
 
-                        continue;
-                    }
+            // Mixing is done on the audio thread as soon as every device has provided the frame, so there is no handoff to another thread
+            auto add_audio_frame = [&](AudioTrack &audio_track, AudioDeviceData &audio_device) {
+                if(!audio_track.mixer) {
+                    encode_audio_frame(audio_track, audio_device.frame);
+                    return;
+                }
 
-                    int ret = av_frame_make_writable(audio_device.frame);
-                    if (ret < 0) {
+                gsr_audio_mixer_add_frame(audio_track.mixer, audio_device.mixer_source_index, audio_device.frame->data);
+                while(true) {
+                    if(audio_frame_make_writable(audio_track.mixed_frame, num_audio_frame_allocations) < 0) {
                         fprintf(stderr, "Failed to make audio frame writable\n");
                         break;
                     }
 
-                    // TODO: Is this |received_audio_time| really correct?
-                    const int64_t num_expected_frames = std::round((this_audio_frame_time - record_start_time) / timeout_sec);
-                    int64_t num_missing_frames = std::max((int64_t)0LL, num_expected_frames - num_received_frames);
-
-                    if(got_audio_data)
-                        num_missing_frames = std::max((int64_t)0LL, num_missing_frames - 1);
-
-                    if(!audio_device.sound_device.handle)
-                        num_missing_frames = std::max((int64_t)1, num_missing_frames);
-
-                    // Fucking hell is there a better way to do this? I JUST WANT TO KEEP VIDEO AND AUDIO SYNCED HOLY FUCK I WANT TO KILL MYSELF NOW.
-                    // THIS PIECE OF SHIT WANTS EMPTY FRAMES OTHERWISE VIDEO PLAYS TOO FAST TO KEEP UP WITH AUDIO OR THE AUDIO PLAYS TOO EARLY.
-                    // BUT WE CANT USE DELAYS TO GIVE DUMMY DATA BECAUSE PULSEAUDIO MIGHT GIVE AUDIO A BIG DELAYED!!!
-                    // This garbage is needed because we want to produce constant frame rate videos instead of variable frame rate
-                    // videos because bad software such as video editing software and VLC do not support variable frame rate software,
-                    // despite nvidia shadowplay and xbox game bar producing variable frame rate videos.
-                    // So we have to make sure we produce frames at the same relative rate as the video.
-                    if((num_missing_frames >= 1 && got_audio_data) || num_missing_frames >= 5 || !audio_device.sound_device.handle) {
-                        // TODO:
-                        //audio_track.frame->data[0] = empty_audio;
-                        if(first_frame || num_missing_frames >= 5) {
-                            if(needs_audio_conversion)
-                                swr_convert(swr, &audio_device.frame->data[0], audio_track.codec_context->frame_size, (const uint8_t**)&empty_audio, audio_track.codec_context->frame_size);
-                            else
-                                audio_device.frame->data[0] = empty_audio;
-                        }
-                        first_frame = false;
-
-                        // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
-                        std::lock_guard<std::mutex> lock(audio_filter_mutex);
-                        for(int i = 0; i < num_missing_frames; ++i) {
-                            if(audio_track.graph) {
-                                // TODO: av_buffersrc_add_frame
-                                if(av_buffersrc_write_frame(audio_device.src_filter_ctx, audio_device.frame) < 0) {
-                                    fprintf(stderr, "Error: failed to add audio frame to filter\n");
-                                }
-                            } else {
-                                ret = avcodec_send_frame(audio_track.codec_context, audio_device.frame);
-                                if(ret >= 0) {
-                                    // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                    receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, audio_device.frame->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                                } else {
-                                    fprintf(stderr, "Failed to encode audio!\n");
-                                }
-                            }
-
-                            audio_device.frame->pts += audio_track.codec_context->frame_size;
-                            num_received_frames++;
-                        }
-                    }
+                    if(!gsr_audio_mixer_get_frame(audio_track.mixer, audio_track.mixed_frame->data))
+                        break;
 
-                    if(!audio_device.sound_device.handle)
-                        av_usleep(timeout_ms * 1000);
+                    audio_track.mixed_frame->pts = audio_track.pts;
+                    encode_audio_frame(audio_track, audio_track.mixed_frame);
+                    audio_track.pts += audio_track.codec_context->frame_size;
+                }
+            };
+
+            // Returns true if an audio chunk was read from the audio device
+            auto process_audio_device = [&](AudioTrack &audio_track, AudioDeviceData &audio_device) {
+                const double audio_fps = (double)audio_track.codec_context->sample_rate / (double)audio_track.codec_context->frame_size;
+                const double audio_frame_duration_sec = 1000.0 / audio_fps / 1000.0;
+                // Only used when the sound device format matches the codec format, which is always an interleaved format
+                #if LIBAVCODEC_VERSION_MAJOR < 60
+                const int num_channels = audio_track.codec_context->channels;
+                #else
+                const int num_channels = audio_track.codec_context->ch_layout.nb_channels;
+                #endif
+                const size_t audio_frame_size_bytes = (size_t)audio_track.codec_context->frame_size * num_channels * av_get_bytes_per_sample(audio_track.codec_context->sample_fmt);
+
+                void *sound_buffer;
+                int sound_buffer_size = -1;
+                if(audio_device.sound_device.handle) {
+                    // TODO: use this instead of calculating time to read. But this can fluctuate and we dont want to go back in time,
+                    // also it's 0.0 for some users???
+                    double latency_seconds = 0.0;
+                    sound_buffer_size = sound_device_read_next_chunk(&audio_device.sound_device, &sound_buffer, &latency_seconds);
+                }
+
+                const bool got_audio_data = sound_buffer_size > 0;
+                //fprintf(stderr, "got audio data: %s\n", got_audio_data ? "yes" : "no");
+                const double this_audio_frame_time = clock_get_monotonic_seconds() - paused_time_offset;
+
+                if(paused)
+                    return got_audio_data;
+
+                int ret = audio_frame_make_writable(audio_device.frame, num_audio_frame_allocations);
+                if (ret < 0) {
+                    fprintf(stderr, "Failed to make audio frame writable\n");
+                    return false;
+                }
 
-                    if(got_audio_data) {
-                        // TODO: Instead of converting audio, get float audio from alsa. Or does alsa do conversion internally to get this format?
-                        if(needs_audio_conversion)
-                            swr_convert(swr, &audio_device.frame->data[0], audio_track.codec_context->frame_size, (const uint8_t**)&sound_buffer, audio_track.codec_context->frame_size);
+                // TODO: Is this |received_audio_time| really correct?
+                const int64_t num_expected_frames = std::round((this_audio_frame_time - record_start_time) / audio_frame_duration_sec);
+                int64_t num_missing_frames = std::max((int64_t)0LL, num_expected_frames - audio_device.num_received_frames);
+
+                if(got_audio_data)
+                    num_missing_frames = std::max((int64_t)0LL, num_missing_frames - 1);
+
+                // Fucking hell is there a better way to do this? I JUST WANT TO KEEP VIDEO AND AUDIO SYNCED HOLY FUCK I WANT TO KILL MYSELF NOW.
+                // THIS PIECE OF SHIT WANTS EMPTY FRAMES OTHERWISE VIDEO PLAYS TOO FAST TO KEEP UP WITH AUDIO OR THE AUDIO PLAYS TOO EARLY.
+                // BUT WE CANT USE DELAYS TO GIVE DUMMY DATA BECAUSE PULSEAUDIO MIGHT GIVE AUDIO A BIG DELAYED!!!
+                // This garbage is needed because we want to produce constant frame rate videos instead of variable frame rate
+                // videos because bad software such as video editing software and VLC do not support variable frame rate software,
+                // despite nvidia shadowplay and xbox game bar producing variable frame rate videos.
+                // So we have to make sure we produce frames at the same relative rate as the video.
+                // Devices without a sound device only produce silence, at the same rate as the audio frames are expected.
+                if((num_missing_frames >= 1 && (got_audio_data || !audio_device.sound_device.handle)) || num_missing_frames >= 5) {
+                    // TODO:
+                    //audio_track.frame->data[0] = empty_audio;
+                    if(audio_device.sound_device.handle)
+                        gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_AUDIO_UNDERRUNS, 1);
+
+                    if(audio_device.first_frame || num_missing_frames >= 5 || !audio_device.sound_device.handle) {
+                        if(audio_device.sound_device.handle)
+                            gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_AUDIO_SILENCE_FILLS, num_missing_frames);
+                        if(audio_device.swr)
+                            swr_convert(audio_device.swr, &audio_device.frame->data[0], audio_track.codec_context->frame_size, (const uint8_t**)&empty_audio, audio_track.codec_context->frame_size);
                         else
-                            audio_device.frame->data[0] = (uint8_t*)sound_buffer;
-                        first_frame = false;
-
-                        if(audio_track.graph) {
-                            std::lock_guard<std::mutex> lock(audio_filter_mutex);
-                            // TODO: av_buffersrc_add_frame
-                            if(av_buffersrc_write_frame(audio_device.src_filter_ctx, audio_device.frame) < 0) {
-                                fprintf(stderr, "Error: failed to add audio frame to filter\n");
-                            }
-                        } else {
-                            ret = avcodec_send_frame(audio_track.codec_context, audio_device.frame);
-                            if(ret >= 0) {
-                                // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, audio_device.frame->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                            } else {
-                                fprintf(stderr, "Failed to encode audio!\n");
-                            }
-                        }
+                            memset(audio_device.frame->data[0], 0, audio_frame_size_bytes);
+                    }
+                    audio_device.first_frame = false;
 
+                    // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
+                    for(int i = 0; i < num_missing_frames; ++i) {
+                        add_audio_frame(audio_track, audio_device);
                         audio_device.frame->pts += audio_track.codec_context->frame_size;
-                        num_received_frames++;
+                        audio_device.num_received_frames++;
                     }
                 }
 
-                if(swr)
-                    swr_free(&swr);
-            });
-        }
-    }
+                if(got_audio_data) {
+                    // TODO: Instead of converting audio, get float audio from alsa. Or does alsa do conversion internally to get this format?
+                    if(audio_device.swr)
+                        swr_convert(audio_device.swr, &audio_device.frame->data[0], audio_track.codec_context->frame_size, (const uint8_t**)&sound_buffer, audio_track.codec_context->frame_size);
+                    else
+                        memcpy(audio_device.frame->data[0], sound_buffer, audio_frame_size_bytes);
+                    audio_device.first_frame = false;
+
+                    add_audio_frame(audio_track, audio_device);
+                    audio_device.frame->pts += audio_track.codec_context->frame_size;
+                    audio_device.num_received_frames++;
+                }
 
-    std::thread amix_thread;
-    if(uses_amix) {
-        amix_thread = std::thread([&]() {
-            AVFrame *aframe = av_frame_alloc();
+                return got_audio_data;
+            };
+
+            // Sleeps until one of the audio devices has data or until an audio frame is expected, to add silence to devices that don't have any audio
             while(running) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_filter_mutex);
-                    for(AudioTrack &audio_track : audio_tracks) {
-                        if(!audio_track.sink)
-                            continue;
-
-                        int err = 0;
-                        while ((err = av_buffersink_get_frame(audio_track.sink, aframe)) >= 0) {
-                            aframe->pts = audio_track.pts;
-                            err = avcodec_send_frame(audio_track.codec_context, aframe);
-                            if(err >= 0){
-                                // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, aframe->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                            } else {
-                                fprintf(stderr, "Failed to encode audio!\n");
-                            }
-                            av_frame_unref(aframe);
-                            audio_track.pts += audio_track.codec_context->frame_size;
-                        }
+                if(sound_mainloop.handle) {
+                    if(sound_mainloop_wait(&sound_mainloop, timeout_sec) != 0) {
+                        fprintf(stderr, "Error: failed to wait for audio data\n");
+                        av_usleep(timeout_sec * 1000.0 * 1000.0);
+                    }
+                } else {
+                    av_usleep(timeout_sec * 1000.0 * 1000.0);
+                }
+
+                for(AudioTrack &audio_track : audio_tracks) {
+                    for(AudioDeviceData &audio_device : audio_track.audio_devices) {
+                        while(running && process_audio_device(audio_track, audio_device)) {}
                     }
                 }
-                av_usleep(5 * 1000); // 5 milliseconds
             }
-            av_frame_free(&aframe);
+
+            for(AudioTrack &audio_track : audio_tracks) {
+                for(AudioDeviceData &audio_device : audio_track.audio_devices) {
+                    if(audio_device.swr)
+                        swr_free(&audio_device.swr);
+                }
+            }
         });
     }
 
@@ -4071,17 +4307,24 @@ int main(int argc, char **argv) {
 
     int64_t video_pts_counter = 0;
     int64_t video_prev_pts = 0;
+    bool has_captured_video_frame = false;
 
     bool hdr_metadata_set = false;
 
-    double damage_timeout_seconds = framerate_mode == FramerateMode::CONTENT ? 0.5 : 0.1;
+    // In content mode and when static frames are skipped, frames are only captured when something changed
+    const bool damage_driven_capture = framerate_mode == FramerateMode::CONTENT || skip_static_frames;
+    double damage_timeout_seconds = damage_driven_capture ? 0.5 : 0.1;
     damage_timeout_seconds = std::max(damage_timeout_seconds, target_fps);
+    // The loop has to wake up to repeat the static frames
+    if(skip_static_frames)
+        damage_timeout_seconds = gsr_frame_scheduler_get_static_frame_repeat_interval(target_fps);
 
     bool use_damage_tracking = false;
     gsr_damage damage;
     memset(&damage, 0, sizeof(damage));
-    if(gsr_window_get_display_server(window) == GSR_DISPLAY_SERVER_X11) {
-        gsr_damage_init(&damage, &egl, record_cursor);
+    if(gsr_window_get_display_server(window) == GSR_DISPLAY_SERVER_X11 && !capture->is_damaged) {
+        // Only captures that convert the damaged regions alone use the regions
+        gsr_damage_init(&damage, &egl, record_cursor, capture->set_damage_regions != nullptr);
         use_damage_tracking = true;
     }
 
@@ -4091,6 +4334,67 @@ int main(int argc, char **argv) {
     double last_capture_seconds = record_start_time;
     bool wait_until_frame_time_elapsed = false;
 
+    // Waits on the display server connection as well, so that damage events wake up the main loop right away
+    gsr_frame_scheduler frame_scheduler;
+    if(!gsr_frame_scheduler_init(&frame_scheduler)) {
+        fprintf(stderr, "Error: failed to create frame scheduler\n");
+        _exit(1);
+    }
+    signal_wake_fd = gsr_frame_scheduler_get_wake_fd(&frame_scheduler);
+    gsr_frame_scheduler_add_event_fd(&frame_scheduler, gsr_window_get_event_fd(window));
+    // Captures that track damage themselves (pipewire) signal new frames with an fd. Captures without one have to be polled
+    const int capture_damage_fd = gsr_capture_get_damage_fd(capture);
+    gsr_frame_scheduler_add_event_fd(&frame_scheduler, capture_damage_fd);
+    const bool capture_damage_needs_polling = !use_damage_tracking && capture->is_damaged && capture_damage_fd == -1;
+
+    // The pts of |video_frame| is the frame number it was captured at (constant framerate) or the capture time. The pts is set before the frame is
+    // copied because the cpu encoder delays the frame. With a constant framerate the frames that were missed before this frame are filled with this frame
+    auto encode_video_frame = [&]() {
+        const int64_t frame_pts = video_frame->pts;
+        const int num_frames_to_encode = framerate_mode == FramerateMode::CONSTANT ? std::max((int64_t)1LL, frame_pts - video_pts_counter) : 1;
+        // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
+        for(int i = 0; i < num_frames_to_encode; ++i) {
+            // Duplicate frames didn't change
+            if(i == 1)
+                av_frame_remove_side_data(video_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+            if(framerate_mode == FramerateMode::CONSTANT) {
+                video_frame->pts = video_pts_counter + i;
+            } else {
+                const bool same_pts = frame_pts == video_prev_pts;
+                video_prev_pts = frame_pts;
+                if(same_pts)
+                    continue;
+            }
+
+            const double encoder_submit_start_time = clock_get_monotonic_seconds();
+            int ret = avcodec_send_frame(video_codec_context, video_frame);
+            if(ret == 0) {
+                receive_frames(video_codec_context, VIDEO_STREAM_INDEX, video_stream, video_frame->pts, &packet_pool, packet_queue_ptr,
+                    replay_buffer_ptr, write_output_mutex, &stats, paused_time_offset);
+            } else {
+                fprintf(stderr, "Error: avcodec_send_frame failed, error: %s\n", av_error_to_string(ret));
+            }
+            gsr_stats_add_timing(&stats, GSR_STATS_TIMING_ENCODER_SUBMIT, clock_get_monotonic_seconds() - encoder_submit_start_time);
+        }
+
+        video_pts_counter += num_frames_to_encode;
+    };
+
+    // Sleeps until the absolute |deadline|, or until there are new events if |wake_on_events| is true
+    auto wait_until = [&](double deadline, bool wake_on_events) {
+        if(wake_on_events && gsr_window_has_queued_events(window))
+            return;
+
+        // The capture damage fd stays readable until the damage is cleared, which only happens when a frame is captured.
+        // Waking up on events while that damage is pending would return immediately and spin until the deadline
+        if(wake_on_events && capture_damage_fd != -1 && capture->is_damaged && capture->is_damaged(capture))
+            wake_on_events = false;
+
+        if(gsr_frame_scheduler_wait(&frame_scheduler, deadline, wake_on_events) == GSR_FRAME_SCHEDULER_WAKE_DEADLINE)
+            gsr_stats_add_timing(&stats, GSR_STATS_TIMING_PACING_JITTER, std::max(0.0, clock_get_monotonic_seconds() - deadline));
+    };
+
     while(running) {
         const double frame_start = clock_get_monotonic_seconds();
 
@@ -4125,7 +4429,7 @@ int main(int argc, char **argv) {
             damaged = true;
 
         // TODO: Readd wayland sync warning when removing this
-        if(framerate_mode != FramerateMode::CONTENT)
+        if(!damage_driven_capture)
             damaged = true;
 
         if(damaged)
@@ -4138,6 +4442,41 @@ int main(int argc, char **argv) {
         if (elapsed >= 1.0) {
             if(verbose) {
                 fprintf(stderr, "update fps: %d, damage fps: %d\n", fps_counter, damage_fps_counter);
+                if(packet_queue_ptr) {
+                    const gsr_packet_queue_stats packet_queue_stats = gsr_packet_queue_get_stats(packet_queue_ptr);
+                    fprintf(stderr, "packet queue: %zu queued, %zu max queued, %" PRIu64 " written, %" PRIu64 " dropped\n",
+                        packet_queue_stats.num_packets, packet_queue_stats.max_num_packets, packet_queue_stats.num_packets_written, packet_queue_stats.num_packets_dropped);
+                }
+
+                // Should be 0 when recording has started, the packets, packet payloads and audio frames are reused.
+                // Packet payloads are still allocated by encoders that don't support allocating them from the packet pool
+                const uint64_t num_packet_allocations = gsr_packet_pool_get_num_allocations(&packet_pool);
+                const uint64_t num_payload_allocations = gsr_packet_pool_get_num_payload_allocations(&packet_pool);
+                const uint64_t num_frame_allocations = num_audio_frame_allocations.load(std::memory_order_relaxed);
+                fprintf(stderr, "allocations: %" PRIu64 " packets/s, %" PRIu64 " packet payloads/s, %" PRIu64 " audio frames/s\n",
+                    num_packet_allocations - prev_num_packet_allocations, num_payload_allocations - prev_num_payload_allocations,
+                    num_frame_allocations - prev_num_audio_frame_allocations);
+                prev_num_packet_allocations = num_packet_allocations;
+                prev_num_payload_allocations = num_payload_allocations;
+                prev_num_audio_frame_allocations = num_frame_allocations;
+            }
+
+            if(stats.enabled) {
+                gsr_stats_gauges stats_gauges;
+                memset(&stats_gauges, 0, sizeof(stats_gauges));
+                stats_gauges.update_fps = fps_counter;
+                stats_gauges.damage_fps = damage_fps_counter;
+                if(packet_queue_ptr) {
+                    const gsr_packet_queue_stats packet_queue_stats = gsr_packet_queue_get_stats(packet_queue_ptr);
+                    stats_gauges.packet_queue_packets = packet_queue_stats.num_packets;
+                    stats_gauges.packet_queue_dropped = packet_queue_stats.num_packets_dropped;
+                }
+                // Read without locking |write_output_mutex|, reporting stats shouldn't make the encoders wait
+                if(replay_buffer_ptr) {
+                    stats_gauges.replay_buffer_bytes = gsr_replay_buffer_get_num_bytes(replay_buffer_ptr);
+                    stats_gauges.replay_buffer_packets = gsr_replay_buffer_get_num_packets(replay_buffer_ptr);
+                }
+                gsr_stats_report(&stats, &stats_gauges);
             }
             fps_start_time = time_now;
             fps_counter = 0;
@@ -4151,58 +4490,69 @@ int main(int argc, char **argv) {
 
         bool force_frame_capture = wait_until_frame_time_elapsed && frame_timeout;
         bool allow_capture = !wait_until_frame_time_elapsed || force_frame_capture;
-        if(framerate_mode == FramerateMode::CONTENT) {
+        if(damage_driven_capture) {
             force_frame_capture = false;
             allow_capture = frame_timeout;
         }
 
+        // When static frames are skipped the previous frame is encoded again once in a while without capturing it again
+        const bool repeat_static_frame = skip_static_frames && !paused && gsr_frame_scheduler_should_repeat_static_frame(damaged, has_captured_video_frame, time_since_last_frame_captured_seconds, target_fps);
+
         bool frame_captured = false;
-        if((damaged || force_frame_capture) && allow_capture && !paused) {
+        if(((damaged || force_frame_capture) && allow_capture && !paused) || repeat_static_frame) {
             frame_captured = true;
             frame_time_overflow = std::min(std::max(0.0, frame_time_overflow), target_fps);
             last_capture_seconds = this_video_frame_time - frame_time_overflow;
             wait_until_frame_time_elapsed = false;
 
-            gsr_damage_clear(&damage);
-            if(capture->clear_damage)
-                capture->clear_damage(capture);
-
-            // TODO: Dont do this if no damage?
-            egl.glClear(0);
-            gsr_capture_capture(capture, video_frame, &color_conversion);
-            gsr_egl_swap_buffers(&egl);
-            gsr_video_encoder_copy_textures_to_frame(video_encoder, video_frame, &color_conversion);
+            double readback_start_time = clock_get_monotonic_seconds();
+            if(repeat_static_frame) {
+                // The destination textures still have the previous frame
+                av_frame_remove_side_data(video_frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+                gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_STATIC_FRAMES_REPEATED, 1);
+            } else {
+                if(use_damage_tracking) {
+                    const gsr_rectangle *damage_regions = NULL;
+                    int num_damage_regions = 0;
+                    const bool damage_regions_known = gsr_damage_get_regions(&damage, &damage_regions, &num_damage_regions);
+                    gsr_capture_set_damage_regions(capture, damage_regions_known ? damage_regions : NULL, num_damage_regions);
+                }
 
-            if(hdr && !hdr_metadata_set && replay_buffer_size_secs == -1 && add_hdr_metadata_to_video_stream(capture, video_stream))
-                hdr_metadata_set = true;
+                gsr_damage_clear(&damage);
+                if(capture->clear_damage)
+                    capture->clear_damage(capture);
+
+                // TODO: Dont do this if no damage?
+                // The capture time doesn't include the color conversion that the capture does. These are cpu times, the gpu work is asynchronous
+                const double capture_start_time = clock_get_monotonic_seconds();
+                const double color_conversion_draw_time_start = color_conversion.draw_time_seconds;
+                egl.glClear(0);
+                gsr_capture_capture(capture, video_frame, &color_conversion);
+                gsr_egl_swap_buffers(&egl);
+                const double color_conversion_time = color_conversion.draw_time_seconds - color_conversion_draw_time_start;
+                readback_start_time = clock_get_monotonic_seconds();
+                gsr_stats_add_timing(&stats, GSR_STATS_TIMING_CAPTURE, readback_start_time - capture_start_time - color_conversion_time);
+                gsr_stats_add_timing(&stats, GSR_STATS_TIMING_COLOR_CONVERSION, color_conversion_time);
+                gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_FRAMES_CAPTURED, 1);
+                has_captured_video_frame = true;
+
+                // Set before the copy because the cpu encoder delays the frame, together with its side data
+                set_video_frame_damage_regions_of_interest(video_frame, capture, regions_of_interest_pool);
+            }
 
-            const int64_t expected_frames = std::round((this_video_frame_time - record_start_time) / target_fps);
-            const int num_missed_frames = std::max((int64_t)1LL, expected_frames - video_pts_counter);
+            if(framerate_mode == FramerateMode::CONSTANT)
+                video_frame->pts = std::round((this_video_frame_time - record_start_time) / target_fps);
+            else
+                video_frame->pts = (this_video_frame_time - record_start_time) * (double)AV_TIME_BASE;
 
-            // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
-            const int num_frames_to_encode = framerate_mode == FramerateMode::CONSTANT ? num_missed_frames : 1;
-            for(int i = 0; i < num_frames_to_encode; ++i) {
-                if(framerate_mode == FramerateMode::CONSTANT) {
-                    video_frame->pts = video_pts_counter + i;
-                } else {
-                    video_frame->pts = (this_video_frame_time - record_start_time) * (double)AV_TIME_BASE;
-                    const bool same_pts = video_frame->pts == video_prev_pts;
-                    video_prev_pts = video_frame->pts;
-                    if(same_pts)
-                        continue;
-                }
+            const bool video_frame_ready = gsr_video_encoder_copy_textures_to_frame(video_encoder, video_frame, &color_conversion);
+            gsr_stats_add_timing(&stats, GSR_STATS_TIMING_READBACK, clock_get_monotonic_seconds() - readback_start_time);
 
-                int ret = avcodec_send_frame(video_codec_context, video_frame);
-                if(ret == 0) {
-                    // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                    receive_frames(video_codec_context, VIDEO_STREAM_INDEX, video_stream, video_frame->pts, av_format_context,
-                        record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                } else {
-                    fprintf(stderr, "Error: avcodec_send_frame failed, error: %s\n", av_error_to_string(ret));
-                }
-            }
+            if(hdr && !hdr_metadata_set && replay_buffer_size_secs == -1 && add_hdr_metadata_to_video_stream(capture, video_stream))
+                hdr_metadata_set = true;
 
-            video_pts_counter += num_frames_to_encode;
+            if(video_frame_ready)
+                encode_video_frame();
         }
 
         if(toggle_pause == 1) {
@@ -4226,12 +4576,12 @@ int main(int argc, char **argv) {
             if(recording_saved_script)
                 run_recording_saved_script_async(recording_saved_script, save_replay_output_filepath.c_str(), "replay");
             std::lock_guard<std::mutex> lock(write_output_mutex);
-            save_replay_packets.clear();
+            save_replay_release(replay_buffer_ptr);
         }
 
         if(save_replay == 1 && !save_replay_thread.valid() && replay_buffer_size_secs != -1) {
             save_replay = 0;
-            save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, frame_data_queue, frames_erased, filename, container_format, file_extension, write_output_mutex, date_folders, hdr, capture);
+            save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, replay_buffer_ptr, save_replay_seconds, paused_time_offset, filename, container_format, file_extension, write_output_mutex, &stats, date_folders, hdr, capture);
         }
 
         const double frame_end = clock_get_monotonic_seconds();
@@ -4245,21 +4595,41 @@ int main(int argc, char **argv) {
 
         const double frame_time = frame_end - frame_start;
         const bool frame_deadline_missed = frame_time > target_fps;
+        if(frame_deadline_missed)
+            gsr_stats_add_counter(&stats, GSR_STATS_COUNTER_FRAME_DEADLINE_MISSED, 1);
+        // The deadline is absolute so the time spent in this iteration doesn't delay the next frame.
+        // The signal handlers (stop, pause, save replay) wake up the wait with the wake fd of the frame scheduler
+        const double next_frame_deadline = frame_end + time_to_next_frame;
         if(time_to_next_frame >= 0.0 && !frame_deadline_missed && frame_captured)
-            av_usleep(time_to_next_frame * 1000.0 * 1000.0);
+            wait_until(next_frame_deadline, false);
         else {
             if(paused)
-                av_usleep(20.0 * 1000.0); // 20 milliseconds
+                wait_until(frame_end + 0.5, false); // Nothing is captured while paused. Unpausing wakes up the wait with the wake fd
             else if(frame_deadline_missed)
             {}
-            else if(framerate_mode == FramerateMode::CONTENT || !frame_captured)
-                av_usleep(2.8 * 1000.0); // 2.8 milliseconds
-            else if(!frame_captured)
-                av_usleep(1.0 * 1000.0); // 1 milliseconds
+            else if(damaged && !frame_captured && damage_driven_capture)
+                wait_until(last_capture_seconds + paused_time_offset + target_fps, false); // The damage is already pending, capture it as soon as the frame time has elapsed
+            else if(damage_driven_capture || !frame_captured) {
+                // Sleeps until damage is signaled by the display server connection or the capture damage fd.
+                // Damage that isn't signaled by an event (cursor movement on x11, synthetic capture) is polled once per frame
+                double wake_deadline = frame_end + damage_timeout_seconds;
+                const bool damage_needs_polling = !damage_driven_capture || capture_damage_needs_polling || (use_damage_tracking && gsr_damage_needs_polling(&damage));
+                if(damage_needs_polling)
+                    wake_deadline = std::min(wake_deadline, next_frame_deadline);
+                wait_until(wake_deadline, true);
+            }
             wait_until_frame_time_elapsed = true;
         }
     }
 
+    // The frame scheduler isn't deinitialized. A signal handler on another thread could have loaded |signal_wake_fd| already
+    // and would then write to a closed eventfd, or to another fd that reuses the number. The fds are closed when the process exits
+
+    // The last frames are still in the cpu encoder readback buffers
+    while(gsr_video_encoder_get_delayed_frame(video_encoder, video_frame)) {
+        encode_video_frame();
+    }
+
     running = 0;
 
     if(save_replay_thread.valid()) {
@@ -4269,18 +4639,36 @@ int main(int argc, char **argv) {
         if(recording_saved_script)
             run_recording_saved_script_async(recording_saved_script, save_replay_output_filepath.c_str(), "replay");
         std::lock_guard<std::mutex> lock(write_output_mutex);
-        save_replay_packets.clear();
+        save_replay_release(replay_buffer_ptr);
     }
 
+    if(audio_thread.joinable())
+        audio_thread.join();
+
     for(AudioTrack &audio_track : audio_tracks) {
         for(auto &audio_device : audio_track.audio_devices) {
-            audio_device.thread.join();
             sound_device_close(&audio_device.sound_device);
         }
     }
+    sound_mainloop_destroy(&sound_mainloop);
 
-    if(amix_thread.joinable())
-        amix_thread.join();
+    for(AudioTrack &audio_track : audio_tracks) {
+        if(audio_track.mixer) {
+            gsr_audio_mixer_deinit(audio_track.mixer);
+            free(audio_track.mixer);
+        }
+        av_frame_free(&audio_track.mixed_frame);
+    }
+
+    if(packet_queue_ptr) {
+        gsr_packet_queue_close(packet_queue_ptr);
+        packet_writer_thread.join();
+        gsr_packet_queue_deinit(packet_queue_ptr);
+    }
+    gsr_packet_pool_deinit(&packet_pool);
+    // The buffers that are still in use (by the video frame or the cpu encoder) free the pool when they are unreferenced
+    av_buffer_pool_uninit(&regions_of_interest_pool);
+    gsr_stats_deinit(&stats);
 
     if (replay_buffer_size_secs == -1 && av_write_trailer(av_format_context) != 0) {
         fprintf(stderr, "Failed to write trailer\n");
@@ -4289,6 +4677,9 @@ int main(int argc, char **argv) {
     if(replay_buffer_size_secs == -1 && !(output_format->flags & AVFMT_NOFILE))
         avio_close(av_format_context->pb);
 
+    if(replay_buffer_ptr)
+        gsr_replay_buffer_deinit(replay_buffer_ptr);
+
     gsr_damage_deinit(&damage);
     gsr_color_conversion_deinit(&color_conversion);
     gsr_video_encoder_destroy(video_encoder, video_codec_context);
@@ -0,0 +1,160 @@
+#include "../include/packet_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+
+#define PAYLOAD_MIN_SIZE_SHIFT 10
+
+#if LIBAVUTIL_VERSION_MAJOR < 57
+typedef int buffer_size_t;
+#else
+typedef size_t buffer_size_t;
+#endif
+
+static AVBufferRef* gsr_packet_pool_alloc_payload(void *opaque, buffer_size_t size) {
+    gsr_packet_pool *self = opaque;
+    __atomic_add_fetch(&self->num_payload_allocations, 1, __ATOMIC_RELAXED);
+    return av_buffer_alloc(size);
+}
+
+bool gsr_packet_pool_init(gsr_packet_pool *self, size_t capacity) {
+    memset(self, 0, sizeof(*self));
+    self->capacity = capacity;
+
+    self->packets = calloc(capacity, sizeof(AVPacket*));
+    if(!self->packets) {
+        fprintf(stderr, "gsr error: gsr_packet_pool_init: failed to allocate memory\n");
+        return false;
+    }
+
+    if(pthread_mutex_init(&self->mutex, NULL) != 0) {
+        fprintf(stderr, "gsr error: gsr_packet_pool_init: failed to create mutex\n");
+        free(self->packets);
+        self->packets = NULL;
+        return false;
+    }
+
+    /* The payloads are only allocated when they are needed */
+    for(int i = 0; i < GSR_PACKET_POOL_NUM_PAYLOAD_SIZE_CLASSES; ++i) {
+        self->payload_pools[i] = av_buffer_pool_init2((size_t)1 << (PAYLOAD_MIN_SIZE_SHIFT + i), self, gsr_packet_pool_alloc_payload, NULL);
+        if(!self->payload_pools[i]) {
+            fprintf(stderr, "gsr error: gsr_packet_pool_init: failed to create payload pool\n");
+            gsr_packet_pool_deinit(self);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void gsr_packet_pool_deinit(gsr_packet_pool *self) {
+    if(!self->packets)
+        return;
+
+    for(size_t i = 0; i < self->num_packets; ++i) {
+        av_packet_free(&self->packets[i]);
+    }
+
+    /* A payload pool is freed when its last payload is returned */
+    for(int i = 0; i < GSR_PACKET_POOL_NUM_PAYLOAD_SIZE_CLASSES; ++i) {
+        av_buffer_pool_uninit(&self->payload_pools[i]);
+    }
+
+    pthread_mutex_destroy(&self->mutex);
+    free(self->packets);
+    self->packets = NULL;
+    self->num_packets = 0;
+}
+
+AVPacket* gsr_packet_pool_get(gsr_packet_pool *self) {
+    AVPacket *packet = NULL;
+    pthread_mutex_lock(&self->mutex);
+    if(self->num_packets > 0)
+        packet = self->packets[--self->num_packets];
+    pthread_mutex_unlock(&self->mutex);
+
+    if(!packet) {
+        __atomic_add_fetch(&self->num_allocations, 1, __ATOMIC_RELAXED);
+        packet = av_packet_alloc();
+    }
+    return packet;
+}
+
+void gsr_packet_pool_put(gsr_packet_pool *self, AVPacket *packet) {
+    av_packet_unref(packet);
+
+    pthread_mutex_lock(&self->mutex);
+    if(self->num_packets < self->capacity) {
+        self->packets[self->num_packets++] = packet;
+        packet = NULL;
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    if(packet)
+        av_packet_free(&packet);
+}
+
+static AVBufferRef* gsr_packet_pool_get_payload(gsr_packet_pool *self, size_t size) {
+    for(int i = 0; i < GSR_PACKET_POOL_NUM_PAYLOAD_SIZE_CLASSES; ++i) {
+        if(size <= ((size_t)1 << (PAYLOAD_MIN_SIZE_SHIFT + i)))
+            return av_buffer_pool_get(self->payload_pools[i]);
+    }
+
+    __atomic_add_fetch(&self->num_payload_allocations, 1, __ATOMIC_RELAXED);
+    return av_buffer_alloc(size);
+}
+
+/* get_encode_buffer was added in ffmpeg 4.4 */
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 134, 100)
+#define GSR_PACKET_POOL_HAS_ENCODE_BUFFER
+#endif
+
+#ifdef GSR_PACKET_POOL_HAS_ENCODE_BUFFER
+static int gsr_packet_pool_get_encode_buffer(AVCodecContext *codec_context, AVPacket *packet, int flags) {
+    (void)flags;
+    gsr_packet_pool *self = codec_context->opaque;
+    packet->buf = gsr_packet_pool_get_payload(self, (size_t)packet->size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if(!packet->buf)
+        return AVERROR(ENOMEM);
+
+    packet->data = packet->buf->data;
+    memset(packet->data + packet->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return 0;
+}
+#endif
+
+void gsr_packet_pool_set_payload_allocator(gsr_packet_pool *self, AVCodecContext *codec_context) {
+#ifdef GSR_PACKET_POOL_HAS_ENCODE_BUFFER
+    if(!(codec_context->codec->capabilities & AV_CODEC_CAP_DR1))
+        return;
+
+    codec_context->opaque = self;
+    codec_context->get_encode_buffer = gsr_packet_pool_get_encode_buffer;
+#else
+    (void)self;
+    (void)codec_context;
+#endif
+}
+
+void gsr_packet_pool_count_received_payload(gsr_packet_pool *self, const AVCodecContext *codec_context, const AVPacket *packet) {
+#ifdef GSR_PACKET_POOL_HAS_ENCODE_BUFFER
+    if(packet->buf && codec_context->get_encode_buffer == gsr_packet_pool_get_encode_buffer)
+        return;
+#else
+    (void)codec_context;
+#endif
+    if(packet->buf)
+        __atomic_add_fetch(&self->num_payload_allocations, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t gsr_packet_pool_get_num_allocations(gsr_packet_pool *self) {
+    return __atomic_load_n(&self->num_allocations, __ATOMIC_RELAXED);
+}
+
+uint64_t gsr_packet_pool_get_num_payload_allocations(gsr_packet_pool *self) {
+    return __atomic_load_n(&self->num_payload_allocations, __ATOMIC_RELAXED);
+}
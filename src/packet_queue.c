@@ -0,0 +1,181 @@
+#include "../include/packet_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <libavcodec/avcodec.h>
+
+static size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1;
+    while(result < value)
+        result <<= 1;
+    return result;
+}
+
+bool gsr_packet_queue_init(gsr_packet_queue *self, size_t capacity, gsr_packet_queue_full_policy full_policy, int video_stream_index, gsr_packet_pool *packet_pool) {
+    memset(self, 0, sizeof(*self));
+    self->capacity = round_up_to_power_of_two(capacity < 2 ? 2 : capacity);
+    self->full_policy = full_policy;
+    self->video_stream_index = video_stream_index;
+    self->packet_pool = packet_pool;
+
+    self->slots = calloc(self->capacity, sizeof(gsr_packet_queue_slot));
+    if(!self->slots) {
+        fprintf(stderr, "gsr error: gsr_packet_queue_init: failed to allocate memory\n");
+        return false;
+    }
+
+    for(size_t i = 0; i < self->capacity; ++i) {
+        self->slots[i].sequence = i;
+    }
+
+    if(sem_init(&self->num_packets_sem, 0, 0) != 0) {
+        fprintf(stderr, "gsr error: gsr_packet_queue_init: sem_init failed, error: %s\n", strerror(errno));
+        free(self->slots);
+        self->slots = NULL;
+        return false;
+    }
+
+    if(sem_init(&self->num_free_slots_sem, 0, self->capacity) != 0) {
+        fprintf(stderr, "gsr error: gsr_packet_queue_init: sem_init failed, error: %s\n", strerror(errno));
+        sem_destroy(&self->num_packets_sem);
+        free(self->slots);
+        self->slots = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static AVPacket* gsr_packet_queue_try_pop(gsr_packet_queue *self) {
+    const size_t pos = self->dequeue_pos;
+    gsr_packet_queue_slot *slot = &self->slots[pos & (self->capacity - 1)];
+    if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+        return NULL;
+
+    AVPacket *packet = slot->packet;
+    slot->packet = NULL;
+    __atomic_store_n(&slot->sequence, pos + self->capacity, __ATOMIC_RELEASE);
+    __atomic_store_n(&self->dequeue_pos, pos + 1, __ATOMIC_RELEASE);
+    return packet;
+}
+
+void gsr_packet_queue_deinit(gsr_packet_queue *self) {
+    if(!self->slots)
+        return;
+
+    AVPacket *packet = NULL;
+    while((packet = gsr_packet_queue_try_pop(self))) {
+        gsr_packet_pool_put(self->packet_pool, packet);
+    }
+
+    sem_destroy(&self->num_packets_sem);
+    sem_destroy(&self->num_free_slots_sem);
+    free(self->slots);
+    self->slots = NULL;
+}
+
+static bool gsr_packet_queue_try_push(gsr_packet_queue *self, AVPacket *packet) {
+    size_t pos = __atomic_load_n(&self->enqueue_pos, __ATOMIC_RELAXED);
+    gsr_packet_queue_slot *slot = NULL;
+    for(;;) {
+        slot = &self->slots[pos & (self->capacity - 1)];
+        const size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        const intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&self->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&self->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->packet = packet;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&self->num_packets_sem);
+    return true;
+}
+
+static void gsr_packet_queue_drop(gsr_packet_queue *self, AVPacket *packet) {
+    if(packet->stream_index == self->video_stream_index)
+        self->video_waiting_for_keyframe = true;
+    __atomic_add_fetch(&self->num_packets_dropped, 1, __ATOMIC_RELAXED);
+    gsr_packet_pool_put(self->packet_pool, packet);
+}
+
+bool gsr_packet_queue_push(gsr_packet_queue *self, AVPacket *packet) {
+    if(packet->stream_index == self->video_stream_index && self->video_waiting_for_keyframe) {
+        if(!(packet->flags & AV_PKT_FLAG_KEY)) {
+            gsr_packet_queue_drop(self, packet);
+            return false;
+        }
+        self->video_waiting_for_keyframe = false;
+    }
+
+    /* Reserve a free slot first. The writer thread posts the semaphore when it pops a packet, so a blocked push wakes up as soon as there is room */
+    if(self->full_policy == GSR_PACKET_QUEUE_FULL_DROP) {
+        if(sem_trywait(&self->num_free_slots_sem) != 0) {
+            gsr_packet_queue_drop(self, packet);
+            return false;
+        }
+    } else {
+        while(sem_wait(&self->num_free_slots_sem) == -1 && errno == EINTR) {}
+    }
+
+    /* The writer releases the slot before it posts the semaphore, so this succeeds on the first try once a free slot has been reserved */
+    while(!gsr_packet_queue_try_push(self, packet)) {
+        sched_yield();
+    }
+
+    return true;
+}
+
+AVPacket* gsr_packet_queue_pop(gsr_packet_queue *self) {
+    while(sem_wait(&self->num_packets_sem) == -1 && errno == EINTR) {}
+
+    /* Every push and the close post the semaphore once, so there is either a packet in the queue or the queue has been closed */
+    if(__atomic_load_n(&self->closed, __ATOMIC_ACQUIRE) && self->dequeue_pos == __atomic_load_n(&self->enqueue_pos, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    const size_t num_packets = gsr_packet_queue_get_num_packets(self);
+    if(num_packets > __atomic_load_n(&self->max_num_packets, __ATOMIC_RELAXED))
+        __atomic_store_n(&self->max_num_packets, num_packets, __ATOMIC_RELAXED);
+
+    /* A producer might have reserved the slot but not stored the packet yet */
+    AVPacket *packet = NULL;
+    while(!(packet = gsr_packet_queue_try_pop(self))) {
+        sched_yield();
+    }
+
+    sem_post(&self->num_free_slots_sem);
+    return packet;
+}
+
+void gsr_packet_queue_count_written_packet(gsr_packet_queue *self) {
+    __atomic_add_fetch(&self->num_packets_written, 1, __ATOMIC_RELAXED);
+}
+
+void gsr_packet_queue_close(gsr_packet_queue *self) {
+    __atomic_store_n(&self->closed, true, __ATOMIC_RELEASE);
+    sem_post(&self->num_packets_sem);
+}
+
+size_t gsr_packet_queue_get_num_packets(gsr_packet_queue *self) {
+    /* Load the dequeue position first, otherwise the result could be negative */
+    const size_t dequeue_pos = __atomic_load_n(&self->dequeue_pos, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&self->enqueue_pos, __ATOMIC_ACQUIRE) - dequeue_pos;
+}
+
+gsr_packet_queue_stats gsr_packet_queue_get_stats(gsr_packet_queue *self) {
+    gsr_packet_queue_stats stats;
+    stats.num_packets = gsr_packet_queue_get_num_packets(self);
+    stats.max_num_packets = __atomic_load_n(&self->max_num_packets, __ATOMIC_RELAXED);
+    stats.num_packets_written = __atomic_load_n(&self->num_packets_written, __ATOMIC_RELAXED);
+    stats.num_packets_dropped = __atomic_load_n(&self->num_packets_dropped, __ATOMIC_RELAXED);
+    return stats;
+}
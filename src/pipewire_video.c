@@ -10,6 +10,7 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 
 /* This code is partially based on xr-video-player pipewire implementation which is based on obs-studio's pipewire implementation */
 
@@ -85,10 +86,44 @@ static const struct pw_core_events core_events = {
     .error = on_core_error_cb,
 };
 
+/* Has to be called with |self->mutex| locked */
+static void gsr_pipewire_video_add_damage(gsr_pipewire_video *self, struct spa_meta *video_damage) {
+    if(self->damage.full)
+        return;
+
+    if(!video_damage) {
+        self->damage.full = true;
+        return;
+    }
+
+    /* The list of regions ends with an invalid (empty) region */
+    struct spa_meta_region *meta_region = NULL;
+    spa_meta_for_each(meta_region, video_damage) {
+        if(!spa_meta_region_is_valid(meta_region))
+            break;
+
+        const gsr_rectangle damage_region = {
+            (vec2i){ meta_region->region.position.x, meta_region->region.position.y },
+            (vec2i){ (int)meta_region->region.size.width, (int)meta_region->region.size.height }
+        };
+        gsr_rectangle_list_add(self->damage.regions, &self->damage.num_regions, GSR_PIPEWIRE_VIDEO_MAX_DAMAGE_REGIONS, damage_region);
+    }
+}
+
+/* The damage of a buffer that is skipped for a newer one still has to be converted again, since the newer buffer only has the damage since the skipped one */
+static void gsr_pipewire_video_add_skipped_buffer_damage(gsr_pipewire_video *self, struct spa_buffer *buffer) {
+    if(buffer->datas[0].chunk->size == 0 || buffer->datas[0].type != SPA_DATA_DmaBuf)
+        return;
+
+    pthread_mutex_lock(&self->mutex);
+    gsr_pipewire_video_add_damage(self, spa_buffer_find_meta(buffer, SPA_META_VideoDamage));
+    pthread_mutex_unlock(&self->mutex);
+}
+
 static void on_process_cb(void *user_data) {
     gsr_pipewire_video *self = user_data;
     struct spa_meta_cursor *cursor = NULL;
-    //struct spa_meta *video_damage = NULL;
+    struct spa_meta *video_damage = NULL;
 
     /* Find the most recent buffer */
     struct pw_buffer *pw_buf = NULL;
@@ -96,8 +131,10 @@ static void on_process_cb(void *user_data) {
         struct pw_buffer *aux = pw_stream_dequeue_buffer(self->stream);
         if(!aux)
             break;
-        if(pw_buf)
+        if(pw_buf) {
+            gsr_pipewire_video_add_skipped_buffer_damage(self, pw_buf->buffer);
             pw_stream_queue_buffer(self->stream, pw_buf);
+        }
         pw_buf = aux;
     }
 
@@ -131,6 +168,14 @@ static void on_process_cb(void *user_data) {
             self->dmabuf_data[i].stride = buffer->datas[i].chunk->stride;
         }
 
+        video_damage = spa_buffer_find_meta(buffer, SPA_META_VideoDamage);
+        gsr_pipewire_video_add_damage(self, video_damage);
+
+        if(!self->damaged && self->damage_event_fd > 0) {
+            const uint64_t value = 1;
+            if(write(self->damage_event_fd, &value, sizeof(value)) != sizeof(value))
+                fprintf(stderr, "gsr warning: pipewire: failed to signal damage\n");
+        }
         self->damaged = true;
     } else {
         // TODO:
@@ -155,17 +200,6 @@ static void on_process_cb(void *user_data) {
 
 read_metadata:
 
-    // video_damage = spa_buffer_find_meta(buffer, SPA_META_VideoDamage);
-    // if(video_damage) {
-    //     struct spa_meta_region *r = spa_meta_first(video_damage);
-    //     if(spa_meta_check(r, video_damage)) {
-    //         //fprintf(stderr, "damage: %d,%d %ux%u\n", r->region.position.x, r->region.position.y, r->region.size.width, r->region.size.height);
-    //         pthread_mutex_lock(&self->mutex);
-    //         self->damaged = true;
-    //         pthread_mutex_unlock(&self->mutex);
-    //     }
-    // }
-
     cursor = spa_buffer_find_meta_data(buffer, SPA_META_Cursor, sizeof(*cursor));
     self->cursor.valid = cursor && spa_meta_cursor_is_valid(cursor);
     
@@ -564,6 +598,15 @@ bool gsr_pipewire_video_init(gsr_pipewire_video *self, int pipewire_fd, uint32_t
         return false;
     }
     self->mutex_initialized = true;
+
+    self->damage_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(self->damage_event_fd == -1) {
+        fprintf(stderr, "gsr error: gsr_pipewire_video_init: failed to create damage eventfd\n");
+        self->damage_event_fd = 0;
+        gsr_pipewire_video_deinit(self);
+        return false;
+    }
+
     self->video_info.fps_num = fps;
     self->video_info.fps_den = 1;
     self->cursor.visible = capture_cursor;
@@ -623,6 +666,11 @@ void gsr_pipewire_video_deinit(gsr_pipewire_video *self) {
         self->mutex_initialized = false;
     }
 
+    if(self->damage_event_fd > 0) {
+        close(self->damage_event_fd);
+        self->damage_event_fd = 0;
+    }
+
     if(self->cursor.data) {
         free(self->cursor.data);
         self->cursor.data = NULL;
@@ -715,11 +763,13 @@ static void gsr_pipewire_video_update_cursor_texture(gsr_pipewire_video *self, g
     self->cursor.data = NULL;
 }
 
-bool gsr_pipewire_video_map_texture(gsr_pipewire_video *self, gsr_texture_map texture_map, gsr_pipewire_video_region *region, gsr_pipewire_video_region *cursor_region, gsr_pipewire_video_dmabuf_data *dmabuf_data, int *num_dmabuf_data, uint32_t *fourcc, uint64_t *modifiers, bool *using_external_image) {
+bool gsr_pipewire_video_map_texture(gsr_pipewire_video *self, gsr_texture_map texture_map, gsr_pipewire_video_region *region, gsr_pipewire_video_region *cursor_region, gsr_pipewire_video_damage *damage, gsr_pipewire_video_dmabuf_data *dmabuf_data, int *num_dmabuf_data, uint32_t *fourcc, uint64_t *modifiers, bool *using_external_image) {
     for(int i = 0; i < GSR_PIPEWIRE_VIDEO_DMABUF_MAX_PLANES; ++i) {
         memset(&dmabuf_data[i], 0, sizeof(gsr_pipewire_video_dmabuf_data));
     }
     *num_dmabuf_data = 0;
+    memset(damage, 0, sizeof(*damage));
+    damage->full = true;
     *using_external_image = self->external_texture_fallback;
     *fourcc = 0;
     *modifiers = 0;
@@ -765,6 +815,8 @@ bool gsr_pipewire_video_map_texture(gsr_pipewire_video *self, gsr_texture_map te
         self->dmabuf_data[i].fd = -1;
     }
     *num_dmabuf_data = self->dmabuf_num_planes;
+    *damage = self->damage;
+    memset(&self->damage, 0, sizeof(self->damage));
     *fourcc = spa_video_format_to_drm_format(self->format.info.raw.format);
     *modifiers = self->format.info.raw.modifier;
     self->dmabuf_num_planes = 0;
@@ -783,6 +835,14 @@ bool gsr_pipewire_video_is_damaged(gsr_pipewire_video *self) {
 
 void gsr_pipewire_video_clear_damage(gsr_pipewire_video *self) {
     pthread_mutex_lock(&self->mutex);
+    if(self->damaged && self->damage_event_fd > 0) {
+        uint64_t value = 0;
+        if(read(self->damage_event_fd, &value, sizeof(value)) != sizeof(value)) {}
+    }
     self->damaged = false;
     pthread_mutex_unlock(&self->mutex);
 }
+
+int gsr_pipewire_video_get_damage_fd(gsr_pipewire_video *self) {
+    return self->damage_event_fd > 0 ? self->damage_event_fd : -1;
+}
@@ -0,0 +1,494 @@
+#include "../include/replay_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include <libavcodec/avcodec.h>
+
+#define SLAB_INITIAL_PACKETS_CAPACITY 512
+#define INITIAL_KEYFRAMES_CAPACITY 64
+
+static bool gsr_replay_buffer_map_slab_data(gsr_replay_buffer *self, gsr_replay_slab *slab) {
+    off_t file_offset;
+    if(self->num_free_file_offsets > 0) {
+        file_offset = self->free_file_offsets[--self->num_free_file_offsets];
+    } else {
+        file_offset = self->storage_file_size;
+        /* posix_fallocate instead of ftruncate to fail here instead of getting SIGBUS when writing to the mapping on a full disk */
+        const int err = posix_fallocate(self->storage_fd, file_offset, slab->data_capacity);
+        if(err != 0) {
+            fprintf(stderr, "gsr error: gsr_replay_buffer_map_slab_data: failed to grow storage file, error: %s\n", strerror(err));
+            return false;
+        }
+        self->storage_file_size += slab->data_capacity;
+    }
+
+    void *data = mmap(NULL, slab->data_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, self->storage_fd, file_offset);
+    if(data == MAP_FAILED) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_map_slab_data: mmap failed, error: %s\n", strerror(errno));
+        self->free_file_offsets[self->num_free_file_offsets++] = file_offset;
+        return false;
+    }
+
+    slab->data = data;
+    slab->file_offset = file_offset;
+    return true;
+}
+
+static void gsr_replay_buffer_destroy_slab(gsr_replay_buffer *self, gsr_replay_slab *slab) {
+    if(slab->file_offset != -1) {
+        munmap(slab->data, slab->data_capacity);
+        self->free_file_offsets[self->num_free_file_offsets++] = slab->file_offset;
+    } else {
+        free(slab->data);
+    }
+    self->num_allocated_bytes -= slab->data_capacity;
+    free(slab->packets);
+    free(slab);
+}
+
+static bool gsr_replay_buffer_ensure_free_file_offsets_capacity(gsr_replay_buffer *self) {
+    const size_t num_file_slabs = self->storage_file_size / GSR_REPLAY_BUFFER_SLAB_SIZE;
+    if(num_file_slabs < self->free_file_offsets_capacity)
+        return true;
+
+    const size_t new_capacity = self->free_file_offsets_capacity == 0 ? 16 : self->free_file_offsets_capacity * 2;
+    off_t *new_free_file_offsets = realloc(self->free_file_offsets, new_capacity * sizeof(off_t));
+    if(!new_free_file_offsets)
+        return false;
+
+    self->free_file_offsets = new_free_file_offsets;
+    self->free_file_offsets_capacity = new_capacity;
+    return true;
+}
+
+/* Jumbo slabs are always stored in RAM */
+static gsr_replay_slab* gsr_replay_buffer_create_slab(gsr_replay_buffer *self, size_t data_capacity) {
+    gsr_replay_slab *slab = calloc(1, sizeof(gsr_replay_slab));
+    if(!slab)
+        return NULL;
+
+    slab->data_capacity = data_capacity;
+    slab->file_offset = -1;
+    slab->packets = malloc(SLAB_INITIAL_PACKETS_CAPACITY * sizeof(gsr_replay_packet));
+    if(!slab->packets) {
+        free(slab);
+        return NULL;
+    }
+
+    if(self->storage == GSR_REPLAY_STORAGE_DISK && data_capacity == GSR_REPLAY_BUFFER_SLAB_SIZE) {
+        if(!gsr_replay_buffer_ensure_free_file_offsets_capacity(self) || !gsr_replay_buffer_map_slab_data(self, slab)) {
+            free(slab->packets);
+            free(slab);
+            return NULL;
+        }
+    } else {
+        slab->data = malloc(data_capacity);
+        if(!slab->data) {
+            free(slab->packets);
+            free(slab);
+            return NULL;
+        }
+    }
+
+    slab->packets_capacity = SLAB_INITIAL_PACKETS_CAPACITY;
+    self->num_allocated_bytes += data_capacity;
+    return slab;
+}
+
+static bool gsr_replay_slab_ensure_packets_capacity(gsr_replay_slab *slab) {
+    assert(slab->refcount == 0);
+    if(slab->num_packets < slab->packets_capacity)
+        return true;
+
+    const size_t new_capacity = slab->packets_capacity * 2;
+    gsr_replay_packet *new_packets = realloc(slab->packets, new_capacity * sizeof(gsr_replay_packet));
+    if(!new_packets)
+        return false;
+
+    slab->packets = new_packets;
+    slab->packets_capacity = new_capacity;
+    return true;
+}
+
+static bool gsr_replay_buffer_create_storage_file(gsr_replay_buffer *self, const char *storage_dir) {
+    char filepath[PATH_MAX];
+    if(snprintf(filepath, sizeof(filepath), "%s/gsr-replay-XXXXXX", storage_dir) >= (int)sizeof(filepath)) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_create_storage_file: storage directory path is too long: %s\n", storage_dir);
+        return false;
+    }
+
+    self->storage_fd = mkstemp(filepath);
+    if(self->storage_fd == -1) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_create_storage_file: failed to create file %s, error: %s\n", filepath, strerror(errno));
+        return false;
+    }
+
+    /* The file is only accessed through the file descriptor, this makes sure that the file is removed when the program exits (or crashes) */
+    unlink(filepath);
+    fcntl(self->storage_fd, F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+bool gsr_replay_buffer_init(gsr_replay_buffer *self, gsr_replay_storage storage, const char *storage_dir, size_t max_bytes, double max_duration_seconds, int video_stream_index) {
+    memset(self, 0, sizeof(*self));
+    self->storage = storage;
+    self->storage_fd = -1;
+    self->max_duration_seconds = max_duration_seconds;
+    self->video_stream_index = video_stream_index;
+    self->max_bytes = max_bytes;
+    /* One slab is written to while the oldest one is being evicted */
+    if(max_bytes > 0 && max_bytes < 2 * GSR_REPLAY_BUFFER_SLAB_SIZE) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_init: max size %zu is too small, it has to be at least %d bytes\n", max_bytes, 2 * GSR_REPLAY_BUFFER_SLAB_SIZE);
+        return false;
+    }
+
+    self->slabs_capacity = max_bytes > 0 ? max_bytes / GSR_REPLAY_BUFFER_SLAB_SIZE : 16;
+    self->slabs = malloc(self->slabs_capacity * sizeof(gsr_replay_slab*));
+    self->free_slabs_capacity = self->slabs_capacity;
+    self->free_slabs = malloc(self->free_slabs_capacity * sizeof(gsr_replay_slab*));
+    self->keyframes_capacity = INITIAL_KEYFRAMES_CAPACITY;
+    self->keyframes = malloc(self->keyframes_capacity * sizeof(gsr_replay_keyframe));
+    if(!self->slabs || !self->free_slabs || !self->keyframes) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_init: failed to allocate memory\n");
+        gsr_replay_buffer_deinit(self);
+        return false;
+    }
+
+    if(storage == GSR_REPLAY_STORAGE_DISK && !gsr_replay_buffer_create_storage_file(self, storage_dir)) {
+        gsr_replay_buffer_deinit(self);
+        return false;
+    }
+
+    return true;
+}
+
+void gsr_replay_buffer_deinit(gsr_replay_buffer *self) {
+    for(size_t i = 0; i < self->num_slabs; ++i) {
+        gsr_replay_slab *slab = gsr_replay_buffer_get_slab(self, i);
+        assert(slab->refcount == 0);
+        gsr_replay_buffer_destroy_slab(self, slab);
+    }
+
+    for(size_t i = 0; i < self->num_free_slabs; ++i) {
+        gsr_replay_buffer_destroy_slab(self, self->free_slabs[i]);
+    }
+
+    /* A detached slab would be recycled into this replay buffer when its snapshot is released, after the replay buffer is gone */
+    assert(self->num_allocated_bytes == 0);
+
+    free(self->slabs);
+    free(self->free_slabs);
+    free(self->free_file_offsets);
+    free(self->keyframes);
+    if(self->storage_fd != -1)
+        close(self->storage_fd);
+    memset(self, 0, sizeof(*self));
+}
+
+static void gsr_replay_buffer_recycle_slab(gsr_replay_buffer *self, gsr_replay_slab *slab) {
+    assert(slab->refcount == 0);
+    const bool is_jumbo_slab = slab->data_capacity != GSR_REPLAY_BUFFER_SLAB_SIZE;
+    /* Slabs that had to be allocated because slabs were detached while saving a replay are freed to stay within the size limit */
+    const bool over_size_limit = self->max_bytes > 0 && self->num_allocated_bytes > self->max_bytes;
+    if(is_jumbo_slab || over_size_limit || self->num_free_slabs == self->free_slabs_capacity) {
+        gsr_replay_buffer_destroy_slab(self, slab);
+        return;
+    }
+
+    slab->data_size = 0;
+    slab->num_packets = 0;
+    slab->detached = false;
+    self->free_slabs[self->num_free_slabs++] = slab;
+}
+
+static gsr_replay_slab* gsr_replay_buffer_take_slab(gsr_replay_buffer *self, size_t data_capacity) {
+    if(data_capacity == GSR_REPLAY_BUFFER_SLAB_SIZE && self->num_free_slabs > 0)
+        return self->free_slabs[--self->num_free_slabs];
+
+    /* Free slabs are given up when a new slab (a jumbo slab for example) would otherwise go over the size limit */
+    while(self->max_bytes > 0 && self->num_free_slabs > 0 && self->num_allocated_bytes + data_capacity > self->max_bytes) {
+        gsr_replay_buffer_destroy_slab(self, self->free_slabs[--self->num_free_slabs]);
+    }
+
+    return gsr_replay_buffer_create_slab(self, data_capacity);
+}
+
+static void gsr_replay_buffer_pop_oldest_slab(gsr_replay_buffer *self) {
+    assert(self->num_slabs > 0);
+    gsr_replay_slab *slab = self->slabs[self->slabs_head];
+    if(self->first_packet_index < slab->num_packets) {
+        __atomic_sub_fetch(&self->num_packets, slab->num_packets - self->first_packet_index, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&self->num_bytes, slab->data_size - slab->packets[self->first_packet_index].offset, __ATOMIC_RELAXED);
+        self->packets_erased = true;
+    }
+
+    self->slabs_head = (self->slabs_head + 1) % self->slabs_capacity;
+    --self->num_slabs;
+    self->slabs_bytes -= slab->data_capacity;
+    self->first_packet_index = 0;
+
+    if(slab->refcount > 0)
+        slab->detached = true;
+    else
+        gsr_replay_buffer_recycle_slab(self, slab);
+}
+
+static bool gsr_replay_buffer_ensure_slabs_capacity(gsr_replay_buffer *self) {
+    if(self->num_slabs < self->slabs_capacity)
+        return true;
+
+    const size_t new_capacity = self->slabs_capacity * 2;
+    gsr_replay_slab **new_slabs = malloc(new_capacity * sizeof(gsr_replay_slab*));
+    gsr_replay_slab **new_free_slabs = realloc(self->free_slabs, new_capacity * sizeof(gsr_replay_slab*));
+    if(!new_slabs || !new_free_slabs) {
+        free(new_slabs);
+        if(new_free_slabs)
+            self->free_slabs = new_free_slabs;
+        return false;
+    }
+
+    for(size_t i = 0; i < self->num_slabs; ++i) {
+        new_slabs[i] = gsr_replay_buffer_get_slab(self, i);
+    }
+
+    free(self->slabs);
+    self->slabs = new_slabs;
+    self->slabs_capacity = new_capacity;
+    self->slabs_head = 0;
+    self->free_slabs = new_free_slabs;
+    self->free_slabs_capacity = new_capacity;
+    return true;
+}
+
+static gsr_replay_slab* gsr_replay_buffer_push_slab(gsr_replay_buffer *self, size_t min_data_capacity) {
+    const size_t data_capacity = min_data_capacity > GSR_REPLAY_BUFFER_SLAB_SIZE ? min_data_capacity : GSR_REPLAY_BUFFER_SLAB_SIZE;
+    /* A packet that is larger than the size limit evicts everything else. It's still added since the video breaks without it */
+    while(self->max_bytes > 0 && self->num_slabs > 0 && self->slabs_bytes + data_capacity > self->max_bytes) {
+        gsr_replay_buffer_pop_oldest_slab(self);
+    }
+
+    if(!gsr_replay_buffer_ensure_slabs_capacity(self))
+        return NULL;
+
+    gsr_replay_slab *slab = gsr_replay_buffer_take_slab(self, data_capacity);
+    if(!slab)
+        return NULL;
+
+    self->slabs[(self->slabs_head + self->num_slabs) % self->slabs_capacity] = slab;
+    ++self->num_slabs;
+    self->slabs_bytes += slab->data_capacity;
+    return slab;
+}
+
+static void gsr_replay_buffer_evict_expired_packets(gsr_replay_buffer *self, double timestamp) {
+    while(self->num_slabs > 0) {
+        gsr_replay_slab *slab = self->slabs[self->slabs_head];
+        while(self->first_packet_index < slab->num_packets) {
+            const gsr_replay_packet *packet = &slab->packets[self->first_packet_index];
+            if(timestamp - packet->timestamp < self->max_duration_seconds)
+                return;
+
+            __atomic_sub_fetch(&self->num_packets, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&self->num_bytes, packet->size, __ATOMIC_RELAXED);
+            ++self->first_packet_index;
+            self->packets_erased = true;
+        }
+
+        /* Every packet has been evicted but it's the slab we are writing to, so reuse it */
+        if(self->num_slabs == 1 && slab->refcount == 0) {
+            slab->data_size = 0;
+            slab->num_packets = 0;
+            self->first_packet_index = 0;
+            return;
+        }
+
+        gsr_replay_buffer_pop_oldest_slab(self);
+    }
+}
+
+static bool gsr_replay_buffer_push_keyframe(gsr_replay_buffer *self, uint64_t packet_seq, double timestamp) {
+    if(self->num_keyframes == self->keyframes_capacity) {
+        const size_t new_capacity = self->keyframes_capacity * 2;
+        gsr_replay_keyframe *new_keyframes = malloc(new_capacity * sizeof(gsr_replay_keyframe));
+        if(!new_keyframes)
+            return false;
+
+        for(size_t i = 0; i < self->num_keyframes; ++i) {
+            new_keyframes[i] = self->keyframes[(self->keyframes_head + i) % self->keyframes_capacity];
+        }
+
+        free(self->keyframes);
+        self->keyframes = new_keyframes;
+        self->keyframes_capacity = new_capacity;
+        self->keyframes_head = 0;
+    }
+
+    gsr_replay_keyframe *keyframe = &self->keyframes[(self->keyframes_head + self->num_keyframes) % self->keyframes_capacity];
+    keyframe->packet_seq = packet_seq;
+    keyframe->timestamp = timestamp;
+    ++self->num_keyframes;
+    return true;
+}
+
+static uint64_t gsr_replay_buffer_get_first_packet_seq(gsr_replay_buffer *self) {
+    if(self->num_slabs == 0)
+        return self->next_packet_seq;
+    return self->slabs[self->slabs_head]->first_packet_seq + self->first_packet_index;
+}
+
+static void gsr_replay_buffer_evict_stale_keyframes(gsr_replay_buffer *self) {
+    const uint64_t first_packet_seq = gsr_replay_buffer_get_first_packet_seq(self);
+    while(self->num_keyframes > 0 && self->keyframes[self->keyframes_head].packet_seq < first_packet_seq) {
+        self->keyframes_head = (self->keyframes_head + 1) % self->keyframes_capacity;
+        --self->num_keyframes;
+    }
+}
+
+bool gsr_replay_buffer_append(gsr_replay_buffer *self, const AVPacket *av_packet, double timestamp) {
+    if(av_packet->size <= 0)
+        return false;
+
+    gsr_replay_buffer_evict_expired_packets(self, timestamp);
+
+    const size_t packet_size = av_packet->size;
+    gsr_replay_slab *slab = self->num_slabs > 0 ? gsr_replay_buffer_get_slab(self, self->num_slabs - 1) : NULL;
+    if(!slab || slab->refcount > 0 || slab->data_size + packet_size > slab->data_capacity) {
+        slab = gsr_replay_buffer_push_slab(self, packet_size);
+        if(!slab) {
+            fprintf(stderr, "gsr error: gsr_replay_buffer_append: failed to allocate slab\n");
+            return false;
+        }
+    }
+
+    if(!gsr_replay_slab_ensure_packets_capacity(slab)) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_append: failed to allocate packet index\n");
+        return false;
+    }
+
+    if(slab->num_packets == 0)
+        slab->first_packet_seq = self->next_packet_seq;
+
+    gsr_replay_packet *packet = &slab->packets[slab->num_packets];
+    packet->pts = av_packet->pts;
+    packet->timestamp = timestamp;
+    packet->offset = slab->data_size;
+    packet->size = packet_size;
+    packet->stream_index = av_packet->stream_index;
+    packet->flags = av_packet->flags;
+    memcpy(slab->data + slab->data_size, av_packet->data, packet_size);
+
+    slab->data_size += packet_size;
+    ++slab->num_packets;
+    __atomic_add_fetch(&self->num_packets, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&self->num_bytes, packet_size, __ATOMIC_RELAXED);
+    ++self->next_packet_seq;
+
+    gsr_replay_buffer_evict_stale_keyframes(self);
+    if((av_packet->flags & AV_PKT_FLAG_KEY) && av_packet->stream_index == self->video_stream_index) {
+        if(!gsr_replay_buffer_push_keyframe(self, self->next_packet_seq - 1, timestamp)) {
+            fprintf(stderr, "gsr error: gsr_replay_buffer_append: failed to allocate keyframe index\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the index of the slab that contains the packet with the sequence number |packet_seq|. The packet has to be in the replay buffer */
+static size_t gsr_replay_buffer_find_slab_index(gsr_replay_buffer *self, uint64_t packet_seq) {
+    size_t low = 0;
+    size_t high = self->num_slabs;
+    while(high - low > 1) {
+        const size_t mid = low + (high - low) / 2;
+        if(gsr_replay_buffer_get_slab(self, mid)->first_packet_seq <= packet_seq)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/* Returns the index of the last keyframe with a timestamp <= |timestamp|, or 0 if there is no such keyframe */
+static size_t gsr_replay_buffer_find_keyframe_index(gsr_replay_buffer *self, double timestamp) {
+    size_t low = 0;
+    size_t high = self->num_keyframes;
+    while(high - low > 1) {
+        const size_t mid = low + (high - low) / 2;
+        if(self->keyframes[(self->keyframes_head + mid) % self->keyframes_capacity].timestamp <= timestamp)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+bool gsr_replay_buffer_snapshot(gsr_replay_buffer *self, double start_timestamp, gsr_replay_snapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    if(self->num_keyframes == 0)
+        return false;
+
+    const size_t keyframe_index = gsr_replay_buffer_find_keyframe_index(self, start_timestamp);
+    /* Keep the packets before the first keyframe if nothing has been erased yet, as that's what the first video packets depend on anyways */
+    snapshot->starts_at_keyframe = keyframe_index > 0 || self->packets_erased;
+    const uint64_t start_packet_seq = snapshot->starts_at_keyframe
+        ? self->keyframes[(self->keyframes_head + keyframe_index) % self->keyframes_capacity].packet_seq
+        : gsr_replay_buffer_get_first_packet_seq(self);
+    const size_t start_slab_index = gsr_replay_buffer_find_slab_index(self, start_packet_seq);
+
+    snapshot->num_slabs = self->num_slabs - start_slab_index;
+    snapshot->slabs = malloc(snapshot->num_slabs * sizeof(gsr_replay_slab*));
+    if(!snapshot->slabs) {
+        fprintf(stderr, "gsr error: gsr_replay_buffer_snapshot: failed to allocate memory\n");
+        memset(snapshot, 0, sizeof(*snapshot));
+        return false;
+    }
+
+    for(size_t i = 0; i < snapshot->num_slabs; ++i) {
+        gsr_replay_slab *slab = gsr_replay_buffer_get_slab(self, start_slab_index + i);
+        gsr_replay_buffer_ref_slab(self, slab);
+        snapshot->slabs[i] = slab;
+    }
+
+    snapshot->first_packet_index = start_packet_seq - snapshot->slabs[0]->first_packet_seq;
+    return true;
+}
+
+void gsr_replay_buffer_snapshot_release(gsr_replay_buffer *self, gsr_replay_snapshot *snapshot) {
+    for(size_t i = 0; i < snapshot->num_slabs; ++i) {
+        gsr_replay_buffer_unref_slab(self, snapshot->slabs[i]);
+    }
+    free(snapshot->slabs);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+gsr_replay_slab* gsr_replay_buffer_get_slab(gsr_replay_buffer *self, size_t index) {
+    assert(index < self->num_slabs);
+    return self->slabs[(self->slabs_head + index) % self->slabs_capacity];
+}
+
+void gsr_replay_buffer_ref_slab(gsr_replay_buffer *self, gsr_replay_slab *slab) {
+    (void)self;
+    ++slab->refcount;
+}
+
+void gsr_replay_buffer_unref_slab(gsr_replay_buffer *self, gsr_replay_slab *slab) {
+    assert(slab->refcount > 0);
+    --slab->refcount;
+    if(slab->refcount == 0 && slab->detached)
+        gsr_replay_buffer_recycle_slab(self, slab);
+}
+
+size_t gsr_replay_buffer_get_num_packets(gsr_replay_buffer *self) {
+    return __atomic_load_n(&self->num_packets, __ATOMIC_RELAXED);
+}
+
+size_t gsr_replay_buffer_get_num_bytes(gsr_replay_buffer *self) {
+    return __atomic_load_n(&self->num_bytes, __ATOMIC_RELAXED);
+}
@@ -7,6 +7,7 @@ extern "C" {
 #include <stdio.h>
 #include <string.h>
 #include <cmath>
+#include <algorithm>
 #include <time.h>
 
 #include <pulse/pulseaudio.h>
@@ -29,25 +30,34 @@ extern "C" {
         }                                                               \
     } while(false);
 
+// Number of audio chunks that can be buffered in the ring buffer before audio data is dropped
+#define RING_BUFFER_NUM_CHUNKS 16
+// pa_stream_update_timing_info is a round trip to the server, so only do that once in a while
+#define TIMING_INFO_UPDATE_INTERVAL_SECONDS 1.0
+
 struct pa_handle {
     pa_context *context;
     pa_stream *stream;
-    pa_mainloop *mainloop;
+    pa_mainloop *mainloop; // Shared between all sound devices, not owned by the handle
 
-    const void *read_data;
-    size_t read_index, read_length;
+    // Audio data is copied into the ring buffer in the stream read callback, which is called from the mainloop
+    uint8_t *ring_data;
+    size_t ring_capacity, ring_read_index, ring_size;
+    bool read_failed;
 
     uint8_t *output_data;
-    size_t output_index, output_length;
+    size_t output_length;
 
     int operation_success;
     double latency_seconds;
+    double timing_info_update_time;
 };
 
 static void pa_sound_device_free(pa_handle *p) {
     assert(p);
 
     if (p->stream) {
+        pa_stream_set_read_callback(p->stream, NULL, NULL);
         pa_stream_unref(p->stream);
         p->stream = NULL;
     }
@@ -58,20 +68,84 @@ static void pa_sound_device_free(pa_handle *p) {
         p->context = NULL;
     }
 
-    if (p->mainloop) {
-        pa_mainloop_free(p->mainloop);
-        p->mainloop = NULL;
-    }
-
     if (p->output_data) {
         free(p->output_data);
         p->output_data = NULL;
     }
 
+    if (p->ring_data) {
+        free(p->ring_data);
+        p->ring_data = NULL;
+    }
+
     pa_xfree(p);
 }
 
-static pa_handle* pa_sound_device_new(const char *server,
+static void pa_sound_device_ring_write(pa_handle *p, const uint8_t *data, size_t size) {
+    if(p->ring_size + size > p->ring_capacity) {
+        // The audio thread is not keeping up. Drop the new data, the audio thread adds silence to keep audio in sync
+        return;
+    }
+
+    const size_t write_index = (p->ring_read_index + p->ring_size) % p->ring_capacity;
+    const size_t size_until_end = std::min(size, p->ring_capacity - write_index);
+    memcpy(p->ring_data + write_index, data, size_until_end);
+    memcpy(p->ring_data, data + size_until_end, size - size_until_end);
+    p->ring_size += size;
+}
+
+static void pa_sound_device_update_latency(pa_handle *p) {
+    const double now = clock_get_monotonic_seconds();
+    if(now - p->timing_info_update_time >= TIMING_INFO_UPDATE_INTERVAL_SECONDS) {
+        p->timing_info_update_time = now;
+        pa_operation *operation = pa_stream_update_timing_info(p->stream, NULL, NULL);
+        if(operation)
+            pa_operation_unref(operation);
+    }
+
+    pa_usec_t latency = 0;
+    int negative = 0;
+    if(pa_stream_get_latency(p->stream, &latency, &negative) >= 0) {
+        p->latency_seconds = negative ? -(double)latency : latency;
+        if(p->latency_seconds < 0.0)
+            p->latency_seconds = 0.0;
+        p->latency_seconds *= 0.0000001;
+    }
+}
+
+static void pa_stream_read_cb(pa_stream *stream, size_t, void *userdata) {
+    pa_handle *p = (pa_handle*)userdata;
+    bool got_data = false;
+
+    for(;;) {
+        const void *data = NULL;
+        size_t length = 0;
+        if(pa_stream_peek(stream, &data, &length) < 0) {
+            p->read_failed = true;
+            return;
+        }
+
+        if(length == 0)
+            break;
+
+        // If |data| is NULL then there is a hole in the stream :( drop it. Maybe we should generate silence instead? TODO
+        if(data) {
+            pa_sound_device_ring_write(p, (const uint8_t*)data, length);
+            got_data = true;
+        }
+
+        if(pa_stream_drop(stream) != 0) {
+            p->read_failed = true;
+            return;
+        }
+    }
+
+    if(got_data)
+        pa_sound_device_update_latency(p);
+}
+
+static pa_handle* pa_sound_device_new(pa_mainloop *mainloop,
+        const char *server,
         const char *name,
         const char *dev,
         const char *stream_name,
@@ -93,10 +167,15 @@ static pa_handle* pa_sound_device_new(const char *server,
 
     p->output_data = (uint8_t*)buffer;
     p->output_length = buffer_size;
-    p->output_index = 0;
 
-    if (!(p->mainloop = pa_mainloop_new()))
+    p->ring_capacity = buffer_size * RING_BUFFER_NUM_CHUNKS;
+    p->ring_data = (uint8_t*)malloc(p->ring_capacity);
+    if(!p->ring_data) {
+        fprintf(stderr, "failed to allocate buffer for audio\n");
         goto fail;
+    }
+
+    p->mainloop = mainloop;
 
     if (!(p->context = pa_context_new(pa_mainloop_get_api(p->mainloop), name)))
         goto fail;
@@ -125,6 +204,8 @@ static pa_handle* pa_sound_device_new(const char *server,
         goto fail;
     }
 
+    pa_stream_set_read_callback(p->stream, pa_stream_read_cb, p);
+
     r = pa_stream_connect_record(p->stream, dev, attr,
         (pa_stream_flags_t)(PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_ADJUST_LATENCY|PA_STREAM_AUTO_TIMING_UPDATE));
 
@@ -156,88 +237,31 @@ fail:
     return NULL;
 }
 
-static int pa_sound_device_read(pa_handle *p, double timeout_seconds) {
+// Non-blocking. Returns 1 if a whole chunk has been read into |output_data|, 0 if there isn't enough data yet and -1 on failure
+static int pa_sound_device_read(pa_handle *p) {
     assert(p);
 
-    const double start_time = clock_get_monotonic_seconds();
-
-    bool success = false;
     int r = 0;
     int *rerror = &r;
-    pa_usec_t latency = 0;
-    int negative = 0;
 
     CHECK_DEAD_GOTO(p, rerror, fail);
+    if(p->read_failed)
+        goto fail;
 
-    while (p->output_index < p->output_length) {
-        if(clock_get_monotonic_seconds() - start_time >= timeout_seconds)
-            return -1;
-
-        if(!p->read_data) {
-            pa_mainloop_prepare(p->mainloop, 1 * 1000); // 1 ms
-            pa_mainloop_poll(p->mainloop);
-            pa_mainloop_dispatch(p->mainloop);
-
-            if(pa_stream_peek(p->stream, &p->read_data, &p->read_length) < 0)
-                goto fail;
-
-            if(!p->read_data && p->read_length == 0)
-                continue;
-
-            if(!p->read_data && p->read_length > 0) {
-                // There is a hole in the stream :( drop it. Maybe we should generate silence instead? TODO
-                if(pa_stream_drop(p->stream) != 0)
-                    goto fail;
-                continue;
-            }
-
-            if(p->read_length <= 0) {
-                p->read_data = NULL;
-                if(pa_stream_drop(p->stream) != 0)
-                    goto fail;
-
-                CHECK_DEAD_GOTO(p, rerror, fail);
-                continue;
-            }
-
-            pa_operation_unref(pa_stream_update_timing_info(p->stream, NULL, NULL));
-            // TODO: Deal with one pa_stream_peek not being enough. In that case we need to add multiple of these together(?)
-            if(pa_stream_get_latency(p->stream, &latency, &negative) >= 0) {
-                p->latency_seconds = negative ? -(double)latency : latency;
-                if(p->latency_seconds < 0.0)
-                    p->latency_seconds = 0.0;
-                p->latency_seconds *= 0.0000001;
-            }
-        }
+    if(p->ring_size < p->output_length)
+        return 0;
 
-        const size_t space_free_in_output_buffer = p->output_length - p->output_index;
-        if(space_free_in_output_buffer < p->read_length) {
-            memcpy(p->output_data + p->output_index, (const uint8_t*)p->read_data + p->read_index, space_free_in_output_buffer);
-            p->output_index = 0;
-            p->read_index += space_free_in_output_buffer;
-            p->read_length -= space_free_in_output_buffer;
-            break;
-        } else {
-            memcpy(p->output_data + p->output_index, (const uint8_t*)p->read_data + p->read_index, p->read_length);
-            p->output_index += p->read_length;
-            p->read_data = NULL;
-            p->read_length = 0;
-            p->read_index = 0;
-            
-            if(pa_stream_drop(p->stream) != 0)
-                goto fail;
-
-            if(p->output_index == p->output_length) {
-                p->output_index = 0;
-                break;
-            }
-        }
+    {
+        const size_t size_until_end = std::min(p->output_length, p->ring_capacity - p->ring_read_index);
+        memcpy(p->output_data, p->ring_data + p->ring_read_index, size_until_end);
+        memcpy(p->output_data + size_until_end, p->ring_data, p->output_length - size_until_end);
+        p->ring_read_index = (p->ring_read_index + p->output_length) % p->ring_capacity;
+        p->ring_size -= p->output_length;
     }
-
-    success = true;
+    return 1;
 
     fail:
-    return success ? 0 : -1;
+    return -1;
 }
 
 static pa_sample_format_t audio_format_to_pulse_audio_format(AudioFormat audio_format) {
@@ -260,7 +284,33 @@ static int audio_format_to_get_bytes_per_sample(AudioFormat audio_format) {
     return 2;
 }
 
-int sound_device_get_by_name(SoundDevice *device, const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format) {
+int sound_mainloop_create(SoundMainloop *mainloop) {
+    mainloop->handle = pa_mainloop_new();
+    if(!mainloop->handle) {
+        fprintf(stderr, "gsr error: sound_mainloop_create: pa_mainloop_new failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+void sound_mainloop_destroy(SoundMainloop *mainloop) {
+    if(mainloop->handle)
+        pa_mainloop_free((pa_mainloop*)mainloop->handle);
+    mainloop->handle = NULL;
+}
+
+int sound_mainloop_wait(SoundMainloop *mainloop, double timeout_sec) {
+    pa_mainloop *m = (pa_mainloop*)mainloop->handle;
+    if(pa_mainloop_prepare(m, (int)(std::max(0.0, timeout_sec) * 1000.0 * 1000.0)) < 0)
+        return -1;
+    if(pa_mainloop_poll(m) < 0)
+        return -1;
+    if(pa_mainloop_dispatch(m) < 0)
+        return -1;
+    return 0;
+}
+
+int sound_device_get_by_name(SoundDevice *device, SoundMainloop *mainloop, const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format) {
     pa_sample_spec ss;
     ss.format = audio_format_to_pulse_audio_format(audio_format);
     ss.rate = 48000;
@@ -274,7 +324,7 @@ int sound_device_get_by_name(SoundDevice *device, const char *device_name, const
     buffer_attr.maxlength = buffer_attr.fragsize;
 
     int error = 0;
-    pa_handle *handle = pa_sound_device_new(nullptr, description, device_name, description, &ss, &buffer_attr, &error);
+    pa_handle *handle = pa_sound_device_new((pa_mainloop*)mainloop->handle, nullptr, description, device_name, description, &ss, &buffer_attr, &error);
     if(!handle) {
         fprintf(stderr, "pa_sound_device_new() failed: %s. Audio input device %s might not be valid\n", pa_strerror(error), device_name);
         return -1;
@@ -291,12 +341,13 @@ void sound_device_close(SoundDevice *device) {
     device->handle = NULL;
 }
 
-int sound_device_read_next_chunk(SoundDevice *device, void **buffer, double timeout_sec, double *latency_seconds) {
+int sound_device_read_next_chunk(SoundDevice *device, void **buffer, double *latency_seconds) {
     pa_handle *pa = (pa_handle*)device->handle;
-    if(pa_sound_device_read(pa, timeout_sec) < 0) {
+    const int res = pa_sound_device_read(pa);
+    if(res <= 0) {
         //fprintf(stderr, "pa_simple_read() failed: %s\n", pa_strerror(error));
         *latency_seconds = 0.0;
-        return -1;
+        return res;
     }
     *buffer = pa->output_data;
     *latency_seconds = pa->latency_seconds;
@@ -0,0 +1,244 @@
+#include "../include/stats.h"
+#include "../include/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *counter_names[GSR_STATS_NUM_COUNTERS] = {
+    "frames_captured",
+    "frame_deadline_missed",
+    "packets_written",
+    "bytes_written",
+    "audio_underruns",
+    "audio_silence_fills",
+    "static_frames_repeated"
+};
+
+static const char *timing_names[GSR_STATS_NUM_TIMINGS] = {
+    "capture_us",
+    "color_conversion_us",
+    "readback_us",
+    "encoder_submit_us",
+    "write_output_mutex_wait_us",
+    "pacing_jitter_us"
+};
+
+bool gsr_stats_init(gsr_stats *self, const char *path) {
+    memset(self, 0, sizeof(*self));
+    self->fd = -1;
+    if(!path)
+        return true;
+
+    struct stat st;
+    if(stat(path, &st) == -1) {
+        if(mkfifo(path, 0600) == -1) {
+            fprintf(stderr, "gsr error: gsr_stats_init: failed to create fifo %s, error: %s\n", path, strerror(errno));
+            return false;
+        }
+    } else if(!S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode) && !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "gsr error: gsr_stats_init: %s is not a fifo, unix domain socket or regular file\n", path);
+        return false;
+    }
+
+    self->path = strdup(path);
+    self->timings = calloc(GSR_STATS_NUM_TIMINGS, sizeof(gsr_stats_timing_samples));
+    self->report_timings = calloc(GSR_STATS_NUM_TIMINGS, sizeof(gsr_stats_timing_samples));
+    if(!self->path || !self->timings || !self->report_timings) {
+        fprintf(stderr, "gsr error: gsr_stats_init: failed to allocate memory\n");
+        free(self->path);
+        free(self->timings);
+        free(self->report_timings);
+        memset(self, 0, sizeof(*self));
+        self->fd = -1;
+        return false;
+    }
+
+    pthread_mutex_init(&self->timings_mutex, NULL);
+    self->last_report_time = clock_get_monotonic_seconds();
+    self->enabled = true;
+    return true;
+}
+
+void gsr_stats_deinit(gsr_stats *self) {
+    if(!self->enabled)
+        return;
+
+    if(self->fd != -1)
+        close(self->fd);
+    pthread_mutex_destroy(&self->timings_mutex);
+    free(self->path);
+    free(self->timings);
+    free(self->report_timings);
+    memset(self, 0, sizeof(*self));
+    self->fd = -1;
+}
+
+void gsr_stats_add_counter(gsr_stats *self, gsr_stats_counter counter, uint64_t value) {
+    if(!self->enabled)
+        return;
+    __atomic_add_fetch(&self->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void gsr_stats_add_timing(gsr_stats *self, gsr_stats_timing timing, double seconds) {
+    if(!self->enabled)
+        return;
+
+    pthread_mutex_lock(&self->timings_mutex);
+    gsr_stats_timing_samples *timing_samples = &self->timings[timing];
+    if(timing_samples->num_samples < GSR_STATS_MAX_TIMING_SAMPLES)
+        timing_samples->samples[timing_samples->num_samples++] = seconds;
+    ++timing_samples->count;
+    if(seconds > timing_samples->max)
+        timing_samples->max = seconds;
+    pthread_mutex_unlock(&self->timings_mutex);
+}
+
+/* Opens the output if it's not open. Returns false if nobody is reading the fifo or socket yet */
+static bool gsr_stats_open_output(gsr_stats *self) {
+    if(self->fd != -1)
+        return true;
+
+    struct stat st;
+    if(stat(self->path, &st) == -1)
+        return false;
+
+    if(S_ISSOCK(st.st_mode)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", self->path);
+
+        self->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(self->fd == -1)
+            return false;
+
+        if(connect(self->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(self->fd);
+            self->fd = -1;
+            return false;
+        }
+
+        fcntl(self->fd, F_SETFL, fcntl(self->fd, F_GETFL) | O_NONBLOCK);
+    } else if(S_ISFIFO(st.st_mode)) {
+        /* Fails with ENXIO when the fifo isn't opened for reading */
+        self->fd = open(self->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    } else {
+        self->fd = open(self->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+
+    return self->fd != -1;
+}
+
+/* The reader can go away at any time, which would otherwise kill the process with SIGPIPE */
+static ssize_t write_without_sigpipe(int fd, const void *data, size_t size) {
+    sigset_t sigpipe_mask;
+    sigemptyset(&sigpipe_mask);
+    sigaddset(&sigpipe_mask, SIGPIPE);
+
+    sigset_t prev_mask;
+    pthread_sigmask(SIG_BLOCK, &sigpipe_mask, &prev_mask);
+    const ssize_t result = write(fd, data, size);
+    const int write_errno = errno;
+    if(result == -1 && write_errno == EPIPE) {
+        const struct timespec no_wait = { 0, 0 };
+        sigtimedwait(&sigpipe_mask, NULL, &no_wait);
+    }
+    pthread_sigmask(SIG_SETMASK, &prev_mask, NULL);
+
+    errno = write_errno;
+    return result;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double da = *(const double*)a;
+    const double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+/* Nearest-rank percentile. |samples| has to be sorted */
+static double get_percentile(const double *samples, int num_samples, double percentile) {
+    if(num_samples == 0)
+        return 0.0;
+
+    int rank = (int)(percentile * num_samples + 0.999999);
+    if(rank < 1)
+        rank = 1;
+    if(rank > num_samples)
+        rank = num_samples;
+    return samples[rank - 1];
+}
+
+void gsr_stats_report(gsr_stats *self, const gsr_stats_gauges *gauges) {
+    if(!self->enabled)
+        return;
+
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+
+    const double time_now = clock_get_monotonic_seconds();
+    const double interval = time_now - self->last_report_time;
+    self->last_report_time = time_now;
+
+    uint64_t counters[GSR_STATS_NUM_COUNTERS];
+    for(int i = 0; i < GSR_STATS_NUM_COUNTERS; ++i) {
+        counters[i] = __atomic_exchange_n(&self->counters[i], 0, __ATOMIC_RELAXED);
+    }
+
+    /* Sorted outside of the lock so that the threads that add timings are not blocked */
+    gsr_stats_timing_samples *timings = self->report_timings;
+    pthread_mutex_lock(&self->timings_mutex);
+    memcpy(timings, self->timings, GSR_STATS_NUM_TIMINGS * sizeof(gsr_stats_timing_samples));
+    memset(self->timings, 0, GSR_STATS_NUM_TIMINGS * sizeof(gsr_stats_timing_samples));
+    pthread_mutex_unlock(&self->timings_mutex);
+
+    char line[4096];
+    int line_size = snprintf(line, sizeof(line),
+        "{\"time\": %.3f, \"interval\": %.3f, \"update_fps\": %d, \"damage_fps\": %d, \"packet_queue_packets\": %zu, \"packet_queue_dropped_total\": %" PRIu64 ", \"replay_buffer_bytes\": %zu, \"replay_buffer_packets\": %zu",
+        (double)realtime.tv_sec + (double)realtime.tv_nsec * 0.000000001, interval, gauges->update_fps, gauges->damage_fps, gauges->packet_queue_packets, gauges->packet_queue_dropped, gauges->replay_buffer_bytes, gauges->replay_buffer_packets);
+
+    for(int i = 0; i < GSR_STATS_NUM_COUNTERS && line_size < (int)sizeof(line); ++i) {
+        line_size += snprintf(line + line_size, sizeof(line) - line_size, ", \"%s\": %" PRIu64, counter_names[i], counters[i]);
+    }
+
+    for(int i = 0; i < GSR_STATS_NUM_TIMINGS && line_size < (int)sizeof(line); ++i) {
+        gsr_stats_timing_samples *timing_samples = &timings[i];
+        qsort(timing_samples->samples, timing_samples->num_samples, sizeof(double), compare_doubles);
+        line_size += snprintf(line + line_size, sizeof(line) - line_size, ", \"%s\": {\"count\": %" PRIu64 ", \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+            timing_names[i], timing_samples->count,
+            get_percentile(timing_samples->samples, timing_samples->num_samples, 0.50) * 1000000.0,
+            get_percentile(timing_samples->samples, timing_samples->num_samples, 0.99) * 1000000.0,
+            timing_samples->max * 1000000.0);
+    }
+
+    if(line_size >= (int)sizeof(line) - 2) {
+        fprintf(stderr, "gsr error: gsr_stats_report: stats line is too long\n");
+        return;
+    }
+    line[line_size++] = '}';
+    line[line_size++] = '\n';
+
+    if(!gsr_stats_open_output(self))
+        return;
+
+    /* Writes up to PIPE_BUF bytes to a fifo are atomic. A partial write to a socket would break the line, so the socket is reconnected instead */
+    const ssize_t written = write_without_sigpipe(self->fd, line, line_size);
+    if(written == line_size)
+        return;
+
+    /* The reader is too slow, nothing was written so the report is dropped */
+    if(written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    close(self->fd);
+    self->fd = -1;
+}
@@ -2,6 +2,7 @@
 #include "../include/window/window.h"
 
 #include <time.h>
+#include <math.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -122,7 +123,8 @@ void for_each_active_monitor_output_x11_not_cached(Display *display, active_moni
                         .size = monitor_size,
                         .connector_id = x11_output_get_connector_id(display, screen_res->outputs[i], randr_connector_id_atom),
                         .rotation = rotation,
-                        .monitor_identifier = out_info->crtc
+                        .monitor_identifier = out_info->crtc,
+                        .scale = 1
                     };
                     callback(&monitor, userdata);
                 }
@@ -236,7 +238,8 @@ static void for_each_active_monitor_output_drm(const char *card_path, active_mon
                     .size = { .x = (int)crtc->width, .y = (int)crtc->height },
                     .connector_id = connector->connector_id,
                     .rotation = GSR_MONITOR_ROT_0,
-                    .monitor_identifier = connector_type_index_name != -1 ? monitor_identifier_from_type_and_count(connector_type_index_name, connector_type->count_active) : 0
+                    .monitor_identifier = connector_type_index_name != -1 ? monitor_identifier_from_type_and_count(connector_type_index_name, connector_type->count_active) : 0,
+                    .scale = 1
                 };
                 callback(&monitor, userdata);
             }
@@ -289,6 +292,8 @@ bool get_monitor_by_name(const gsr_egl *egl, gsr_connection_type connection_type
 typedef struct {
     const gsr_monitor *monitor;
     gsr_monitor_rotation rotation;
+    vec2i position;
+    int scale;
     bool match_found;
 } get_monitor_by_connector_id_userdata;
 
@@ -300,6 +305,8 @@ static void get_monitor_by_name_and_size_callback(const gsr_monitor *monitor, vo
     get_monitor_by_connector_id_userdata *data = (get_monitor_by_connector_id_userdata*)userdata;
     if(monitor->name && data->monitor->name && strcmp(monitor->name, data->monitor->name) == 0 && vec2i_eql(monitor->size, data->monitor->size)) {
         data->rotation = monitor->rotation;
+        data->position = monitor->pos;
+        data->scale = monitor->scale;
         data->match_found = true;
     }
 }
@@ -310,39 +317,42 @@ static void get_monitor_by_connector_id_callback(const gsr_monitor *monitor, voi
         (!monitor->connector_id && monitor->monitor_identifier == data->monitor->monitor_identifier))
     {
         data->rotation = monitor->rotation;
+        data->position = monitor->pos;
+        data->scale = monitor->scale;
         data->match_found = true;
     }
 }
 
-gsr_monitor_rotation drm_monitor_get_display_server_rotation(const gsr_window *window, const gsr_monitor *monitor) {
+/* Finds the display server monitor (wayland output or x11 crtc) of the drm monitor */
+static get_monitor_by_connector_id_userdata drm_monitor_get_display_server_monitor(const gsr_window *window, const gsr_monitor *monitor) {
+    get_monitor_by_connector_id_userdata userdata;
+    userdata.monitor = monitor;
+    userdata.rotation = GSR_MONITOR_ROT_0;
+    userdata.position = monitor->pos;
+    userdata.scale = 1;
+    userdata.match_found = false;
+
     if(gsr_window_get_display_server(window) == GSR_DISPLAY_SERVER_WAYLAND) {
-        {
-            get_monitor_by_connector_id_userdata userdata;
-            userdata.monitor = monitor;
-            userdata.rotation = GSR_MONITOR_ROT_0;
-            userdata.match_found = false;
-            gsr_window_for_each_active_monitor_output_cached(window, get_monitor_by_name_and_size_callback, &userdata);
-            if(userdata.match_found)
-                return userdata.rotation;
-        }
-        {
-            get_monitor_by_connector_id_userdata userdata;
-            userdata.monitor = monitor;
-            userdata.rotation = GSR_MONITOR_ROT_0;
-            userdata.match_found = false;
-            gsr_window_for_each_active_monitor_output_cached(window, get_monitor_by_connector_id_callback, &userdata);
-            return userdata.rotation;
-        }
-    } else {
-        get_monitor_by_connector_id_userdata userdata;
-        userdata.monitor = monitor;
-        userdata.rotation = GSR_MONITOR_ROT_0;
-        userdata.match_found = false;
-        gsr_window_for_each_active_monitor_output_cached(window, get_monitor_by_connector_id_callback, &userdata);
-        return userdata.rotation;
+        gsr_window_for_each_active_monitor_output_cached(window, get_monitor_by_name_and_size_callback, &userdata);
+        if(userdata.match_found)
+            return userdata;
     }
 
-    return GSR_MONITOR_ROT_0;
+    gsr_window_for_each_active_monitor_output_cached(window, get_monitor_by_connector_id_callback, &userdata);
+    return userdata;
+}
+
+gsr_monitor_rotation drm_monitor_get_display_server_rotation(const gsr_window *window, const gsr_monitor *monitor) {
+    return drm_monitor_get_display_server_monitor(window, monitor).rotation;
+}
+
+vec2i drm_monitor_get_display_server_position(const gsr_window *window, const gsr_monitor *monitor) {
+    return drm_monitor_get_display_server_monitor(window, monitor).position;
+}
+
+int drm_monitor_get_display_server_scale(const gsr_window *window, const gsr_monitor *monitor) {
+    const int scale = drm_monitor_get_display_server_monitor(window, monitor).scale;
+    return scale > 0 ? scale : 1;
 }
 
 bool gl_get_gpu_info(gsr_egl *egl, gsr_gpu_info *info) {
@@ -367,6 +377,12 @@ bool gl_get_gpu_info(gsr_egl *egl, gsr_gpu_info *info) {
     if(gl_renderer) {
         for(int i = 0; software_renderers[i]; ++i) {
             if(strstr((const char*)gl_renderer, software_renderers[i])) {
+                if(egl->allow_software_renderer) {
+                    fprintf(stderr, "gsr info: using %s (software rendering) for opengl\n", software_renderers[i]);
+                    info->vendor = GSR_GPU_VENDOR_SOFTWARE;
+                    goto end;
+                }
+
                 fprintf(stderr, "gsr error: your opengl environment is not properly setup. It's using %s (software rendering) for opengl instead of your graphics card. Please make sure your graphics driver is properly installed\n", software_renderers[i]);
                 supported = false;
                 goto end;
@@ -895,3 +911,63 @@ vec2i scale_keep_aspect_ratio(vec2i from, vec2i to) {
 
     return from;
 }
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+bool gsr_rectangle_is_empty(gsr_rectangle rect) {
+    return rect.size.x <= 0 || rect.size.y <= 0;
+}
+
+gsr_rectangle gsr_rectangle_intersection(gsr_rectangle rect1, gsr_rectangle rect2) {
+    const int left = max_int(rect1.pos.x, rect2.pos.x);
+    const int top = max_int(rect1.pos.y, rect2.pos.y);
+    const int right = min_int(rect1.pos.x + rect1.size.x, rect2.pos.x + rect2.size.x);
+    const int bottom = min_int(rect1.pos.y + rect1.size.y, rect2.pos.y + rect2.size.y);
+    if(right <= left || bottom <= top)
+        return (gsr_rectangle){ (vec2i){0, 0}, (vec2i){0, 0} };
+    return (gsr_rectangle){ (vec2i){left, top}, (vec2i){right - left, bottom - top} };
+}
+
+static gsr_rectangle gsr_rectangle_union(gsr_rectangle rect1, gsr_rectangle rect2) {
+    const int left = min_int(rect1.pos.x, rect2.pos.x);
+    const int top = min_int(rect1.pos.y, rect2.pos.y);
+    const int right = max_int(rect1.pos.x + rect1.size.x, rect2.pos.x + rect2.size.x);
+    const int bottom = max_int(rect1.pos.y + rect1.size.y, rect2.pos.y + rect2.size.y);
+    return (gsr_rectangle){ (vec2i){left, top}, (vec2i){right - left, bottom - top} };
+}
+
+void gsr_rectangle_list_add(gsr_rectangle *rects, int *num_rects, int max_rects, gsr_rectangle rect) {
+    if(gsr_rectangle_is_empty(rect) || max_rects <= 0)
+        return;
+
+    if(*num_rects < max_rects) {
+        rects[(*num_rects)++] = rect;
+        return;
+    }
+
+    for(int i = 1; i < *num_rects; ++i) {
+        rect = gsr_rectangle_union(rect, rects[i]);
+    }
+    rects[0] = gsr_rectangle_union(rect, rects[0]);
+    *num_rects = 1;
+}
+
+gsr_rectangle gsr_rectangle_map_to_area(gsr_rectangle rect, vec2i source_size, vec2i dest_pos, vec2i dest_size, int padding) {
+    if(source_size.x <= 0 || source_size.y <= 0)
+        return (gsr_rectangle){ (vec2i){0, 0}, (vec2i){0, 0} };
+
+    const double scale_x = (double)dest_size.x / (double)source_size.x;
+    const double scale_y = (double)dest_size.y / (double)source_size.y;
+    const int left = dest_pos.x + (int)floor(rect.pos.x * scale_x) - padding;
+    const int top = dest_pos.y + (int)floor(rect.pos.y * scale_y) - padding;
+    const int right = dest_pos.x + (int)ceil((rect.pos.x + rect.size.x) * scale_x) + padding;
+    const int bottom = dest_pos.y + (int)ceil((rect.pos.y + rect.size.y) * scale_y) + padding;
+    const gsr_rectangle mapped_rect = { (vec2i){left, top}, (vec2i){right - left, bottom - top} };
+    return gsr_rectangle_intersection(mapped_rect, (gsr_rectangle){ dest_pos, dest_size });
+}
@@ -13,6 +13,14 @@ XEvent* gsr_window_get_event_data(gsr_window *self) {
     return NULL;
 }
 
+int gsr_window_get_event_fd(gsr_window *self) {
+    return self->get_event_fd(self);
+}
+
+bool gsr_window_has_queued_events(gsr_window *self) {
+    return self->has_queued_events(self);
+}
+
 gsr_display_server gsr_window_get_display_server(const gsr_window *self) {
     return self->get_display_server();
 }
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <poll.h>
 #include <wayland-client.h>
 #include <wayland-egl.h>
 
@@ -18,6 +19,7 @@ typedef struct {
     vec2i pos;
     vec2i size;
     int32_t transform;
+    int32_t scale;
     char *name;
 } gsr_wayland_output;
 
@@ -62,9 +64,9 @@ static void output_handle_done(void *data, struct wl_output *wl_output) {
 }
 
 static void output_handle_scale(void* data, struct wl_output *wl_output, int32_t factor) {
-    (void)data;
     (void)wl_output;
-    (void)factor;
+    gsr_wayland_output *gsr_output = data;
+    gsr_output->scale = factor;
 }
 
 static void output_handle_name(void *data, struct wl_output *wl_output, const char *name) {
@@ -120,6 +122,7 @@ static void registry_add_object(void *data, struct wl_registry *registry, uint32
             .pos = { .x = 0, .y = 0 },
             .size = { .x = 0, .y = 0 },
             .transform = 0,
+            .scale = 1,
             .name = NULL,
         };
         wl_output_add_listener(gsr_output->output, &output_listener, gsr_output);
@@ -226,12 +229,35 @@ static void gsr_window_wayland_destroy(gsr_window *window) {
 
 static bool gsr_window_wayland_process_event(gsr_window *window) {
     gsr_window_wayland *self = window->priv;
-    // TODO: pselect on wl_display_get_fd before doing dispatch
+    /* Reads the events that have arrived without blocking, otherwise the fd stays readable and waiting on it would return immediately */
+    if(wl_display_prepare_read(self->display) == 0) {
+        struct pollfd poll_fd = { .fd = wl_display_get_fd(self->display), .events = POLLIN, .revents = 0 };
+        if(poll(&poll_fd, 1, 0) > 0 && (poll_fd.revents & POLLIN))
+            wl_display_read_events(self->display);
+        else
+            wl_display_cancel_read(self->display);
+    }
+
     const bool events_available = wl_display_dispatch_pending(self->display) > 0;
     wl_display_flush(self->display);
     return events_available;
 }
 
+static int gsr_window_wayland_get_event_fd(gsr_window *window) {
+    gsr_window_wayland *self = window->priv;
+    return wl_display_get_fd(self->display);
+}
+
+static bool gsr_window_wayland_has_queued_events(gsr_window *window) {
+    gsr_window_wayland *self = window->priv;
+    wl_display_flush(self->display);
+    /* Fails if there are events in the queue that haven't been dispatched */
+    if(wl_display_prepare_read(self->display) != 0)
+        return true;
+    wl_display_cancel_read(self->display);
+    return false;
+}
+
 static gsr_display_server gsr_wayland_get_display_server(void) {
     return GSR_DISPLAY_SERVER_WAYLAND;
 }
@@ -283,7 +309,8 @@ static void gsr_window_wayland_for_each_active_monitor_output_cached(const gsr_w
             .size = { .x = output->size.x, .y = output->size.y },
             .connector_id = 0,
             .rotation = wayland_transform_to_gsr_rotation(output->transform),
-            .monitor_identifier = connector_type ? monitor_identifier_from_type_and_count(connector_type_index, connector_type->count_active) : 0
+            .monitor_identifier = connector_type ? monitor_identifier_from_type_and_count(connector_type_index, connector_type->count_active) : 0,
+            .scale = output->scale
         };
         callback(&monitor, userdata);
     }
@@ -309,6 +336,8 @@ gsr_window* gsr_window_wayland_create(void) {
     *window = (gsr_window) {
         .destroy = gsr_window_wayland_destroy,
         .process_event = gsr_window_wayland_process_event,
+        .get_event_fd = gsr_window_wayland_get_event_fd,
+        .has_queued_events = gsr_window_wayland_has_queued_events,
         .get_event_data = NULL,
         .get_display_server = gsr_wayland_get_display_server,
         .get_display = gsr_window_wayland_get_display,
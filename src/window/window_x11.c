@@ -93,6 +93,17 @@ static bool gsr_window_x11_process_event(gsr_window *window) {
     return false;
 }
 
+static int gsr_window_x11_get_event_fd(gsr_window *window) {
+    gsr_window_x11 *self = window->priv;
+    return ConnectionNumber(self->display);
+}
+
+static bool gsr_window_x11_has_queued_events(gsr_window *window) {
+    gsr_window_x11 *self = window->priv;
+    /* Xlib reads events into its queue when waiting for replies, those don't make the fd readable */
+    return XEventsQueued(self->display, QueuedAfterFlush) > 0;
+}
+
 static XEvent* gsr_window_x11_get_event_data(gsr_window *window) {
     gsr_window_x11 *self = window->priv;
     return &self->xev;
@@ -123,7 +134,8 @@ static void gsr_window_x11_for_each_active_monitor_output_cached(const gsr_windo
             .size = output->size,
             .connector_id = output->connector_id,
             .rotation = output->rotation,
-            .monitor_identifier = output->monitor_identifier
+            .monitor_identifier = output->monitor_identifier,
+            .scale = 1
         };
         callback(&monitor, userdata);
     }
@@ -150,6 +162,8 @@ gsr_window* gsr_window_x11_create(Display *display) {
     *window = (gsr_window) {
         .destroy = gsr_window_x11_destroy,
         .process_event = gsr_window_x11_process_event,
+        .get_event_fd = gsr_window_x11_get_event_fd,
+        .has_queued_events = gsr_window_x11_has_queued_events,
         .get_event_data = gsr_window_x11_get_event_data,
         .get_display_server = gsr_window_x11_get_display_server,
         .get_display = gsr_window_x11_get_display,